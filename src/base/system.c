@@ -1,5 +1,8 @@
 /* (c) Magnus Auvinen. See licence.txt in the root of the distribution for more information. */
 /* If you are missing that file, acquire a complete release at teeworlds.com.                */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+	#define _GNU_SOURCE /* sendmmsg */
+#endif
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
@@ -32,6 +35,12 @@
 		#include <Carbon/Carbon.h>
 	#endif
 
+	#if defined(CONF_PLATFORM_LINUX)
+		#include <sys/epoll.h>
+		#include <sys/eventfd.h>
+		#include <sys/timerfd.h>
+	#endif
+
 #elif defined(CONF_FAMILY_WINDOWS)
 	#define WIN32_LEAN_AND_MEAN
 	#include <windows.h>
@@ -67,6 +76,22 @@ static int num_loggers = 0;
 
 static NETSTATS network_stats = {0};
 
+/* the allocation counters are updated from every thread that allocates */
+static volatile long memory_total_allocations = 0;
+static volatile long memory_active_allocations = 0;
+
+#if defined(__GNUC__)
+	#define MEM_STATS_INC(counter) __sync_add_and_fetch(&(counter), 1)
+	#define MEM_STATS_DEC(counter) __sync_add_and_fetch(&(counter), -1)
+	#define MEM_STATS_GET(counter) __sync_add_and_fetch(&(counter), 0)
+#elif defined(_MSC_VER)
+	#define MEM_STATS_INC(counter) InterlockedIncrement(&(counter))
+	#define MEM_STATS_DEC(counter) InterlockedDecrement(&(counter))
+	#define MEM_STATS_GET(counter) InterlockedExchangeAdd(&(counter), 0)
+#else
+	#error missing atomic implementation for this compiler
+#endif
+
 static NETSOCKET invalid_socket = {NETTYPE_INVALID, -1, -1};
 
 void dbg_logger(DBG_LOGGER logger)
@@ -294,11 +319,15 @@ static const int MEM_GUARD_VAL = 0xbaadc0de;
 
 void *mem_alloc_debug(const char *filename, int line, unsigned size, unsigned alignment)
 {
+	MEM_STATS_INC(memory_total_allocations);
+	MEM_STATS_INC(memory_active_allocations);
 	return malloc(size);
 }
 
 void mem_free(void *p)
 {
+	if(p)
+		MEM_STATS_DEC(memory_active_allocations);
 	free(p);
 }
 
@@ -1204,6 +1233,171 @@ int net_udp_send(NETSOCKET sock, const NETADDR *addr, const void *data, int size
 	return d;
 }
 
+#if defined(CONF_PLATFORM_LINUX)
+enum
+{
+	NET_BATCH_SIZE = 64
+};
+
+typedef union
+{
+	struct sockaddr_in in;
+	struct sockaddr_in6 in6;
+} NETSOCKADDR;
+
+static int net_udp_send_mmsg(int fd, struct mmsghdr *msgs, int num)
+{
+	int sent = 0, syscalls = 0;
+	while(sent < num)
+	{
+		int result = sendmmsg(fd, msgs+sent, num-sent, 0);
+		syscalls++;
+		if(result <= 0)
+			break; /* drop the rest like a failed sendto */
+		sent += result;
+	}
+	return syscalls;
+}
+
+int net_udp_send_batch(NETSOCKET sock, const NETUDPPACKET *packets, int num)
+{
+	struct mmsghdr msgs[NET_BATCH_SIZE];
+	struct iovec iovs[NET_BATCH_SIZE];
+	NETSOCKADDR addrs[NET_BATCH_SIZE];
+	int batch_fd = -1;
+	int batch_num = 0;
+	int syscalls = 0;
+	int i;
+
+	for(i = 0; i < num; i++)
+	{
+		const NETUDPPACKET *p = &packets[i];
+		int type = p->addr.type&(NETTYPE_IPV4|NETTYPE_IPV6);
+		int fd = type == NETTYPE_IPV4 ? sock.ipv4sock : type == NETTYPE_IPV6 ? sock.ipv6sock : -1;
+
+		if(fd != batch_fd || batch_num == NET_BATCH_SIZE || fd < 0 || (p->addr.type&NETTYPE_LINK_BROADCAST))
+		{
+			if(batch_num)
+				syscalls += net_udp_send_mmsg(batch_fd, msgs, batch_num);
+			batch_num = 0;
+			batch_fd = fd;
+		}
+
+		/* broadcasts and packets for both families take the normal way */
+		if(fd < 0 || (p->addr.type&NETTYPE_LINK_BROADCAST))
+		{
+			net_udp_send(sock, &p->addr, p->data, p->size);
+			syscalls++;
+			continue;
+		}
+
+		mem_zero(&msgs[batch_num], sizeof(msgs[batch_num]));
+		if(type == NETTYPE_IPV4)
+		{
+			netaddr_to_sockaddr_in(&p->addr, &addrs[batch_num].in);
+			msgs[batch_num].msg_hdr.msg_namelen = sizeof(addrs[batch_num].in);
+		}
+		else
+		{
+			netaddr_to_sockaddr_in6(&p->addr, &addrs[batch_num].in6);
+			msgs[batch_num].msg_hdr.msg_namelen = sizeof(addrs[batch_num].in6);
+		}
+		msgs[batch_num].msg_hdr.msg_name = &addrs[batch_num];
+		iovs[batch_num].iov_base = p->data;
+		iovs[batch_num].iov_len = p->size;
+		msgs[batch_num].msg_hdr.msg_iov = &iovs[batch_num];
+		msgs[batch_num].msg_hdr.msg_iovlen = 1;
+		batch_num++;
+
+		network_stats.sent_bytes += p->size;
+		network_stats.sent_packets++;
+	}
+
+	if(batch_num)
+		syscalls += net_udp_send_mmsg(batch_fd, msgs, batch_num);
+	return syscalls;
+}
+
+static int net_udp_recv_mmsg(int fd, NETUDPPACKET *packets, int num)
+{
+	struct mmsghdr msgs[NET_BATCH_SIZE];
+	struct iovec iovs[NET_BATCH_SIZE];
+	NETSOCKADDR addrs[NET_BATCH_SIZE];
+	int i, result;
+
+	if(num > NET_BATCH_SIZE)
+		num = NET_BATCH_SIZE;
+
+	mem_zero(msgs, sizeof(msgs[0])*num);
+	for(i = 0; i < num; i++)
+	{
+		iovs[i].iov_base = packets[i].data;
+		iovs[i].iov_len = packets[i].size;
+		msgs[i].msg_hdr.msg_name = &addrs[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	result = recvmmsg(fd, msgs, num, MSG_DONTWAIT, NULL);
+	if(result < 0)
+		return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+
+	for(i = 0; i < result; i++)
+	{
+		sockaddr_to_netaddr((struct sockaddr *)&addrs[i], &packets[i].addr);
+		packets[i].size = msgs[i].msg_len;
+		network_stats.recv_bytes += msgs[i].msg_len;
+		network_stats.recv_packets++;
+	}
+	return result;
+}
+
+int net_udp_recv_batch(NETSOCKET sock, NETUDPPACKET *packets, int num)
+{
+	int received = 0;
+	int result;
+
+	if(sock.ipv4sock >= 0)
+	{
+		result = net_udp_recv_mmsg(sock.ipv4sock, packets, num);
+		if(result < 0)
+			return -1;
+		received += result;
+	}
+
+	if(received < num && sock.ipv6sock >= 0)
+	{
+		result = net_udp_recv_mmsg(sock.ipv6sock, packets+received, num-received);
+		if(result < 0)
+			return received ? received : -1;
+		received += result;
+	}
+	return received;
+}
+#else
+int net_udp_send_batch(NETSOCKET sock, const NETUDPPACKET *packets, int num)
+{
+	int i;
+	for(i = 0; i < num; i++)
+		net_udp_send(sock, &packets[i].addr, packets[i].data, packets[i].size);
+	return num;
+}
+
+int net_udp_recv_batch(NETSOCKET sock, NETUDPPACKET *packets, int num)
+{
+	int i;
+	for(i = 0; i < num; i++)
+	{
+		int bytes = net_udp_recv(sock, &packets[i].addr, packets[i].data, packets[i].size);
+		if(bytes <= 0)
+			break;
+		packets[i].size = bytes;
+	}
+	return i;
+}
+#endif
+
 int net_udp_recv(NETSOCKET sock, NETADDR *addr, void *data, int maxsize)
 {
 	char sockaddrbuf[128];
@@ -1931,6 +2125,130 @@ int net_socket_read_wait(NETSOCKET sock, int time)
 	return 0;
 }
 
+#if defined(CONF_PLATFORM_LINUX)
+struct NETWAITINTERNAL
+{
+	int epollfd;
+	int timerfd;
+	int eventfd;
+};
+
+NETWAIT net_wait_create()
+{
+	struct epoll_event event;
+	NETWAIT wait = (NETWAIT)mem_alloc(sizeof(*wait), 1);
+	wait->epollfd = epoll_create1(EPOLL_CLOEXEC);
+	wait->timerfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK|TFD_CLOEXEC); /* time_get uses gettimeofday */
+	wait->eventfd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+	if(wait->epollfd < 0 || wait->timerfd < 0 || wait->eventfd < 0)
+	{
+		net_wait_destroy(wait);
+		return 0;
+	}
+
+	mem_zero(&event, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.fd = wait->timerfd;
+	if(epoll_ctl(wait->epollfd, EPOLL_CTL_ADD, wait->timerfd, &event) < 0)
+	{
+		net_wait_destroy(wait);
+		return 0;
+	}
+	event.data.fd = wait->eventfd;
+	if(epoll_ctl(wait->epollfd, EPOLL_CTL_ADD, wait->eventfd, &event) < 0)
+	{
+		net_wait_destroy(wait);
+		return 0;
+	}
+	return wait;
+}
+
+int net_wait_add(NETWAIT wait, NETSOCKET sock)
+{
+	struct epoll_event event;
+	int i;
+	int socks[2];
+	socks[0] = sock.ipv4sock;
+	socks[1] = sock.ipv6sock;
+
+	for(i = 0; i < 2; i++)
+	{
+		if(socks[i] < 0)
+			continue;
+		mem_zero(&event, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.fd = socks[i];
+		if(epoll_ctl(wait->epollfd, EPOLL_CTL_ADD, socks[i], &event) < 0 && errno != EEXIST)
+			return -1;
+	}
+	return 0;
+}
+
+int net_wait_until(NETWAIT wait, int64 deadline)
+{
+	struct itimerspec spec;
+	struct epoll_event aEvents[8];
+	int num, i, result = 0;
+
+	if(deadline <= time_get())
+		return 0;
+
+	mem_zero(&spec, sizeof(spec));
+	spec.it_value.tv_sec = deadline/1000000;
+	spec.it_value.tv_nsec = (deadline%1000000)*1000;
+	if(timerfd_settime(wait->timerfd, TFD_TIMER_ABSTIME, &spec, NULL) < 0)
+		return -1;
+
+	num = epoll_wait(wait->epollfd, aEvents, sizeof(aEvents)/sizeof(aEvents[0]), -1);
+	if(num < 0)
+		return errno == EINTR ? 0 : -1;
+
+	for(i = 0; i < num; i++)
+	{
+		if(aEvents[i].data.fd == wait->timerfd)
+		{
+			/* consume the expiration so the timer isn't readable anymore */
+			unsigned long long expirations;
+			ssize_t bytes = read(wait->timerfd, &expirations, sizeof(expirations));
+			(void)bytes;
+		}
+		else if(aEvents[i].data.fd == wait->eventfd)
+		{
+			eventfd_t value;
+			eventfd_read(wait->eventfd, &value);
+			result = 1;
+		}
+		else
+			result = 1;
+	}
+	return result;
+}
+
+void net_wait_interrupt(NETWAIT wait)
+{
+	eventfd_write(wait->eventfd, 1);
+}
+
+void net_wait_destroy(NETWAIT wait)
+{
+	if(!wait)
+		return;
+	if(wait->epollfd >= 0)
+		close(wait->epollfd);
+	if(wait->timerfd >= 0)
+		close(wait->timerfd);
+	if(wait->eventfd >= 0)
+		close(wait->eventfd);
+	mem_free(wait);
+}
+#else
+NETWAIT net_wait_create() { return 0; }
+int net_wait_add(NETWAIT wait, NETSOCKET sock) { return -1; }
+int net_wait_until(NETWAIT wait, int64 deadline) { return -1; }
+void net_wait_interrupt(NETWAIT wait) {}
+void net_wait_destroy(NETWAIT wait) {}
+#endif
+
 int time_timestamp()
 {
 	return time(0);
@@ -2512,6 +2830,12 @@ void net_stats(NETSTATS *stats_inout)
 	*stats_inout = network_stats;
 }
 
+void mem_stats(MEMSTATS *stats_inout)
+{
+	stats_inout->total_allocations = (int)MEM_STATS_GET(memory_total_allocations);
+	stats_inout->active_allocations = (int)MEM_STATS_GET(memory_active_allocations);
+}
+
 int str_isspace(char c) { return c == ' ' || c == '\n' || c == '\t'; }
 
 char str_uppercase(char c)
@@ -721,6 +721,45 @@ NETSOCKET net_udp_create(NETADDR bindaddr, int use_random_port);
 */
 int net_udp_send(NETSOCKET sock, const NETADDR *addr, const void *data, int size);
 
+typedef struct
+{
+	NETADDR addr;
+	void *data;
+	int size;
+} NETUDPPACKET;
+
+/*
+	Function: net_udp_send_batch
+		Sends several packets at once, with as few system calls as
+		possible (sendmmsg on linux).
+
+	Parameters:
+		sock - Socket to use.
+		packets - Packets to send, in order.
+		num - Number of packets.
+
+	Returns:
+		The number of system calls that were needed.
+*/
+int net_udp_send_batch(NETSOCKET sock, const NETUDPPACKET *packets, int num);
+
+/*
+	Function: net_udp_recv_batch
+		Receives as many waiting packets as fit, with as few system
+		calls as possible (recvmmsg on linux). Doesn't block.
+
+	Parameters:
+		sock - Socket to use.
+		packets - Packets to fill. data and size have to be set to
+			the buffer of each packet, size is set to the received
+			size and addr to the sender.
+		num - Number of packets.
+
+	Returns:
+		The number of received packets, -1 on error.
+*/
+int net_udp_recv_batch(NETSOCKET sock, NETUDPPACKET *packets, int num);
+
 /*
 	Function: net_udp_recv
 		Receives a packet over an UDP socket.
@@ -1592,6 +1631,64 @@ int net_would_block();
 
 int net_socket_read_wait(NETSOCKET sock, int time);
 
+/* Group: Network Waiting */
+typedef struct NETWAITINTERNAL *NETWAIT;
+
+/*
+	Function: net_wait_create
+		Creates an object to wait for several sockets and a precise
+		deadline at once. Only available on linux (timerfd and epoll).
+
+	Returns:
+		The wait object or 0 if it isn't supported.
+*/
+NETWAIT net_wait_create();
+
+/*
+	Function: net_wait_add
+		Wakes up net_wait_until when the socket has data to read.
+
+	Parameters:
+		wait - Wait object.
+		sock - Socket to add, udp or a listening tcp socket.
+
+	Returns:
+		Returns 0 on success.
+*/
+int net_wait_add(NETWAIT wait, NETSOCKET sock);
+
+/*
+	Function: net_wait_until
+		Waits until one of the added sockets has data, the deadline
+		is reached or <net_wait_interrupt> is called.
+
+	Parameters:
+		wait - Wait object.
+		deadline - Time to wake up at, in <time_get> units.
+
+	Returns:
+		1 - if a socket has data or the wait was interrupted
+		0 - if the deadline was reached
+		-1 - on error
+*/
+int net_wait_until(NETWAIT wait, int64 deadline);
+
+/*
+	Function: net_wait_interrupt
+		Makes the current or the next <net_wait_until> return early.
+		Can be called from any thread.
+
+	Parameters:
+		wait - Wait object.
+*/
+void net_wait_interrupt(NETWAIT wait);
+
+/*
+	Function: net_wait_destroy
+		Frees the wait object. The sockets aren't closed.
+*/
+void net_wait_destroy(NETWAIT wait);
+
 void swap_endian(void *data, unsigned elem_size, unsigned num);
 
 
@@ -1619,6 +1716,22 @@ typedef struct
 
 void net_stats(NETSTATS *stats);
 
+typedef struct
+{
+	int total_allocations;
+	int active_allocations;
+} MEMSTATS;
+
+/*
+	Function: mem_stats
+		Gets the number of blocks allocated through <mem_alloc>.
+
+	Remarks:
+		- The counters are updated atomically and may be read from
+		any thread.
+*/
+void mem_stats(MEMSTATS *stats);
+
 int str_toint(const char *str);
 float str_tofloat(const char *str);
 int str_isspace(char c);
@@ -0,0 +1,353 @@
+/* (c) Magnus Auvinen. See licence.txt in the root of the distribution for more information. */
+/* If you are missing that file, acquire a complete release at teeworlds.com.                */
+#include <base/math.h>
+#include <base/system.h>
+
+#include <engine/shared/compression.h>
+#include <engine/shared/huffman.h>
+#include <engine/shared/network.h>
+
+/*
+	Compares the throughput of CHuffman with the previous bit by bit
+	implementation on packets that look like snapshot deltas: mostly
+	small integers packed with CVariableInt. The outputs of both are
+	checked to be identical.
+*/
+
+// the previous implementation: one lookup per symbol and a 32 bit encoder
+class CHuffmanReference
+{
+	enum
+	{
+		HUFFMAN_EOF_SYMBOL = 256,
+
+		HUFFMAN_MAX_SYMBOLS=HUFFMAN_EOF_SYMBOL+1,
+		HUFFMAN_MAX_NODES=HUFFMAN_MAX_SYMBOLS*2-1,
+
+		HUFFMAN_LUTBITS = 10,
+		HUFFMAN_LUTSIZE = (1<<HUFFMAN_LUTBITS),
+		HUFFMAN_LUTMASK = (HUFFMAN_LUTSIZE-1)
+	};
+
+	struct CNode
+	{
+		unsigned m_Bits;
+		unsigned m_NumBits;
+		unsigned short m_aLeafs[2];
+		unsigned char m_Symbol;
+	};
+
+	struct CConstructNode
+	{
+		unsigned short m_NodeId;
+		int m_Frequency;
+	};
+
+	CNode m_aNodes[HUFFMAN_MAX_NODES];
+	CNode *m_apDecodeLut[HUFFMAN_LUTSIZE];
+	CNode *m_pStartNode;
+	int m_NumNodes;
+
+	void Setbits_r(CNode *pNode, int Bits, unsigned Depth)
+	{
+		if(pNode->m_aLeafs[1] != 0xffff)
+			Setbits_r(&m_aNodes[pNode->m_aLeafs[1]], Bits|(1<<Depth), Depth+1);
+		if(pNode->m_aLeafs[0] != 0xffff)
+			Setbits_r(&m_aNodes[pNode->m_aLeafs[0]], Bits, Depth+1);
+
+		if(pNode->m_NumBits)
+		{
+			pNode->m_Bits = Bits;
+			pNode->m_NumBits = Depth;
+		}
+	}
+
+	static void BubbleSort(CConstructNode **ppList, int Size)
+	{
+		int Changed = 1;
+		while(Changed)
+		{
+			Changed = 0;
+			for(int i = 0; i < Size-1; i++)
+			{
+				if(ppList[i]->m_Frequency < ppList[i+1]->m_Frequency)
+				{
+					CConstructNode *pTemp = ppList[i];
+					ppList[i] = ppList[i+1];
+					ppList[i+1] = pTemp;
+					Changed = 1;
+				}
+			}
+			Size--;
+		}
+	}
+
+public:
+	void Init(const unsigned *pFrequencies)
+	{
+		mem_zero(this, sizeof(*this));
+
+		CConstructNode aNodesLeftStorage[HUFFMAN_MAX_SYMBOLS];
+		CConstructNode *apNodesLeft[HUFFMAN_MAX_SYMBOLS];
+		int NumNodesLeft = HUFFMAN_MAX_SYMBOLS;
+		for(int i = 0; i < HUFFMAN_MAX_SYMBOLS; i++)
+		{
+			m_aNodes[i].m_NumBits = 0xFFFFFFFF;
+			m_aNodes[i].m_Symbol = i;
+			m_aNodes[i].m_aLeafs[0] = 0xffff;
+			m_aNodes[i].m_aLeafs[1] = 0xffff;
+			aNodesLeftStorage[i].m_Frequency = i == HUFFMAN_EOF_SYMBOL ? 1 : pFrequencies[i];
+			aNodesLeftStorage[i].m_NodeId = i;
+			apNodesLeft[i] = &aNodesLeftStorage[i];
+		}
+		m_NumNodes = HUFFMAN_MAX_SYMBOLS;
+		while(NumNodesLeft > 1)
+		{
+			BubbleSort(apNodesLeft, NumNodesLeft);
+			m_aNodes[m_NumNodes].m_NumBits = 0;
+			m_aNodes[m_NumNodes].m_aLeafs[0] = apNodesLeft[NumNodesLeft-1]->m_NodeId;
+			m_aNodes[m_NumNodes].m_aLeafs[1] = apNodesLeft[NumNodesLeft-2]->m_NodeId;
+			apNodesLeft[NumNodesLeft-2]->m_NodeId = m_NumNodes;
+			apNodesLeft[NumNodesLeft-2]->m_Frequency = apNodesLeft[NumNodesLeft-1]->m_Frequency + apNodesLeft[NumNodesLeft-2]->m_Frequency;
+			m_NumNodes++;
+			NumNodesLeft--;
+		}
+		m_pStartNode = &m_aNodes[m_NumNodes-1];
+		Setbits_r(m_pStartNode, 0, 0);
+
+		for(int i = 0; i < HUFFMAN_LUTSIZE; i++)
+		{
+			unsigned Bits = i;
+			int k;
+			CNode *pNode = m_pStartNode;
+			for(k = 0; k < HUFFMAN_LUTBITS; k++)
+			{
+				pNode = &m_aNodes[pNode->m_aLeafs[Bits&1]];
+				Bits >>= 1;
+				if(pNode->m_NumBits)
+				{
+					m_apDecodeLut[i] = pNode;
+					break;
+				}
+			}
+			if(k == HUFFMAN_LUTBITS)
+				m_apDecodeLut[i] = pNode;
+		}
+	}
+
+	int Compress(const void *pInput, int InputSize, void *pOutput, int OutputSize)
+	{
+		const unsigned char *pSrc = (const unsigned char *)pInput;
+		const unsigned char *pSrcEnd = pSrc + InputSize;
+		unsigned char *pDst = (unsigned char *)pOutput;
+		unsigned char *pDstEnd = pDst + OutputSize;
+		unsigned Bits = 0;
+		unsigned Bitcount = 0;
+
+		for(int i = 0; i <= InputSize; i++)
+		{
+			int Symbol = pSrc == pSrcEnd ? (int)HUFFMAN_EOF_SYMBOL : *pSrc++;
+			Bits |= m_aNodes[Symbol].m_Bits << Bitcount;
+			Bitcount += m_aNodes[Symbol].m_NumBits;
+			while(Bitcount >= 8)
+			{
+				*pDst++ = (unsigned char)(Bits&0xff);
+				if(pDst == pDstEnd)
+					return -1;
+				Bits >>= 8;
+				Bitcount -= 8;
+			}
+		}
+		*pDst++ = Bits;
+		return (int)(pDst - (const unsigned char *)pOutput);
+	}
+
+	int Decompress(const void *pInput, int InputSize, void *pOutput, int OutputSize)
+	{
+		unsigned char *pDst = (unsigned char *)pOutput;
+		const unsigned char *pSrc = (const unsigned char *)pInput;
+		unsigned char *pDstEnd = pDst + OutputSize;
+		const unsigned char *pSrcEnd = pSrc + InputSize;
+		unsigned Bits = 0;
+		unsigned Bitcount = 0;
+		CNode *pEof = &m_aNodes[HUFFMAN_EOF_SYMBOL];
+
+		while(1)
+		{
+			CNode *pNode = 0;
+			if(Bitcount >= HUFFMAN_LUTBITS)
+				pNode = m_apDecodeLut[Bits&HUFFMAN_LUTMASK];
+			while(Bitcount < 24 && pSrc != pSrcEnd)
+			{
+				Bits |= (*pSrc++) << Bitcount;
+				Bitcount += 8;
+			}
+			if(!pNode)
+				pNode = m_apDecodeLut[Bits&HUFFMAN_LUTMASK];
+
+			if(pNode->m_NumBits)
+			{
+				Bits >>= pNode->m_NumBits;
+				Bitcount -= pNode->m_NumBits;
+			}
+			else
+			{
+				Bits >>= HUFFMAN_LUTBITS;
+				Bitcount -= HUFFMAN_LUTBITS;
+				while(1)
+				{
+					pNode = &m_aNodes[pNode->m_aLeafs[Bits&1]];
+					Bitcount--;
+					Bits >>= 1;
+					if(pNode->m_NumBits)
+						break;
+					if(Bitcount == 0)
+						return -1;
+				}
+			}
+
+			if(pNode == pEof)
+				break;
+			if(pDst == pDstEnd)
+				return -1;
+			*pDst++ = pNode->m_Symbol;
+		}
+		return (int)(pDst - (const unsigned char *)pOutput);
+	}
+};
+
+class CRandom
+{
+	unsigned m_State;
+public:
+	CRandom(unsigned Seed) : m_State(Seed) {}
+	unsigned Next()
+	{
+		m_State = m_State*1103515245+12345;
+		return m_State>>8;
+	}
+	// mostly unchanged or slightly changed values like snapshot deltas
+	int NextValue()
+	{
+		switch(Next()%8)
+		{
+		case 0: case 1: case 2: case 3: return 0;
+		case 4: case 5: return (int)(Next()%64) - 32;
+		case 6: return (int)(Next()%16384) - 8192;
+		default: return (int)(Next()<<8 | (Next()&0xff));
+		}
+	}
+};
+
+static void Usage(const char *pName)
+{
+	dbg_msg("bench", "usage: %s [-p packets] [-s size] [-i iterations]", pName);
+}
+
+int main(int argc, const char **argv) // ignore_convention
+{
+	dbg_logger_stdout();
+
+	int NumPackets = 1024;
+	int PacketSize = 800;
+	int NumIterations = 100;
+
+	for(int i = 1; i < argc; i++) // ignore_convention
+	{
+		if(i+1 >= argc || argv[i][0] != '-') // ignore_convention
+		{
+			Usage(argv[0]); // ignore_convention
+			return -1;
+		}
+
+		const char *pValue = argv[++i]; // ignore_convention
+		switch(argv[i-1][1]) // ignore_convention
+		{
+		case 'p': NumPackets = max(str_toint(pValue), 1); break;
+		case 's': PacketSize = clamp(str_toint(pValue), 16, (int)NET_MAX_PAYLOAD); break;
+		case 'i': NumIterations = max(str_toint(pValue), 1); break;
+		default:
+			Usage(argv[0]); // ignore_convention
+			return -1;
+		}
+	}
+
+	// pack the packets
+	unsigned char *pPackets = (unsigned char *)mem_alloc(NumPackets*PacketSize, 1);
+	int *pSizes = (int *)mem_alloc(NumPackets*sizeof(int), 1);
+	CRandom Random(1);
+	int64 TotalBytes = 0;
+	for(int p = 0; p < NumPackets; p++)
+	{
+		int aValues[NET_MAX_PAYLOAD/4];
+		int NumValues = PacketSize/5; // a packed int takes at most 5 bytes
+		for(int i = 0; i < NumValues; i++)
+			aValues[i] = Random.NextValue();
+		pSizes[p] = CVariableInt::Compress(aValues, NumValues*sizeof(int), pPackets+p*PacketSize, PacketSize);
+		dbg_assert(pSizes[p] > 0, "packing failed");
+		TotalBytes += pSizes[p];
+	}
+
+	// both build the tree from the byte frequencies of the packets
+	unsigned aFrequencies[256];
+	mem_zero(aFrequencies, sizeof(aFrequencies));
+	for(int p = 0; p < NumPackets; p++)
+		for(int i = 0; i < pSizes[p]; i++)
+			aFrequencies[pPackets[p*PacketSize+i]]++;
+	static CHuffman s_Huffman;
+	static CHuffmanReference s_Reference;
+	s_Huffman.Init(aFrequencies);
+	s_Reference.Init(aFrequencies);
+
+	static unsigned char s_aCompressed[NET_MAX_PACKETSIZE*2];
+	static unsigned char s_aReferenceCompressed[NET_MAX_PACKETSIZE*2];
+	static unsigned char s_aDecompressed[NET_MAX_PAYLOAD];
+	int64 aTime[4] = {0, 0, 0, 0}; // reference compress, compress, reference decompress, decompress
+	int64 CompressedBytes = 0;
+	for(int n = 0; n < NumIterations; n++)
+	{
+		for(int p = 0; p < NumPackets; p++)
+		{
+			const unsigned char *pPacket = pPackets+p*PacketSize;
+			int64 Start = time_get();
+			int ReferenceSize = s_Reference.Compress(pPacket, pSizes[p], s_aReferenceCompressed, sizeof(s_aReferenceCompressed));
+			int64 End = time_get();
+			aTime[0] += End-Start;
+			int Size = s_Huffman.Compress(pPacket, pSizes[p], s_aCompressed, sizeof(s_aCompressed));
+			Start = time_get();
+			aTime[1] += Start-End;
+			if(Size != ReferenceSize || mem_comp(s_aCompressed, s_aReferenceCompressed, Size) != 0)
+			{
+				dbg_msg("bench", "compressed data differs. packet=%d", p);
+				return -1;
+			}
+
+			int ReferenceDecompressed = s_Reference.Decompress(s_aCompressed, Size, s_aDecompressed, sizeof(s_aDecompressed));
+			End = time_get();
+			aTime[2] += End-Start;
+			int Decompressed = s_Huffman.Decompress(s_aCompressed, Size, s_aDecompressed, sizeof(s_aDecompressed));
+			aTime[3] += time_get()-End;
+			if(Decompressed != pSizes[p] || ReferenceDecompressed != pSizes[p] || mem_comp(s_aDecompressed, pPacket, pSizes[p]) != 0)
+			{
+				dbg_msg("bench", "decompressed data differs. packet=%d", p);
+				return -1;
+			}
+			CompressedBytes += Size;
+		}
+	}
+
+	static const char *s_apNames[4] = {"compress_ref", "compress", "decompress_ref", "decompress"};
+	dbg_msg("bench", "packets=%d size=%lld compressed=%lld iterations=%d",
+		NumPackets, TotalBytes/NumPackets, CompressedBytes/NumIterations/NumPackets, NumIterations);
+	for(int i = 0; i < 4; i++)
+	{
+		// throughput in uncompressed bytes
+		double Seconds = max(aTime[i], (int64)1)/(double)time_freq();
+		dbg_msg("bench", "%-14s %8.1f MB/s %8lld ns/packet", s_apNames[i], TotalBytes*NumIterations/Seconds/(1024*1024),
+			aTime[i]*1000000000/time_freq()/((int64)NumPackets*NumIterations));
+	}
+
+	mem_free(pPackets);
+	mem_free(pSizes);
+	return 0;
+}
@@ -0,0 +1,209 @@
+/* (c) Magnus Auvinen. See licence.txt in the root of the distribution for more information. */
+/* If you are missing that file, acquire a complete release at teeworlds.com.                */
+#include <base/math.h>
+#include <base/system.h>
+
+#include <engine/console.h>
+#include <engine/shared/config.h>
+#include <engine/shared/netban.h>
+
+/*
+	Imports a large banlist of address ranges and measures how many
+	range lookups per second the trie handles, compared with the
+	previous lookup that walked the hash lists of every prefix length.
+	Both lookups are checked to agree with IsBanned.
+*/
+
+class CRandom
+{
+	unsigned m_State;
+public:
+	CRandom(unsigned Seed) : m_State(Seed) {}
+	unsigned Next()
+	{
+		m_State = m_State*1103515245+12345;
+		return m_State>>8;
+	}
+	unsigned Next32() { return Next()<<16 ^ Next(); }
+};
+
+class CBenchBan : public CNetBan
+{
+public:
+	bool IsBannedTrie(const NETADDR *pAddr) const
+	{
+		return m_BanRangeTrie.Find(pAddr) != 0;
+	}
+
+	// the previous lookup: one hash list per number of leading bytes a range shares
+	bool IsBannedHashed(const NETADDR *pAddr) const
+	{
+		int Length = pAddr->type == NETTYPE_IPV4 ? NETADDR_SIZE_IPV4 : NETADDR_SIZE_IPV6;
+		CNetHash aHash[NETADDR_SIZE_IPV6+1];
+		aHash[0].m_Hash = 0;
+		aHash[0].m_HashIndex = 0;
+		for(int i = 1, Sum = 0; i <= Length; ++i)
+		{
+			Sum += pAddr->ip[i-1];
+			aHash[i].m_Hash = Sum&0xFF;
+			aHash[i].m_HashIndex = i%Length;
+		}
+
+		for(int i = Length-1; i >= 0; --i)
+		{
+			for(CBanRange *pBan = m_BanRangePool.First(&aHash[i]); pBan; pBan = pBan->m_pHashNext)
+			{
+				if(NetMatch(&pBan->m_Data, pAddr, i, Length))
+					return true;
+			}
+		}
+		return false;
+	}
+
+	int NumRanges() const { return m_BanRangePool.Num(); }
+};
+
+static void RandomRange(CRandom *pRandom, CNetRange *pRange)
+{
+	pRange->m_LB.type = pRange->m_UB.type = pRandom->Next()%10 == 0 ? NETTYPE_IPV6 : NETTYPE_IPV4;
+	pRange->m_LB.port = pRange->m_UB.port = 0;
+	mem_zero(pRange->m_LB.ip, sizeof(pRange->m_LB.ip));
+	if(pRange->m_LB.type == NETTYPE_IPV4)
+	{
+		// mostly subnets, some arbitrary spans like the ones of hosting providers
+		unsigned Start = pRandom->Next32(), End;
+		if(pRandom->Next()%4)
+		{
+			unsigned Bits = pRandom->Next()%13;
+			Start &= ~((1u<<Bits)-1);
+			End = Start | ((1u<<Bits)-1);
+		}
+		else
+			End = Start + 1 + pRandom->Next()%4096;
+		if(End < Start)
+			End = 0xffffffff;
+		for(int b = 0; b < NETADDR_SIZE_IPV4; b++)
+		{
+			pRange->m_LB.ip[b] = (Start>>(24-b*8))&0xff;
+			pRange->m_UB.ip[b] = (End>>(24-b*8))&0xff;
+		}
+	}
+	else
+	{
+		// 2000::/3 with /48 to /64 prefixes
+		for(int b = 0; b < NETADDR_SIZE_IPV6; b++)
+			pRange->m_LB.ip[b] = pRandom->Next()&0xff;
+		pRange->m_LB.ip[0] = 0x20 | (pRange->m_LB.ip[0]&0x1f);
+		int Bits = 48 + pRandom->Next()%17;
+		mem_copy(pRange->m_UB.ip, pRange->m_LB.ip, sizeof(pRange->m_UB.ip));
+		for(int i = Bits; i < NETADDR_SIZE_IPV6*8; i++)
+		{
+			pRange->m_LB.ip[i/8] &= ~(1<<(7-i%8));
+			pRange->m_UB.ip[i/8] |= 1<<(7-i%8);
+		}
+	}
+}
+
+static void Usage(const char *pName)
+{
+	dbg_msg("bench", "usage: %s [-b bans] [-l lookups]", pName);
+}
+
+int main(int argc, const char **argv) // ignore_convention
+{
+	int NumBans = 100000;
+	int NumLookups = 200000;
+
+	for(int i = 1; i < argc; i++) // ignore_convention
+	{
+		if(i+1 >= argc || argv[i][0] != '-') // ignore_convention
+		{
+			dbg_logger_stdout();
+			Usage(argv[0]); // ignore_convention
+			return -1;
+		}
+
+		const char *pValue = argv[++i]; // ignore_convention
+		switch(argv[i-1][1]) // ignore_convention
+		{
+		case 'b': NumBans = max(str_toint(pValue), 1); break;
+		case 'l': NumLookups = max(str_toint(pValue), 1); break;
+		default:
+			dbg_logger_stdout();
+			Usage(argv[0]); // ignore_convention
+			return -1;
+		}
+	}
+
+	// every ban is printed by the console, only log once they are in
+	IConsole *pConsole = CreateConsole(CFGFLAG_SERVER);
+	static CBenchBan s_Ban;
+	s_Ban.Init(pConsole, 0);
+
+	CRandom Random(1);
+	CNetRange *pRanges = (CNetRange *)mem_alloc(NumBans*sizeof(CNetRange), 1);
+	int64 ImportTime = time_get();
+	for(int i = 0; i < NumBans; i++)
+	{
+		RandomRange(&Random, &pRanges[i]);
+		s_Ban.BanRange(&pRanges[i], 0, "bench");
+	}
+	ImportTime = time_get()-ImportTime;
+	dbg_logger_stdout();
+
+	// half of the lookups hit a banned range
+	NETADDR *pAddrs = (NETADDR *)mem_alloc(NumLookups*sizeof(NETADDR), 1);
+	for(int i = 0; i < NumLookups; i++)
+	{
+		if(i%2)
+		{
+			pAddrs[i] = pRanges[Random.Next()%NumBans].m_LB;
+			pAddrs[i].ip[pAddrs[i].type == NETTYPE_IPV4 ? 3 : 15] |= Random.Next()&1;
+		}
+		else
+		{
+			CNetRange Range;
+			RandomRange(&Random, &Range);
+			pAddrs[i] = Range.m_UB;
+		}
+	}
+
+	int NumBanned = 0;
+	bool *pBanned = (bool *)mem_alloc(NumLookups*sizeof(bool), 1);
+	char aBuf[256];
+	for(int i = 0; i < NumLookups; i++)
+	{
+		pBanned[i] = s_Ban.IsBanned(&pAddrs[i], aBuf, sizeof(aBuf), 0);
+		NumBanned += pBanned[i];
+	}
+
+	int64 aTime[2] = {0, 0}; // trie, hashed
+	for(int i = 0; i < 2; i++)
+	{
+		int64 Start = time_get();
+		for(int a = 0; a < NumLookups; a++)
+		{
+			bool Banned = i == 0 ? s_Ban.IsBannedTrie(&pAddrs[a]) : s_Ban.IsBannedHashed(&pAddrs[a]);
+			if(Banned != pBanned[a])
+			{
+				dbg_msg("bench", "lookups differ. lookup=%s address=%d", i == 0 ? "trie" : "hashed", a);
+				return -1;
+			}
+		}
+		aTime[i] = time_get()-Start;
+	}
+
+	dbg_msg("bench", "bans=%d import=%lld ms lookups=%d banned=%d", s_Ban.NumRanges(), ImportTime*1000/time_freq(), NumLookups, NumBanned);
+	static const char *s_apNames[2] = {"trie", "hashed"};
+	for(int i = 0; i < 2; i++)
+	{
+		double Seconds = max(aTime[i], (int64)1)/(double)time_freq();
+		dbg_msg("bench", "%-8s %12.0f lookups/s %8lld ns/lookup", s_apNames[i], NumLookups/Seconds, aTime[i]*1000000000/time_freq()/NumLookups);
+	}
+
+	mem_free(pRanges);
+	mem_free(pAddrs);
+	mem_free(pBanned);
+	delete pConsole;
+	return 0;
+}
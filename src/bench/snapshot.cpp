@@ -0,0 +1,443 @@
+/* (c) Magnus Auvinen. See licence.txt in the root of the distribution for more information. */
+/* If you are missing that file, acquire a complete release at teeworlds.com.                */
+#include <base/math.h>
+#include <base/system.h>
+
+#include <engine/config.h>
+#include <engine/console.h>
+#include <engine/map.h>
+#include <engine/server.h>
+#include <engine/storage.h>
+#include <engine/shared/compression.h>
+#include <engine/shared/config.h>
+#include <engine/shared/huffman.h>
+#include <engine/shared/network.h>
+#include <engine/shared/protocol.h>
+#include <engine/shared/snapshot.h>
+
+#include <game/server/entities/character.h>
+#include <game/server/entities/laser.h>
+#include <game/server/entities/projectile.h>
+#include <game/server/entity.h>
+#include <game/server/gamecontext.h>
+#include <game/server/player.h>
+#include <game/version.h>
+
+/*
+	Drives the server snapshot pipeline without networking:
+	a game context with bots, projectiles and lasers on a real map
+	is ticked and snapped for a number of simulated clients, the
+	cost of every stage is reported per client snapshot.
+*/
+
+// minimal server, snapshot items go straight into the benchmark builder
+class CBenchServer : public IServer
+{
+	int m_aFreeIDs[16*1024];
+	int m_NumFreeIDs;
+	int m_NextID;
+
+public:
+	CSnapshotBuilder *m_pBuilder;
+	CSnapshotDelta m_SnapshotDelta;
+
+	CBenchServer()
+	{
+		m_CurrentGameTick = 0;
+		m_TickSpeed = SERVER_TICK_SPEED;
+		m_NumFreeIDs = 0;
+		m_NextID = 0;
+		m_pBuilder = 0;
+	}
+
+	void SetTick(int Tick) { m_CurrentGameTick = Tick; }
+
+	virtual const char *ClientName(int ClientID) const { return "bot"; }
+	virtual const char *ClientClan(int ClientID) const { return ""; }
+	virtual int ClientCountry(int ClientID) const { return -1; }
+	virtual bool ClientIngame(int ClientID) const { return false; }
+	virtual int GetClientInfo(int ClientID, CClientInfo *pInfo) const
+	{
+		pInfo->m_pName = ClientName(ClientID);
+		pInfo->m_Latency = 0;
+		return 1;
+	}
+	virtual void GetClientAddr(int ClientID, char *pAddrStr, int Size) const { str_copy(pAddrStr, "0.0.0.0", Size); }
+	virtual int GetClientVersion(int ClientID) const { return CLIENT_VERSION; }
+
+	virtual int SendMsg(CMsgPacker *pMsg, int Flags, int ClientID) { return 0; }
+
+	virtual void SetClientName(int ClientID, char const *pName) {}
+	virtual void SetClientClan(int ClientID, char const *pClan) {}
+	virtual void SetClientCountry(int ClientID, int Country) {}
+	virtual void SetClientScore(int ClientID, int Score) {}
+	virtual void ExpireServerInfo() {}
+
+	virtual int SnapNewID()
+	{
+		if(m_NumFreeIDs)
+			return m_aFreeIDs[--m_NumFreeIDs];
+		dbg_assert(m_NextID < (int)(sizeof(m_aFreeIDs)/sizeof(m_aFreeIDs[0])), "too many snapshot ids");
+		return m_NextID++;
+	}
+	virtual void SnapFreeID(int ID) { m_aFreeIDs[m_NumFreeIDs++] = ID; }
+	virtual void *SnapNewItem(int Type, int ID, int Size) { return m_pBuilder->NewItem(Type, ID, Size); }
+	virtual void SnapSetStaticsize(int ItemType, int Size) { m_SnapshotDelta.SetStaticsize(ItemType, Size); }
+
+	virtual void SetRconCID(int ClientID) {}
+	virtual bool IsAuthed(int ClientID) const { return false; }
+	virtual bool IsBanned(int ClientID) { return false; }
+	virtual void Kick(int ClientID, const char *pReason) {}
+	virtual void ChangeMap(const char *pMap) {}
+
+	virtual void DemoRecorder_HandleAutoStart() {}
+	virtual bool DemoRecorder_IsRecording() { return false; }
+};
+
+enum
+{
+	STAGE_TICK=0,
+	STAGE_QUERY_GRID,
+	STAGE_QUERY_LIST,
+	STAGE_SNAP_SHARED,
+	STAGE_ONSNAP,
+	STAGE_FINISH,
+	STAGE_DELTA,
+	STAGE_VARINT,
+	STAGE_HUFFMAN,
+	NUM_STAGES,
+};
+
+static const char *s_apStageNames[NUM_STAGES] = {"tick", "query_grid", "query_list", "snap_shared", "onsnap", "finish", "delta", "varint", "huffman"};
+
+// per client state, the acked snapshot is the base of the delta like on the real server
+struct CBenchClient
+{
+	CSnapshotStorage m_Snapshots;
+	int m_LastAckedSnapshot;
+};
+
+static int CountEntities(CGameWorld *pWorld, int Type)
+{
+	int Num = 0;
+	for(CEntity *pEnt = pWorld->FindFirst(Type); pEnt; pEnt = pEnt->TypeNext())
+		Num++;
+	return Num;
+}
+
+// the position queries of a tick: projectile hits, explosions and pickups
+static int64 RunQueries(CGameWorld *pWorld)
+{
+	int64 Checksum = 0;
+	CEntity *apEnts[MAX_CLIENTS];
+	vec2 NewPos;
+
+	for(CEntity *pEnt = pWorld->FindFirst(CGameWorld::ENTTYPE_PROJECTILE); pEnt; pEnt = pEnt->TypeNext())
+	{
+		vec2 Pos = pEnt->GetPos();
+		CCharacter *pChr = pWorld->IntersectCharacter(Pos, Pos+vec2(24.0f, 12.0f), 6.0f, NewPos);
+		Checksum = Checksum*31 + (pChr ? pChr->GetPlayer()->GetCID() : -1);
+
+		int Num = pWorld->FindEntities(Pos, 135.0f, apEnts, MAX_CLIENTS, CGameWorld::ENTTYPE_CHARACTER);
+		for(int i = 0; i < Num; i++)
+			Checksum = Checksum*31 + ((CCharacter *)apEnts[i])->GetPlayer()->GetCID();
+	}
+
+	for(CEntity *pEnt = pWorld->FindFirst(CGameWorld::ENTTYPE_PICKUP); pEnt; pEnt = pEnt->TypeNext())
+	{
+		CCharacter *pChr = (CCharacter *)pWorld->ClosestEntity(pEnt->GetPos(), 20.0f, CGameWorld::ENTTYPE_CHARACTER, 0);
+		Checksum = Checksum*31 + (pChr ? pChr->GetPlayer()->GetCID() : -1);
+	}
+
+	return Checksum;
+}
+
+static void Usage(const char *pName)
+{
+	dbg_msg("bench", "usage: %s [-m map] [-b bots] [-c clients] [-p projectiles] [-l lasers] [-t ticks] [-a ackdelay]", pName);
+}
+
+int main(int argc, const char **argv) // ignore_convention
+{
+	dbg_logger_stdout();
+
+	const char *pMapName = "dm1";
+	int NumBots = 16;
+	int NumClients = 16;
+	int NumProjectiles = 32;
+	int NumLasers = 8;
+	int NumTicks = 1000;
+	int AckDelay = 2;
+
+	for(int i = 1; i < argc; i++) // ignore_convention
+	{
+		if(i+1 >= argc || argv[i][0] != '-') // ignore_convention
+		{
+			Usage(argv[0]); // ignore_convention
+			return -1;
+		}
+
+		const char *pValue = argv[++i]; // ignore_convention
+		switch(argv[i-1][1]) // ignore_convention
+		{
+		case 'm': pMapName = pValue; break;
+		case 'b': NumBots = clamp(str_toint(pValue), 1, (int)MAX_CLIENTS); break;
+		case 'c': NumClients = clamp(str_toint(pValue), 1, (int)MAX_CLIENTS); break;
+		case 'p': NumProjectiles = max(str_toint(pValue), 0); break;
+		case 'l': NumLasers = max(str_toint(pValue), 0); break;
+		case 't': NumTicks = max(str_toint(pValue), 1); break;
+		case 'a': AckDelay = clamp(str_toint(pValue), 1, (int)SERVER_TICK_SPEED); break;
+		default:
+			Usage(argv[0]); // ignore_convention
+			return -1;
+		}
+	}
+
+	// the simulated clients are the bots, the snap needs a player to look from
+	NumClients = min(NumClients, NumBots);
+
+	IKernel *pKernel = IKernel::Create();
+	CBenchServer *pServer = new CBenchServer();
+	IEngineMap *pEngineMap = CreateEngineMap();
+	IGameServer *pGameServer = CreateGameServer();
+	IConsole *pConsole = CreateConsole(CFGFLAG_SERVER);
+	IStorage *pStorage = CreateStorage("Teeworlds", IStorage::STORAGETYPE_SERVER, argc, argv); // ignore_convention
+	IConfigManager *pConfigManager = CreateConfigManager();
+
+	{
+		bool RegisterFail = false;
+
+		RegisterFail = RegisterFail || !pKernel->RegisterInterface(static_cast<IServer*>(pServer));
+		RegisterFail = RegisterFail || !pKernel->RegisterInterface(static_cast<IEngineMap*>(pEngineMap)); // register as both
+		RegisterFail = RegisterFail || !pKernel->RegisterInterface(static_cast<IMap*>(pEngineMap));
+		RegisterFail = RegisterFail || !pKernel->RegisterInterface(pGameServer);
+		RegisterFail = RegisterFail || !pKernel->RegisterInterface(pConsole);
+		RegisterFail = RegisterFail || !pKernel->RegisterInterface(pStorage);
+		RegisterFail = RegisterFail || !pKernel->RegisterInterface(pConfigManager);
+
+		if(RegisterFail)
+			return -1;
+	}
+
+	pConfigManager->Init(CFGFLAG_SERVER);
+	pConsole->Init();
+	pGameServer->OnConsoleInit();
+
+	CConfig *pConfig = pConfigManager->Values();
+	pConfig->m_SvMaxClients = MAX_CLIENTS;
+	pConfig->m_SvPlayerSlots = MAX_PLAYERS;
+	pConfig->m_SvWarmup = 0;
+	pConfig->m_SvScorelimit = 0;
+	pConfig->m_SvTimelimit = 0;
+
+	char aBuf[IO_MAX_PATH_LENGTH];
+	str_format(aBuf, sizeof(aBuf), "maps/%s.map", pMapName);
+	if(!pEngineMap->Load(aBuf))
+	{
+		dbg_msg("bench", "failed to load map. mapname='%s'", pMapName);
+		return -1;
+	}
+
+	pGameServer->OnInit();
+	CGameContext *pGameContext = (CGameContext *)pGameServer;
+
+	for(int i = 0; i < NumBots; i++)
+	{
+		pGameContext->OnClientConnected(i, true, false);
+		pGameContext->OnClientEnter(i);
+	}
+
+	CBenchClient *pClients = new CBenchClient[NumClients];
+	for(int i = 0; i < NumClients; i++)
+		pClients[i].m_LastAckedSnapshot = -1;
+
+	CSnapshotBuilder *pSharedBuilder = new CSnapshotBuilder();
+	CSnapshotBuilder *pBuilder = new CSnapshotBuilder();
+	static char s_aData[CSnapshot::MAX_SIZE];
+	static char s_aDeltaData[CSnapshot::MAX_SIZE];
+	static char s_aCompData[CSnapshot::MAX_SIZE];
+	static char s_aHuffmanData[NET_MAX_PACKETSIZE];
+	CHuffman Huffman;
+	Huffman.Init();
+	// trained on the warmup snapshots, like sv_huffman_train does on a running server
+	static CHuffman s_TrainedHuffman;
+	unsigned aByteCounts[256] = {0};
+
+	int64 aStageTime[NUM_STAGES] = {0};
+	int64 SnapBytes = 0;
+	int64 DeltaBytes = 0;
+	int64 CompBytes = 0;
+	int64 HuffmanBytes = 0;
+	int64 TrainedBytes = 0;
+	int64 NumSnapshots = 0;
+	MEMSTATS StartMem = {0};
+
+	// let the bots spawn before measuring
+	const int WarmupTicks = SERVER_TICK_SPEED;
+	for(int Tick = 1; Tick <= WarmupTicks+NumTicks; Tick++)
+	{
+		const bool Measure = Tick > WarmupTicks;
+		if(Tick == WarmupTicks+1)
+		{
+			mem_stats(&StartMem);
+			unsigned aFrequencies[256];
+			CHuffman::NormalizeFrequencies(aByteCounts, aFrequencies);
+			s_TrainedHuffman.Init(aFrequencies);
+		}
+
+		pServer->SetTick(Tick);
+		int64 Start = time_get();
+
+		// keep the bots moving and the projectile and laser counts steady
+		for(int i = 0; i < NumBots; i++)
+		{
+			CNetObj_PlayerInput Input = {0};
+			Input.m_Direction = ((Tick/SERVER_TICK_SPEED+i)&1) ? -1 : 1;
+			Input.m_TargetX = (int)(cosf(Tick*0.05f+i)*100.0f);
+			Input.m_TargetY = (int)(sinf(Tick*0.05f+i)*100.0f);
+			Input.m_Jump = (Tick+i)%25 == 0;
+			pGameContext->OnClientPredictedInput(i, &Input);
+		}
+
+		CGameWorld *pWorld = &pGameContext->m_World;
+		CCharacter *apChars[MAX_CLIENTS];
+		int NumChars = 0;
+		for(CEntity *pEnt = pWorld->FindFirst(CGameWorld::ENTTYPE_CHARACTER); pEnt; pEnt = pEnt->TypeNext())
+			apChars[NumChars++] = (CCharacter *)pEnt;
+		for(int n = CountEntities(pWorld, CGameWorld::ENTTYPE_PROJECTILE); NumChars && n < NumProjectiles; n++)
+		{
+			CCharacter *pChr = apChars[n%NumChars];
+			vec2 Dir = direction(n*0.7f+Tick*0.1f);
+			new CProjectile(pWorld, WEAPON_GRENADE, pChr->GetPlayer()->GetCID(), pChr->GetPos(), Dir, SERVER_TICK_SPEED*2, 0, false, 0, -1, WEAPON_GRENADE);
+		}
+		for(int n = CountEntities(pWorld, CGameWorld::ENTTYPE_LASER); NumChars && n < NumLasers; n++)
+		{
+			CCharacter *pChr = apChars[n%NumChars];
+			new CLaser(pWorld, pChr->GetPos(), direction(n*1.3f+Tick*0.1f), pGameContext->Tuning()->m_LaserReach, pChr->GetPlayer()->GetCID());
+		}
+
+		pGameServer->OnTick();
+		int64 Now = time_get();
+		if(Measure)
+			aStageTime[STAGE_TICK] += Now-Start;
+
+		// compare the entity grid against walking the entity lists
+		Start = Now;
+		pConfig->m_SvWorldGrid = 1;
+		int64 GridChecksum = RunQueries(pWorld);
+		Now = time_get();
+		if(Measure)
+			aStageTime[STAGE_QUERY_GRID] += Now-Start;
+		Start = Now;
+		pConfig->m_SvWorldGrid = 0;
+		int64 ListChecksum = RunQueries(pWorld);
+		Now = time_get();
+		if(Measure)
+			aStageTime[STAGE_QUERY_LIST] += Now-Start;
+		pConfig->m_SvWorldGrid = 1;
+		dbg_assert(GridChecksum == ListChecksum, "grid and list queries differ");
+		Start = Now;
+
+		pGameServer->OnPreSnap();
+		pSharedBuilder->Init();
+		pServer->m_pBuilder = pSharedBuilder;
+		pGameServer->OnSnapShared();
+		Now = time_get();
+		if(Measure)
+			aStageTime[STAGE_SNAP_SHARED] += Now-Start;
+
+		for(int i = 0; i < NumClients; i++)
+		{
+			CBenchClient *pClient = &pClients[i];
+			int64 aTimes[NUM_STAGES];
+
+			aTimes[STAGE_ONSNAP] = time_get();
+			pBuilder->Init(pSharedBuilder);
+			pServer->m_pBuilder = pBuilder;
+			pGameServer->OnSnap(i);
+
+			aTimes[STAGE_FINISH] = time_get();
+			CSnapshot *pData = (CSnapshot *)s_aData;
+			int SnapshotSize = pBuilder->Finish(pData);
+
+			pClient->m_Snapshots.PurgeUntil(Tick-SERVER_TICK_SPEED*3);
+			pClient->m_Snapshots.Add(Tick, 0, SnapshotSize, pData, 0);
+
+			static const CSnapshot s_EmptySnap = CSnapshot();
+			const CSnapshot *pDeltashot = &s_EmptySnap;
+			CSnapshot *pAckedSnap;
+			if(pClient->m_Snapshots.Get(pClient->m_LastAckedSnapshot, 0, &pAckedSnap, 0) >= 0)
+				pDeltashot = pAckedSnap;
+
+			aTimes[STAGE_DELTA] = time_get();
+			int DeltaSize = pServer->m_SnapshotDelta.CreateDelta(pDeltashot, pData, s_aDeltaData);
+
+			aTimes[STAGE_VARINT] = time_get();
+			int CompSize = 0;
+			if(DeltaSize)
+				CompSize = CVariableInt::Compress(s_aDeltaData, DeltaSize, s_aCompData, sizeof(s_aCompData));
+
+			// the network layer compresses every snapshot part separately
+			aTimes[STAGE_HUFFMAN] = time_get();
+			int HuffmanSize = 0;
+			for(int Offset = 0; Offset < CompSize; Offset += MAX_SNAPSHOT_PACKSIZE)
+				HuffmanSize += Huffman.Compress(s_aCompData+Offset, min(CompSize-Offset, (int)MAX_SNAPSHOT_PACKSIZE), s_aHuffmanData, sizeof(s_aHuffmanData));
+			Now = time_get();
+
+			// the client acks with a delay, like over a real connection
+			if(Tick-AckDelay > pClient->m_LastAckedSnapshot)
+				pClient->m_LastAckedSnapshot = Tick-AckDelay;
+
+			if(!Measure)
+			{
+				for(int b = 0; b < CompSize; b++)
+					aByteCounts[(unsigned char)s_aCompData[b]]++;
+				continue;
+			}
+			for(int Offset = 0; Offset < CompSize; Offset += MAX_SNAPSHOT_PACKSIZE)
+				TrainedBytes += s_TrainedHuffman.Compress(s_aCompData+Offset, min(CompSize-Offset, (int)MAX_SNAPSHOT_PACKSIZE), s_aHuffmanData, sizeof(s_aHuffmanData));
+			for(int s = STAGE_ONSNAP; s < STAGE_HUFFMAN; s++)
+				aStageTime[s] += aTimes[s+1]-aTimes[s];
+			aStageTime[STAGE_HUFFMAN] += Now-aTimes[STAGE_HUFFMAN];
+			SnapBytes += SnapshotSize;
+			DeltaBytes += DeltaSize;
+			CompBytes += CompSize;
+			HuffmanBytes += HuffmanSize;
+			NumSnapshots++;
+		}
+
+		pServer->m_pBuilder = 0;
+		pGameServer->OnPostSnap();
+	}
+
+	MEMSTATS EndMem;
+	mem_stats(&EndMem);
+
+	dbg_msg("bench", "map=%s bots=%d clients=%d projectiles=%d lasers=%d ticks=%d ackdelay=%d",
+		pMapName, NumBots, NumClients, NumProjectiles, NumLasers, NumTicks, AckDelay);
+	for(int s = 0; s < NUM_STAGES; s++)
+	{
+		// tick, the queries and snap_shared run once per tick, the others once per client snapshot
+		int64 NumOps = s <= STAGE_SNAP_SHARED ? NumTicks : NumSnapshots;
+		dbg_msg("bench", "%-12s %10lld ns/op", s_apStageNames[s], aStageTime[s]*1000000000/time_freq()/max(NumOps, (int64)1));
+	}
+	dbg_msg("bench", "bytes per client snapshot: snap=%lld delta=%lld varint=%lld huffman=%lld",
+		SnapBytes/max(NumSnapshots, (int64)1), DeltaBytes/max(NumSnapshots, (int64)1),
+		CompBytes/max(NumSnapshots, (int64)1), HuffmanBytes/max(NumSnapshots, (int64)1));
+	dbg_msg("bench", "bytes per client snapshot with a trained huffman table: %lld", TrainedBytes/max(NumSnapshots, (int64)1));
+	dbg_msg("bench", "allocations per tick: %.2f", (EndMem.total_allocations-StartMem.total_allocations)/(float)NumTicks);
+
+	delete pBuilder;
+	delete pSharedBuilder;
+	delete[] pClients;
+	pGameServer->OnShutdown();
+
+	delete pKernel;
+	delete pServer;
+	delete pEngineMap;
+	delete pGameServer;
+	delete pConsole;
+	delete pStorage;
+	delete pConfigManager;
+	return 0;
+}
@@ -775,7 +775,7 @@ const void *CClient::SnapGetItem(int SnapID, int Index, CSnapItem *pItem) const
 	dbg_assert(SnapID >= 0 && SnapID < NUM_SNAPSHOT_TYPES, "invalid SnapID");
 	const CSnapshotItem *i = m_aSnapshots[m_pConfig->m_ClDummy][SnapID]->m_pAltSnap->GetItem(Index);
 	pItem->m_DataSize = m_aSnapshots[m_pConfig->m_ClDummy][SnapID]->m_pAltSnap->GetItemSize(Index);
-	pItem->m_Type = m_aSnapshots[m_pConfig->m_ClDummy][SnapID]->m_pAltSnap->GetItemType(Index);
+	pItem->m_Type = m_aSnapshots[m_pConfig->m_ClDummy][SnapID]->m_pAltSnap->GetItemType(Index, &m_aSnapshots[m_pConfig->m_ClDummy][SnapID]->m_AltTypeCache);
 	pItem->m_ID = i->ID();
 	return i->Data();
 }
@@ -800,7 +800,7 @@ const void *CClient::SnapFindItem(int SnapID, int Type, int ID) const
 		return 0x0;
 
 	CSnapshot* pAltSnap = m_aSnapshots[m_pConfig->m_ClDummy][SnapID]->m_pAltSnap;
-	int Index = pAltSnap->GetItemIndex(Type, ID);
+	int Index = pAltSnap->GetItemIndex(Type, ID, &m_aSnapshots[m_pConfig->m_ClDummy][SnapID]->m_AltTypeCache);
 	if(Index != -1)
 		return pAltSnap->GetItem(Index)->Data();
 
@@ -1524,6 +1524,21 @@ void CClient::ProcessServerPacket(CNetChunk *pPacket)
 			if(Unpacker.Error() == 0)
 				GameClient()->OnRconLine(pLine);
 		}
+		else if((pPacket->m_Flags&NET_CHUNKFLAG_VITAL) != 0 && Msg == NETMSG_HUFFMAN_TABLE)
+		{
+			int Generation = Unpacker.GetInt();
+			unsigned aFrequencies[256];
+			for(int i = 0; i < 256; i++)
+				aFrequencies[i] = Unpacker.GetInt();
+			if(Unpacker.Error() == 0 && Generation > 0 && CHuffman::ValidFrequencies(aFrequencies))
+			{
+				// the server uses the table once we acknowledged it
+				m_NetClient[m_pConfig->m_ClDummy].SetHuffmanTable(Generation, aFrequencies);
+				CMsgPacker Msg(NETMSG_HUFFMAN_TABLE_ACK, true);
+				Msg.AddInt(Generation);
+				SendMsg(&Msg, MSGFLAG_VITAL);
+			}
+		}
 		else if(Msg == NETMSG_PING_REPLY)
 		{
 			char aBuf[256];
@@ -2043,6 +2058,7 @@ void CClient::OnDemoPlayerSnapshot(void *pData, int Size)
 
 	mem_copy(m_aSnapshots[m_pConfig->m_ClDummy][SNAP_CURRENT]->m_pSnap, pData, Size);
 	mem_copy(m_aSnapshots[m_pConfig->m_ClDummy][SNAP_CURRENT]->m_pAltSnap, pData, Size);
+	m_aSnapshots[m_pConfig->m_ClDummy][SNAP_CURRENT]->m_AltTypeCache.Reset();
 
 	GameClient()->OnNewSnapshot();
 }
@@ -2805,11 +2821,13 @@ const char *CClient::DemoPlayer_Play(const char *pFilename, int StorageType)
 	m_aSnapshots[m_pConfig->m_ClDummy][SNAP_CURRENT]->m_pAltSnap = (CSnapshot *)m_aDemorecSnapshotData[SNAP_CURRENT][1];
 	m_aSnapshots[m_pConfig->m_ClDummy][SNAP_CURRENT]->m_SnapSize = 0;
 	m_aSnapshots[m_pConfig->m_ClDummy][SNAP_CURRENT]->m_Tick = -1;
+	m_aSnapshots[m_pConfig->m_ClDummy][SNAP_CURRENT]->m_AltTypeCache.Reset();
 
 	m_aSnapshots[m_pConfig->m_ClDummy][SNAP_PREV]->m_pSnap = (CSnapshot *)m_aDemorecSnapshotData[SNAP_PREV][0];
 	m_aSnapshots[m_pConfig->m_ClDummy][SNAP_PREV]->m_pAltSnap = (CSnapshot *)m_aDemorecSnapshotData[SNAP_PREV][1];
 	m_aSnapshots[m_pConfig->m_ClDummy][SNAP_PREV]->m_SnapSize = 0;
 	m_aSnapshots[m_pConfig->m_ClDummy][SNAP_PREV]->m_Tick = -1;
+	m_aSnapshots[m_pConfig->m_ClDummy][SNAP_PREV]->m_AltTypeCache.Reset();
 
 	// enter demo playback state
 	SetState(IClient::STATE_DEMOPLAYBACK);
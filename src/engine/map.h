@@ -28,6 +28,10 @@ public:
 	virtual bool Load(const char *pMapName, class IStorage *pStorage=0) = 0;
 	virtual bool IsLoaded() = 0;
 	virtual void Unload() = 0;
+	// loads a map next to the current one, safe to call from another thread
+	virtual bool Preload(const char *pMapName, class IStorage *pStorage) = 0;
+	virtual void SwapPreloaded() = 0;
+	virtual void UnloadPreloaded() = 0;
 	virtual SHA256_DIGEST Sha256() = 0;
 	virtual unsigned Crc() = 0;
 };
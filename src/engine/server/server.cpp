@@ -3,6 +3,8 @@
 
 #include <base/math.h>
 #include <base/system.h>
+#include <base/tl/algorithm.h>
+#include <base/tl/threading.h>
 
 #include <engine/config.h>
 #include <engine/console.h>
@@ -18,6 +20,7 @@
 #include <engine/shared/demo.h>
 #include <engine/shared/econ.h>
 #include <engine/shared/filecollection.h>
+#include <engine/shared/jsonwriter.h>
 #include <engine/shared/mapchecker.h>
 #include <engine/shared/netban.h>
 #include <engine/shared/network.h>
@@ -145,6 +148,365 @@ void CSnapIDPool::FreeID(int ID)
 }
 
 
+CSnapWorkerPool::CSnapWorkerPool()
+{
+	m_NumThreads = 0;
+	m_Shutdown = false;
+	m_pfnJob = 0;
+	m_pJobUser = 0;
+	m_NumJobs = 0;
+	m_NextJob = 0;
+#if !defined(CONF_PLATFORM_MACOSX)
+	semaphore_init(&m_Done);
+#endif
+}
+
+CSnapWorkerPool::~CSnapWorkerPool()
+{
+	Shutdown();
+#if !defined(CONF_PLATFORM_MACOSX)
+	semaphore_destroy(&m_Done);
+#endif
+}
+
+void CSnapWorkerPool::ProcessJobs()
+{
+	while(1)
+	{
+		int Index = (int)atomic_inc(&m_NextJob)-1;
+		if(Index >= m_NumJobs)
+			break;
+		m_pfnJob(Index, m_pJobUser);
+	}
+}
+
+void CSnapWorkerPool::WorkerThread(void *pUser)
+{
+#if !defined(CONF_PLATFORM_MACOSX)
+	CWorker *pWorker = (CWorker *)pUser;
+	CSnapWorkerPool *pPool = pWorker->m_pPool;
+	while(1)
+	{
+		semaphore_wait(&pWorker->m_Activity);
+		if(pPool->m_Shutdown)
+			break;
+		pPool->ProcessJobs();
+		semaphore_signal(&pPool->m_Done);
+	}
+#endif
+}
+
+int CSnapWorkerPool::Init(int NumThreads)
+{
+	NumThreads = clamp(NumThreads, 0, (int)MAX_THREADS);
+#if defined(CONF_PLATFORM_MACOSX)
+	// no semaphores available, snapshots are always created on the calling thread
+	NumThreads = 0;
+#endif
+	if(NumThreads == m_NumThreads)
+		return m_NumThreads;
+
+	Shutdown();
+
+#if !defined(CONF_PLATFORM_MACOSX)
+	for(int i = 0; i < NumThreads; i++)
+	{
+		CWorker *pWorker = &m_aWorkers[i];
+		pWorker->m_pPool = this;
+		semaphore_init(&pWorker->m_Activity);
+		pWorker->m_pThread = thread_init(WorkerThread, pWorker);
+		if(!pWorker->m_pThread)
+		{
+			semaphore_destroy(&pWorker->m_Activity);
+			break;
+		}
+		m_NumThreads++;
+	}
+#endif
+	return m_NumThreads;
+}
+
+void CSnapWorkerPool::Shutdown()
+{
+#if !defined(CONF_PLATFORM_MACOSX)
+	m_Shutdown = true;
+	sync_barrier();
+	for(int i = 0; i < m_NumThreads; i++)
+	{
+		semaphore_signal(&m_aWorkers[i].m_Activity);
+		thread_wait(m_aWorkers[i].m_pThread);
+		semaphore_destroy(&m_aWorkers[i].m_Activity);
+	}
+	m_Shutdown = false;
+#endif
+	m_NumThreads = 0;
+}
+
+void CSnapWorkerPool::Run(FJob pfnJob, void *pUser, int NumJobs)
+{
+	m_pfnJob = pfnJob;
+	m_pJobUser = pUser;
+	m_NumJobs = NumJobs;
+	m_NextJob = 0;
+	sync_barrier();
+
+#if !defined(CONF_PLATFORM_MACOSX)
+	for(int i = 0; i < m_NumThreads; i++)
+		semaphore_signal(&m_aWorkers[i].m_Activity);
+#endif
+
+	// help out instead of idling
+	ProcessJobs();
+
+#if !defined(CONF_PLATFORM_MACOSX)
+	for(int i = 0; i < m_NumThreads; i++)
+		semaphore_wait(&m_Done);
+#endif
+}
+
+
+CSnapDeltaCache::CSnapDeltaCache()
+{
+	for(int i = 0; i < MAX_ENTRIES; i++)
+	{
+		m_aEntries[i].m_pData = 0;
+		m_aEntries[i].m_Capacity = 0;
+	}
+	m_NumEntries = 0;
+	m_Lock = lock_create();
+	m_Hits = 0;
+	m_Misses = 0;
+	m_TickHits = 0;
+	m_TickMisses = 0;
+}
+
+CSnapDeltaCache::~CSnapDeltaCache()
+{
+	for(int i = 0; i < MAX_ENTRIES; i++)
+		mem_free(m_aEntries[i].m_pData);
+	lock_destroy(m_Lock);
+}
+
+void CSnapDeltaCache::Reset()
+{
+	m_NumEntries = 0;
+	m_TickHits = 0;
+	m_TickMisses = 0;
+}
+
+bool CSnapDeltaCache::Get(const CSnapshot *pSnap, int64 Hash, const CSnapshot *pBase, int64 BaseHash, void *pData, int *pDataSize)
+{
+	lock_wait(m_Lock);
+	int NumEntries = m_NumEntries;
+	lock_unlock(m_Lock);
+
+	// entries don't change until the next reset
+	const int SnapSize = pSnap->Size();
+	const int BaseSize = pBase->Size();
+	const CEntry *pFound = 0;
+	for(int i = 0; i < NumEntries && !pFound; i++)
+	{
+		const CEntry *pEntry = &m_aEntries[i];
+		if(pEntry->m_Hash == Hash && pEntry->m_BaseHash == BaseHash &&
+			pEntry->m_SnapSize == SnapSize && pEntry->m_BaseSize == BaseSize &&
+			mem_comp(pEntry->m_pData, pSnap, SnapSize) == 0 &&
+			mem_comp(pEntry->m_pData+SnapSize, pBase, BaseSize) == 0)
+			pFound = pEntry;
+	}
+
+	lock_wait(m_Lock);
+	if(pFound)
+	{
+		m_Hits++;
+		m_TickHits++;
+	}
+	else
+	{
+		m_Misses++;
+		m_TickMisses++;
+	}
+	lock_unlock(m_Lock);
+
+	if(!pFound)
+		return false;
+	mem_copy(pData, pFound->m_pData+SnapSize+BaseSize, pFound->m_DataSize);
+	*pDataSize = pFound->m_DataSize;
+	return true;
+}
+
+void CSnapDeltaCache::Add(const CSnapshot *pSnap, int64 Hash, const CSnapshot *pBase, int64 BaseHash, const void *pData, int DataSize)
+{
+	const int SnapSize = pSnap->Size();
+	const int BaseSize = pBase->Size();
+	const int Size = SnapSize+BaseSize+DataSize;
+
+	lock_wait(m_Lock);
+	if(m_NumEntries < MAX_ENTRIES)
+	{
+		CEntry *pEntry = &m_aEntries[m_NumEntries];
+		if(pEntry->m_Capacity < Size)
+		{
+			mem_free(pEntry->m_pData);
+			pEntry->m_Capacity = max(Size, 8*1024);
+			pEntry->m_pData = (char *)mem_alloc(pEntry->m_Capacity, 1);
+		}
+		pEntry->m_Hash = Hash;
+		pEntry->m_BaseHash = BaseHash;
+		pEntry->m_SnapSize = SnapSize;
+		pEntry->m_BaseSize = BaseSize;
+		pEntry->m_DataSize = DataSize;
+		mem_copy(pEntry->m_pData, pSnap, SnapSize);
+		mem_copy(pEntry->m_pData+SnapSize, pBase, BaseSize);
+		mem_copy(pEntry->m_pData+SnapSize+BaseSize, pData, DataSize);
+		m_NumEntries++;
+	}
+	lock_unlock(m_Lock);
+}
+
+
+CTickProfiler::CTickProfiler()
+{
+	Reset();
+}
+
+void CTickProfiler::Reset()
+{
+	mem_zero(m_aCurrent, sizeof(m_aCurrent));
+	mem_zero(m_aCounterTotal, sizeof(m_aCounterTotal));
+	mem_zero(m_aCounterLastTotal, sizeof(m_aCounterLastTotal));
+	m_NumSamples = 0;
+	m_NextSample = 0;
+	m_Started = false;
+}
+
+void CTickProfiler::NextTick()
+{
+	// the first tick starts with the profiler, it has no times yet
+	if(m_Started)
+	{
+		m_aCurrent[PHASE_BUSY] = 0;
+		for(int i = 0; i < PHASE_BUSY; i++)
+		{
+			if(i != PHASE_WAIT)
+				m_aCurrent[PHASE_BUSY] += m_aCurrent[i];
+		}
+
+		for(int i = 0; i < NUM_PHASES; i++)
+			m_aaSamples[i][m_NextSample] = (int)(m_aCurrent[i]*1000000/time_freq());
+		for(int i = 0; i < NUM_COUNTERS; i++)
+			m_aaCounterSamples[i][m_NextSample] = (int)(m_aCounterTotal[i]-m_aCounterLastTotal[i]);
+		m_NextSample = (m_NextSample+1)%HISTORY_SIZE;
+		m_NumSamples = min(m_NumSamples+1, (int)HISTORY_SIZE);
+	}
+
+	m_Started = true;
+	mem_zero(m_aCurrent, sizeof(m_aCurrent));
+	mem_copy(m_aCounterLastTotal, m_aCounterTotal, sizeof(m_aCounterLastTotal));
+}
+
+static void CalcStats(const int *pSamples, int NumSamples, CTickProfiler::CStats *pStats)
+{
+	mem_zero(pStats, sizeof(*pStats));
+	if(!NumSamples)
+		return;
+
+	int aSorted[CTickProfiler::HISTORY_SIZE];
+	int64 Sum = 0;
+	for(int i = 0; i < NumSamples; i++)
+	{
+		aSorted[i] = pSamples[i];
+		Sum += aSorted[i];
+	}
+	sort(plain_range<int>(aSorted, aSorted+NumSamples));
+
+	pStats->m_Mean = (int)(Sum/NumSamples);
+	pStats->m_P50 = aSorted[(NumSamples-1)*50/100];
+	pStats->m_P99 = aSorted[(NumSamples-1)*99/100];
+	pStats->m_Max = aSorted[NumSamples-1];
+}
+
+void CTickProfiler::GetStats(int Phase, CStats *pStats) const
+{
+	CalcStats(m_aaSamples[Phase], m_NumSamples, pStats);
+}
+
+void CTickProfiler::GetCounterStats(int Counter, CStats *pStats) const
+{
+	CalcStats(m_aaCounterSamples[Counter], m_NumSamples, pStats);
+}
+
+bool CTickProfiler::WriteJson(IOHANDLE File) const
+{
+	if(!File)
+		return false;
+
+	CJsonWriter Writer(File);
+	Writer.BeginObject(); // root
+	Writer.WriteAttribute("time");
+	Writer.WriteIntValue((int)time_timestamp());
+	Writer.WriteAttribute("tick_budget_us");
+	Writer.WriteIntValue(1000000/SERVER_TICK_SPEED);
+	Writer.WriteAttribute("samples");
+	Writer.WriteIntValue(m_NumSamples);
+	Writer.WriteAttribute("phases");
+	Writer.BeginObject();
+	for(int i = 0; i < NUM_PHASES; i++)
+	{
+		CStats Stats;
+		GetStats(i, &Stats);
+		Writer.WriteAttribute(PhaseName(i));
+		Writer.BeginObject();
+		Writer.WriteAttribute("mean_us");
+		Writer.WriteIntValue(Stats.m_Mean);
+		Writer.WriteAttribute("p50_us");
+		Writer.WriteIntValue(Stats.m_P50);
+		Writer.WriteAttribute("p99_us");
+		Writer.WriteIntValue(Stats.m_P99);
+		Writer.WriteAttribute("max_us");
+		Writer.WriteIntValue(Stats.m_Max);
+		Writer.EndObject();
+	}
+	Writer.EndObject();
+	Writer.WriteAttribute("counters");
+	Writer.BeginObject();
+	for(int i = 0; i < NUM_COUNTERS; i++)
+	{
+		CStats Stats;
+		GetCounterStats(i, &Stats);
+		Writer.WriteAttribute(CounterName(i));
+		Writer.BeginObject();
+		Writer.WriteAttribute("mean");
+		Writer.WriteIntValue(Stats.m_Mean);
+		Writer.WriteAttribute("p50");
+		Writer.WriteIntValue(Stats.m_P50);
+		Writer.WriteAttribute("p99");
+		Writer.WriteIntValue(Stats.m_P99);
+		Writer.WriteAttribute("max");
+		Writer.WriteIntValue(Stats.m_Max);
+		Writer.EndObject();
+	}
+	Writer.EndObject();
+	Writer.EndObject();
+	return true;
+}
+
+const char *CTickProfiler::PhaseName(int Phase)
+{
+	static const char *s_apNames[NUM_PHASES] = {
+		"input", "tick", "snap_build", "snap_delta", "snap_compress", "snap_send", "network", "register", "wait", "busy", "start_delay"
+	};
+	return s_apNames[Phase];
+}
+
+const char *CTickProfiler::CounterName(int Counter)
+{
+	static const char *s_apNames[NUM_COUNTERS] = {
+		"sent_packets", "send_calls", "recv_packets", "recv_calls", "dropped_packets", "dropped_bytes", "info_cache_hits"
+	};
+	return s_apNames[Counter];
+}
+
+
 void CServerBan::InitServerBan(IConsole *pConsole, IStorage *pStorage, CServer* pServer)
 {
 	CNetBan::Init(pConsole, pStorage);
@@ -256,17 +618,24 @@ void CServerBan::ConBanExt(IConsole::IResult *pResult, void *pUser)
 void CServer::CClient::Reset()
 {
 	// reset input
-	for(int i = 0; i < 200; i++)
+	for(int i = 0; i < INPUT_HISTORY; i++)
 		m_aInputs[i].m_GameTick = -1;
-	m_CurrentInput = 0;
 	mem_zero(&m_LatestInput, sizeof(m_LatestInput));
+	m_LateInputs = 0;
+	m_DuplicateInputs = 0;
+	m_MissedInputs = 0;
 
 	m_Snapshots.PurgeAll();
+	for(int i = 0; i < SNAP_HASH_HISTORY; i++)
+		m_aSnapHashes[i].m_Tick = -1;
 	m_LastAckedSnapshot = -1;
 	m_LastInputTick = -1;
 	m_SnapRate = CClient::SNAPRATE_INIT;
 	m_Score = 0;
 	m_MapChunk = 0;
+	m_MapChunksAcked = -1;
+	m_MapWindow = 0;
+	m_MapMinRtt = 0;
 }
 
 CServer::CServer() : m_DemoRecorder(&m_SnapshotDelta)
@@ -287,6 +656,21 @@ CServer::CServer() : m_DemoRecorder(&m_SnapshotDelta)
 	m_pMapListHeap = 0;
 
 	m_MapReload = false;
+	m_MapLoading = false;
+	m_MapLoad.m_pData = 0;
+	m_MapDownloadStart = 0;
+	m_LastPerfDump = 0;
+	m_NetWait = 0;
+	m_NetWaitEcon = false;
+	m_NetWaitFailed = false;
+	m_InfoCacheLock = lock_create();
+	m_InfoCacheSize = 0;
+	m_InfoCacheValid = false;
+	m_InfoCacheHits = 0;
+
+	m_HuffmanCountedBytes = 0;
+	m_HuffmanTraining = false;
+	m_HuffmanGeneration = 0;
 
 	m_RconClientID = IServer::RCON_CID_SERV;
 	m_RconAuthLevel = AUTHED_ADMIN;
@@ -294,9 +678,18 @@ CServer::CServer() : m_DemoRecorder(&m_SnapshotDelta)
 	m_RconPasswordSet = 0;
 	m_GeneratedRconPassword = 0;
 
+	for(int i = 0; i < MAX_CLIENTS; i++)
+		m_apSnapContexts[i] = 0;
+	m_NumSnapJobs = 0;
+
 	Init();
 }
 
+CServer::~CServer()
+{
+	lock_destroy(m_InfoCacheLock);
+}
+
 
 void CServer::SetClientName(int ClientID, const char *pName)
 {
@@ -306,6 +699,7 @@ void CServer::SetClientName(int ClientID, const char *pName)
 	const char *pDefaultName = "(1)";
 	pName = str_utf8_skip_whitespaces(pName);
 	str_utf8_copy_num(m_aClients[ClientID].m_aName, *pName ? pName : pDefaultName, sizeof(m_aClients[ClientID].m_aName), MAX_NAME_LENGTH);
+	ExpireServerInfo();
 }
 
 void CServer::SetClientClan(int ClientID, const char *pClan)
@@ -314,6 +708,7 @@ void CServer::SetClientClan(int ClientID, const char *pClan)
 		return;
 
 	str_utf8_copy_num(m_aClients[ClientID].m_aClan, pClan, sizeof(m_aClients[ClientID].m_aClan), MAX_CLAN_LENGTH);
+	ExpireServerInfo();
 }
 
 void CServer::SetClientCountry(int ClientID, int Country)
@@ -322,13 +717,25 @@ void CServer::SetClientCountry(int ClientID, int Country)
 		return;
 
 	m_aClients[ClientID].m_Country = Country;
+	ExpireServerInfo();
 }
 
 void CServer::SetClientScore(int ClientID, int Score)
 {
 	if(ClientID < 0 || ClientID >= MAX_CLIENTS || m_aClients[ClientID].m_State < CClient::STATE_READY)
 		return;
-	m_aClients[ClientID].m_Score = Score;
+
+	// set by the players every tick
+	if(m_aClients[ClientID].m_Score != Score)
+	{
+		m_aClients[ClientID].m_Score = Score;
+		ExpireServerInfo();
+	}
+}
+
+void CServer::ExpireServerInfo()
+{
+	m_InfoCacheValid = false;
 }
 
 void CServer::Kick(int ClientID, const char *pReason)
@@ -534,26 +941,194 @@ int CServer::SendMsg(CMsgPacker *pMsg, int Flags, int ClientID)
 	return 0;
 }
 
+// builder used by SnapNewItem, each snapshot worker thread uses its own
+static thread_local CSnapshotBuilder *gs_pSnapBuilder = 0;
+
+CServer::CSnapContext *CServer::SnapContext(int Index)
+{
+	if(!m_apSnapContexts[Index])
+		m_apSnapContexts[Index] = new CSnapContext();
+	return m_apSnapContexts[Index];
+}
+
+void CServer::CreateSnapshot(int ClientID, CSnapContext *pContext)
+{
+	CSnapshot *pData = (CSnapshot*)pContext->m_aData;	// Fix compiler warning for strict-aliasing
+	static const CSnapshot s_EmptySnap = CSnapshot();
+	const CSnapshot *pDeltashot = &s_EmptySnap;
+	CSnapshot *pAckedSnap;
+	int SnapshotSize;
+	int64 Start = time_get();
+
+	pContext->m_DeltaTime = 0;
+	pContext->m_CompressTime = 0;
+	pContext->m_Builder.Init(&m_SnapshotBuilder);
+
+	gs_pSnapBuilder = &pContext->m_Builder;
+	GameServer()->OnSnap(ClientID);
+	gs_pSnapBuilder = 0;
+
+	// finish snapshot
+	SnapshotSize = pContext->m_Builder.Finish(pData);
+	pContext->m_Crc = pData->Crc();
+
+	// remove old snapshos
+	// keep 3 seconds worth of snapshots
+	m_aClients[ClientID].m_Snapshots.PurgeUntil(m_CurrentGameTick-SERVER_TICK_SPEED*3);
+
+	// save it the snapshot
+	int64 Now = time_get();
+	m_aClients[ClientID].m_Snapshots.Add(m_CurrentGameTick, Now, SnapshotSize, pData, 0);
+	pContext->m_BuildTime = Now-Start;
+	Start = Now;
+
+	const bool UseCache = Config()->m_SvSnapCache;
+	int64 Hash = 0;
+	if(UseCache)
+	{
+		CClient::CSnapHash *pHash = &m_aClients[ClientID].m_aSnapHashes[m_CurrentGameTick%CClient::SNAP_HASH_HISTORY];
+		Hash = pData->Hash();
+		pHash->m_Tick = m_CurrentGameTick;
+		pHash->m_Hash = Hash;
+	}
+
+	// find snapshot that we can perform delta against
+	pContext->m_DeltaTick = -1;
+	if(m_aClients[ClientID].m_Snapshots.Get(m_aClients[ClientID].m_LastAckedSnapshot, 0, &pAckedSnap, 0) >= 0)
+	{
+		pDeltashot = pAckedSnap;
+		pContext->m_DeltaTick = m_aClients[ClientID].m_LastAckedSnapshot;
+	}
+	else
+	{
+		// no acked package found, force client to recover rate
+		if(m_aClients[ClientID].m_SnapRate == CClient::SNAPRATE_FULL)
+			m_aClients[ClientID].m_SnapRate = CClient::SNAPRATE_RECOVER;
+	}
+
+	// reuse the delta of another client with the same snapshot and base
+	int64 BaseHash = 0;
+	if(UseCache)
+	{
+		const CClient::CSnapHash *pBaseHash = 0;
+		if(pContext->m_DeltaTick >= 0)
+			pBaseHash = &m_aClients[ClientID].m_aSnapHashes[pContext->m_DeltaTick%CClient::SNAP_HASH_HISTORY];
+		if(pBaseHash && pBaseHash->m_Tick == pContext->m_DeltaTick)
+			BaseHash = pBaseHash->m_Hash;
+		else
+			BaseHash = pDeltashot->Hash();
+
+		if(m_SnapDeltaCache.Get(pData, Hash, pDeltashot, BaseHash, pContext->m_aCompData, &pContext->m_CompSize))
+		{
+			pContext->m_DeltaTime = time_get()-Start;
+			return;
+		}
+	}
+
+	// create delta
+	int DeltaSize = m_SnapshotDelta.CreateDelta(pDeltashot, pData, pContext->m_aDeltaData);
+	Now = time_get();
+	pContext->m_DeltaTime = Now-Start;
+	Start = Now;
+
+	// compress it
+	pContext->m_CompSize = 0;
+	if(DeltaSize)
+		pContext->m_CompSize = CVariableInt::Compress(pContext->m_aDeltaData, DeltaSize, pContext->m_aCompData, sizeof(pContext->m_aCompData));
+
+	if(UseCache)
+		m_SnapDeltaCache.Add(pData, Hash, pDeltashot, BaseHash, pContext->m_aCompData, pContext->m_CompSize);
+	pContext->m_CompressTime = time_get()-Start;
+}
+
+void CServer::SendSnapshot(int ClientID, const CSnapContext *pContext)
+{
+	if(m_HuffmanTraining)
+	{
+		for(int i = 0; i < pContext->m_CompSize; i++)
+			m_aHuffmanCounts[(unsigned char)pContext->m_aCompData[i]]++;
+		m_HuffmanCountedBytes += pContext->m_CompSize;
+	}
+
+	if(pContext->m_CompSize)
+	{
+		const int MaxSize = MAX_SNAPSHOT_PACKSIZE;
+		int NumPackets = (pContext->m_CompSize+MaxSize-1)/MaxSize;
+
+		for(int n = 0, Left = pContext->m_CompSize; Left > 0; n++)
+		{
+			int Chunk = Left < MaxSize ? Left : MaxSize;
+			Left -= Chunk;
+
+			if(NumPackets == 1)
+			{
+				CMsgPacker Msg(NETMSG_SNAPSINGLE, true);
+				Msg.AddInt(m_CurrentGameTick);
+				Msg.AddInt(m_CurrentGameTick-pContext->m_DeltaTick);
+				Msg.AddInt(pContext->m_Crc);
+				Msg.AddInt(Chunk);
+				Msg.AddRaw(&pContext->m_aCompData[n*MaxSize], Chunk);
+				SendMsg(&Msg, MSGFLAG_FLUSH, ClientID);
+			}
+			else
+			{
+				CMsgPacker Msg(NETMSG_SNAP, true);
+				Msg.AddInt(m_CurrentGameTick);
+				Msg.AddInt(m_CurrentGameTick-pContext->m_DeltaTick);
+				Msg.AddInt(NumPackets);
+				Msg.AddInt(n);
+				Msg.AddInt(pContext->m_Crc);
+				Msg.AddInt(Chunk);
+				Msg.AddRaw(&pContext->m_aCompData[n*MaxSize], Chunk);
+				SendMsg(&Msg, MSGFLAG_FLUSH, ClientID);
+			}
+		}
+	}
+	else
+	{
+		CMsgPacker Msg(NETMSG_SNAPEMPTY, true);
+		Msg.AddInt(m_CurrentGameTick);
+		Msg.AddInt(m_CurrentGameTick-pContext->m_DeltaTick);
+		SendMsg(&Msg, MSGFLAG_FLUSH, ClientID);
+	}
+}
+
+void CServer::SnapshotJob(int Index, void *pUser)
+{
+	CServer *pThis = (CServer *)pUser;
+	int ClientID = pThis->m_aSnapJobs[Index];
+	pThis->CreateSnapshot(ClientID, pThis->m_apSnapContexts[ClientID]);
+}
+
 void CServer::DoSnapshot()
 {
+	int64 Start = time_get();
 	GameServer()->OnPreSnap();
 
+	// build the items that are the same for every client once,
+	// the client snapshots only add their own items on top of it
+	m_SnapshotBuilder.Init();
+	GameServer()->OnSnapShared();
+
 	// create snapshot for demo recording
 	if(m_DemoRecorder.IsRecording())
 	{
-		char aData[CSnapshot::MAX_SIZE];
+		CSnapContext *pContext = SnapContext(0);
 		int SnapshotSize;
 
 		// build snap and possibly add some messages
-		m_SnapshotBuilder.Init();
+		pContext->m_Builder.Init(&m_SnapshotBuilder);
+		gs_pSnapBuilder = &pContext->m_Builder;
 		GameServer()->OnSnap(-1);
-		SnapshotSize = m_SnapshotBuilder.Finish(aData);
+		gs_pSnapBuilder = 0;
+		SnapshotSize = pContext->m_Builder.Finish(pContext->m_aData);
 
 		// write snapshot
-		m_DemoRecorder.RecordSnapshot(Tick(), aData, SnapshotSize);
+		m_DemoRecorder.RecordSnapshot(Tick(), pContext->m_aData, SnapshotSize);
 	}
 
-	// create snapshots for all clients
+	// collect all clients that get a snapshot this tick
+	m_NumSnapJobs = 0;
 	for(int i = 0; i < MAX_CLIENTS; i++)
 	{
 		// client must be ingame to receive snapshots
@@ -568,102 +1143,56 @@ void CServer::DoSnapshot()
 		if(m_aClients[i].m_SnapRate == CClient::SNAPRATE_INIT && (Tick()%10) != 0)
 			continue;
 
-		{
-			char aData[CSnapshot::MAX_SIZE];
-			CSnapshot *pData = (CSnapshot*)aData;	// Fix compiler warning for strict-aliasing
-			char aDeltaData[CSnapshot::MAX_SIZE];
-			char aCompData[CSnapshot::MAX_SIZE];
-			int SnapshotSize;
-			int Crc;
-			static CSnapshot EmptySnap;
-			CSnapshot *pDeltashot = &EmptySnap;
-			int DeltashotSize;
-			int DeltaTick = -1;
-			int DeltaSize;
-
-			m_SnapshotBuilder.Init();
-
-			GameServer()->OnSnap(i);
-
-			// finish snapshot
-			SnapshotSize = m_SnapshotBuilder.Finish(pData);
-			Crc = pData->Crc();
-
-			// remove old snapshos
-			// keep 3 seconds worth of snapshots
-			m_aClients[i].m_Snapshots.PurgeUntil(m_CurrentGameTick-SERVER_TICK_SPEED*3);
-
-			// save it the snapshot
-			m_aClients[i].m_Snapshots.Add(m_CurrentGameTick, time_get(), SnapshotSize, pData, 0);
-
-			// find snapshot that we can perform delta against
-			EmptySnap.Clear();
-
-			{
-				DeltashotSize = m_aClients[i].m_Snapshots.Get(m_aClients[i].m_LastAckedSnapshot, 0, &pDeltashot, 0);
-				if(DeltashotSize >= 0)
-					DeltaTick = m_aClients[i].m_LastAckedSnapshot;
-				else
-				{
-					// no acked package found, force client to recover rate
-					if(m_aClients[i].m_SnapRate == CClient::SNAPRATE_FULL)
-						m_aClients[i].m_SnapRate = CClient::SNAPRATE_RECOVER;
-				}
-			}
-
-			// create delta
-			DeltaSize = m_SnapshotDelta.CreateDelta(pDeltashot, pData, aDeltaData);
+		m_aSnapJobs[m_NumSnapJobs++] = i;
+	}
 
-			if(DeltaSize)
-			{
-				// compress it
-				int SnapshotSize;
-				const int MaxSize = MAX_SNAPSHOT_PACKSIZE;
-				int NumPackets;
+	// deltas can only be shared within one tick
+	m_SnapDeltaCache.Reset();
+	m_TickProfiler.Add(CTickProfiler::PHASE_SNAP_BUILD, time_get()-Start);
 
-				SnapshotSize = CVariableInt::Compress(aDeltaData, DeltaSize, aCompData, sizeof(aCompData));
-				NumPackets = (SnapshotSize+MaxSize-1)/MaxSize;
+	// create snapshots for all clients. the phase times are the sum over all clients,
+	// with workers they can exceed the wall clock time
+	int64 SendTime = 0;
+	if(m_SnapWorkers.Init(Config()->m_SvSnapThreads) > 0 && m_NumSnapJobs > 1)
+	{
+		// every client needs its own buffers while the workers are running
+		for(int i = 0; i < m_NumSnapJobs; i++)
+			SnapContext(m_aSnapJobs[i]);
 
-				for(int n = 0, Left = SnapshotSize; Left > 0; n++)
-				{
-					int Chunk = Left < MaxSize ? Left : MaxSize;
-					Left -= Chunk;
+		m_SnapWorkers.Run(SnapshotJob, this, m_NumSnapJobs);
 
-					if(NumPackets == 1)
-					{
-						CMsgPacker Msg(NETMSG_SNAPSINGLE, true);
-						Msg.AddInt(m_CurrentGameTick);
-						Msg.AddInt(m_CurrentGameTick-DeltaTick);
-						Msg.AddInt(Crc);
-						Msg.AddInt(Chunk);
-						Msg.AddRaw(&aCompData[n*MaxSize], Chunk);
-						SendMsg(&Msg, MSGFLAG_FLUSH, i);
-					}
-					else
-					{
-						CMsgPacker Msg(NETMSG_SNAP, true);
-						Msg.AddInt(m_CurrentGameTick);
-						Msg.AddInt(m_CurrentGameTick-DeltaTick);
-						Msg.AddInt(NumPackets);
-						Msg.AddInt(n);
-						Msg.AddInt(Crc);
-						Msg.AddInt(Chunk);
-						Msg.AddRaw(&aCompData[n*MaxSize], Chunk);
-						SendMsg(&Msg, MSGFLAG_FLUSH, i);
-					}
-				}
-			}
-			else
-			{
-				CMsgPacker Msg(NETMSG_SNAPEMPTY, true);
-				Msg.AddInt(m_CurrentGameTick);
-				Msg.AddInt(m_CurrentGameTick-DeltaTick);
-				SendMsg(&Msg, MSGFLAG_FLUSH, i);
-			}
+		// send them in a fixed order
+		Start = time_get();
+		for(int i = 0; i < m_NumSnapJobs; i++)
+		{
+			const CSnapContext *pContext = m_apSnapContexts[m_aSnapJobs[i]];
+			m_TickProfiler.Add(CTickProfiler::PHASE_SNAP_BUILD, pContext->m_BuildTime);
+			m_TickProfiler.Add(CTickProfiler::PHASE_SNAP_DELTA, pContext->m_DeltaTime);
+			m_TickProfiler.Add(CTickProfiler::PHASE_SNAP_COMPRESS, pContext->m_CompressTime);
+			SendSnapshot(m_aSnapJobs[i], pContext);
 		}
+		SendTime = time_get()-Start;
 	}
+	else
+	{
+		CSnapContext *pContext = SnapContext(0);
+		for(int i = 0; i < m_NumSnapJobs; i++)
+		{
+			CreateSnapshot(m_aSnapJobs[i], pContext);
+			m_TickProfiler.Add(CTickProfiler::PHASE_SNAP_BUILD, pContext->m_BuildTime);
+			m_TickProfiler.Add(CTickProfiler::PHASE_SNAP_DELTA, pContext->m_DeltaTime);
+			m_TickProfiler.Add(CTickProfiler::PHASE_SNAP_COMPRESS, pContext->m_CompressTime);
+
+			Start = time_get();
+			SendSnapshot(m_aSnapJobs[i], pContext);
+			SendTime += time_get()-Start;
+		}
+	}
+	m_TickProfiler.Add(CTickProfiler::PHASE_SNAP_SEND, SendTime);
 
+	Start = time_get();
 	GameServer()->OnPostSnap();
+	m_TickProfiler.Add(CTickProfiler::PHASE_SNAP_BUILD, time_get()-Start);
 }
 
 
@@ -678,6 +1207,7 @@ int CServer::NewClientCallback(int ClientID, void *pUser)
 	}
 
 	pThis->m_aClients[ClientID].m_State = CClient::STATE_AUTH;
+	pThis->ExpireServerInfo();
 	pThis->m_aClients[ClientID].m_aName[0] = 0;
 	pThis->m_aClients[ClientID].m_aClan[0] = 0;
 	pThis->m_aClients[ClientID].m_Country = -1;
@@ -710,6 +1240,7 @@ int CServer::DelClientCallback(int ClientID, const char *pReason, void *pUser)
 	}
 
 	pThis->m_aClients[ClientID].m_State = CClient::STATE_EMPTY;
+	pThis->ExpireServerInfo();
 	pThis->m_aClients[ClientID].m_aName[0] = 0;
 	pThis->m_aClients[ClientID].m_aClan[0] = 0;
 	pThis->m_aClients[ClientID].m_Country = -1;
@@ -735,6 +1266,104 @@ void CServer::SendMap(int ClientID)
 	SendMsg(&Msg, MSGFLAG_VITAL|MSGFLAG_FLUSH, ClientID);
 }
 
+void CServer::SendHuffmanTable(int ClientID)
+{
+	CMsgPacker Msg(NETMSG_HUFFMAN_TABLE, true);
+	Msg.AddInt(m_HuffmanGeneration);
+	for(int i = 0; i < 256; i++)
+		Msg.AddInt(m_aHuffmanTable[i]);
+	SendMsg(&Msg, MSGFLAG_VITAL|MSGFLAG_NORECORD, ClientID);
+}
+
+void CServer::StartHuffmanTraining()
+{
+	mem_zero(m_aHuffmanCounts, sizeof(m_aHuffmanCounts));
+	m_HuffmanCountedBytes = 0;
+	m_HuffmanTraining = Config()->m_SvHuffmanTrain != 0;
+}
+
+void CServer::UpdateHuffmanTable()
+{
+	if(!m_HuffmanTraining || m_HuffmanCountedBytes < HUFFMAN_TRAIN_BYTES)
+		return;
+	m_HuffmanTraining = false;
+
+	unsigned aTable[256];
+	CHuffman::NormalizeFrequencies(m_aHuffmanCounts, aTable);
+
+	// compare the sizes the snapshots would have had with each table
+	CHuffman *pHuffman = new CHuffman();
+	pHuffman->Init();
+	unsigned long long DefaultSize = pHuffman->EstimateSize(m_aHuffmanCounts);
+	unsigned long long CurrentSize = DefaultSize;
+	if(m_HuffmanGeneration)
+	{
+		pHuffman->Init(m_aHuffmanTable);
+		CurrentSize = pHuffman->EstimateSize(m_aHuffmanCounts);
+	}
+	pHuffman->Init(aTable);
+	unsigned long long TrainedSize = pHuffman->EstimateSize(m_aHuffmanCounts);
+	delete pHuffman;
+
+	char aBuf[256];
+	str_format(aBuf, sizeof(aBuf), "trained huffman table on %d snapshot bytes, size default=%d%% current=%d%% trained=%d%%", m_HuffmanCountedBytes,
+		(int)(DefaultSize*100/m_HuffmanCountedBytes), (int)(CurrentSize*100/m_HuffmanCountedBytes), (int)(TrainedSize*100/m_HuffmanCountedBytes));
+	Console()->Print(IConsole::OUTPUT_LEVEL_ADDINFO, "server", aBuf);
+	if(TrainedSize >= CurrentSize)
+		return;
+
+	// offer the table, clients switch to it once they acknowledged it
+	mem_copy(m_aHuffmanTable, aTable, sizeof(m_aHuffmanTable));
+	m_HuffmanGeneration++;
+	m_NetServer.SetHuffmanTable(m_HuffmanGeneration, m_aHuffmanTable);
+	for(int i = 0; i < MAX_CLIENTS; i++)
+	{
+		if(m_aClients[i].m_State > CClient::STATE_AUTH)
+			SendHuffmanTable(i);
+	}
+}
+
+int CServer::SendMapData(int ClientID, int MaxChunks)
+{
+	CClient *pClient = &m_aClients[ClientID];
+	int NumChunks = (m_CurrentMapSize+MAP_CHUNK_SIZE-1)/MAP_CHUNK_SIZE;
+	int Sent = 0;
+	while(Sent < MaxChunks && pClient->m_MapChunk < NumChunks && pClient->m_MapChunk-pClient->m_MapChunksAcked < pClient->m_MapWindow)
+	{
+		int Chunk = pClient->m_MapChunk++;
+		int Offset = Chunk*MAP_CHUNK_SIZE;
+		int ChunkSize = min((int)MAP_CHUNK_SIZE, m_CurrentMapSize-Offset);
+		pClient->m_aMapChunkSendTimes[Chunk%CClient::MAP_WINDOW_MAX] = time_get();
+
+		CMsgPacker Msg(NETMSG_MAP_DATA, true);
+		Msg.AddRaw(&m_pCurrentMapData[Offset], ChunkSize);
+		SendMsg(&Msg, MSGFLAG_VITAL|MSGFLAG_FLUSH, ClientID);
+		Sent++;
+
+		if(Config()->m_Debug)
+		{
+			char aBuf[64];
+			str_format(aBuf, sizeof(aBuf), "sending chunk %d with size %d", Chunk, ChunkSize);
+			Console()->Print(IConsole::OUTPUT_LEVEL_DEBUG, "server", aBuf);
+		}
+	}
+	return Sent;
+}
+
+void CServer::UpdateMapDownloads()
+{
+	// the chunks of a loop are limited, so many joining clients can't stall the ticks
+	int Budget = MAP_CHUNKS_PER_UPDATE;
+	for(int i = 0; i < MAX_CLIENTS && Budget > 0; i++)
+	{
+		int ClientID = (m_MapDownloadStart+i)%MAX_CLIENTS;
+		if((m_aClients[ClientID].m_State == CClient::STATE_CONNECTING || m_aClients[ClientID].m_State == CClient::STATE_CONNECTING_AS_SPEC) &&
+			m_aClients[ClientID].m_MapChunksAcked >= 0)
+			Budget -= SendMapData(ClientID, Budget);
+	}
+	m_MapDownloadStart = (m_MapDownloadStart+1)%MAX_CLIENTS;
+}
+
 void CServer::SendConnectionReady(int ClientID)
 {
 	CMsgPacker Msg(NETMSG_CON_READY, true);
@@ -879,38 +1508,36 @@ void CServer::ProcessClientPacket(CNetChunk *pPacket)
 
 				m_aClients[ClientID].m_State = CClient::STATE_CONNECTING;
 				SendMap(ClientID);
+				if(m_HuffmanGeneration)
+					SendHuffmanTable(ClientID);
 			}
 		}
 		else if(Msg == NETMSG_REQUEST_MAP_DATA)
 		{
 			if((pPacket->m_Flags&NET_CHUNKFLAG_VITAL) != 0 && (m_aClients[ClientID].m_State == CClient::STATE_CONNECTING || m_aClients[ClientID].m_State == CClient::STATE_CONNECTING_AS_SPEC))
 			{
-				int ChunkSize = MAP_CHUNK_SIZE;
-
-				// send map chunks
-				for(int i = 0; i < m_MapChunksPerRequest && m_aClients[ClientID].m_MapChunk >= 0; ++i)
+				// the chunks are sent by UpdateMapDownloads, the client requests the
+				// next package after every m_MapChunksPerRequest chunks it received
+				CClient *pClient = &m_aClients[ClientID];
+				if(pClient->m_MapChunksAcked < 0)
 				{
-					int Chunk = m_aClients[ClientID].m_MapChunk;
-					int Offset = Chunk * ChunkSize;
-
-					// check for last part
-					if(Offset+ChunkSize >= m_CurrentMapSize)
+					pClient->m_MapChunksAcked = 0;
+					pClient->m_MapWindow = m_MapChunksPerRequest;
+				}
+				else
+				{
+					pClient->m_MapChunksAcked = min(pClient->m_MapChunksAcked+m_MapChunksPerRequest, pClient->m_MapChunk);
+					if(pClient->m_MapChunksAcked > 0)
 					{
-						ChunkSize = m_CurrentMapSize-Offset;
-						m_aClients[ClientID].m_MapChunk = -1;
-					}
-					else
-						m_aClients[ClientID].m_MapChunk++;
+						int64 Rtt = time_get()-pClient->m_aMapChunkSendTimes[(pClient->m_MapChunksAcked-1)%CClient::MAP_WINDOW_MAX];
+						if(!pClient->m_MapMinRtt || Rtt < pClient->m_MapMinRtt)
+							pClient->m_MapMinRtt = Rtt;
 
-					CMsgPacker Msg(NETMSG_MAP_DATA, true);
-					Msg.AddRaw(&m_pCurrentMapData[Offset], ChunkSize);
-					SendMsg(&Msg, MSGFLAG_VITAL|MSGFLAG_FLUSH, ClientID);
-
-					if(Config()->m_Debug)
-					{
-						char aBuf[64];
-						str_format(aBuf, sizeof(aBuf), "sending chunk %d with size %d", Chunk, ChunkSize);
-						Console()->Print(IConsole::OUTPUT_LEVEL_DEBUG, "server", aBuf);
+						// a late request means queued or resent chunks, back off
+						if(Rtt > pClient->m_MapMinRtt*2+time_freq()/50)
+							pClient->m_MapWindow = max(pClient->m_MapWindow/2, m_MapChunksPerRequest);
+						else
+							pClient->m_MapWindow = min(pClient->m_MapWindow+m_MapChunksPerRequest, (int)CClient::MAP_WINDOW_MAX);
 					}
 				}
 			}
@@ -929,6 +1556,7 @@ void CServer::ProcessClientPacket(CNetChunk *pPacket)
 				bool ConnectAsSpec = m_aClients[ClientID].m_State == CClient::STATE_CONNECTING_AS_SPEC;
 				m_aClients[ClientID].m_State = CClient::STATE_READY;
 				GameServer()->OnClientConnected(ClientID, ConnectAsSpec);
+				ExpireServerInfo();
 				SendConnectionReady(ClientID);
 			}
 		}
@@ -943,13 +1571,13 @@ void CServer::ProcessClientPacket(CNetChunk *pPacket)
 				str_format(aBuf, sizeof(aBuf), "player has entered the game. ClientID=%d addr=%s", ClientID, aAddrStr);
 				Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "server", aBuf);
 				m_aClients[ClientID].m_State = CClient::STATE_INGAME;
+				ExpireServerInfo();
 				SendServerInfo(ClientID);
 				GameServer()->OnClientEnter(ClientID);
 			}
 		}
 		else if(Msg == NETMSG_INPUT)
 		{
-			CClient::CInput *pInput;
 			int64 TagTime;
 			int64 Now = time_get();
 
@@ -978,15 +1606,26 @@ void CServer::ProcessClientPacket(CNetChunk *pPacket)
 
 			m_aClients[ClientID].m_LastInputTick = IntendedTick;
 
-			pInput = &m_aClients[ClientID].m_aInputs[m_aClients[ClientID].m_CurrentInput];
-
+			// late input is used for the next tick
 			if(IntendedTick <= Tick())
+			{
 				IntendedTick = Tick()+1;
+				m_aClients[ClientID].m_LateInputs++;
+			}
 
-			pInput->m_GameTick = IntendedTick;
-
+			CClient::CInput *pLatestInput = &m_aClients[ClientID].m_LatestInput;
 			for(int i = 0; i < Size/4; i++)
-				pInput->m_aData[i] = Unpacker.GetInt();
+				pLatestInput->m_aData[i] = Unpacker.GetInt();
+
+			// keep it for its tick, unless it is too far ahead to fit into the history
+			if(IntendedTick < Tick()+CClient::INPUT_HISTORY)
+			{
+				CClient::CInput *pInput = &m_aClients[ClientID].m_aInputs[IntendedTick%CClient::INPUT_HISTORY];
+				if(pInput->m_GameTick == IntendedTick)
+					m_aClients[ClientID].m_DuplicateInputs++;
+				pInput->m_GameTick = IntendedTick;
+				mem_copy(pInput->m_aData, pLatestInput->m_aData, MAX_INPUT_SIZE*sizeof(int));
+			}
 
 			int PingCorrection = clamp(Unpacker.GetInt(), 0, 50);
 			if(m_aClients[ClientID].m_Snapshots.Get(m_aClients[ClientID].m_LastAckedSnapshot, &TagTime, 0, 0) >= 0)
@@ -995,11 +1634,6 @@ void CServer::ProcessClientPacket(CNetChunk *pPacket)
 				m_aClients[ClientID].m_Latency = max(0, m_aClients[ClientID].m_Latency - PingCorrection);
 			}
 
-			mem_copy(m_aClients[ClientID].m_LatestInput.m_aData, pInput->m_aData, MAX_INPUT_SIZE*sizeof(int));
-
-			m_aClients[ClientID].m_CurrentInput++;
-			m_aClients[ClientID].m_CurrentInput %= 200;
-
 			// call the mod with the fresh input data
 			if(m_aClients[ClientID].m_State == CClient::STATE_INGAME)
 				GameServer()->OnClientDirectInput(ClientID, m_aClients[ClientID].m_LatestInput.m_aData);
@@ -1094,6 +1728,13 @@ void CServer::ProcessClientPacket(CNetChunk *pPacket)
 			CMsgPacker Msg(NETMSG_PING_REPLY, true);
 			SendMsg(&Msg, 0, ClientID);
 		}
+		else if(Msg == NETMSG_HUFFMAN_TABLE_ACK)
+		{
+			// the client installed the table, compress its packets with it from now on
+			int Generation = Unpacker.GetInt();
+			if(!Unpacker.Error() && m_HuffmanGeneration && Generation == m_HuffmanGeneration)
+				m_NetServer.SetClientHuffmanTable(ClientID, Generation);
+		}
 		else
 		{
 			if(Config()->m_Debug)
@@ -1125,6 +1766,29 @@ void CServer::ProcessClientPacket(CNetChunk *pPacket)
 }
 
 void CServer::GenerateServerInfo(CPacker *pPacker, int Token)
+{
+	if(Token == -1)
+	{
+		GenerateServerInfoBody(pPacker, false);
+		return;
+	}
+
+	// only the token differs between the requests
+	pPacker->Reset();
+	pPacker->AddRaw(SERVERBROWSE_INFO, sizeof(SERVERBROWSE_INFO));
+	pPacker->AddInt(Token);
+	if(m_InfoCacheValid)
+		m_InfoCacheHits++;
+	else
+		UpdateServerInfoCache();
+
+	if(m_InfoCacheValid)
+		pPacker->AddRaw(m_aInfoCache, m_InfoCacheSize);
+	else
+		GenerateServerInfoBody(pPacker, true);
+}
+
+void CServer::GenerateServerInfoBody(CPacker *pPacker, bool ClientList)
 {
 	// count the players
 	int PlayerCount = 0, ClientCount = 0;
@@ -1139,13 +1803,6 @@ void CServer::GenerateServerInfo(CPacker *pPacker, int Token)
 		}
 	}
 
-	if(Token != -1)
-	{
-		pPacker->Reset();
-		pPacker->AddRaw(SERVERBROWSE_INFO, sizeof(SERVERBROWSE_INFO));
-		pPacker->AddInt(Token);
-	}
-
 	pPacker->AddString(GameServer()->Version(), 32);
 	pPacker->AddString(Config()->m_SvName, 64);
 	pPacker->AddString(Config()->m_SvHostname, 128);
@@ -1168,7 +1825,7 @@ void CServer::GenerateServerInfo(CPacker *pPacker, int Token)
 	pPacker->AddInt(ClientCount); // num clients
 	pPacker->AddInt(max(ClientCount, Config()->m_SvMaxClients)); // max clients
 
-	if(Token != -1)
+	if(ClientList)
 	{
 		for(int i = 0; i < MAX_CLIENTS; i++)
 		{
@@ -1184,6 +1841,53 @@ void CServer::GenerateServerInfo(CPacker *pPacker, int Token)
 	}
 }
 
+void CServer::UpdateServerInfoCache()
+{
+	if(m_InfoCacheValid)
+		return;
+
+	CPacker Packer;
+	Packer.Reset();
+	GenerateServerInfoBody(&Packer, true);
+	if(Packer.Error())
+		return;
+
+	lock_wait(m_InfoCacheLock);
+	mem_copy(m_aInfoCache, Packer.Data(), Packer.Size());
+	m_InfoCacheSize = Packer.Size();
+	lock_unlock(m_InfoCacheLock);
+	m_InfoCacheValid = true;
+}
+
+int CServer::ConnlessCallback(const CNetChunk *pPacket, unsigned char *pReply, int MaxReplySize, void *pUser)
+{
+	// runs on the network thread, only answers info requests from the cache
+	CServer *pThis = (CServer *)pUser;
+	if(pPacket->m_DataSize < int(sizeof(SERVERBROWSE_GETINFO)) ||
+		mem_comp(pPacket->m_pData, SERVERBROWSE_GETINFO, sizeof(SERVERBROWSE_GETINFO)) != 0)
+		return 0;
+
+	CUnpacker Unpacker;
+	Unpacker.Reset((unsigned char*)pPacket->m_pData+sizeof(SERVERBROWSE_GETINFO), pPacket->m_DataSize-sizeof(SERVERBROWSE_GETINFO));
+	int SrvBrwsToken = Unpacker.GetInt();
+	if(Unpacker.Error())
+		return 0;
+
+	CPacker Packer;
+	Packer.Reset();
+	Packer.AddRaw(SERVERBROWSE_INFO, sizeof(SERVERBROWSE_INFO));
+	Packer.AddInt(SrvBrwsToken);
+	lock_wait(pThis->m_InfoCacheLock);
+	Packer.AddRaw(pThis->m_aInfoCache, pThis->m_InfoCacheSize);
+	pThis->m_InfoCacheHits++;
+	lock_unlock(pThis->m_InfoCacheLock);
+	if(Packer.Error() || Packer.Size() > MaxReplySize)
+		return 0;
+
+	mem_copy(pReply, Packer.Data(), Packer.Size());
+	return Packer.Size();
+}
+
 void CServer::SendServerInfo(int ClientID)
 {
 	CMsgPacker Msg(NETMSG_SERVERINFO, true);
@@ -1263,50 +1967,96 @@ void CServer::ChangeMap(const char *pMap)
 	m_MapReload = str_comp(Config()->m_SvMap, m_aCurrentMap) != 0;
 }
 
-int CServer::LoadMap(const char *pMapName)
+void CServer::PrepareMapLoad(const char *pMapName)
+{
+	str_copy(m_MapLoad.m_aName, pMapName, sizeof(m_MapLoad.m_aName));
+	m_MapLoad.m_aError[0] = 0;
+	m_MapLoad.m_pData = 0;
+	m_MapLoad.m_DataSize = 0;
+	m_MapLoad.m_StartTime = time_get();
+}
+
+int CServer::LoadMapJob(void *pUser)
 {
+	CServer *pThis = (CServer *)pUser;
+	CMapLoad *pLoad = &pThis->m_MapLoad;
 	char aBuf[IO_MAX_PATH_LENGTH];
-	str_format(aBuf, sizeof(aBuf), "maps/%s.map", pMapName);
+	str_format(aBuf, sizeof(aBuf), "maps/%s.map", pLoad->m_aName);
 
 	// check for valid standard map
-	if(!m_MapChecker.ReadAndValidateMap(Storage(), aBuf, IStorage::TYPE_ALL))
+	if(!pThis->m_MapChecker.ReadAndValidateMap(pThis->Storage(), aBuf, IStorage::TYPE_ALL))
 	{
-		Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "mapchecker", "invalid standard map");
+		str_copy(pLoad->m_aError, "invalid standard map", sizeof(pLoad->m_aError));
 		return 0;
 	}
 
-	if(!m_pMap->Load(aBuf))
+	// parse it next to the current map, which is still in use
+	if(!pThis->m_pMap->Preload(aBuf, pThis->Storage()))
 		return 0;
 
+	// load complete map into memory for download
+	IOHANDLE File = pThis->Storage()->OpenFile(aBuf, IOFLAG_READ, IStorage::TYPE_ALL);
+	if(!File)
+		return 0;
+	pLoad->m_DataSize = (int)io_length(File);
+	pLoad->m_pData = (unsigned char *)mem_alloc(pLoad->m_DataSize, 1);
+	io_read(File, pLoad->m_pData, pLoad->m_DataSize);
+	io_close(File);
+	return 1;
+}
+
+void CServer::FinishMapLoad()
+{
 	// stop recording when we change map
 	m_DemoRecorder.Stop();
 
 	// reinit snapshot ids
 	m_IDPool.TimeoutIDs();
 
+	m_pMap->SwapPreloaded();
+
 	// get the sha256 and crc of the map
 	m_CurrentMapSha256 = m_pMap->Sha256();
 	m_CurrentMapCrc = m_pMap->Crc();
 	char aSha256[SHA256_MAXSTRSIZE];
 	sha256_str(m_CurrentMapSha256, aSha256, sizeof(aSha256));
 	char aBufMsg[256];
-	str_format(aBufMsg, sizeof(aBufMsg), "%s sha256 is %s", aBuf, aSha256);
+	str_format(aBufMsg, sizeof(aBufMsg), "maps/%s.map sha256 is %s", m_MapLoad.m_aName, aSha256);
 	Console()->Print(IConsole::OUTPUT_LEVEL_ADDINFO, "server", aBufMsg);
-	str_format(aBufMsg, sizeof(aBufMsg), "%s crc is %08x", aBuf, m_CurrentMapCrc);
+	str_format(aBufMsg, sizeof(aBufMsg), "maps/%s.map crc is %08x", m_MapLoad.m_aName, m_CurrentMapCrc);
 	Console()->Print(IConsole::OUTPUT_LEVEL_ADDINFO, "server", aBufMsg);
 
-	str_copy(m_aCurrentMap, pMapName, sizeof(m_aCurrentMap));
+	str_copy(m_aCurrentMap, m_MapLoad.m_aName, sizeof(m_aCurrentMap));
 
-	// load complete map into memory for download
+	if(m_pCurrentMapData)
+		mem_free(m_pCurrentMapData);
+	m_pCurrentMapData = m_MapLoad.m_pData;
+	m_CurrentMapSize = m_MapLoad.m_DataSize;
+	m_MapLoad.m_pData = 0;
+	ExpireServerInfo();
+}
+
+void CServer::AbortMapLoad()
+{
+	if(m_MapLoad.m_aError[0])
+		Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "mapchecker", m_MapLoad.m_aError);
+	m_pMap->UnloadPreloaded();
+	if(m_MapLoad.m_pData)
 	{
-		IOHANDLE File = Storage()->OpenFile(aBuf, IOFLAG_READ, IStorage::TYPE_ALL);
-		m_CurrentMapSize = (int)io_length(File);
-		if(m_pCurrentMapData)
-			mem_free(m_pCurrentMapData);
-		m_pCurrentMapData = (unsigned char *)mem_alloc(m_CurrentMapSize, 1);
-		io_read(File, m_pCurrentMapData, m_CurrentMapSize);
-		io_close(File);
+		mem_free(m_MapLoad.m_pData);
+		m_MapLoad.m_pData = 0;
 	}
+}
+
+int CServer::LoadMap(const char *pMapName)
+{
+	PrepareMapLoad(pMapName);
+	if(!LoadMapJob(this))
+	{
+		AbortMapLoad();
+		return 0;
+	}
+	FinishMapLoad();
 	return 1;
 }
 
@@ -1324,6 +2074,53 @@ void CServer::InitInterfaces(CConfig *pConfig, IConsole *pConsole, IGameServer *
 	m_pStorage = pStorage;
 }
 
+void CServer::WaitForTick()
+{
+	int64 Deadline = TickStartTime(m_CurrentGameTick+1);
+
+	if(Config()->m_SvPreciseTicks && !m_NetWaitFailed)
+	{
+		if(!m_NetWait)
+		{
+			// the network thread reads the server socket itself and wakes up the wait
+			// object it got when it started, see Run
+			m_NetWait = m_NetServer.HasThread() ? 0 : net_wait_create();
+			m_NetWaitEcon = false;
+			if(!m_NetWait || (!m_NetServer.HasThread() && net_wait_add(m_NetWait, m_NetServer.Socket()) != 0))
+			{
+				Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "server", "precise ticks aren't supported, using the normal wait");
+				m_NetWaitFailed = true;
+			}
+		}
+		// the econ socket is opened later
+		if(m_NetWait && !m_NetWaitEcon && m_Econ.IsReady())
+			m_NetWaitEcon = net_wait_add(m_NetWait, m_Econ.Socket()) == 0;
+
+		if(!m_NetWaitFailed)
+		{
+			// wake up a bit early and spin to start the tick on time
+			int64 Spin = Config()->m_SvTickSpin*time_freq()/1000000;
+			int Result = net_wait_until(m_NetWait, Deadline-Spin);
+			if(Result == 0)
+			{
+				while(time_get() <= Deadline)
+					cpu_relax();
+			}
+			if(Result >= 0)
+				return;
+		}
+	}
+
+	// wait for incoming data
+	int Time = clamp(int((Deadline-time_get())*1000/time_freq()), 1, 1000/SERVER_TICK_SPEED/2);
+	if(m_NetServer.HasThread() && m_NetWait)
+		net_wait_until(m_NetWait, time_get()+Time*time_freq()/1000);
+	else if(m_NetServer.HasThread())
+		thread_sleep(Time);
+	else
+		m_NetServer.Wait(Time);
+}
+
 int CServer::Run()
 {
 	if(Config()->m_Debug)
@@ -1348,6 +2145,7 @@ int CServer::Run()
 		return -1;
 	}
 	m_MapChunksPerRequest = Config()->m_SvMapDownloadSpeed;
+	StartHuffmanTraining();
 
 	// start server
 	NETADDR BindAddr;
@@ -1371,6 +2169,21 @@ int CServer::Run()
 		return -1;
 	}
 
+	if(Config()->m_SvNetThread)
+	{
+		// the game thread waits on this instead of the socket
+		UpdateServerInfoCache();
+		m_NetWait = net_wait_create();
+		if(m_NetServer.StartThread(ConnlessCallback, m_NetWait))
+			Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "server", "started the network thread");
+		else
+		{
+			Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "server", "couldn't start the network thread");
+			net_wait_destroy(m_NetWait);
+			m_NetWait = 0;
+		}
+	}
+
 	m_Econ.Init(Config(), Console(), &m_ServerBan);
 
 	char aBuf[256];
@@ -1404,13 +2217,35 @@ int CServer::Run()
 		while(m_RunServer)
 		{
 			// load new map
-			if(m_MapReload || m_CurrentGameTick >= 0x6FFFFFFF) //	force reload to make sure the ticks stay within a valid range
+			if((m_MapReload || m_CurrentGameTick >= 0x6FFFFFFF) && !m_MapLoading) //	force reload to make sure the ticks stay within a valid range
 			{
 				m_MapReload = false;
 
-				// load map
-				if(LoadMap(Config()->m_SvMap))
+				// the game keeps running while the map is loaded in the background
+				PrepareMapLoad(Config()->m_SvMap);
+				m_MapLoading = true;
+				Kernel()->RequestInterface<IEngine>()->AddJob(&m_MapLoad.m_Job, LoadMapJob, this);
+			}
+
+			if(m_MapLoading && m_MapLoad.m_Job.Status() == CJob::STATE_DONE)
+			{
+				m_MapLoading = false;
+
+				if(m_MapLoad.m_Job.Result() && str_comp(Config()->m_SvMap, m_MapLoad.m_aName) != 0)
 				{
+					// sv_map was changed while the map was loading, load the new one instead
+					AbortMapLoad();
+					m_MapReload = str_comp(Config()->m_SvMap, m_aCurrentMap) != 0;
+				}
+				else if(m_MapLoad.m_Job.Result())
+				{
+					// the game still does a full pass over the game layer here: the
+					// collision setup rewrites the tile indices and OnInit spawns the
+					// entities. both are linear in the map size and part of the
+					// main thread time logged below
+					int64 SwapStart = time_get();
+					FinishMapLoad();
+
 					// new map loaded
 					bool aSpecs[MAX_CLIENTS];
 					for(int c = 0; c < MAX_CLIENTS; c++)
@@ -1430,17 +2265,29 @@ int CServer::Run()
 
 					m_GameStartTime = time_get();
 					m_CurrentGameTick = 0;
+					StartHuffmanTraining();
 					Kernel()->ReregisterInterface(GameServer());
 					GameServer()->OnInit();
+
+					int64 End = time_get();
+					str_format(aBuf, sizeof(aBuf), "map change took %d ms (%d ms on the main thread)",
+						(int)((End-m_MapLoad.m_StartTime)*1000/time_freq()), (int)((End-SwapStart)*1000/time_freq()));
+					Console()->Print(IConsole::OUTPUT_LEVEL_ADDINFO, "server", aBuf);
 				}
 				else
 				{
-					str_format(aBuf, sizeof(aBuf), "failed to load map. mapname='%s'", Config()->m_SvMap);
+					AbortMapLoad();
+					str_format(aBuf, sizeof(aBuf), "failed to load map. mapname='%s'", m_MapLoad.m_aName);
 					Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "server", aBuf);
-					str_copy(Config()->m_SvMap, m_aCurrentMap, sizeof(Config()->m_SvMap));
+					// sv_map may have been changed again in the meantime
+					if(str_comp(Config()->m_SvMap, m_MapLoad.m_aName) == 0)
+						str_copy(Config()->m_SvMap, m_aCurrentMap, sizeof(Config()->m_SvMap));
 				}
 			}
 
+			// collect the packets of the loop and send them at once
+			m_NetServer.EnableSendQueue(Config()->m_SvSendBatch);
+
 			int64 Now = time_get();
 			bool NewTicks = false;
 			bool ShouldSnap = false;
@@ -1450,24 +2297,35 @@ int CServer::Run()
 				NewTicks = true;
 				if((m_CurrentGameTick%2) == 0)
 					ShouldSnap = true;
+				m_TickProfiler.SetCounterTotal(CTickProfiler::COUNTER_SENT_PACKETS, m_NetServer.IoNet()->SentPackets());
+				m_TickProfiler.SetCounterTotal(CTickProfiler::COUNTER_SEND_CALLS, m_NetServer.IoNet()->SendCalls());
+				m_TickProfiler.SetCounterTotal(CTickProfiler::COUNTER_RECV_PACKETS, m_NetServer.IoNet()->RecvPackets());
+				m_TickProfiler.SetCounterTotal(CTickProfiler::COUNTER_RECV_CALLS, m_NetServer.IoNet()->RecvCalls());
+				m_TickProfiler.SetCounterTotal(CTickProfiler::COUNTER_DROPPED_PACKETS, m_NetServer.IoNet()->DroppedPackets());
+				m_TickProfiler.SetCounterTotal(CTickProfiler::COUNTER_DROPPED_BYTES, m_NetServer.IoNet()->DroppedBytes());
+				lock_wait(m_InfoCacheLock);
+				m_TickProfiler.SetCounterTotal(CTickProfiler::COUNTER_INFO_CACHE_HITS, m_InfoCacheHits);
+				lock_unlock(m_InfoCacheLock);
+				m_TickProfiler.NextTick();
+				int64 Start = time_get();
+				m_TickProfiler.Add(CTickProfiler::PHASE_START_DELAY, Start-TickStartTime(m_CurrentGameTick));
 
 				// apply new input
 				for(int c = 0; c < MAX_CLIENTS; c++)
 				{
-					if(m_aClients[c].m_State == CClient::STATE_EMPTY)
+					if(m_aClients[c].m_State != CClient::STATE_INGAME)
 						continue;
-					for(int i = 0; i < 200; i++)
-					{
-						if(m_aClients[c].m_aInputs[i].m_GameTick == Tick())
-						{
-							if(m_aClients[c].m_State == CClient::STATE_INGAME)
-								GameServer()->OnClientPredictedInput(c, m_aClients[c].m_aInputs[i].m_aData);
-							break;
-						}
-					}
+					CClient::CInput *pInput = &m_aClients[c].m_aInputs[Tick()%CClient::INPUT_HISTORY];
+					if(pInput->m_GameTick == Tick())
+						GameServer()->OnClientPredictedInput(c, pInput->m_aData);
+					else
+						m_aClients[c].m_MissedInputs++;
 				}
+				int64 End = time_get();
+				m_TickProfiler.Add(CTickProfiler::PHASE_INPUT, End-Start);
 
 				GameServer()->OnTick();
+				m_TickProfiler.Add(CTickProfiler::PHASE_TICK, time_get()-End);
 			}
 
 			// snap game
@@ -1476,23 +2334,61 @@ int CServer::Run()
 				if(Config()->m_SvHighBandwidth || ShouldSnap)
 					DoSnapshot();
 
+				int64 Start = time_get();
 				UpdateClientRconCommands();
 				UpdateClientMapListEntries();
+				UpdateHuffmanTable();
+				if(m_NetServer.HasThread())
+					UpdateServerInfoCache();
+				m_TickProfiler.Add(CTickProfiler::PHASE_NETWORK, time_get()-Start);
+
+				if(Config()->m_SvPerfDump && time_get() > m_LastPerfDump+Config()->m_SvPerfDump*time_freq())
+				{
+					m_LastPerfDump = time_get();
+					if(!m_TickProfiler.WriteJson(Storage()->OpenFile("perf.json", IOFLAG_WRITE, IStorage::TYPE_SAVE)))
+						Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "server", "failed to write perf.json");
+				}
 			}
 
 			// master server stuff
+			int64 Start = time_get();
 			m_Register.RegisterUpdate(m_NetServer.NetType());
+			int64 End = time_get();
+			m_TickProfiler.Add(CTickProfiler::PHASE_REGISTER, End-Start);
 
 			PumpNetwork();
+			UpdateMapDownloads();
+			m_NetServer.FlushSendQueue();
+			Start = time_get();
+			m_TickProfiler.Add(CTickProfiler::PHASE_NETWORK, Start-End);
 
-			// wait for incoming data
-			m_NetServer.Wait(clamp(int((TickStartTime(m_CurrentGameTick+1)-time_get())*1000/time_freq()), 1, 1000/SERVER_TICK_SPEED/2));
+			WaitForTick();
+			m_TickProfiler.Add(CTickProfiler::PHASE_WAIT, time_get()-Start);
 		}
 	}
 	// disconnect all clients on shutdown
 	m_NetServer.Close();
 	m_Econ.Shutdown();
 
+	net_wait_destroy(m_NetWait);
+	m_NetWait = 0;
+
+	m_SnapWorkers.Shutdown();
+	for(int i = 0; i < MAX_CLIENTS; i++)
+	{
+		delete m_apSnapContexts[i];
+		m_apSnapContexts[i] = 0;
+	}
+
+	// the map job still uses the map and storage
+	if(m_MapLoading)
+	{
+		while(m_MapLoad.m_Job.Status() != CJob::STATE_DONE)
+			thread_sleep(1);
+		m_MapLoading = false;
+		AbortMapLoad();
+	}
+
 	GameServer()->OnShutdown();
 	m_pMap->Unload();
 
@@ -1592,6 +2488,85 @@ void CServer::ConStatus(IConsole::IResult *pResult, void *pUser)
 	}
 }
 
+void CServer::ConStatusSnapCache(IConsole::IResult *pResult, void *pUser)
+{
+	CServer *pThis = static_cast<CServer *>(pUser);
+	const CSnapDeltaCache *pCache = &pThis->m_SnapDeltaCache;
+	int64 Total = pCache->Hits()+pCache->Misses();
+
+	char aBuf[256];
+	str_format(aBuf, sizeof(aBuf), "snapshot delta cache: hits=%lld misses=%lld hitrate=%.1f%% last_tick_hits=%d last_tick_misses=%d",
+		pCache->Hits(), pCache->Misses(), Total ? pCache->Hits()*100.0f/Total : 0.0f, pCache->TickHits(), pCache->TickMisses());
+	pThis->Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "server", aBuf);
+}
+
+void CServer::ConStatusSnapMem(IConsole::IResult *pResult, void *pUser)
+{
+	CServer *pThis = static_cast<CServer *>(pUser);
+	char aBuf[256];
+	int TotalUsed = 0;
+	int TotalPool = 0;
+
+	for(int i = 0; i < MAX_CLIENTS; i++)
+	{
+		if(pThis->m_aClients[i].m_State == CClient::STATE_EMPTY)
+			continue;
+
+		const CSnapshotStorage *pStorage = &pThis->m_aClients[i].m_Snapshots;
+		str_format(aBuf, sizeof(aBuf), "id=%d used=%d peak=%d pool=%d heap_allocs=%d",
+			i, pStorage->UsedSize(), pStorage->PeakUsedSize(), pStorage->PoolSize(), pStorage->NumHeapAllocs());
+		pThis->Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "server", aBuf);
+		TotalUsed += pStorage->UsedSize();
+		TotalPool += pStorage->PoolSize();
+	}
+
+	str_format(aBuf, sizeof(aBuf), "snapshot storage: used=%d pool=%d", TotalUsed, TotalPool);
+	pThis->Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "server", aBuf);
+}
+
+void CServer::ConStatusPerf(IConsole::IResult *pResult, void *pUser)
+{
+	CServer *pThis = static_cast<CServer *>(pUser);
+	const CTickProfiler *pProfiler = &pThis->m_TickProfiler;
+	char aBuf[256];
+
+	str_format(aBuf, sizeof(aBuf), "tick phases over the last %d ticks, budget=%dus", pProfiler->NumSamples(), 1000000/SERVER_TICK_SPEED);
+	pThis->Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "server", aBuf);
+	for(int i = 0; i < CTickProfiler::NUM_PHASES; i++)
+	{
+		CTickProfiler::CStats Stats;
+		pProfiler->GetStats(i, &Stats);
+		str_format(aBuf, sizeof(aBuf), "%-13s mean=%dus p50=%dus p99=%dus max=%dus",
+			CTickProfiler::PhaseName(i), Stats.m_Mean, Stats.m_P50, Stats.m_P99, Stats.m_Max);
+		pThis->Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "server", aBuf);
+	}
+	for(int i = 0; i < CTickProfiler::NUM_COUNTERS; i++)
+	{
+		CTickProfiler::CStats Stats;
+		pProfiler->GetCounterStats(i, &Stats);
+		str_format(aBuf, sizeof(aBuf), "%-15s mean=%d p50=%d p99=%d max=%d per tick",
+			CTickProfiler::CounterName(i), Stats.m_Mean, Stats.m_P50, Stats.m_P99, Stats.m_Max);
+		pThis->Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "server", aBuf);
+	}
+}
+
+void CServer::ConStatusInput(IConsole::IResult *pResult, void *pUser)
+{
+	CServer *pThis = static_cast<CServer *>(pUser);
+	char aBuf[256];
+
+	for(int i = 0; i < MAX_CLIENTS; i++)
+	{
+		if(pThis->m_aClients[i].m_State != CClient::STATE_INGAME)
+			continue;
+
+		str_format(aBuf, sizeof(aBuf), "id=%d late=%d duplicate=%d missed=%d latency=%d",
+			i, pThis->m_aClients[i].m_LateInputs, pThis->m_aClients[i].m_DuplicateInputs, pThis->m_aClients[i].m_MissedInputs,
+			pThis->m_aClients[i].m_Latency);
+		pThis->Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "server", aBuf);
+	}
+}
+
 void CServer::ConShutdown(IConsole::IResult *pResult, void *pUser)
 {
 	((CServer *)pUser)->m_RunServer = false;
@@ -1674,6 +2649,7 @@ void CServer::ConchainSpecialInfoupdate(IConsole::IResult *pResult, void *pUserD
 	if(pResult->NumArguments())
 	{
 		str_clean_whitespaces(pSelf->Config()->m_SvName);
+		pSelf->ExpireServerInfo();
 		pSelf->SendServerInfo(-1);
 	}
 }
@@ -1686,6 +2662,7 @@ void CServer::ConchainPlayerSlotsUpdate(IConsole::IResult *pResult, void *pUserD
 	{
 		if(pSelf->Config()->m_SvMaxClients < pSelf->Config()->m_SvPlayerSlots)
 			pSelf->Config()->m_SvPlayerSlots = pSelf->Config()->m_SvMaxClients;
+		pSelf->ExpireServerInfo();
 	}
 }
 
@@ -1771,6 +2748,10 @@ void CServer::RegisterCommands()
 	// register console commands
 	Console()->Register("kick", "i[id] ?r[reason]", CFGFLAG_SERVER, ConKick, this, "Kick player with specified id for any reason");
 	Console()->Register("status", "", CFGFLAG_SERVER, ConStatus, this, "List players");
+	Console()->Register("status_snapcache", "", CFGFLAG_SERVER, ConStatusSnapCache, this, "Show the hit rate of the snapshot delta cache");
+	Console()->Register("status_snapmem", "", CFGFLAG_SERVER, ConStatusSnapMem, this, "Show the snapshot history memory of each client");
+	Console()->Register("status_perf", "", CFGFLAG_SERVER, ConStatusPerf, this, "Show how long the phases of the recent server ticks took");
+	Console()->Register("status_input", "", CFGFLAG_SERVER, ConStatusInput, this, "Show the late, duplicate and missed inputs of each client");
 	Console()->Register("shutdown", "", CFGFLAG_SERVER, ConShutdown, this, "Shut down");
 	Console()->Register("logout", "", CFGFLAG_SERVER|CFGFLAG_BASICACCESS, ConLogout, this, "Logout of rcon");
 
@@ -1781,6 +2762,8 @@ void CServer::RegisterCommands()
 
 	Console()->Chain("sv_name", ConchainSpecialInfoupdate, this);
 	Console()->Chain("password", ConchainSpecialInfoupdate, this);
+	Console()->Chain("sv_hostname", ConchainSpecialInfoupdate, this);
+	Console()->Chain("sv_skill_level", ConchainSpecialInfoupdate, this);
 
 	Console()->Chain("sv_player_slots", ConchainPlayerSlotsUpdate, this);
 	Console()->Chain("sv_max_clients", ConchainMaxclientsUpdate, this);
@@ -1815,7 +2798,9 @@ void *CServer::SnapNewItem(int Type, int ID, int Size)
 		g_UuidManager.GetUuid(Type);
 	}
 	dbg_assert(ID >= 0 && ID <= 0xffff, "incorrect id");
-	return ID < 0 ? 0 : m_SnapshotBuilder.NewItem(Type, ID, Size);
+	if(ID < 0)
+		return 0;
+	return gs_pSnapBuilder ? gs_pSnapBuilder->NewItem(Type, ID, Size) : m_SnapshotBuilder.NewItem(Type, ID, Size);
 }
 
 void CServer::SnapSetStaticsize(int ItemType, int Size)
@@ -41,6 +41,173 @@ public:
 };
 
 
+class CSnapWorkerPool
+{
+public:
+	typedef void (*FJob)(int Index, void *pUser);
+
+private:
+	enum
+	{
+		MAX_THREADS = 32,
+	};
+
+	class CWorker
+	{
+	public:
+		CSnapWorkerPool *m_pPool;
+		void *m_pThread;
+#if !defined(CONF_PLATFORM_MACOSX)
+		SEMAPHORE m_Activity;
+#endif
+	};
+
+	CWorker m_aWorkers[MAX_THREADS];
+	int m_NumThreads;
+	volatile bool m_Shutdown;
+#if !defined(CONF_PLATFORM_MACOSX)
+	SEMAPHORE m_Done;
+#endif
+
+	FJob m_pfnJob;
+	void *m_pJobUser;
+	int m_NumJobs;
+	volatile unsigned m_NextJob;
+
+	void ProcessJobs();
+	static void WorkerThread(void *pUser);
+
+public:
+	CSnapWorkerPool();
+	~CSnapWorkerPool();
+
+	// (re)starts the requested amount of threads, returns the number of running threads
+	int Init(int NumThreads);
+	void Shutdown();
+	int NumThreads() const { return m_NumThreads; }
+
+	// runs pfnJob for every index in [0, NumJobs) on the workers and the calling thread
+	void Run(FJob pfnJob, void *pUser, int NumJobs);
+};
+
+
+class CSnapDeltaCache
+{
+	enum
+	{
+		MAX_ENTRIES = MAX_CLIENTS,
+	};
+
+	class CEntry
+	{
+	public:
+		int64 m_Hash;
+		int64 m_BaseHash;
+		char *m_pData; // the snapshot, its base and the compressed delta
+		int m_SnapSize;
+		int m_BaseSize;
+		int m_DataSize;
+		int m_Capacity;
+	};
+
+	CEntry m_aEntries[MAX_ENTRIES];
+	int m_NumEntries;
+	LOCK m_Lock;
+
+	int64 m_Hits;
+	int64 m_Misses;
+	int m_TickHits;
+	int m_TickMisses;
+
+public:
+	CSnapDeltaCache();
+	~CSnapDeltaCache();
+
+	// forgets all entries, has to be called before each tick's snapshots
+	void Reset();
+
+	// copies the compressed delta from pBase to pSnap, the hashes only narrow
+	// down the search and the snapshots are compared in full before a hit
+	bool Get(const CSnapshot *pSnap, int64 Hash, const CSnapshot *pBase, int64 BaseHash, void *pData, int *pDataSize);
+	void Add(const CSnapshot *pSnap, int64 Hash, const CSnapshot *pBase, int64 BaseHash, const void *pData, int DataSize);
+
+	int64 Hits() const { return m_Hits; }
+	int64 Misses() const { return m_Misses; }
+	int TickHits() const { return m_TickHits; }
+	int TickMisses() const { return m_TickMisses; }
+};
+
+
+class CTickProfiler
+{
+public:
+	enum
+	{
+		PHASE_INPUT=0,
+		PHASE_TICK,
+		PHASE_SNAP_BUILD,
+		PHASE_SNAP_DELTA,
+		PHASE_SNAP_COMPRESS,
+		PHASE_SNAP_SEND,
+		PHASE_NETWORK,
+		PHASE_REGISTER,
+		PHASE_WAIT,
+		PHASE_BUSY, // everything except waiting
+		PHASE_START_DELAY, // how late the tick started
+		NUM_PHASES,
+
+		COUNTER_SENT_PACKETS=0,
+		COUNTER_SEND_CALLS,
+		COUNTER_RECV_PACKETS,
+		COUNTER_RECV_CALLS,
+		COUNTER_DROPPED_PACKETS, // over sv_connless_rate
+		COUNTER_DROPPED_BYTES,
+		COUNTER_INFO_CACHE_HITS,
+		NUM_COUNTERS,
+
+		HISTORY_SIZE=512, // ~10 seconds of ticks
+	};
+
+	class CStats
+	{
+	public:
+		int m_Mean;
+		int m_P50;
+		int m_P99;
+		int m_Max;
+	};
+
+private:
+	int m_aaSamples[NUM_PHASES][HISTORY_SIZE]; // microseconds
+	int64 m_aCurrent[NUM_PHASES];
+	int m_aaCounterSamples[NUM_COUNTERS][HISTORY_SIZE];
+	int64 m_aCounterTotal[NUM_COUNTERS];
+	int64 m_aCounterLastTotal[NUM_COUNTERS];
+	int m_NumSamples;
+	int m_NextSample;
+	bool m_Started;
+
+public:
+	CTickProfiler();
+
+	void Reset();
+
+	// stores the times added since the last call as the sample of the finished tick
+	void NextTick();
+	void Add(int Phase, int64 Time) { m_aCurrent[Phase] += Time; }
+	// counters are sampled as the increase of a running total per tick
+	void SetCounterTotal(int Counter, int64 Total) { m_aCounterTotal[Counter] = Total; }
+
+	int NumSamples() const { return m_NumSamples; }
+	void GetStats(int Phase, CStats *pStats) const;
+	void GetCounterStats(int Counter, CStats *pStats) const;
+	bool WriteJson(IOHANDLE File) const;
+
+	static const char *PhaseName(int Phase);
+	static const char *CounterName(int Counter);
+};
+
+
 class CServerBan : public CNetBan
 {
 	class CServer *m_pServer;
@@ -100,7 +267,13 @@ public:
 
 			SNAPRATE_INIT=0,
 			SNAPRATE_FULL,
-			SNAPRATE_RECOVER
+			SNAPRATE_RECOVER,
+
+			SNAP_HASH_HISTORY=256, // more than the 3 seconds of kept snapshots
+			INPUT_HISTORY=200,
+
+			// map chunks in flight, a quarter of the resend buffer is left for other messages
+			MAP_WINDOW_MAX=NET_CONN_BUFFERSIZE*3/4/NET_MAX_PAYLOAD,
 		};
 
 		class CInput
@@ -110,6 +283,13 @@ public:
 			int m_GameTick; // the tick that was chosen for the input
 		};
 
+		class CSnapHash
+		{
+		public:
+			int m_Tick;
+			int64 m_Hash;
+		};
+
 		// connection state info
 		int m_State;
 		int m_Latency;
@@ -118,10 +298,15 @@ public:
 		int m_LastAckedSnapshot;
 		int m_LastInputTick;
 		CSnapshotStorage m_Snapshots;
+		CSnapHash m_aSnapHashes[SNAP_HASH_HISTORY]; // indexed by tick
 
 		CInput m_LatestInput;
-		CInput m_aInputs[200]; // TODO: handle input better
-		int m_CurrentInput;
+		CInput m_aInputs[INPUT_HISTORY]; // indexed by the tick they are for
+
+		// input statistics
+		int m_LateInputs; // arrived after their tick, moved to the next one
+		int m_DuplicateInputs; // replaced an input for the same tick
+		int m_MissedInputs; // ticks without input while ingame
 
 		char m_aName[MAX_NAME_ARRAY_SIZE];
 		char m_aClan[MAX_CLAN_ARRAY_SIZE];
@@ -131,7 +316,13 @@ public:
 		int m_Authed;
 		int m_AuthTries;
 
-		int m_MapChunk;
+		// map download, the requests of the client acknowledge the chunks in flight
+		int m_MapChunk; // next chunk to send
+		int m_MapChunksAcked; // -1 until the first request
+		int m_MapWindow;
+		int64 m_MapMinRtt;
+		int64 m_aMapChunkSendTimes[MAP_WINDOW_MAX];
+
 		bool m_NoRconNote;
 		bool m_Quitting;
 		const IConsole::CCommandInfo *m_pRconCmdToSend;
@@ -142,8 +333,56 @@ public:
 
 	CClient m_aClients[MAX_CLIENTS];
 
+	// buffers needed to create the snapshot of a single client
+	class CSnapContext
+	{
+	public:
+		CSnapshotBuilder m_Builder;
+		char m_aData[CSnapshot::MAX_SIZE];
+		char m_aDeltaData[CSnapshot::MAX_SIZE];
+		char m_aCompData[CSnapshot::MAX_SIZE];
+		int m_Crc;
+		int m_DeltaTick;
+		int m_CompSize; // 0 = empty delta
+
+		// time spent on the last snapshot
+		int64 m_BuildTime;
+		int64 m_DeltaTime;
+		int64 m_CompressTime;
+	};
+
+	CSnapContext *m_apSnapContexts[MAX_CLIENTS];
+	int m_aSnapJobs[MAX_CLIENTS];
+	int m_NumSnapJobs;
+	CSnapWorkerPool m_SnapWorkers;
+	CSnapDeltaCache m_SnapDeltaCache;
+	CTickProfiler m_TickProfiler;
+	int64 m_LastPerfDump;
+	NETWAIT m_NetWait; // for sv_precise_ticks
+	bool m_NetWaitEcon;
+	bool m_NetWaitFailed;
+
+	// packed server info with the client list, rebuilt only after ExpireServerInfo.
+	// the network thread answers from it too, see sv_net_thread
+	LOCK m_InfoCacheLock;
+	unsigned char m_aInfoCache[NET_MAX_PAYLOAD];
+	int m_InfoCacheSize;
+	bool m_InfoCacheValid;
+	int64 m_InfoCacheHits; // info requests answered from the cache
+
+	// huffman table trained on the snapshots of the current map, see sv_huffman_train
+	enum
+	{
+		HUFFMAN_TRAIN_BYTES=2*1024*1024,
+	};
+	unsigned m_aHuffmanCounts[256];
+	int m_HuffmanCountedBytes;
+	bool m_HuffmanTraining;
+	unsigned m_aHuffmanTable[256];
+	int m_HuffmanGeneration; // 0 = default table
+
 	CSnapshotDelta m_SnapshotDelta;
-	CSnapshotBuilder m_SnapshotBuilder;
+	CSnapshotBuilder m_SnapshotBuilder; // items shared by all client snapshots
 	CSnapIDPool m_IDPool;
 	CNetServer m_NetServer;
 	CEcon m_Econ;
@@ -162,6 +401,7 @@ public:
 	enum
 	{
 		MAP_CHUNK_SIZE=NET_MAX_PAYLOAD-NET_MAX_CHUNKHEADERSIZE-4, // msg type
+		MAP_CHUNKS_PER_UPDATE=128, // for all clients together
 	};
 	char m_aCurrentMap[64];
 	SHA256_DIGEST m_CurrentMapSha256;
@@ -169,6 +409,20 @@ public:
 	unsigned char *m_pCurrentMapData;
 	int m_CurrentMapSize;
 	int m_MapChunksPerRequest;
+	int m_MapDownloadStart; // client that gets map chunks first, rotates
+
+	// the next map is read and parsed by a job, the main thread only swaps it in
+	struct CMapLoad
+	{
+		CJob m_Job;
+		char m_aName[64];
+		char m_aError[128];
+		unsigned char *m_pData;
+		int m_DataSize;
+		int64 m_StartTime;
+	};
+	CMapLoad m_MapLoad;
+	bool m_MapLoading;
 
 	//maplist
 	struct CMapListEntry
@@ -197,11 +451,13 @@ public:
 	CMapChecker m_MapChecker;
 
 	CServer();
+	~CServer();
 
 	virtual void SetClientName(int ClientID, const char *pName);
 	virtual void SetClientClan(int ClientID, char const *pClan);
 	virtual void SetClientCountry(int ClientID, int Country);
 	virtual void SetClientScore(int ClientID, int Score);
+	virtual void ExpireServerInfo();
 
 	void Kick(int ClientID, const char *pReason);
 
@@ -227,12 +483,21 @@ public:
 
 	virtual int SendMsg(CMsgPacker *pMsg, int Flags, int ClientID);
 
+	CSnapContext *SnapContext(int Index);
+	void CreateSnapshot(int ClientID, CSnapContext *pContext);
+	void SendSnapshot(int ClientID, const CSnapContext *pContext);
+	static void SnapshotJob(int Index, void *pUser);
 	void DoSnapshot();
 
 	static int NewClientCallback(int ClientID, void *pUser);
 	static int DelClientCallback(int ClientID, const char *pReason, void *pUser);
 
 	void SendMap(int ClientID);
+	int SendMapData(int ClientID, int MaxChunks);
+	void UpdateMapDownloads();
+	void SendHuffmanTable(int ClientID);
+	void StartHuffmanTraining();
+	void UpdateHuffmanTable();
 	void SendConnectionReady(int ClientID);
 	void SendRconLine(int ClientID, const char *pLine);
 	static void SendRconLineAuthed(const char *pLine, void *pUser, bool Highlighted);
@@ -248,12 +513,20 @@ public:
 
 	void SendServerInfo(int ClientID);
 	void GenerateServerInfo(CPacker *pPacker, int Token);
+	void GenerateServerInfoBody(CPacker *pPacker, bool ClientList);
+	void UpdateServerInfoCache();
+	static int ConnlessCallback(const CNetChunk *pPacket, unsigned char *pReply, int MaxReplySize, void *pUser);
 
 	void PumpNetwork();
+	void WaitForTick();
 
 	virtual void ChangeMap(const char *pMap);
 	const char *GetMapName();
 	int LoadMap(const char *pMapName);
+	static int LoadMapJob(void *pUser);
+	void PrepareMapLoad(const char *pMapName);
+	void FinishMapLoad();
+	void AbortMapLoad();
 
 	void InitRegister(CNetServer *pNetServer, IEngineMasterServer *pMasterServer, CConfig *pConfig, IConsole *pConsole);
 	void InitInterfaces(CConfig *pConfig, IConsole *pConsole, IGameServer *pGameServer, IEngineMap *pMap, IStorage *pStorage);
@@ -263,6 +536,10 @@ public:
 
 	static void ConKick(IConsole::IResult *pResult, void *pUser);
 	static void ConStatus(IConsole::IResult *pResult, void *pUser);
+	static void ConStatusSnapCache(IConsole::IResult *pResult, void *pUser);
+	static void ConStatusSnapMem(IConsole::IResult *pResult, void *pUser);
+	static void ConStatusPerf(IConsole::IResult *pResult, void *pUser);
+	static void ConStatusInput(IConsole::IResult *pResult, void *pUser);
 	static void ConShutdown(IConsole::IResult *pResult, void *pUser);
 	static void ConRecord(IConsole::IResult *pResult, void *pUser);
 	static void ConStopRecord(IConsole::IResult *pResult, void *pUser);
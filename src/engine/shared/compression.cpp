@@ -3,64 +3,19 @@
 #include <base/system.h>
 
 #include "compression.h"
+#include "snapshot_simd.h"
 
-// Format: ESDDDDDD EDDDDDDD EDD... Extended, Data, Sign
-unsigned char *CVariableInt::Pack(unsigned char *pDst, int i)
+long CVariableInt::Decompress(const void *pSrc, int SrcSize, void *pDst, int DstSize)
 {
-	*pDst = (i>>25)&0x40; // set sign bit if i<0
-	i = i^(i>>31); // if(i<0) i = ~i
-
-	*pDst |= i&0x3F; // pack 6bit into dst
-	i >>= 6; // discard 6 bits
-	if(i)
-	{
-		*pDst |= 0x80; // set extend bit
-		while(1)
-		{
-			pDst++;
-			*pDst = i&(0x7F); // pack 7bit
-			i >>= 7; // discard 7 bits
-			*pDst |= (i!=0)<<7; // set extend bit (may branch)
-			if(!i)
-				break;
-		}
-	}
-
-	pDst++;
-	return pDst;
+	return SnapshotSimd()->m_pfnVarIntDecompress(pSrc, SrcSize, pDst, DstSize);
 }
 
-const unsigned char *CVariableInt::Unpack(const unsigned char *pSrc, int *pInOut)
+long CVariableInt::Compress(const void *pSrc, int SrcSize, void *pDst, int DstSize)
 {
-	int Sign = (*pSrc>>6)&1;
-	*pInOut = *pSrc&0x3F;
-
-	do
-	{
-		if(!(*pSrc&0x80)) break;
-		pSrc++;
-		*pInOut |= (*pSrc&(0x7F))<<(6);
-
-		if(!(*pSrc&0x80)) break;
-		pSrc++;
-		*pInOut |= (*pSrc&(0x7F))<<(6+7);
-
-		if(!(*pSrc&0x80)) break;
-		pSrc++;
-		*pInOut |= (*pSrc&(0x7F))<<(6+7+7);
-
-		if(!(*pSrc&0x80)) break;
-		pSrc++;
-		*pInOut |= (*pSrc&(0x7F))<<(6+7+7+7);
-	} while(0);
-
-	pSrc++;
-	*pInOut ^= -Sign; // if(sign) *i = ~(*i)
-	return pSrc;
+	return SnapshotSimd()->m_pfnVarIntCompress(pSrc, SrcSize, pDst, DstSize);
 }
 
-
-long CVariableInt::Decompress(const void *pSrc_, int SrcSize, void *pDst_, int DstSize)
+long CVariableInt::DecompressScalar(const void *pSrc_, int SrcSize, void *pDst_, int DstSize)
 {
 	const unsigned char *pSrc = (unsigned char *)pSrc_;
 	const unsigned char *pEnd = pSrc + SrcSize;
@@ -76,7 +31,7 @@ long CVariableInt::Decompress(const void *pSrc_, int SrcSize, void *pDst_, int D
 	return (long)((unsigned char *)pDst-(unsigned char *)pDst_);
 }
 
-long CVariableInt::Compress(const void *pSrc_, int SrcSize, void *pDst_, int DstSize)
+long CVariableInt::CompressScalar(const void *pSrc_, int SrcSize, void *pDst_, int DstSize)
 {
 	int *pSrc = (int *)pSrc_;
 	unsigned char *pDst = (unsigned char *)pDst_;
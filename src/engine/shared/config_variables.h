@@ -91,6 +91,16 @@ MACRO_CONFIG_INT(SvMaxClients, sv_max_clients, 8, 1, MAX_CLIENTS, CFGFLAG_SAVE|C
 MACRO_CONFIG_INT(SvMaxClientsPerIP, sv_max_clients_per_ip, 4, 1, MAX_CLIENTS, CFGFLAG_SAVE|CFGFLAG_SERVER, "Maximum number of clients with the same IP that can connect to the server")
 MACRO_CONFIG_INT(SvMapDownloadSpeed, sv_map_download_speed, 8, 1, 16, CFGFLAG_SAVE|CFGFLAG_SERVER, "Number of map data packages a client gets on each request")
 MACRO_CONFIG_INT(SvHighBandwidth, sv_high_bandwidth, 0, 0, 1, CFGFLAG_SAVE|CFGFLAG_SERVER, "Use high bandwidth mode. Doubles the bandwidth required for the server. LAN use only")
+MACRO_CONFIG_INT(SvSnapThreads, sv_snap_threads, 0, 0, 32, CFGFLAG_SAVE|CFGFLAG_SERVER, "Number of worker threads used to build client snapshots (0 = build them on the main thread)")
+MACRO_CONFIG_INT(SvSnapCache, sv_snap_cache, 0, 0, 1, CFGFLAG_SAVE|CFGFLAG_SERVER, "Reuse the compressed snapshot delta of clients that get the same snapshot against the same base (only pays off when clients see the same latencies)")
+MACRO_CONFIG_INT(SvPerfDump, sv_perf_dump, 0, 0, 3600, CFGFLAG_SAVE|CFGFLAG_SERVER, "Write the tick phase timings to perf.json every this many seconds (0 = off)")
+MACRO_CONFIG_INT(SvPreciseTicks, sv_precise_ticks, 0, 0, 1, CFGFLAG_SAVE|CFGFLAG_SERVER, "Start the ticks at their exact time instead of waiting in milliseconds (linux only)")
+MACRO_CONFIG_INT(SvTickSpin, sv_tick_spin, 0, 0, 5000, CFGFLAG_SAVE|CFGFLAG_SERVER, "Microseconds to busy wait before a tick starts with sv_precise_ticks")
+MACRO_CONFIG_INT(SvSendBatch, sv_send_batch, 1, 0, 1, CFGFLAG_SAVE|CFGFLAG_SERVER, "Send the packets of a server loop together, with one system call on linux")
+MACRO_CONFIG_INT(SvHuffmanTrain, sv_huffman_train, 1, 0, 1, CFGFLAG_SAVE|CFGFLAG_SERVER, "Train a huffman table on the snapshots of each map and offer it to the clients")
+MACRO_CONFIG_INT(SvNetThread, sv_net_thread, 0, 0, 1, CFGFLAG_SAVE|CFGFLAG_SERVER, "Receive packets and answer info requests on a separate network thread")
+MACRO_CONFIG_INT(SvConnlessRate, sv_connless_rate, 30, 0, 10000, CFGFLAG_SAVE|CFGFLAG_SERVER, "Connless and control packets per second that are accepted from one address (0 = no limit)")
+MACRO_CONFIG_INT(SvConnlessBurst, sv_connless_burst, 60, 1, 10000, CFGFLAG_SAVE|CFGFLAG_SERVER, "Connless and control packets that one address can send at once")
 MACRO_CONFIG_INT(SvRegister, sv_register, 1, 0, 1, CFGFLAG_SAVE|CFGFLAG_SERVER, "Register server with master server for public listing")
 MACRO_CONFIG_STR(SvRconPassword, sv_rcon_password, 32, "", CFGFLAG_SAVE|CFGFLAG_SERVER, "Remote console password (full access)")
 MACRO_CONFIG_STR(SvRconModPassword, sv_rcon_mod_password, 32, "", CFGFLAG_SAVE|CFGFLAG_SERVER, "Remote console password for moderators (limited access)")
@@ -21,6 +21,7 @@ public:
 
 	bool Open(class IStorage *pStorage, const char *pFilename, int StorageType);
 	bool Close();
+	void Swap(CDataFileReader *pOther) { struct CDatafile *pTmp = m_pDataFile; m_pDataFile = pOther->m_pDataFile; pOther->m_pDataFile = pTmp; }
 
 	void *GetData(int Index);
 	void *GetDataSwapped(int Index); // makes sure that the data is 32bit LE ints when saved
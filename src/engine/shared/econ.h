@@ -53,6 +53,8 @@ public:
 	void Init(CConfig *pConfig, IConsole *pConsole, class CNetBan *pNetBan);
 	bool Open();
 	void Update();
+	bool IsReady() const { return m_Ready; }
+	NETSOCKET Socket() const { return m_NetConsole.Socket(); }
 	void Send(int ClientID, const char *pLine);
 	void Shutdown();
 };
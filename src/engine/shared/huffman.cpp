@@ -120,98 +120,101 @@ void CHuffman::Init(const unsigned *pFrequencies)
 		pFrequencies = gs_aFreqTable;
 	ConstructTree(pFrequencies);
 
-	// build decode LUT
+	// build decode LUT, each entry holds all symbols that fit into its bits
 	for(int i = 0; i < HUFFMAN_LUTSIZE; i++)
 	{
-		unsigned Bits = i;
-		int k;
-		CNode *pNode = m_pStartNode;
-		for(k = 0; k < HUFFMAN_LUTBITS; k++)
+		CDecodeEntry *pEntry = &m_aDecodeLut[i];
+		pEntry->m_Node = HUFFMAN_NO_NODE;
+		pEntry->m_NumBits = 0;
+		pEntry->m_NumSymbols = 0;
+
+		int Used = 0;
+		while(pEntry->m_NumSymbols < HUFFMAN_LUTSYMBOLS)
 		{
-			pNode = &m_aNodes[pNode->m_aLeafs[Bits&1]];
-			Bits >>= 1;
+			CNode *pNode = m_pStartNode;
+			int k = Used;
+			while(k < HUFFMAN_LUTBITS && !pNode->m_NumBits)
+			{
+				pNode = &m_aNodes[pNode->m_aLeafs[(i>>k)&1]];
+				k++;
+			}
 
-			if(!pNode)
+			if(!pNode->m_NumBits)
+			{
+				// the symbol doesn't fit, the decoder walks the tree from here
+				if(pEntry->m_NumSymbols == 0)
+				{
+					pEntry->m_Node = (unsigned short)(pNode - m_aNodes);
+					pEntry->m_NumBits = HUFFMAN_LUTBITS;
+				}
 				break;
+			}
 
-			if(pNode->m_NumBits)
+			Used = k;
+			pEntry->m_NumBits = Used;
+			if(pNode == &m_aNodes[HUFFMAN_EOF_SYMBOL])
 			{
-				m_apDecodeLut[i] = pNode;
+				pEntry->m_Node = HUFFMAN_EOF_SYMBOL;
 				break;
 			}
+			pEntry->m_aSymbols[pEntry->m_NumSymbols++] = pNode->m_Symbol;
 		}
-
-		if(k == HUFFMAN_LUTBITS)
-			m_apDecodeLut[i] = pNode;
 	}
-
 }
 
 //***************************************************************
 int CHuffman::Compress(const void *pInput, int InputSize, void *pOutput, int OutputSize)
 {
-	// this macro loads a symbol for a byte into bits and bitcount
-#define HUFFMAN_MACRO_LOADSYMBOL(Sym) \
-	Bits |= m_aNodes[Sym].m_Bits << Bitcount; \
-	Bitcount += m_aNodes[Sym].m_NumBits;
-
-	// this macro writes the symbol stored in bits and bitcount to the dst pointer
-#define HUFFMAN_MACRO_WRITE() \
-	while(Bitcount >= 8) \
-	{ \
-		*pDst++ = (unsigned char)(Bits&0xff); \
-		if(pDst == pDstEnd) \
-			return -1; \
-		Bits >>= 8; \
-		Bitcount -= 8; \
-	}
-
 	// setup buffer pointers
 	const unsigned char *pSrc = (const unsigned char *)pInput;
 	const unsigned char *pSrcEnd = pSrc + InputSize;
 	unsigned char *pDst = (unsigned char *)pOutput;
 	unsigned char *pDstEnd = pDst + OutputSize;
 
-	// symbol variables
-	unsigned Bits = 0;
+	// symbol variables, symbols are at most 32 bits long
+	unsigned long long Bits = 0;
 	unsigned Bitcount = 0;
 
-	// make sure that we have data that we want to compress
-	if(InputSize)
+	while(pSrc != pSrcEnd)
 	{
-		// {A} load the first symbol
-		int Symbol = *pSrc++;
+		const CNode *pNode = &m_aNodes[*pSrc++];
+		Bits |= (unsigned long long)pNode->m_Bits << Bitcount;
+		Bitcount += pNode->m_NumBits;
 
-		while(pSrc != pSrcEnd)
+		// write 32 bits at once, one byte has to stay free for the end
+		if(Bitcount >= 32)
 		{
-			// {B} load the symbol
-			HUFFMAN_MACRO_LOADSYMBOL(Symbol)
-
-			// {C} fetch next symbol, this is done here because it will reduce dependency in the code
-			Symbol = *pSrc++;
-
-			// {B} write the symbol loaded at
-			HUFFMAN_MACRO_WRITE()
+			if(pDstEnd - pDst <= 4)
+				return -1;
+			pDst[0] = (unsigned char)Bits;
+			pDst[1] = (unsigned char)(Bits>>8);
+			pDst[2] = (unsigned char)(Bits>>16);
+			pDst[3] = (unsigned char)(Bits>>24);
+			pDst += 4;
+			Bits >>= 32;
+			Bitcount -= 32;
 		}
-
-		// write the last symbol loaded from {C} or {A} in the case of only 1 byte input buffer
-		HUFFMAN_MACRO_LOADSYMBOL(Symbol)
-		HUFFMAN_MACRO_WRITE()
 	}
 
 	// write EOF symbol
-	HUFFMAN_MACRO_LOADSYMBOL(HUFFMAN_EOF_SYMBOL)
-	HUFFMAN_MACRO_WRITE()
+	Bits |= (unsigned long long)m_aNodes[HUFFMAN_EOF_SYMBOL].m_Bits << Bitcount;
+	Bitcount += m_aNodes[HUFFMAN_EOF_SYMBOL].m_NumBits;
+	while(Bitcount >= 8)
+	{
+		if(pDstEnd - pDst <= 1)
+			return -1;
+		*pDst++ = (unsigned char)Bits;
+		Bits >>= 8;
+		Bitcount -= 8;
+	}
 
 	// write out the last bits
-	*pDst++ = Bits;
+	if(pDst == pDstEnd)
+		return -1;
+	*pDst++ = (unsigned char)Bits;
 
 	// return the size of the output
 	return (int)(pDst - (const unsigned char *)pOutput);
-
-	// remove macros
-#undef HUFFMAN_MACRO_LOADSYMBOL
-#undef HUFFMAN_MACRO_WRITE
 }
 
 //***************************************************************
@@ -219,73 +222,92 @@ int CHuffman::Decompress(const void *pInput, int InputSize, void *pOutput, int O
 {
 	// setup buffer pointers
 	unsigned char *pDst = (unsigned char *)pOutput;
-	unsigned char *pSrc = (unsigned char *)pInput;
+	const unsigned char *pSrc = (const unsigned char *)pInput;
 	unsigned char *pDstEnd = pDst + OutputSize;
-	unsigned char *pSrcEnd = pSrc + InputSize;
+	const unsigned char *pSrcEnd = pSrc + InputSize;
 
-	unsigned Bits = 0;
+	unsigned long long Bits = 0;
 	unsigned Bitcount = 0;
+	unsigned Padding = 0;
 
-	CNode *pEof = &m_aNodes[HUFFMAN_EOF_SYMBOL];
-	CNode *pNode = 0;
+	const CNode *pEof = &m_aNodes[HUFFMAN_EOF_SYMBOL];
+
+	// this macro fills the bit buffer with at least 57 bits, zeros are padded after the end of the input
+#define HUFFMAN_MACRO_REFILL() \
+	if(pSrcEnd - pSrc >= 8) \
+	{ \
+		unsigned long long Word = (unsigned long long)pSrc[0] | (unsigned long long)pSrc[1]<<8 | \
+			(unsigned long long)pSrc[2]<<16 | (unsigned long long)pSrc[3]<<24 | \
+			(unsigned long long)pSrc[4]<<32 | (unsigned long long)pSrc[5]<<40 | \
+			(unsigned long long)pSrc[6]<<48 | (unsigned long long)pSrc[7]<<56; \
+		Bits |= Word << Bitcount; \
+		pSrc += (63-Bitcount)>>3; \
+		Bitcount |= 56; \
+	} \
+	else \
+	{ \
+		while(Bitcount <= 56) \
+		{ \
+			if(pSrc == pSrcEnd) \
+			{ \
+				if(Bitcount < Padding) \
+					return -1; \
+				Padding += 64-Bitcount; \
+				Bitcount = 64; \
+				break; \
+			} \
+			Bits |= (unsigned long long)(*pSrc++) << Bitcount; \
+			Bitcount += 8; \
+		} \
+	}
 
 	while(1)
 	{
-		// {A} try to load a node now, this will reduce dependency at location {D}
-		pNode = 0;
-		if(Bitcount >= HUFFMAN_LUTBITS)
-			pNode = m_apDecodeLut[Bits&HUFFMAN_LUTMASK];
-
-		// {B} fill with new bits
-		while(Bitcount < 24 && pSrc != pSrcEnd)
-		{
-			Bits |= (*pSrc++) << Bitcount;
-			Bitcount += 8;
-		}
+		HUFFMAN_MACRO_REFILL()
 
-		// {C} load symbol now if we didn't that earlier at location {A}
-		if(!pNode)
-			pNode = m_apDecodeLut[Bits&HUFFMAN_LUTMASK];
-
-		if(!pNode)
-			return -1;
-
-		// {D} check if we hit a symbol already
-		if(pNode->m_NumBits)
+		// output all symbols of the lut entry at once
+		const CDecodeEntry *pEntry = &m_aDecodeLut[Bits&HUFFMAN_LUTMASK];
+		if(pDstEnd - pDst >= HUFFMAN_LUTSYMBOLS)
 		{
-			// remove the bits for that symbol
-			Bits >>= pNode->m_NumBits;
-			Bitcount -= pNode->m_NumBits;
+			pDst[0] = pEntry->m_aSymbols[0];
+			pDst[1] = pEntry->m_aSymbols[1];
+			pDst[2] = pEntry->m_aSymbols[2];
+			pDst[3] = pEntry->m_aSymbols[3];
 		}
 		else
 		{
-			// remove the bits that the lut checked up for us
-			Bits >>= HUFFMAN_LUTBITS;
-			Bitcount -= HUFFMAN_LUTBITS;
-
-			// walk the tree bit by bit
-			while(1)
-			{
-				// traverse tree
-				pNode = &m_aNodes[pNode->m_aLeafs[Bits&1]];
-
-				// remove bit
-				Bitcount--;
-				Bits >>= 1;
+			if(pDstEnd - pDst < pEntry->m_NumSymbols)
+				return -1;
+			for(int i = 0; i < pEntry->m_NumSymbols; i++)
+				pDst[i] = pEntry->m_aSymbols[i];
+		}
+		pDst += pEntry->m_NumSymbols;
+		Bits >>= pEntry->m_NumBits;
+		Bitcount -= pEntry->m_NumBits;
 
-				// check if we hit a symbol
-				if(pNode->m_NumBits)
-					break;
+		if(pEntry->m_Node == HUFFMAN_NO_NODE)
+			continue;
 
-				// no more bits, decoding error
-				if(Bitcount == 0)
-					return -1;
+		// walk the tree bit by bit for symbols longer than the lut
+		const CNode *pNode = &m_aNodes[pEntry->m_Node];
+		while(!pNode->m_NumBits)
+		{
+			if(Bitcount == 0)
+			{
+				HUFFMAN_MACRO_REFILL()
 			}
+			pNode = &m_aNodes[pNode->m_aLeafs[Bits&1]];
+			Bits >>= 1;
+			Bitcount--;
 		}
 
-		// check for eof
+		// check for eof, it has to be within the input
 		if(pNode == pEof)
+		{
+			if(Bitcount < Padding)
+				return -1;
 			break;
+		}
 
 		// output character
 		if(pDst == pDstEnd)
@@ -293,6 +315,41 @@ int CHuffman::Decompress(const void *pInput, int InputSize, void *pOutput, int O
 		*pDst++ = pNode->m_Symbol;
 	}
 
+#undef HUFFMAN_MACRO_REFILL
+
 	// return the size of the decompressed buffer
 	return (int)(pDst - (const unsigned char *)pOutput);
 }
+
+void CHuffman::NormalizeFrequencies(const unsigned *pCounts, unsigned *pFrequencies)
+{
+	unsigned long long Total = 0;
+	for(int i = 0; i < HUFFMAN_MAX_SYMBOLS-1; i++)
+		Total += pCounts[i];
+
+	for(int i = 0; i < HUFFMAN_MAX_SYMBOLS-1; i++)
+	{
+		unsigned Frequency = Total ? (unsigned)(pCounts[i]*(unsigned long long)HUFFMAN_NORMALIZED_TOTAL/Total) : 0;
+		pFrequencies[i] = Frequency > 0 ? Frequency : 1;
+	}
+}
+
+bool CHuffman::ValidFrequencies(const unsigned *pFrequencies)
+{
+	unsigned long long Total = 0;
+	for(int i = 0; i < HUFFMAN_MAX_SYMBOLS-1; i++)
+	{
+		if(pFrequencies[i] == 0)
+			return false;
+		Total += pFrequencies[i];
+	}
+	return Total <= HUFFMAN_MAX_TOTAL;
+}
+
+unsigned long long CHuffman::EstimateSize(const unsigned *pCounts) const
+{
+	unsigned long long Bits = 0;
+	for(int i = 0; i < HUFFMAN_MAX_SYMBOLS-1; i++)
+		Bits += pCounts[i]*(unsigned long long)m_aNodes[i].m_NumBits;
+	return (Bits+7)/8;
+}
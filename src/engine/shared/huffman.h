@@ -14,9 +14,11 @@ class CHuffman
 		HUFFMAN_MAX_SYMBOLS=HUFFMAN_EOF_SYMBOL+1,
 		HUFFMAN_MAX_NODES=HUFFMAN_MAX_SYMBOLS*2-1,
 
-		HUFFMAN_LUTBITS = 10,
+		HUFFMAN_LUTBITS = 11,
 		HUFFMAN_LUTSIZE = (1<<HUFFMAN_LUTBITS),
-		HUFFMAN_LUTMASK = (HUFFMAN_LUTSIZE-1)
+		HUFFMAN_LUTMASK = (HUFFMAN_LUTSIZE-1),
+		HUFFMAN_LUTSYMBOLS = 4,
+		HUFFMAN_NO_NODE = 0xffff
 	};
 
 	struct CNode
@@ -32,8 +34,19 @@ class CHuffman
 		unsigned char m_Symbol;
 	};
 
+	// all symbols that fit completely into HUFFMAN_LUTBITS bits
+	struct CDecodeEntry
+	{
+		// tree node to continue with after the symbols: the eof symbol,
+		// an inner node when the first symbol is longer than the lut or HUFFMAN_NO_NODE
+		unsigned short m_Node;
+		unsigned char m_NumBits;
+		unsigned char m_NumSymbols;
+		unsigned char m_aSymbols[HUFFMAN_LUTSYMBOLS];
+	};
+
 	CNode m_aNodes[HUFFMAN_MAX_NODES];
-	CNode *m_apDecodeLut[HUFFMAN_LUTSIZE];
+	CDecodeEntry m_aDecodeLut[HUFFMAN_LUTSIZE];
 	CNode *m_pStartNode;
 	int m_NumNodes;
 
@@ -41,6 +54,13 @@ class CHuffman
 	void ConstructTree(const unsigned *pFrequencies);
 
 public:
+	enum
+	{
+		// bounds for tables made by NormalizeFrequencies, they keep every code below 32 bits
+		HUFFMAN_NORMALIZED_TOTAL = 1<<16,
+		HUFFMAN_MAX_TOTAL = 1<<17
+	};
+
 	/*
 		Function: huffman_init
 			Inits the compressor/decompressor.
@@ -87,5 +107,39 @@ public:
 	*/
 	int Decompress(const void *pInput, int InputSize, void *pOutput, int OutputSize);
 
+	/*
+		Function: NormalizeFrequencies
+			Turns counted bytes into a frequency table that can be passed to Init.
+
+		Parameters:
+			pCounts - A pointer to an array of 256 entries with the number of times each byte occurred
+			pFrequencies - A pointer to an array of 256 entries to put the frequencies into
+
+		Remarks:
+			- Every byte keeps a frequency of at least 1, so all data stays compressible.
+	*/
+	static void NormalizeFrequencies(const unsigned *pCounts, unsigned *pFrequencies);
+
+	/*
+		Function: ValidFrequencies
+			Checks a frequency table that was received from a peer.
+
+		Returns:
+			Returns true if the table stays within the bounds of NormalizeFrequencies.
+	*/
+	static bool ValidFrequencies(const unsigned *pFrequencies);
+
+	/*
+		Function: EstimateSize
+			Calculates the compressed size of data with the given byte counts.
+
+		Parameters:
+			pCounts - A pointer to an array of 256 entries with the number of times each byte occurred
+
+		Returns:
+			Returns the size in bytes, without the eof symbol and padding.
+	*/
+	unsigned long long EstimateSize(const unsigned *pCounts) const;
+
 };
 #endif // __HUFFMAN_HEADER__
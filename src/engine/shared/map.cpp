@@ -9,6 +9,7 @@
 class CMap : public IEngineMap
 {
 	CDataFileReader m_DataFile;
+	CDataFileReader m_PreloadedDataFile;
 public:
 	CMap() {}
 
@@ -26,29 +27,25 @@ public:
 		m_DataFile.Close();
 	}
 
-	virtual bool Load(const char *pMapName, IStorage *pStorage)
+	static bool LoadDataFile(CDataFileReader *pDataFile, const char *pMapName, IStorage *pStorage)
 	{
-		if(!pStorage)
-			pStorage = Kernel()->RequestInterface<IStorage>();
-		if(!pStorage)
-			return false;
-		if(!m_DataFile.Open(pStorage, pMapName, IStorage::TYPE_ALL))
+		if(!pDataFile->Open(pStorage, pMapName, IStorage::TYPE_ALL))
 			return false;
 		// check version
-		CMapItemVersion *pItem = (CMapItemVersion *)m_DataFile.FindItem(MAPITEMTYPE_VERSION, 0);
+		CMapItemVersion *pItem = (CMapItemVersion *)pDataFile->FindItem(MAPITEMTYPE_VERSION, 0);
 		if(!pItem || pItem->m_Version != CMapItemVersion::CURRENT_VERSION)
 			return false;
 
 		// replace compressed tile layers with uncompressed ones
 		int GroupsStart, GroupsNum, LayersStart, LayersNum;
-		m_DataFile.GetType(MAPITEMTYPE_GROUP, &GroupsStart, &GroupsNum);
-		m_DataFile.GetType(MAPITEMTYPE_LAYER, &LayersStart, &LayersNum);
+		pDataFile->GetType(MAPITEMTYPE_GROUP, &GroupsStart, &GroupsNum);
+		pDataFile->GetType(MAPITEMTYPE_LAYER, &LayersStart, &LayersNum);
 		for(int g = 0; g < GroupsNum; g++)
 		{
-			CMapItemGroup *pGroup = static_cast<CMapItemGroup *>(m_DataFile.GetItem(GroupsStart + g, 0, 0));
+			CMapItemGroup *pGroup = static_cast<CMapItemGroup *>(pDataFile->GetItem(GroupsStart + g, 0, 0));
 			for(int l = 0; l < pGroup->m_NumLayers; l++)
 			{
-				CMapItemLayer *pLayer = static_cast<CMapItemLayer *>(m_DataFile.GetItem(LayersStart + pGroup->m_StartLayer + l, 0, 0));
+				CMapItemLayer *pLayer = static_cast<CMapItemLayer *>(pDataFile->GetItem(LayersStart + pGroup->m_StartLayer + l, 0, 0));
 
 				if(pLayer->m_Type == LAYERTYPE_TILES)
 				{
@@ -70,7 +67,7 @@ public:
 
 						// extract original tile data
 						int i = 0;
-						CTile *pSavedTiles = static_cast<CTile *>(m_DataFile.GetData(pTilemap->m_Data));
+						CTile *pSavedTiles = static_cast<CTile *>(pDataFile->GetData(pTilemap->m_Data));
 						while(i < TilemapCount)
 						{
 							for(unsigned Counter = 0; Counter <= pSavedTiles->m_Skip && i < TilemapCount; Counter++)
@@ -82,7 +79,7 @@ public:
 							pSavedTiles++;
 						}
 
-						m_DataFile.ReplaceData(pTilemap->m_Data, reinterpret_cast<char *>(pTiles), TilemapSize);
+						pDataFile->ReplaceData(pTilemap->m_Data, reinterpret_cast<char *>(pTiles), TilemapSize);
 					}
 				}
 			}
@@ -92,6 +89,34 @@ public:
 		return true;
 	}
 
+	virtual bool Load(const char *pMapName, IStorage *pStorage)
+	{
+		if(!pStorage)
+			pStorage = Kernel()->RequestInterface<IStorage>();
+		if(!pStorage)
+			return false;
+		return LoadDataFile(&m_DataFile, pMapName, pStorage);
+	}
+
+	virtual bool Preload(const char *pMapName, IStorage *pStorage)
+	{
+		if(LoadDataFile(&m_PreloadedDataFile, pMapName, pStorage))
+			return true;
+		m_PreloadedDataFile.Close();
+		return false;
+	}
+
+	virtual void SwapPreloaded()
+	{
+		m_DataFile.Swap(&m_PreloadedDataFile);
+		m_PreloadedDataFile.Close();
+	}
+
+	virtual void UnloadPreloaded()
+	{
+		m_PreloadedDataFile.Close();
+	}
+
 	virtual bool IsLoaded()
 	{
 		return m_DataFile.IsOpen();
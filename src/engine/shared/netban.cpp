@@ -29,25 +29,10 @@ CNetBan::CNetHash::CNetHash(const CNetRange *pRange)
 	m_Hash &= 0xFF;
 }
 
-int CNetBan::CNetHash::MakeHashArray(const NETADDR *pAddr, CNetHash aHash[17])
-{
-	int Length = pAddr->type==NETTYPE_IPV4 ? 4 : 16;
-	aHash[0].m_Hash = 0;
-	aHash[0].m_HashIndex = 0;
-	for(int i = 1, Sum = 0; i <= Length; ++i)
-	{
-		Sum += pAddr->ip[i-1];
-		aHash[i].m_Hash = Sum&0xFF;
-		aHash[i].m_HashIndex = i%Length;
-	}
-	return Length;
-}
-
-
 template<class T, int HashCount>
 typename CNetBan::CBan<T> *CNetBan::CBanPool<T, HashCount>::Add(const T *pData, const CBanInfo *pInfo,  const CNetHash *pNetHash)
 {
-	if(!m_pFirstFree)
+	if(!m_pFirstFree && !Grow())
 		return 0;
 
 	// create new ban
@@ -197,19 +182,31 @@ template<class T, int HashCount>
 void CNetBan::CBanPool<T, HashCount>::Reset()
 {
 	mem_zero(m_paaHashList, sizeof(m_paaHashList));
-	mem_zero(m_aBans, sizeof(m_aBans));
+	for(int i = 0; i < m_NumBlocks; ++i)
+		mem_free(m_apBlocks[i]);
+	m_NumBlocks = 0;
+	m_pFirstFree = 0;
 	m_pFirstUsed = 0;
 	m_CountUsed = 0;
+}
 
-	for(int i = 1; i < MAX_BANS-1; ++i)
+template<class T, int HashCount>
+bool CNetBan::CBanPool<T, HashCount>::Grow()
+{
+	if(m_NumBlocks == MAX_BLOCKS)
+		return false;
+
+	CBan<T> *pBlock = (CBan<T> *)mem_alloc(sizeof(CBan<T>)*BLOCK_SIZE, 1);
+	mem_zero(pBlock, sizeof(CBan<T>)*BLOCK_SIZE);
+	for(int i = 0; i < BLOCK_SIZE; ++i)
 	{
-		m_aBans[i].m_pNext = &m_aBans[i+1];
-		m_aBans[i].m_pPrev = &m_aBans[i-1];
+		pBlock[i].m_pNext = i < BLOCK_SIZE-1 ? &pBlock[i+1] : 0;
+		pBlock[i].m_pPrev = i > 0 ? &pBlock[i-1] : 0;
 	}
 
-	m_aBans[0].m_pNext = &m_aBans[1];
-	m_aBans[MAX_BANS-1].m_pPrev = &m_aBans[MAX_BANS-2];
-	m_pFirstFree = &m_aBans[0];
+	m_apBlocks[m_NumBlocks++] = pBlock;
+	m_pFirstFree = pBlock;
+	return true;
 }
 
 template<class T, int HashCount>
@@ -228,6 +225,276 @@ typename CNetBan::CBan<T> *CNetBan::CBanPool<T, HashCount>::Get(int Index) const
 }
 
 
+static inline int PrefixBit(const unsigned char *pPrefix, int Bit)
+{
+	return (pPrefix[Bit>>3]>>(7-(Bit&7)))&1;
+}
+
+// number of leading bits both prefixes share, at most MaxBits
+static int CommonPrefixBits(const unsigned char *pPrefix1, const unsigned char *pPrefix2, int MaxBits)
+{
+	for(int i = 0; i*8 < MaxBits; ++i)
+	{
+		unsigned Diff = pPrefix1[i]^pPrefix2[i];
+		if(Diff)
+		{
+			int Bits = i*8;
+			while(!(Diff&0x80))
+			{
+				Diff <<= 1;
+				++Bits;
+			}
+			return min(Bits, MaxBits);
+		}
+	}
+	return MaxBits;
+}
+
+CNetBan::CBanRangeTrie::CBanRangeTrie()
+{
+	for(int i = 0; i < 2; ++i)
+		m_apSubRoots[i] = (int *)mem_alloc(NUM_SUBROOTS*sizeof(int), 1);
+	Reset();
+}
+
+CNetBan::CBanRangeTrie::~CBanRangeTrie()
+{
+	for(int i = 0; i < 2; ++i)
+		mem_free(m_apSubRoots[i]);
+}
+
+void CNetBan::CBanRangeTrie::Reset()
+{
+	m_aNodes.clear();
+	m_aEntries.clear();
+	m_FirstFreeNode = -1;
+	m_FirstFreeEntry = -1;
+
+	unsigned char aZero[NETADDR_SIZE_IPV6] = {0};
+	NewNode(aZero, 0); // ROOT_IPV4
+	NewNode(aZero, 0); // ROOT_IPV6
+	for(int i = 0; i < 2; ++i)
+		for(int r = 0; r < NUM_SUBROOTS; ++r)
+			m_apSubRoots[i][r] = -1;
+}
+
+int CNetBan::CBanRangeTrie::StartNode(const unsigned char *pPrefix, int Length, int Type, bool Create)
+{
+	if(Length < SUBROOT_BITS)
+		return Type == NETTYPE_IPV4 ? ROOT_IPV4 : ROOT_IPV6;
+
+	int *pSubRoot = &m_apSubRoots[Type == NETTYPE_IPV4 ? 0 : 1][pPrefix[0]<<8 | pPrefix[1]];
+	if(*pSubRoot < 0 && Create)
+		*pSubRoot = NewNode(pPrefix, SUBROOT_BITS);
+	return *pSubRoot;
+}
+
+int CNetBan::CBanRangeTrie::NewNode(const unsigned char *pPrefix, int Length)
+{
+	CNode Node;
+	mem_zero(Node.m_aPrefix, sizeof(Node.m_aPrefix));
+	mem_copy(Node.m_aPrefix, pPrefix, (Length+7)/8);
+	if(Length%8)
+		Node.m_aPrefix[Length/8] &= 0xff<<(8-Length%8);
+	Node.m_Length = Length;
+	Node.m_aChildren[0] = Node.m_aChildren[1] = -1;
+	Node.m_FirstEntry = -1;
+
+	if(m_FirstFreeNode < 0)
+		return m_aNodes.add(Node);
+
+	int Index = m_FirstFreeNode;
+	m_FirstFreeNode = m_aNodes[Index].m_aChildren[0];
+	m_aNodes[Index] = Node;
+	return Index;
+}
+
+void CNetBan::CBanRangeTrie::FreeNode(int Node)
+{
+	m_aNodes[Node].m_aChildren[0] = m_FirstFreeNode;
+	m_FirstFreeNode = Node;
+}
+
+void CNetBan::CBanRangeTrie::Insert(const unsigned char *pPrefix, int Length, CBanRange *pBan)
+{
+	int Node = StartNode(pPrefix, Length, pBan->m_Data.m_LB.type, true);
+	while(m_aNodes[Node].m_Length < Length)
+	{
+		int Bit = PrefixBit(pPrefix, m_aNodes[Node].m_Length);
+		int Child = m_aNodes[Node].m_aChildren[Bit];
+		if(Child < 0)
+		{
+			int Leaf = NewNode(pPrefix, Length);
+			m_aNodes[Node].m_aChildren[Bit] = Leaf;
+			Node = Leaf;
+			break;
+		}
+
+		int ChildLength = m_aNodes[Child].m_Length;
+		int Common = CommonPrefixBits(pPrefix, m_aNodes[Child].m_aPrefix, min(ChildLength, Length));
+		if(Common == ChildLength)
+		{
+			Node = Child;
+			continue;
+		}
+
+		// split the edge to the child at the first differing bit
+		int Split = NewNode(pPrefix, Common);
+		m_aNodes[Split].m_aChildren[PrefixBit(m_aNodes[Child].m_aPrefix, Common)] = Child;
+		m_aNodes[Node].m_aChildren[Bit] = Split;
+		Node = Split;
+		if(Common < Length)
+		{
+			int Leaf = NewNode(pPrefix, Length);
+			m_aNodes[Split].m_aChildren[PrefixBit(pPrefix, Common)] = Leaf;
+			Node = Leaf;
+		}
+		break;
+	}
+
+	CEntry Entry;
+	Entry.m_pBan = pBan;
+	Entry.m_Next = m_aNodes[Node].m_FirstEntry;
+	int Index;
+	if(m_FirstFreeEntry < 0)
+		Index = m_aEntries.add(Entry);
+	else
+	{
+		Index = m_FirstFreeEntry;
+		m_FirstFreeEntry = m_aEntries[Index].m_Next;
+		m_aEntries[Index] = Entry;
+	}
+	m_aNodes[Node].m_FirstEntry = Index;
+}
+
+void CNetBan::CBanRangeTrie::Erase(const unsigned char *pPrefix, int Length, CBanRange *pBan)
+{
+	int aPath[NETADDR_SIZE_IPV6*8+1];
+	int Depth = 0;
+	int Node = StartNode(pPrefix, Length, pBan->m_Data.m_LB.type, false);
+	if(Node < 0)
+		return;
+	while(m_aNodes[Node].m_Length < Length)
+	{
+		int Child = m_aNodes[Node].m_aChildren[PrefixBit(pPrefix, m_aNodes[Node].m_Length)];
+		if(Child < 0 || m_aNodes[Child].m_Length > Length ||
+			CommonPrefixBits(pPrefix, m_aNodes[Child].m_aPrefix, m_aNodes[Child].m_Length) < m_aNodes[Child].m_Length)
+			return;
+		aPath[Depth++] = Node;
+		Node = Child;
+	}
+
+	// unlink the entry
+	for(int *pIndex = &m_aNodes[Node].m_FirstEntry; *pIndex >= 0; pIndex = &m_aEntries[*pIndex].m_Next)
+	{
+		int Index = *pIndex;
+		if(m_aEntries[Index].m_pBan == pBan)
+		{
+			*pIndex = m_aEntries[Index].m_Next;
+			m_aEntries[Index].m_Next = m_FirstFreeEntry;
+			m_FirstFreeEntry = Index;
+			break;
+		}
+	}
+
+	// drop nodes that no longer branch or hold bans
+	if(Depth == 0 || m_aNodes[Node].m_FirstEntry >= 0)
+		return;
+	int Parent = aPath[Depth-1];
+	int *pSlot = &m_aNodes[Parent].m_aChildren[m_aNodes[Parent].m_aChildren[1] == Node];
+	if(m_aNodes[Node].m_aChildren[0] >= 0 && m_aNodes[Node].m_aChildren[1] >= 0)
+		return;
+	if(m_aNodes[Node].m_aChildren[0] >= 0 || m_aNodes[Node].m_aChildren[1] >= 0)
+	{
+		*pSlot = max(m_aNodes[Node].m_aChildren[0], m_aNodes[Node].m_aChildren[1]);
+		FreeNode(Node);
+		return;
+	}
+	*pSlot = -1;
+	FreeNode(Node);
+
+	// the parent may be left with a single child now
+	if(Depth == 1 || m_aNodes[Parent].m_FirstEntry >= 0)
+		return;
+	int Remaining = max(m_aNodes[Parent].m_aChildren[0], m_aNodes[Parent].m_aChildren[1]);
+	int GrandParent = aPath[Depth-2];
+	m_aNodes[GrandParent].m_aChildren[m_aNodes[GrandParent].m_aChildren[1] == Parent] = Remaining;
+	FreeNode(Parent);
+}
+
+void CNetBan::CBanRangeTrie::Cover(CBanRange *pBan, unsigned char *pPrefix, int Length, bool Insertion)
+{
+	const CNetRange *pRange = &pBan->m_Data;
+	int Size = pRange->m_LB.type == NETTYPE_IPV4 ? NETADDR_SIZE_IPV4 : NETADDR_SIZE_IPV6;
+
+	// the addresses the prefix spans
+	unsigned char aLast[NETADDR_SIZE_IPV6];
+	mem_copy(aLast, pPrefix, Size);
+	if(Length%8)
+		aLast[Length/8] |= 0xff>>(Length%8);
+	for(int i = (Length+7)/8; i < Size; ++i)
+		aLast[i] = 0xff;
+	if(mem_comp(aLast, pRange->m_LB.ip, Size) < 0 || mem_comp(pPrefix, pRange->m_UB.ip, Size) > 0)
+		return;
+
+	if(mem_comp(pPrefix, pRange->m_LB.ip, Size) >= 0 && mem_comp(aLast, pRange->m_UB.ip, Size) <= 0)
+	{
+		if(Insertion)
+			Insert(pPrefix, Length, pBan);
+		else
+			Erase(pPrefix, Length, pBan);
+		return;
+	}
+
+	Cover(pBan, pPrefix, Length+1, Insertion);
+	pPrefix[Length>>3] |= 1<<(7-(Length&7));
+	Cover(pBan, pPrefix, Length+1, Insertion);
+	pPrefix[Length>>3] &= ~(1<<(7-(Length&7)));
+}
+
+void CNetBan::CBanRangeTrie::Add(CBanRange *pBan)
+{
+	unsigned char aPrefix[NETADDR_SIZE_IPV6] = {0};
+	Cover(pBan, aPrefix, 0, true);
+}
+
+void CNetBan::CBanRangeTrie::Remove(CBanRange *pBan)
+{
+	unsigned char aPrefix[NETADDR_SIZE_IPV6] = {0};
+	Cover(pBan, aPrefix, 0, false);
+}
+
+CNetBan::CBanRange *CNetBan::CBanRangeTrie::Find(const NETADDR *pAddr) const
+{
+	if(pAddr->type != NETTYPE_IPV4 && pAddr->type != NETTYPE_IPV6)
+		return 0;
+
+	// walk down as far as the address matches, the deepest ban is the most specific one
+	int Bits = pAddr->type == NETTYPE_IPV4 ? NETADDR_SIZE_IPV4*8 : NETADDR_SIZE_IPV6*8;
+	int aStart[2] = {
+		pAddr->type == NETTYPE_IPV4 ? ROOT_IPV4 : ROOT_IPV6,
+		m_apSubRoots[pAddr->type == NETTYPE_IPV4 ? 0 : 1][pAddr->ip[0]<<8 | pAddr->ip[1]]
+	};
+	CBanRange *pBan = 0;
+	for(int i = 0; i < 2; ++i)
+	{
+		int Node = aStart[i];
+		while(Node >= 0)
+		{
+			const CNode *pNode = &m_aNodes[Node];
+			if(pNode->m_FirstEntry >= 0)
+				pBan = m_aEntries[pNode->m_FirstEntry].m_pBan;
+			if(pNode->m_Length == Bits)
+				break;
+
+			Node = pNode->m_aChildren[PrefixBit(pAddr->ip, pNode->m_Length)];
+			if(Node >= 0 && CommonPrefixBits(pAddr->ip, m_aNodes[Node].m_aPrefix, m_aNodes[Node].m_Length) < m_aNodes[Node].m_Length)
+				break;
+		}
+	}
+	return pBan;
+}
+
 template<class T>
 void CNetBan::MakeBanInfo(CBan<T> *pBan, char *pBuf, unsigned BuffSize, int Type, int *pLastInfoQuery)
 {
@@ -288,6 +555,7 @@ int CNetBan::Ban(T *pBanPool, const typename T::CDataType *pData, int Seconds, c
 		return -1;
 	}
 
+	scope_lock Lock(&m_BanLock);
 	int Time = time_timestamp();
 	int Stamp = Seconds > 0 ? Time+Seconds : CBanInfo::EXPIRES_NEVER;
 
@@ -314,6 +582,7 @@ int CNetBan::Ban(T *pBanPool, const typename T::CDataType *pData, int Seconds, c
 	pBan = pBanPool->Add(pData, &Info, &NetHash);
 	if(pBan)
 	{
+		OnAdd(pBan);
 		char aBuf[128];
 		MakeBanInfo(pBan, aBuf, sizeof(aBuf), MSGTYPE_BANADD);
 		Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "net_ban", aBuf);
@@ -327,12 +596,14 @@ int CNetBan::Ban(T *pBanPool, const typename T::CDataType *pData, int Seconds, c
 template<class T>
 int CNetBan::Unban(T *pBanPool, const typename T::CDataType *pData)
 {
+	scope_lock Lock(&m_BanLock);
 	CNetHash NetHash(pData);
 	CBan<typename T::CDataType> *pBan = pBanPool->Find(pData, &NetHash);
 	if(pBan)
 	{
 		char aBuf[256];
 		MakeBanInfo(pBan, aBuf, sizeof(aBuf), MSGTYPE_BANREM);
+		OnRemove(pBan);
 		pBanPool->Remove(pBan);
 		Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "net_ban", aBuf);
 		return 0;
@@ -348,6 +619,7 @@ void CNetBan::Init(IConsole *pConsole, IStorage *pStorage)
 	m_pStorage = pStorage;
 	m_BanAddrPool.Reset();
 	m_BanRangePool.Reset();
+	m_BanRangeTrie.Reset();
 
 	net_host_lookup("localhost", &m_LocalhostIPV4, NETTYPE_IPV4);
 	net_host_lookup("localhost", &m_LocalhostIPV6, NETTYPE_IPV6);
@@ -361,6 +633,7 @@ void CNetBan::Init(IConsole *pConsole, IStorage *pStorage)
 
 void CNetBan::Update()
 {
+	scope_lock Lock(&m_BanLock);
 	int Now = time_timestamp();
 
 	// remove expired bans
@@ -375,6 +648,7 @@ void CNetBan::Update()
 	{
 		str_format(aBuf, sizeof(aBuf), "ban %s expired", NetToString(&m_BanRangePool.First()->m_Data, aNetStr, sizeof(aNetStr)));
 		Console()->Print(IConsole::OUTPUT_LEVEL_STANDARD, "net_ban", aBuf);
+		m_BanRangeTrie.Remove(m_BanRangePool.First());
 		m_BanRangePool.Remove(m_BanRangePool.First());
 	}
 }
@@ -409,6 +683,7 @@ int CNetBan::UnbanByRange(const CNetRange *pRange)
 
 int CNetBan::UnbanByIndex(int Index)
 {
+	scope_lock Lock(&m_BanLock);
 	int Result;
 	char aBuf[256];
 	CBanAddr *pBan = m_BanAddrPool.Get(Index);
@@ -423,6 +698,7 @@ int CNetBan::UnbanByIndex(int Index)
 		if(pBan)
 		{
 			NetToString(&pBan->m_Data, aBuf, sizeof(aBuf));
+			m_BanRangeTrie.Remove(pBan);
 			Result = m_BanRangePool.Remove(pBan);
 		}
 		else
@@ -440,8 +716,10 @@ int CNetBan::UnbanByIndex(int Index)
 
 void CNetBan::UnbanAll()
 {
+	scope_lock Lock(&m_BanLock);
 	m_BanAddrPool.Reset();
 	m_BanRangePool.Reset();
+	m_BanRangeTrie.Reset();
 }
 
 template<class T>
@@ -457,11 +735,11 @@ bool CNetBan::IsBannable(const T *pData)
 
 bool CNetBan::IsBanned(const NETADDR *pAddr, char *pBuf, unsigned BufferSize, int *pLastInfoQuery)
 {
-	CNetHash aHash[17];
-	int Length = CNetHash::MakeHashArray(pAddr, aHash);
+	scope_lock Lock(&m_BanLock);
 
 	// check ban addresses
-	CBanAddr *pBan = m_BanAddrPool.Find(pAddr, &aHash[Length]);
+	CNetHash NetHash(pAddr);
+	CBanAddr *pBan = m_BanAddrPool.Find(pAddr, &NetHash);
 	if(pBan)
 	{
 		MakeBanInfo(pBan, pBuf, BufferSize, MSGTYPE_PLAYER, pLastInfoQuery);
@@ -469,16 +747,11 @@ bool CNetBan::IsBanned(const NETADDR *pAddr, char *pBuf, unsigned BufferSize, in
 	}
 
 	// check ban ranges
-	for(int i = Length-1; i >= 0; --i)
+	CBanRange *pBanRange = m_BanRangeTrie.Find(pAddr);
+	if(pBanRange)
 	{
-		for(CBanRange *pBan = m_BanRangePool.First(&aHash[i]); pBan; pBan = pBan->m_pHashNext)
-		{
-			if(NetMatch(&pBan->m_Data, pAddr, i, Length))
-			{
-				MakeBanInfo(pBan, pBuf, BufferSize, MSGTYPE_PLAYER, pLastInfoQuery);
-				return true;
-			}
-		}
+		MakeBanInfo(pBanRange, pBuf, BufferSize, MSGTYPE_PLAYER, pLastInfoQuery);
+		return true;
 	}
 
 	return false;
@@ -617,6 +890,8 @@ void CNetBan::ConBansSave(IConsole::IResult *pResult, void *pUser)
 }
 
 // explicitly instantiate template for src/engine/server/server.cpp
+template class CNetBan::CBanPool<NETADDR, 1>;
+template class CNetBan::CBanPool<CNetRange, 16>;
 template void CNetBan::MakeBanInfo<CNetRange>(CBan<CNetRange> *pBan, char *pBuf, unsigned BufferSize, int Type, int *pLastInfoQuery);
 template void CNetBan::MakeBanInfo<NETADDR>(CBan<NETADDR> *pBan, char *pBuf, unsigned BufferSize, int Type, int *pLastInfoQuery);
 template int CNetBan::Ban<CNetBan::CBanPool<NETADDR, 1> >(CNetBan::CBanPool<NETADDR, 1> *pBanPool, const NETADDR *pData, int Seconds, const char *pReason);
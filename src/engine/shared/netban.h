@@ -2,6 +2,8 @@
 #define ENGINE_SHARED_NETBAN_H
 
 #include <base/system.h>
+#include <base/tl/array.h>
+#include <base/tl/threading.h>
 
 
 inline int NetComp(const NETADDR *pAddr1, const NETADDR *pAddr2)
@@ -69,8 +71,6 @@ protected:
 		CNetHash() {}	
 		CNetHash(const NETADDR *pAddr);
 		CNetHash(const CNetRange *pRange);
-
-		static int MakeHashArray(const NETADDR *pAddr, CNetHash aHash[17]);
 	};
 
 	struct CBanInfo
@@ -105,6 +105,9 @@ protected:
 	public:
 		typedef T CDataType;
 
+		CBanPool() : m_NumBlocks(0) { Reset(); }
+		~CBanPool() { Reset(); }
+
 		CBan<CDataType> *Add(const CDataType *pData, const CBanInfo *pInfo, const CNetHash *pNetHash);
 		int Remove(CBan<CDataType> *pBan);
 		void Update(CBan<CDataType> *pBan, const CBanInfo *pInfo);
@@ -130,11 +133,16 @@ protected:
 	private:
 		enum
 		{
-			MAX_BANS=1024,
+			BLOCK_SIZE=1024,
+			MAX_BLOCKS=128,
+			MAX_BANS=BLOCK_SIZE*MAX_BLOCKS,
 		};
 
+		bool Grow();
+
 		CBan<CDataType> *m_paaHashList[HashCount][256];
-		CBan<CDataType> m_aBans[MAX_BANS];
+		CBan<CDataType> *m_apBlocks[MAX_BLOCKS]; // bans are allocated in blocks, their addresses stay valid
+		int m_NumBlocks;
 		CBan<CDataType> *m_pFirstFree;
 		CBan<CDataType> *m_pFirstUsed;
 		int m_CountUsed;
@@ -144,7 +152,65 @@ protected:
 	typedef CBanPool<CNetRange, 16> CBanRangePool;
 	typedef CBan<NETADDR> CBanAddr;
 	typedef CBan<CNetRange> CBanRange;
+
+	// longest prefix match over the range bans, each range is stored as the
+	// prefixes that cover it exactly. prefixes of at least 16 bits start at a
+	// node picked by their first 16 bits, which saves most of the walk
+	class CBanRangeTrie
+	{
+	public:
+		CBanRangeTrie();
+		~CBanRangeTrie();
+
+		void Add(CBanRange *pBan);
+		void Remove(CBanRange *pBan);
+		void Reset();
+
+		CBanRange *Find(const NETADDR *pAddr) const;
+
+	private:
+		enum
+		{
+			ROOT_IPV4=0, // prefixes shorter than SUBROOT_BITS
+			ROOT_IPV6,
+			SUBROOT_BITS=16,
+			NUM_SUBROOTS=1<<SUBROOT_BITS,
+		};
+
+		struct CNode
+		{
+			unsigned char m_aPrefix[NETADDR_SIZE_IPV6];
+			int m_Length; // in bits
+			int m_aChildren[2];
+			int m_FirstEntry; // bans that cover exactly this prefix
+		};
+
+		struct CEntry
+		{
+			CBanRange *m_pBan;
+			int m_Next;
+		};
+
+		int StartNode(const unsigned char *pPrefix, int Length, int Type, bool Create);
+		int NewNode(const unsigned char *pPrefix, int Length);
+		void FreeNode(int Node);
+		void Insert(const unsigned char *pPrefix, int Length, CBanRange *pBan);
+		void Erase(const unsigned char *pPrefix, int Length, CBanRange *pBan);
+		void Cover(CBanRange *pBan, unsigned char *pPrefix, int Length, bool Insertion);
+
+		array<CNode> m_aNodes;
+		array<CEntry> m_aEntries;
+		int *m_apSubRoots[2]; // ipv4, ipv6
+		int m_FirstFreeNode;
+		int m_FirstFreeEntry;
+	};
 	
+	// the trie only indexes the range bans
+	void OnAdd(CBanAddr *pBan) {}
+	void OnAdd(CBanRange *pBan) { m_BanRangeTrie.Add(pBan); }
+	void OnRemove(CBanAddr *pBan) {}
+	void OnRemove(CBanRange *pBan) { m_BanRangeTrie.Remove(pBan); }
+
 	template<class T> void MakeBanInfo(CBan<T> *pBan, char *pBuf, unsigned BuffSize, int Type, int *pLastInfoQuery=0);
 	template<class T> int Ban(T *pBanPool, const typename T::CDataType *pData, int Seconds, const char *pReason);
 	template<class T> int Unban(T *pBanPool, const typename T::CDataType *pData);
@@ -153,8 +219,13 @@ protected:
 	class IStorage *m_pStorage;
 	CBanAddrPool m_BanAddrPool;
 	CBanRangePool m_BanRangePool;
+	CBanRangeTrie m_BanRangeTrie;
 	NETADDR m_LocalhostIPV4, m_LocalhostIPV6;
 
+	// the bans are only changed on the main thread, the changes are guarded
+	// against IsBanned calls from the network thread of the server
+	lock m_BanLock;
+
 public:
 	enum
 	{
@@ -112,12 +112,35 @@ CNetBase::CNetBase()
 	m_pEngine = 0;
 	m_DataLogSent = 0;
 	m_DataLogRecv = 0;
+	m_pSendQueue = 0;
+	m_pSendQueueData = 0;
+	m_SendQueueSize = 0;
+	m_SentPackets = 0;
+	m_SendCalls = 0;
+	m_pRecvBatch = 0;
+	m_pRecvBatchData = 0;
+	m_RecvBatchSize = 0;
+	m_RecvBatchPos = 0;
+	m_RecvPackets = 0;
+	m_RecvCalls = 0;
+	m_pRateLimit = 0;
+	m_DroppedPackets = 0;
+	m_DroppedBytes = 0;
+	m_pThreadSendQueue = 0;
+	m_ThreadSendWait = 0;
+	for(int i = 0; i < NET_HUFFMAN_TABLE_SLOTS; i++)
+		m_apHuffmanTables[i] = 0;
 }
 
 CNetBase::~CNetBase()
 {
 	if(m_Socket.type != NETTYPE_INVALID)
 		Shutdown();
+	EnableSendQueue(false);
+	mem_free(m_pRecvBatch);
+	mem_free(m_pRecvBatchData);
+	for(int i = 0; i < NET_HUFFMAN_TABLE_SLOTS; i++)
+		delete m_apHuffmanTables[i];
 }
 
 void CNetBase::Init(NETSOCKET Socket, CConfig *pConfig, IConsole *pConsole, IEngine *pEngine)
@@ -126,6 +149,11 @@ void CNetBase::Init(NETSOCKET Socket, CConfig *pConfig, IConsole *pConsole, IEng
 	m_pConfig = pConfig;
 	m_pEngine = pEngine;
 	m_Huffman.Init();
+	for(int i = 0; i < NET_HUFFMAN_TABLE_SLOTS; i++)
+	{
+		delete m_apHuffmanTables[i];
+		m_apHuffmanTables[i] = 0;
+	}
 	mem_zero(m_aRequestTokenBuf, sizeof(m_aRequestTokenBuf));
 	if(pEngine)
 		pConsole->Chain("dbg_lognetwork", ConchainDbgLognetwork, this);
@@ -133,6 +161,13 @@ void CNetBase::Init(NETSOCKET Socket, CConfig *pConfig, IConsole *pConsole, IEng
 
 void CNetBase::Shutdown()
 {
+	FlushSendQueue();
+	mem_free(m_pRecvBatch);
+	mem_free(m_pRecvBatchData);
+	m_pRecvBatch = 0;
+	m_pRecvBatchData = 0;
+	m_RecvBatchSize = 0;
+	m_RecvBatchPos = 0;
 	net_udp_close(m_Socket);
 	net_invalidate_socket(&m_Socket);
 }
@@ -142,6 +177,109 @@ void CNetBase::Wait(int Time)
 	net_socket_read_wait(m_Socket, Time);
 }
 
+void CNetBase::EnableSendQueue(bool Enable)
+{
+	if(Enable == (m_pSendQueue != 0))
+		return;
+
+	if(Enable)
+	{
+		m_pSendQueue = (NETUDPPACKET *)mem_alloc(sizeof(NETUDPPACKET)*SEND_QUEUE_SIZE, 1);
+		m_pSendQueueData = (unsigned char *)mem_alloc(NET_MAX_PACKETSIZE*SEND_QUEUE_SIZE, 1);
+		m_SendQueueSize = 0;
+	}
+	else
+	{
+		FlushSendQueue();
+		mem_free(m_pSendQueue);
+		mem_free(m_pSendQueueData);
+		m_pSendQueue = 0;
+		m_pSendQueueData = 0;
+	}
+}
+
+void CNetBase::FlushSendQueue()
+{
+	if(m_pThreadSendQueue)
+	{
+		m_pThreadSendQueue->Publish();
+		if(m_ThreadSendWait)
+			net_wait_interrupt(m_ThreadSendWait);
+		return;
+	}
+
+	if(!m_SendQueueSize)
+		return;
+	m_SendCalls += net_udp_send_batch(m_Socket, m_pSendQueue, m_SendQueueSize);
+	m_SendQueueSize = 0;
+}
+
+void CNetBase::SetSendThread(CThreadSendQueue *pQueue, NETWAIT Wait)
+{
+	FlushSendQueue();
+	m_pThreadSendQueue = pQueue;
+	m_ThreadSendWait = Wait;
+}
+
+void CNetBase::SendThreadPackets(CThreadSendQueue *pQueue)
+{
+	NETUDPPACKET aPackets[64];
+	int Num;
+	while((Num = min(pQueue->Size(), int(sizeof(aPackets)/sizeof(aPackets[0])))) > 0)
+	{
+		for(int i = 0; i < Num; i++)
+		{
+			CThreadPacket *pPacket = pQueue->Front(i);
+			aPackets[i].addr = pPacket->m_Addr;
+			aPackets[i].data = pPacket->m_aData;
+			aPackets[i].size = pPacket->m_DataSize;
+		}
+		m_SentPackets += Num;
+		m_SendCalls += net_udp_send_batch(m_Socket, aPackets, Num);
+		pQueue->Pop(Num);
+	}
+}
+
+void CNetBase::SendRaw(const NETADDR *pAddr, const void *pData, int DataSize)
+{
+	if(m_pThreadSendQueue)
+	{
+		CThreadPacket *pPacket;
+		while(!(pPacket = m_pThreadSendQueue->Back()))
+		{
+			// the network thread is behind, let it catch up
+			FlushSendQueue();
+			thread_yield();
+		}
+		pPacket->m_Addr = *pAddr;
+		pPacket->m_DataSize = DataSize;
+		mem_copy(pPacket->m_aData, pData, DataSize);
+		m_pThreadSendQueue->Push();
+		m_SentPackets++;
+		if(!m_pSendQueue)
+			FlushSendQueue();
+		return;
+	}
+
+	m_SentPackets++;
+	if(!m_pSendQueue)
+	{
+		net_udp_send(m_Socket, pAddr, pData, DataSize);
+		m_SendCalls++;
+		return;
+	}
+
+	if(m_SendQueueSize == SEND_QUEUE_SIZE)
+		FlushSendQueue();
+
+	NETUDPPACKET *pPacket = &m_pSendQueue[m_SendQueueSize];
+	pPacket->addr = *pAddr;
+	pPacket->data = m_pSendQueueData + m_SendQueueSize*NET_MAX_PACKETSIZE;
+	pPacket->size = DataSize;
+	mem_copy(pPacket->data, pData, DataSize);
+	m_SendQueueSize++;
+}
+
 // packs the data tight and sends it
 void CNetBase::SendPacketConnless(const NETADDR *pAddr, TOKEN Token, TOKEN ResponseToken, const void *pData, int DataSize)
 {
@@ -165,10 +303,17 @@ void CNetBase::SendPacketConnless(const NETADDR *pAddr, TOKEN Token, TOKEN Respo
 	dbg_assert(i == NET_PACKETHEADERSIZE_CONNLESS, "inconsistency");
 
 	mem_copy(&aBuffer[i], pData, DataSize);
-	net_udp_send(m_Socket, pAddr, aBuffer, i+DataSize);
+	SendRaw(pAddr, aBuffer, i+DataSize);
 }
 
-void CNetBase::SendPacket(const NETADDR *pAddr, CNetPacketConstruct *pPacket)
+void CNetBase::InitHuffmanTable(int Slot, const unsigned *pFrequencies)
+{
+	if(!m_apHuffmanTables[Slot])
+		m_apHuffmanTables[Slot] = new CHuffman();
+	m_apHuffmanTables[Slot]->Init(pFrequencies);
+}
+
+void CNetBase::SendPacket(const NETADDR *pAddr, CNetPacketConstruct *pPacket, int HuffmanSlot)
 {
 	unsigned char aBuffer[NET_MAX_PACKETSIZE];
 	int CompressedSize = -1;
@@ -186,15 +331,25 @@ void CNetBase::SendPacket(const NETADDR *pAddr, CNetPacketConstruct *pPacket)
 
 	dbg_assert((pPacket->m_Token&~NET_TOKEN_MASK) == 0, "token out of range");
 
+	// pick the huffman table
+	CHuffman *pHuffman = &m_Huffman;
+	int HuffmanFlags = 0;
+	if(HuffmanSlot >= 0 && m_apHuffmanTables[HuffmanSlot])
+	{
+		pHuffman = m_apHuffmanTables[HuffmanSlot];
+		HuffmanFlags = NET_PACKETFLAG_HUFFMAN_TABLE | (HuffmanSlot ? NET_PACKETFLAG_HUFFMAN_SLOT : 0);
+	}
+	pPacket->m_Flags &= ~(NET_PACKETFLAG_HUFFMAN_TABLE|NET_PACKETFLAG_HUFFMAN_SLOT);
+
 	// compress if not ctrl msg
 	if(!(pPacket->m_Flags&NET_PACKETFLAG_CONTROL))
-		CompressedSize = m_Huffman.Compress(pPacket->m_aChunkData, pPacket->m_DataSize, &aBuffer[NET_PACKETHEADERSIZE], NET_MAX_PAYLOAD);
+		CompressedSize = pHuffman->Compress(pPacket->m_aChunkData, pPacket->m_DataSize, &aBuffer[NET_PACKETHEADERSIZE], NET_MAX_PAYLOAD);
 
 	// check if the compression was enabled, successful and good enough
 	if(CompressedSize > 0 && CompressedSize < pPacket->m_DataSize)
 	{
 		FinalSize = CompressedSize;
-		pPacket->m_Flags |= NET_PACKETFLAG_COMPRESSION;
+		pPacket->m_Flags |= NET_PACKETFLAG_COMPRESSION | HuffmanFlags;
 	}
 	else
 	{
@@ -220,7 +375,7 @@ void CNetBase::SendPacket(const NETADDR *pAddr, CNetPacketConstruct *pPacket)
 
 		dbg_assert(i == NET_PACKETHEADERSIZE, "inconsistency");
 
-		net_udp_send(m_Socket, pAddr, aBuffer, FinalSize);
+		SendRaw(pAddr, aBuffer, FinalSize);
 
 		// log raw socket data
 		if(m_DataLogSent)
@@ -235,12 +390,35 @@ void CNetBase::SendPacket(const NETADDR *pAddr, CNetPacketConstruct *pPacket)
 }
 
 // TODO: rename this function
-int CNetBase::UnpackPacket(NETADDR *pAddr, unsigned char *pBuffer, CNetPacketConstruct *pPacket)
+int CNetBase::UnpackPacket(NETADDR *pAddr, CNetPacketConstruct *pPacket)
 {
-	int Size = net_udp_recv(m_Socket, pAddr, pBuffer, NET_MAX_PACKETSIZE);
-	// no more packets for now
-	if(Size <= 0)
-		return 1;
+	// only go to the socket when all packets of the last batch are handled
+	if(m_RecvBatchPos == m_RecvBatchSize)
+	{
+		if(!m_pRecvBatch)
+		{
+			m_pRecvBatch = (NETUDPPACKET *)mem_alloc(sizeof(NETUDPPACKET)*RECV_BATCH_SIZE, 1);
+			m_pRecvBatchData = (unsigned char *)mem_alloc(NET_MAX_PACKETSIZE*RECV_BATCH_SIZE, 1);
+		}
+		for(int i = 0; i < RECV_BATCH_SIZE; i++)
+		{
+			m_pRecvBatch[i].data = m_pRecvBatchData + i*NET_MAX_PACKETSIZE;
+			m_pRecvBatch[i].size = NET_MAX_PACKETSIZE;
+		}
+
+		m_RecvCalls++;
+		m_RecvBatchSize = max(net_udp_recv_batch(m_Socket, m_pRecvBatch, RECV_BATCH_SIZE), 0);
+		m_RecvBatchPos = 0;
+		// no more packets for now
+		if(m_RecvBatchSize == 0)
+			return 1;
+	}
+
+	const NETUDPPACKET *pRaw = &m_pRecvBatch[m_RecvBatchPos++];
+	*pAddr = pRaw->addr;
+	unsigned char *pBuffer = (unsigned char *)pRaw->data;
+	int Size = pRaw->size;
+	m_RecvPackets++;
 
 	// log the data
 	if(m_DataLogRecv)
@@ -260,6 +438,15 @@ int CNetBase::UnpackPacket(NETADDR *pAddr, unsigned char *pBuffer, CNetPacketCon
 		return -1;
 	}
 
+	// drop floods of connless and control packets before any decoding
+	if(m_pRateLimit && (pBuffer[0]&((NET_PACKETFLAG_CONNLESS|NET_PACKETFLAG_CONTROL)<<2)) &&
+		!m_pRateLimit->Allow(pAddr, m_pConfig->m_SvConnlessRate, m_pConfig->m_SvConnlessBurst, time_get()))
+	{
+		m_DroppedPackets++;
+		m_DroppedBytes += Size;
+		return -1;
+	}
+
 	// read the packet
 
 	pPacket->m_Flags = (pBuffer[0]&0xfc)>>2;
@@ -309,7 +496,15 @@ int CNetBase::UnpackPacket(NETADDR *pAddr, unsigned char *pBuffer, CNetPacketCon
 		pPacket->m_ResponseToken = NET_TOKEN_NONE;
 
 		if(pPacket->m_Flags&NET_PACKETFLAG_COMPRESSION)
-			pPacket->m_DataSize = m_Huffman.Decompress(&pBuffer[NET_PACKETHEADERSIZE], pPacket->m_DataSize, pPacket->m_aChunkData, sizeof(pPacket->m_aChunkData));
+		{
+			CHuffman *pHuffman = &m_Huffman;
+			if(pPacket->m_Flags&NET_PACKETFLAG_HUFFMAN_TABLE)
+				pHuffman = m_apHuffmanTables[(pPacket->m_Flags&NET_PACKETFLAG_HUFFMAN_SLOT) ? 1 : 0];
+			if(pHuffman)
+				pPacket->m_DataSize = pHuffman->Decompress(&pBuffer[NET_PACKETHEADERSIZE], pPacket->m_DataSize, pPacket->m_aChunkData, sizeof(pPacket->m_aChunkData));
+			else
+				pPacket->m_DataSize = -1;
+		}
 		else
 			mem_copy(pPacket->m_aChunkData, &pBuffer[NET_PACKETHEADERSIZE], pPacket->m_DataSize);
 	}
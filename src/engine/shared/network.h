@@ -82,6 +82,11 @@ enum
 	NET_PACKETFLAG_RESEND=2,
 	NET_PACKETFLAG_COMPRESSION=4,
 	NET_PACKETFLAG_CONNLESS=8,
+	// compressed with a trained huffman table, the second flag selects its slot
+	NET_PACKETFLAG_HUFFMAN_TABLE=16,
+	NET_PACKETFLAG_HUFFMAN_SLOT=32,
+
+	NET_HUFFMAN_TABLE_SLOTS=2,
 
 	NET_MAX_PACKET_CHUNKS=256,
 
@@ -128,7 +133,7 @@ enum
 	NET_CTRLMSG_CLOSE=4,
 	NET_CTRLMSG_TOKEN=5,
 
-	NET_CONN_BUFFERSIZE=1024*32,
+	NET_CONN_BUFFERSIZE=1024*64,
 
 	NET_ENUM_TERMINATOR
 };
@@ -150,6 +155,9 @@ struct CNetChunk
 	const void *m_pData;
 };
 
+// returns the size of the reply written to pReply or 0 to pass the packet on to Recv
+typedef int (*NETFUNC_CONNLESS)(const CNetChunk *pChunk, unsigned char *pReply, int MaxReplySize, void *pUser);
+
 class CNetChunkHeader
 {
 public:
@@ -188,6 +196,21 @@ public:
 
 class CNetBase
 {
+public:
+	// packets that are sent by the network thread, see SetSendThread
+	struct CThreadPacket
+	{
+		NETADDR m_Addr;
+		int m_DataSize;
+		unsigned char m_aData[NET_MAX_PACKETSIZE];
+	};
+	enum
+	{
+		THREAD_SEND_QUEUE_SIZE=1024,
+	};
+	typedef TSpscQueue<CThreadPacket, THREAD_SEND_QUEUE_SIZE> CThreadSendQueue;
+
+private:
 	class CNetInitializer
 	{
 	public:
@@ -205,25 +228,84 @@ class CNetBase
 	IOHANDLE m_DataLogSent;
 	IOHANDLE m_DataLogRecv;
 	CHuffman m_Huffman;
+	CHuffman *m_apHuffmanTables[NET_HUFFMAN_TABLE_SLOTS];
 	unsigned char m_aRequestTokenBuf[NET_TOKENREQUEST_DATASIZE];
 
+	// packets that are sent together by FlushSendQueue
+	enum
+	{
+		SEND_QUEUE_SIZE=256,
+	};
+	NETUDPPACKET *m_pSendQueue;
+	unsigned char *m_pSendQueueData;
+	int m_SendQueueSize;
+
+	int64 m_SentPackets;
+	int64 m_SendCalls;
+
+	// received packets that are handed out one by one by UnpackPacket
+	enum
+	{
+		RECV_BATCH_SIZE=64,
+	};
+	NETUDPPACKET *m_pRecvBatch;
+	unsigned char *m_pRecvBatchData;
+	int m_RecvBatchSize;
+	int m_RecvBatchPos;
+
+	int64 m_RecvPackets;
+	int64 m_RecvCalls;
+
+	// connless and control packets over the rate are dropped before they are decoded
+	class CNetRateLimit *m_pRateLimit;
+	int64 m_DroppedPackets;
+	int64 m_DroppedBytes;
+
+	CThreadSendQueue *m_pThreadSendQueue;
+	NETWAIT m_ThreadSendWait;
+
+	void SendRaw(const NETADDR *pAddr, const void *pData, int DataSize);
+
 public:
 	CNetBase();
 	~CNetBase();
 	CConfig *Config() { return m_pConfig; }
 	class IEngine *Engine() { return m_pEngine; }
 	int NetType() { return m_Socket.type; }
+	NETSOCKET Socket() const { return m_Socket; }
 	
 	void Init(NETSOCKET Socket, class CConfig *pConfig, class IConsole *pConsole, class IEngine *pEngine);
 	void Shutdown();
 	void UpdateLogHandles();
 	void Wait(int Time);
 
+	// with the send queue enabled, packets are only sent by FlushSendQueue or when the queue is full
+	void EnableSendQueue(bool Enable);
+	void FlushSendQueue();
+	int64 SentPackets() const { return m_SentPackets; }
+	int64 SendCalls() const { return m_SendCalls; }
+	int64 RecvPackets() const { return m_RecvPackets; }
+	int64 RecvCalls() const { return m_RecvCalls; }
+	int64 DroppedPackets() const { return m_DroppedPackets; }
+	int64 DroppedBytes() const { return m_DroppedBytes; }
+
+	// limits the connless and control packets per source, see sv_connless_rate
+	void SetRateLimit(class CNetRateLimit *pRateLimit) { m_pRateLimit = pRateLimit; }
+
+	// hands all packets to another thread instead of sending them, it has to call SendThreadPackets,
+	// the thread is woken up through the wait object when packets are ready
+	void SetSendThread(CThreadSendQueue *pQueue, NETWAIT Wait);
+	void SendThreadPackets(CThreadSendQueue *pQueue);
+
+	// trained huffman tables, packets name the slot that they were compressed with
+	void InitHuffmanTable(int Slot, const unsigned *pFrequencies);
+	bool HasHuffmanTable(int Slot) const { return m_apHuffmanTables[Slot] != 0; }
+
 	void SendControlMsg(const NETADDR *pAddr, TOKEN Token, int Ack, int ControlMsg, const void *pExtra, int ExtraSize);
 	void SendControlMsgWithToken(const NETADDR *pAddr, TOKEN Token, int Ack, int ControlMsg, TOKEN MyToken, bool Extended);
 	void SendPacketConnless(const NETADDR *pAddr, TOKEN Token, TOKEN ResponseToken, const void *pData, int DataSize);
-	void SendPacket(const NETADDR *pAddr, CNetPacketConstruct *pPacket);
-	int UnpackPacket(NETADDR *pAddr, unsigned char *pBuffer, CNetPacketConstruct *pPacket);
+	void SendPacket(const NETADDR *pAddr, CNetPacketConstruct *pPacket, int HuffmanSlot = -1);
+	int UnpackPacket(NETADDR *pAddr, CNetPacketConstruct *pPacket);
 };
 
 class CNetTokenManager
@@ -232,6 +314,11 @@ public:
 	void Init(CNetBase *pNetBase, int SeedTime = NET_SEEDTIME);
 	void Update();
 
+	// the net base is used to answer token requests
+	void SetNetBase(CNetBase *pNetBase) { m_pNetBase = pNetBase; }
+	// guards the seeds when the tokens are generated on several threads
+	void SetThreadSafe(bool ThreadSafe);
+
 	void GenerateSeed();
 
 	int ProcessMessage(const NETADDR *pAddr, const CNetPacketConstruct *pPacket);
@@ -251,6 +338,8 @@ private:
 
 	int m_SeedTime;
 	int64 m_NextSeedTime;
+
+	LOCK m_SeedLock;
 };
 
 typedef void(*FSendCallback)(int TrackID, void *pUser);
@@ -311,6 +400,29 @@ private:
 	const CNetTokenManager *m_pTokenManager;
 };
 
+// token buckets per source kept in a count-min sketch: a source maps to one
+// bucket in each row and is limited by the emptiest of them. sources only get
+// limited together when they share all their buckets, the memory stays fixed
+class CNetRateLimit
+{
+	enum
+	{
+		NUM_ROWS=4,
+		ROW_SIZE=4096,
+	};
+
+	// the time at which each bucket runs empty
+	int64 m_aaEmptyTime[NUM_ROWS][ROW_SIZE];
+
+public:
+	CNetRateLimit() { Reset(); }
+	void Reset();
+
+	// takes a packet from the bucket of the address, Rate is in packets per second
+	// and Burst packets can arrive at once. a rate of 0 allows everything
+	bool Allow(const NETADDR *pAddr, int Rate, int Burst, int64 Now);
+};
+
 
 class CNetConnection
 {
@@ -343,6 +455,7 @@ private:
 
 	NETSTATS m_Stats;
 	CNetBase *m_pNetBase;
+	int m_HuffmanSlot;
 
 	//
 	void Reset();
@@ -369,6 +482,10 @@ public:
 	TOKEN PeerToken() const { return m_PeerToken; }
 	class CConfig *Config() { return m_pNetBase->Config(); }
 
+	// the trained huffman table that the peer accepted, -1 for the default one
+	void SetHuffmanSlot(int Slot) { m_HuffmanSlot = Slot; }
+	int HuffmanSlot() const { return m_HuffmanSlot; }
+
 	int Update();
 	int Flush();
 
@@ -433,7 +550,6 @@ public:
 	int m_CurrentChunk;
 	int m_ClientID;
 	CNetPacketConstruct m_Data;
-	unsigned char m_aBuffer[NET_MAX_PACKETSIZE];
 
 	CNetRecvUnpacker() { Clear(); }
 	bool IsActive() { return m_Valid; }
@@ -449,10 +565,25 @@ class CNetServer : public CNetBase
 	{
 	public:
 		CNetConnection m_Connection;
+		bool m_Active;
+		NETADDR m_Addr;
+		int m_AddrHashNext;
+		int m_IPHashNext;
+	};
+
+	// slots by peer address and by ip, the lists are chained through the slots
+	enum
+	{
+		SLOT_HASH_SIZE=256,
 	};
 
 	class CNetBan *m_pNetBan;
 	CSlot m_aSlots[NET_MAX_CLIENTS];
+	int m_aAddrHash[SLOT_HASH_SIZE];
+	int m_aIPHash[SLOT_HASH_SIZE];
+	// free slots in descending order, so the lowest one is taken first
+	int m_aFreeSlots[NET_MAX_CLIENTS];
+	int m_NumFreeSlots;
 	int m_NumClients;
 	int m_MaxClients;
 	int m_MaxClientsPerIP;
@@ -465,6 +596,41 @@ class CNetServer : public CNetBase
 
 	CNetTokenManager m_TokenManager;
 	CNetTokenCache m_TokenCache;
+	CNetRateLimit m_RateLimit; // shared with the network thread, only one of them receives
+
+	// network thread, see StartThread
+	struct CThreadRecvPacket
+	{
+		NETADDR m_Addr;
+		int m_Accept;
+		CNetPacketConstruct m_Data;
+	};
+	enum
+	{
+		THREAD_RECV_QUEUE_SIZE=1024,
+	};
+	void *m_pThread;
+	volatile bool m_ThreadShutdown;
+	NETWAIT m_ThreadWait;
+	NETWAIT m_ThreadRecvWait; // owned by the game thread
+	CNetBase m_ThreadNet;
+	TSpscQueue<CThreadRecvPacket, THREAD_RECV_QUEUE_SIZE> m_ThreadRecvQueue;
+	CThreadSendQueue m_ThreadSendQueue;
+	NETFUNC_CONNLESS m_pfnConnless;
+
+	static void NetThread(void *pUser);
+	void CleanupThread();
+	// returns false if the queue to the game thread is full
+	bool ThreadRecv();
+	// returns false if the packet was handled on the network thread
+	bool ThreadProcessPacket(CThreadRecvPacket *pPacket);
+	int RecvThreadPacket(NETADDR *pAddr, int *pAccept);
+
+	static unsigned AddrHash(const NETADDR *pAddr, bool CheckPort);
+	int FindSlot(const NETADDR *pAddr) const;
+	int NumSlotsWithIP(const NETADDR *pAddr) const;
+	int AddSlot(const NETADDR *pAddr);
+	void RemoveSlot(int ClientID);
 
 public:
 	//
@@ -478,6 +644,15 @@ public:
 	int Update();
 	void AddToken(const NETADDR *pAddr, TOKEN Token) { m_TokenCache.AddToken(pAddr, Token, 0); };
 
+	// moves receiving, decoding, ban checks and token requests to a network thread,
+	// connless packets are offered to the callback on that thread first. RecvWait
+	// is interrupted whenever packets for Recv are queued
+	bool StartThread(NETFUNC_CONNLESS pfnConnless, NETWAIT RecvWait = 0);
+	void StopThread();
+	bool HasThread() const { return m_pThread != 0; }
+	// the base doing the socket io, for its statistics
+	const CNetBase *IoNet() const { return m_pThread ? &m_ThreadNet : this; }
+
 	//
 	void Drop(int ClientID, const char *pReason);
 
@@ -488,6 +663,11 @@ public:
 	//
 	void SetMaxClients(int MaxClients);
 	void SetMaxClientsPerIP(int MaxClientsPerIP);
+
+	// installs a trained huffman table for the generation, clients that used
+	// its slot fall back to the default table until they accept the new one
+	void SetHuffmanTable(int Generation, const unsigned *pFrequencies);
+	void SetClientHuffmanTable(int ClientID, int Generation);
 };
 
 class CNetConsole
@@ -511,6 +691,7 @@ public:
 	//
 	bool Open(NETADDR BindAddr, class CNetBan *pNetBan, NETFUNC_NEWCLIENT pfnNewClient, NETFUNC_DELCLIENT pfnDelClient, void *pUser);
 	void Close();
+	NETSOCKET Socket() const { return m_Socket; }
 
 	//
 	int Recv(char *pLine, int MaxLength, int *pClientID = 0);
@@ -560,6 +741,9 @@ public:
 
 	int ResetErrorString();
 
+	// installs a trained huffman table that the server offered
+	void SetHuffmanTable(int Generation, const unsigned *pFrequencies) { InitHuffmanTable(Generation%NET_HUFFMAN_TABLE_SLOTS, pFrequencies); }
+
 	// error and state
 	int State() const;
 	bool GotProblems() const;
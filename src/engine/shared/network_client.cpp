@@ -74,7 +74,7 @@ int CNetClient::Recv(CNetChunk *pChunk, TOKEN *pResponseToken)
 
 		// TODO: empty the recvinfo
 		NETADDR Addr;
-		int Result = UnpackPacket(&Addr, m_RecvUnpacker.m_aBuffer, &m_RecvUnpacker.m_Data);
+		int Result = UnpackPacket(&Addr, &m_RecvUnpacker.m_Data);
 		// no more packets for now
 		if(Result > 0)
 			break;
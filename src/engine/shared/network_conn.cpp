@@ -29,6 +29,7 @@ void CNetConnection::Reset()
 	m_Buffer.Init();
 
 	mem_zero(&m_Construct, sizeof(m_Construct));
+	m_HuffmanSlot = -1;
 }
 
 void CNetConnection::SetToken(TOKEN Token)
@@ -93,7 +94,7 @@ int CNetConnection::Flush()
 	// send of the packets
 	m_Construct.m_Ack = m_Ack;
 	m_Construct.m_Token = m_PeerToken;
-	m_pNetBase->SendPacket(&m_PeerAddr, &m_Construct);
+	m_pNetBase->SendPacket(&m_PeerAddr, &m_Construct, m_HuffmanSlot);
 
 	// update send times
 	m_LastSendTime = time_get();
@@ -0,0 +1,47 @@
+/* (c) Magnus Auvinen. See licence.txt in the root of the distribution for more information. */
+/* If you are missing that file, acquire a complete release at teeworlds.com.                */
+#include <base/math.h>
+#include <base/system.h>
+
+#include "network.h"
+
+void CNetRateLimit::Reset()
+{
+	mem_zero(m_aaEmptyTime, sizeof(m_aaEmptyTime));
+}
+
+bool CNetRateLimit::Allow(const NETADDR *pAddr, int Rate, int Burst, int64 Now)
+{
+	if(Rate <= 0)
+		return true;
+
+	// ipv6 sources are grouped by their /64, that's what a single host usually gets
+	int Length = pAddr->type == NETTYPE_IPV4 ? NETADDR_SIZE_IPV4 : NETADDR_SIZE_IPV6/2;
+	unsigned Hash1 = 2166136261u; // FNV-1a
+	for(int i = 0; i < Length; i++)
+		Hash1 = (Hash1^pAddr->ip[i])*16777619u;
+	unsigned Hash2 = (Hash1^(Hash1>>15))*2246822519u | 1;
+
+	// other sources can only add to a bucket, so the emptiest one is the closest estimate
+	int aIndex[NUM_ROWS];
+	int64 EmptyTime = 0;
+	for(int i = 0; i < NUM_ROWS; i++)
+	{
+		aIndex[i] = (Hash1 + i*Hash2)%ROW_SIZE;
+		EmptyTime = i == 0 ? m_aaEmptyTime[i][aIndex[i]] : min(EmptyTime, m_aaEmptyTime[i][aIndex[i]]);
+	}
+
+	// each packet fills the bucket by one interval, it holds Burst of them
+	int64 Interval = time_freq()/Rate;
+	int64 NewEmptyTime = max(EmptyTime, Now) + Interval;
+	if(NewEmptyTime - Now > Interval*Burst)
+		return false;
+
+	// only raise the buckets that are below the new level, which keeps the estimate tight
+	for(int i = 0; i < NUM_ROWS; i++)
+	{
+		if(m_aaEmptyTime[i][aIndex[i]] < NewEmptyTime)
+			m_aaEmptyTime[i][aIndex[i]] = NewEmptyTime;
+	}
+	return true;
+}
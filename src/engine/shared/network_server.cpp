@@ -23,6 +23,7 @@ bool CNetServer::Open(NETADDR BindAddr, CConfig *pConfig, IConsole *pConsole, IE
 	// init
 	m_pNetBan = pNetBan;
 	Init(Socket, pConfig, pConsole, pEngine);
+	SetRateLimit(&m_RateLimit);
 
 	m_TokenManager.Init(this);
 	m_TokenCache.Init(this, &m_TokenManager);
@@ -32,7 +33,16 @@ bool CNetServer::Open(NETADDR BindAddr, CConfig *pConfig, IConsole *pConsole, IE
 	SetMaxClientsPerIP(MaxClientsPerIP);
 
 	for(int i = 0; i < NET_MAX_CLIENTS; i++)
+	{
 		m_aSlots[i].m_Connection.Init(this, true);
+		m_aFreeSlots[i] = NET_MAX_CLIENTS-1-i;
+	}
+	m_NumFreeSlots = NET_MAX_CLIENTS;
+	for(int i = 0; i < SLOT_HASH_SIZE; i++)
+	{
+		m_aAddrHash[i] = -1;
+		m_aIPHash[i] = -1;
+	}
 
 	m_pfnNewClient = pfnNewClient;
 	m_pfnDelClient = pfnDelClient;
@@ -46,28 +56,313 @@ void CNetServer::Close()
 	for(int i = 0; i < NET_MAX_CLIENTS; i++)
 		Drop(i, "Server shutdown");
 
+	StopThread();
 	Shutdown();
 }
 
+bool CNetServer::StartThread(NETFUNC_CONNLESS pfnConnless, NETWAIT RecvWait)
+{
+	if(m_pThread)
+		return true;
+
+	// without a wait object the thread polls for packets to send
+	m_ThreadWait = net_wait_create();
+	if(m_ThreadWait && net_wait_add(m_ThreadWait, Socket()) != 0)
+	{
+		net_wait_destroy(m_ThreadWait);
+		m_ThreadWait = 0;
+	}
+
+	m_ThreadNet.Init(Socket(), Config(), 0, 0);
+	m_ThreadNet.EnableSendQueue(true);
+	m_ThreadNet.SetRateLimit(&m_RateLimit);
+	m_ThreadRecvQueue.Init();
+	m_ThreadSendQueue.Init();
+	m_pfnConnless = pfnConnless;
+	m_ThreadRecvWait = RecvWait;
+	m_TokenManager.SetThreadSafe(true);
+	m_TokenManager.SetNetBase(&m_ThreadNet);
+	SetSendThread(&m_ThreadSendQueue, m_ThreadWait);
+
+	m_ThreadShutdown = false;
+	m_pThread = thread_init(NetThread, this);
+	if(!m_pThread)
+	{
+		SetSendThread(0, 0);
+		CleanupThread();
+		return false;
+	}
+	return true;
+}
+
+void CNetServer::StopThread()
+{
+	if(!m_pThread)
+		return;
+
+	// the thread sends the queued packets before it ends
+	SetSendThread(0, 0);
+	m_ThreadShutdown = true;
+	if(m_ThreadWait)
+		net_wait_interrupt(m_ThreadWait);
+	thread_wait(m_pThread);
+	m_pThread = 0;
+	CleanupThread();
+}
+
+void CNetServer::CleanupThread()
+{
+	m_TokenManager.SetNetBase(this);
+	m_TokenManager.SetThreadSafe(false);
+	m_ThreadRecvQueue.Free();
+	m_ThreadSendQueue.Free();
+	net_wait_destroy(m_ThreadWait);
+	m_ThreadWait = 0;
+	m_ThreadRecvWait = 0;
+
+	// the socket is closed by the server itself
+	NETSOCKET Socket;
+	net_invalidate_socket(&Socket);
+	m_ThreadNet.EnableSendQueue(false);
+	m_ThreadNet.SetRateLimit(0);
+	m_ThreadNet.Init(Socket, Config(), 0, 0);
+}
+
+void CNetServer::NetThread(void *pUser)
+{
+	CNetServer *pThis = (CNetServer *)pUser;
+	while(!pThis->m_ThreadShutdown)
+	{
+		// wait for packets on the socket or from the game thread
+		if(pThis->m_ThreadWait)
+			net_wait_until(pThis->m_ThreadWait, time_get()+time_freq()/10);
+		else
+			net_socket_read_wait(pThis->Socket(), 1);
+
+		pThis->m_ThreadNet.SendThreadPackets(&pThis->m_ThreadSendQueue);
+		bool Full = !pThis->ThreadRecv();
+		pThis->m_ThreadNet.FlushSendQueue();
+		pThis->m_TokenManager.Update();
+
+		// the game thread is behind, don't spin on the packets that are still waiting
+		if(Full)
+			thread_sleep(1);
+	}
+	pThis->m_ThreadNet.SendThreadPackets(&pThis->m_ThreadSendQueue);
+	pThis->m_ThreadNet.FlushSendQueue();
+}
+
+bool CNetServer::ThreadRecv()
+{
+	bool Queued = false;
+	bool Full = false;
+	while(1)
+	{
+		CThreadRecvPacket *pPacket = m_ThreadRecvQueue.Back();
+		if(!pPacket)
+		{
+			Full = true;
+			break;
+		}
+
+		int Result = m_ThreadNet.UnpackPacket(&pPacket->m_Addr, &pPacket->m_Data);
+		// no more packets for now
+		if(Result > 0)
+			break;
+
+		if(!Result && ThreadProcessPacket(pPacket))
+		{
+			m_ThreadRecvQueue.Push();
+			Queued = true;
+		}
+	}
+	m_ThreadRecvQueue.Publish();
+
+	// wake up the game thread
+	if(Queued && m_ThreadRecvWait)
+		net_wait_interrupt(m_ThreadRecvWait);
+	return !Full;
+}
+
+bool CNetServer::ThreadProcessPacket(CThreadRecvPacket *pPacket)
+{
+	const NETADDR *pAddr = &pPacket->m_Addr;
+	const CNetPacketConstruct *pData = &pPacket->m_Data;
+
+	// check for bans
+	char aBuf[128];
+	int LastInfoQuery;
+	if(NetBan() && NetBan()->IsBanned(pAddr, aBuf, sizeof(aBuf), &LastInfoQuery))
+	{
+		// banned, reply with a message (5 second cooldown)
+		int Time = time_timestamp();
+		if(LastInfoQuery + 5 < Time)
+		{
+			m_ThreadNet.SendControlMsg(pAddr, pData->m_ResponseToken, 0, NET_CTRLMSG_CLOSE, aBuf, str_length(aBuf) + 1);
+		}
+		return false;
+	}
+
+	// the token check is done here, Recv only needs it for packets that don't belong to a connection
+	pPacket->m_Accept = 0;
+	if(!(pData->m_Flags&(NET_PACKETFLAG_CONNLESS|NET_PACKETFLAG_CONTROL)))
+		return true;
+	pPacket->m_Accept = m_TokenManager.ProcessMessage(pAddr, pData);
+
+	if(pData->m_Flags&NET_PACKETFLAG_CONNLESS)
+	{
+		if(pPacket->m_Accept <= 0)
+			return false;
+
+		if(m_pfnConnless && pData->m_ResponseToken != NET_TOKEN_NONE)
+		{
+			CNetChunk Chunk;
+			Chunk.m_ClientID = -1;
+			Chunk.m_Address = *pAddr;
+			Chunk.m_Flags = NETSENDFLAG_CONNLESS;
+			Chunk.m_DataSize = pData->m_DataSize;
+			Chunk.m_pData = pData->m_aChunkData;
+
+			unsigned char aReply[NET_MAX_PAYLOAD];
+			int ReplySize = m_pfnConnless(&Chunk, aReply, sizeof(aReply), m_UserPtr);
+			if(ReplySize > 0)
+			{
+				m_ThreadNet.SendPacketConnless(pAddr, pData->m_ResponseToken, m_TokenManager.GenerateToken(pAddr), aReply, ReplySize);
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// token requests are answered by the token manager
+	if(pData->m_aChunkData[0] == NET_CTRLMSG_TOKEN && pPacket->m_Accept <= 0)
+		return false;
+	return true;
+}
+
+int CNetServer::RecvThreadPacket(NETADDR *pAddr, int *pAccept)
+{
+	if(!m_ThreadRecvQueue.Size())
+		return 1;
+
+	CThreadRecvPacket *pPacket = m_ThreadRecvQueue.Front();
+	*pAddr = pPacket->m_Addr;
+	*pAccept = pPacket->m_Accept;
+	m_RecvUnpacker.m_Data = pPacket->m_Data;
+	m_ThreadRecvQueue.Pop();
+	return 0;
+}
+
 void CNetServer::Drop(int ClientID, const char *pReason)
 {
-	if(ClientID < 0 || ClientID >= NET_MAX_CLIENTS || m_aSlots[ClientID].m_Connection.State() == NET_CONNSTATE_OFFLINE)
+	if(ClientID < 0 || ClientID >= NET_MAX_CLIENTS || !m_aSlots[ClientID].m_Active)
 		return;
 
 	if(m_pfnDelClient)
 		m_pfnDelClient(ClientID, pReason, m_UserPtr);
 
+	// the connection can already be closed by itself (out of buffer), the slot still has to be freed
 	m_aSlots[ClientID].m_Connection.Disconnect(pReason);
+	RemoveSlot(ClientID);
 	m_NumClients--;
 }
 
+unsigned CNetServer::AddrHash(const NETADDR *pAddr, bool CheckPort)
+{
+	// FNV-1a
+	unsigned Hash = 2166136261u;
+	int Length = pAddr->type == NETTYPE_IPV4 ? NETADDR_SIZE_IPV4 : NETADDR_SIZE_IPV6;
+	for(int i = 0; i < Length; i++)
+		Hash = (Hash^pAddr->ip[i])*16777619u;
+	if(CheckPort)
+	{
+		Hash = (Hash^(pAddr->port&0xff))*16777619u;
+		Hash = (Hash^(pAddr->port>>8))*16777619u;
+	}
+	return Hash%SLOT_HASH_SIZE;
+}
+
+int CNetServer::FindSlot(const NETADDR *pAddr) const
+{
+	for(int i = m_aAddrHash[AddrHash(pAddr, true)]; i != -1; i = m_aSlots[i].m_AddrHashNext)
+	{
+		if(net_addr_comp(&m_aSlots[i].m_Addr, pAddr, true) == 0)
+			return i;
+	}
+	return -1;
+}
+
+int CNetServer::NumSlotsWithIP(const NETADDR *pAddr) const
+{
+	int Num = 0;
+	for(int i = m_aIPHash[AddrHash(pAddr, false)]; i != -1; i = m_aSlots[i].m_IPHashNext)
+	{
+		if(net_addr_comp(&m_aSlots[i].m_Addr, pAddr, false) == 0)
+			Num++;
+	}
+	return Num;
+}
+
+int CNetServer::AddSlot(const NETADDR *pAddr)
+{
+	if(m_NumFreeSlots == 0)
+		return -1;
+
+	int ClientID = m_aFreeSlots[--m_NumFreeSlots];
+	CSlot *pSlot = &m_aSlots[ClientID];
+	pSlot->m_Active = true;
+	pSlot->m_Addr = *pAddr;
+
+	unsigned Hash = AddrHash(pAddr, true);
+	pSlot->m_AddrHashNext = m_aAddrHash[Hash];
+	m_aAddrHash[Hash] = ClientID;
+
+	Hash = AddrHash(pAddr, false);
+	pSlot->m_IPHashNext = m_aIPHash[Hash];
+	m_aIPHash[Hash] = ClientID;
+	return ClientID;
+}
+
+void CNetServer::RemoveSlot(int ClientID)
+{
+	const NETADDR *pAddr = &m_aSlots[ClientID].m_Addr;
+	for(int *pIndex = &m_aAddrHash[AddrHash(pAddr, true)]; *pIndex != -1; pIndex = &m_aSlots[*pIndex].m_AddrHashNext)
+	{
+		if(*pIndex == ClientID)
+		{
+			*pIndex = m_aSlots[ClientID].m_AddrHashNext;
+			break;
+		}
+	}
+	for(int *pIndex = &m_aIPHash[AddrHash(pAddr, false)]; *pIndex != -1; pIndex = &m_aSlots[*pIndex].m_IPHashNext)
+	{
+		if(*pIndex == ClientID)
+		{
+			*pIndex = m_aSlots[ClientID].m_IPHashNext;
+			break;
+		}
+	}
+	m_aSlots[ClientID].m_Active = false;
+
+	// keep the free slots sorted
+	int i = m_NumFreeSlots++;
+	for(; i > 0 && m_aFreeSlots[i-1] < ClientID; i--)
+		m_aFreeSlots[i] = m_aFreeSlots[i-1];
+	m_aFreeSlots[i] = ClientID;
+}
+
 int CNetServer::Update()
 {
 	int64 Now = time_get();
 	for(int i = 0; i < NET_MAX_CLIENTS; i++)
 	{
 		if(m_aSlots[i].m_Connection.State() == NET_CONNSTATE_OFFLINE)
+		{
+			// closed by itself since the last update
+			if(m_aSlots[i].m_Active)
+				Drop(i, m_aSlots[i].m_Connection.ErrorString());
 			continue;
+		}
 
 		m_aSlots[i].m_Connection.Update();
 		if(m_aSlots[i].m_Connection.State() == NET_CONNSTATE_ERROR)
@@ -82,7 +377,9 @@ int CNetServer::Update()
 		}
 	}
 
-	m_TokenManager.Update();
+	// the network thread renews the token seeds itself
+	if(!m_pThread)
+		m_TokenManager.Update();
 	m_TokenCache.Update();
 
 	return 0;
@@ -101,17 +398,22 @@ int CNetServer::Recv(CNetChunk *pChunk, TOKEN *pResponseToken)
 
 		// TODO: empty the recvinfo
 		NETADDR Addr;
-		int Result = UnpackPacket(&Addr, m_RecvUnpacker.m_aBuffer, &m_RecvUnpacker.m_Data);
+		int Accept = 0;
+		int Result;
+		if(m_pThread)
+			Result = RecvThreadPacket(&Addr, &Accept);
+		else
+			Result = UnpackPacket(&Addr, &m_RecvUnpacker.m_Data);
 		// no more packets for now
 		if(Result > 0)
 			break;
 
 		if(!Result)
 		{
-			// check for bans
+			// check for bans, the network thread already did
 			char aBuf[128];
 			int LastInfoQuery;
-			if(NetBan() && NetBan()->IsBanned(&Addr, aBuf, sizeof(aBuf), &LastInfoQuery))
+			if(!m_pThread && NetBan() && NetBan()->IsBanned(&Addr, aBuf, sizeof(aBuf), &LastInfoQuery))
 			{
 				// banned, reply with a message (5 second cooldown)
 				int Time = time_timestamp();
@@ -122,42 +424,39 @@ int CNetServer::Recv(CNetChunk *pChunk, TOKEN *pResponseToken)
 				continue;
 			}
 
-			bool Found = false;
-			// try to find matching slot
-			for(int i = 0; i < NET_MAX_CLIENTS; i++)
+			// try to find matching slot, a closed connection gives its slot up first
+			int Slot = FindSlot(&Addr);
+			if(Slot != -1 && m_aSlots[Slot].m_Connection.State() == NET_CONNSTATE_OFFLINE)
 			{
-				if(m_aSlots[i].m_Connection.State() == NET_CONNSTATE_OFFLINE)
-					continue;
-
-				if(net_addr_comp(m_aSlots[i].m_Connection.PeerAddress(), &Addr, true) == 0)
+				Drop(Slot, m_aSlots[Slot].m_Connection.ErrorString());
+				Slot = -1;
+			}
+			if(Slot != -1)
+			{
+				if(m_aSlots[Slot].m_Connection.Feed(&m_RecvUnpacker.m_Data, &Addr))
 				{
-					if(m_aSlots[i].m_Connection.Feed(&m_RecvUnpacker.m_Data, &Addr))
+					if(m_RecvUnpacker.m_Data.m_DataSize)
 					{
-						if(m_RecvUnpacker.m_Data.m_DataSize)
+						if(!(m_RecvUnpacker.m_Data.m_Flags&NET_PACKETFLAG_CONNLESS))
+							m_RecvUnpacker.Start(&Addr, &m_aSlots[Slot].m_Connection, Slot);
+						else
 						{
-							if(!(m_RecvUnpacker.m_Data.m_Flags&NET_PACKETFLAG_CONNLESS))
-								m_RecvUnpacker.Start(&Addr, &m_aSlots[i].m_Connection, i);
-							else
-							{
-								pChunk->m_Flags = NETSENDFLAG_CONNLESS;
-								pChunk->m_Address = *m_aSlots[i].m_Connection.PeerAddress();
-								pChunk->m_ClientID = i;
-								pChunk->m_DataSize = m_RecvUnpacker.m_Data.m_DataSize;
-								pChunk->m_pData = m_RecvUnpacker.m_Data.m_aChunkData;
-								if(pResponseToken)
-									*pResponseToken = NET_TOKEN_NONE;
-								return 1;
-							}
+							pChunk->m_Flags = NETSENDFLAG_CONNLESS;
+							pChunk->m_Address = *m_aSlots[Slot].m_Connection.PeerAddress();
+							pChunk->m_ClientID = Slot;
+							pChunk->m_DataSize = m_RecvUnpacker.m_Data.m_DataSize;
+							pChunk->m_pData = m_RecvUnpacker.m_Data.m_aChunkData;
+							if(pResponseToken)
+								*pResponseToken = NET_TOKEN_NONE;
+							return 1;
 						}
 					}
-					Found = true;
 				}
-			}
-
-			if(Found)
 				continue;
+			}
 
-			int Accept = m_TokenManager.ProcessMessage(&Addr, &m_RecvUnpacker.m_Data);
+			if(!m_pThread)
+				Accept = m_TokenManager.ProcessMessage(&Addr, &m_RecvUnpacker.m_Data);
 			if(Accept <= 0)
 				continue;
 
@@ -174,41 +473,22 @@ int CNetServer::Recv(CNetChunk *pChunk, TOKEN *pResponseToken)
 					}
 
 					// only allow a specific number of players with the same ip
-					int FoundAddr = 1;
-					
-					bool Continue = false;
-					for(int i = 0; i < NET_MAX_CLIENTS; i++)
+					if(NumSlotsWithIP(&Addr) >= m_MaxClientsPerIP)
 					{
-						if(m_aSlots[i].m_Connection.State() == NET_CONNSTATE_OFFLINE)
-							continue;
-
-						if(!net_addr_comp(&Addr, m_aSlots[i].m_Connection.PeerAddress(), false))
-						{
-							if(FoundAddr++ >= m_MaxClientsPerIP)
-							{
-								char aBuf[128];
-								str_format(aBuf, sizeof(aBuf), "Only %d players with the same IP are allowed", m_MaxClientsPerIP);
-								SendControlMsg(&Addr, m_RecvUnpacker.m_Data.m_ResponseToken, 0, NET_CTRLMSG_CLOSE, aBuf, str_length(aBuf) + 1);
-								Continue = true;
-								break;
-							}
-						}
-					}
-
-					if(Continue)
+						char aBuf[128];
+						str_format(aBuf, sizeof(aBuf), "Only %d players with the same IP are allowed", m_MaxClientsPerIP);
+						SendControlMsg(&Addr, m_RecvUnpacker.m_Data.m_ResponseToken, 0, NET_CTRLMSG_CLOSE, aBuf, str_length(aBuf) + 1);
 						continue;
+					}
 
-					for(int i = 0; i < NET_MAX_CLIENTS; i++)
+					int ClientID = AddSlot(&Addr);
+					if(ClientID != -1)
 					{
-						if(m_aSlots[i].m_Connection.State() == NET_CONNSTATE_OFFLINE)
-						{
-							m_NumClients++;
-							m_aSlots[i].m_Connection.SetToken(m_RecvUnpacker.m_Data.m_Token);
-							m_aSlots[i].m_Connection.Feed(&m_RecvUnpacker.m_Data, &Addr);
-							if(m_pfnNewClient)
-								m_pfnNewClient(i, m_UserPtr);
-							break;
-						}
+						m_NumClients++;
+						m_aSlots[ClientID].m_Connection.SetToken(m_RecvUnpacker.m_Data.m_Token);
+						m_aSlots[ClientID].m_Connection.Feed(&m_RecvUnpacker.m_Data, &Addr);
+						if(m_pfnNewClient)
+							m_pfnNewClient(ClientID, m_UserPtr);
 					}
 				}
 				else if(m_RecvUnpacker.m_Data.m_aChunkData[0] == NET_CTRLMSG_TOKEN)
@@ -240,21 +520,9 @@ int CNetServer::Send(CNetChunk *pChunk, TOKEN Token)
 			return -1;
 		}
 
+		// upgrade the packet, now that we know its recipent
 		if(pChunk->m_ClientID == -1)
-		{
-			for(int i = 0; i < NET_MAX_CLIENTS; i++)
-			{
-				if(m_aSlots[i].m_Connection.State() == NET_CONNSTATE_OFFLINE)
-					continue;
-
-				if(net_addr_comp(&pChunk->m_Address, m_aSlots[i].m_Connection.PeerAddress(), true) == 0)
-				{
-					// upgrade the packet, now that we know its recipent
-					pChunk->m_ClientID = i;
-					break;
-				}
-			}
-		}
+			pChunk->m_ClientID = FindSlot(&pChunk->m_Address);
 
 		if(Token != NET_TOKEN_NONE)
 		{
@@ -314,3 +582,20 @@ void CNetServer::SetMaxClientsPerIP(int MaxClientsPerIP)
 {
 	m_MaxClientsPerIP = clamp(MaxClientsPerIP, 1, int(NET_MAX_CLIENTS));
 }
+
+void CNetServer::SetHuffmanTable(int Generation, const unsigned *pFrequencies)
+{
+	int Slot = Generation%NET_HUFFMAN_TABLE_SLOTS;
+	for(int i = 0; i < NET_MAX_CLIENTS; i++)
+	{
+		if(m_aSlots[i].m_Connection.HuffmanSlot() == Slot)
+			m_aSlots[i].m_Connection.SetHuffmanSlot(-1);
+	}
+	InitHuffmanTable(Slot, pFrequencies);
+}
+
+void CNetServer::SetClientHuffmanTable(int ClientID, int Generation)
+{
+	int Slot = Generation%NET_HUFFMAN_TABLE_SLOTS;
+	m_aSlots[ClientID].m_Connection.SetHuffmanSlot(HasHuffmanTable(Slot) ? Slot : -1);
+}
@@ -23,9 +23,24 @@ void CNetTokenManager::Init(CNetBase *pNetBase, int SeedTime)
 {
 	m_pNetBase = pNetBase;
 	m_SeedTime = SeedTime;
+	m_SeedLock = 0;
 	GenerateSeed();
 }
 
+void CNetTokenManager::SetThreadSafe(bool ThreadSafe)
+{
+	if(ThreadSafe == (m_SeedLock != 0))
+		return;
+
+	if(ThreadSafe)
+		m_SeedLock = lock_create();
+	else
+	{
+		lock_destroy(m_SeedLock);
+		m_SeedLock = 0;
+	}
+}
+
 void CNetTokenManager::Update()
 {
 	if(time_get() > m_NextSeedTime)
@@ -70,19 +85,31 @@ int CNetTokenManager::ProcessMessage(const NETADDR *pAddr, const CNetPacketConst
 void CNetTokenManager::GenerateSeed()
 {
 	static const NETADDR NullAddr = { 0 };
-	m_PrevSeed = m_Seed;
-
-	secure_random_fill(&m_Seed, sizeof(m_Seed));
+	int64 Seed;
+	secure_random_fill(&Seed, sizeof(Seed));
+	TOKEN GlobalToken = GenerateToken(&NullAddr, Seed);
 
+	if(m_SeedLock)
+		lock_wait(m_SeedLock);
+	m_PrevSeed = m_Seed;
+	m_Seed = Seed;
 	m_PrevGlobalToken = m_GlobalToken;
-	m_GlobalToken = GenerateToken(&NullAddr);
+	m_GlobalToken = GlobalToken;
+	if(m_SeedLock)
+		lock_unlock(m_SeedLock);
 
 	m_NextSeedTime = time_get() + time_freq() * m_SeedTime;
 }
 
 TOKEN CNetTokenManager::GenerateToken(const NETADDR *pAddr) const
 {
-	return GenerateToken(pAddr, m_Seed);
+	if(!m_SeedLock)
+		return GenerateToken(pAddr, m_Seed);
+
+	lock_wait(m_SeedLock);
+	int64 Seed = m_Seed;
+	lock_unlock(m_SeedLock);
+	return GenerateToken(pAddr, Seed);
 }
 
 TOKEN CNetTokenManager::GenerateToken(const NETADDR *pAddr, int64 Seed)
@@ -111,21 +138,30 @@ TOKEN CNetTokenManager::GenerateToken(const NETADDR *pAddr, int64 Seed)
 
 bool CNetTokenManager::CheckToken(const NETADDR *pAddr, TOKEN Token, TOKEN ResponseToken, bool *BroadcastResponse)
 {
-	TOKEN CurrentToken = GenerateToken(pAddr, m_Seed);
+	if(m_SeedLock)
+		lock_wait(m_SeedLock);
+	int64 Seed = m_Seed;
+	int64 PrevSeed = m_PrevSeed;
+	TOKEN GlobalToken = m_GlobalToken;
+	TOKEN PrevGlobalToken = m_PrevGlobalToken;
+	if(m_SeedLock)
+		lock_unlock(m_SeedLock);
+
+	TOKEN CurrentToken = GenerateToken(pAddr, Seed);
 	if(CurrentToken == Token)
 		return true;
 
-	if(GenerateToken(pAddr, m_PrevSeed) == Token)
+	if(GenerateToken(pAddr, PrevSeed) == Token)
 	{
 		// no need to notify the peer, just a one time thing
 		return true;
 	}
-	else if(Token == m_GlobalToken)
+	else if(Token == GlobalToken)
 	{
 		*BroadcastResponse = true;
 		return true;
 	}
-	else if(Token == m_PrevGlobalToken)
+	else if(Token == PrevGlobalToken)
 	{
 		// no need to notify the peer, just a broadcast token response
 		*BroadcastResponse = true;
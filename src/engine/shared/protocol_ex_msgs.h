@@ -21,3 +21,5 @@ UUID(NETMSG_WHATIS,         "what-is@ddnet.tw")
 UUID(NETMSG_ITIS,           "it-is@ddnet.tw")
 UUID(NETMSG_IDONTKNOW,      "i-dont-know@ddnet.tw")
 UUID(NETMSG_MYOWNMESSAGE,   "my-own-message@heinrich5991.de")
+UUID(NETMSG_HUFFMAN_TABLE,     "huffman-table@teeworlds.com")
+UUID(NETMSG_HUFFMAN_TABLE_ACK, "huffman-table-ack@teeworlds.com")
@@ -121,6 +121,10 @@ void *CRingBufferBase::Allocate(int Size)
 	// set next block
 	m_pProduce = NextBlock(pBlock);
 
+	// the buffer was empty, the consume pointer might still stand on a free block
+	if(m_pConsume->m_Free)
+		m_pConsume = pBlock;
+
 	// set as used and return the item pointer
 	pBlock->m_Free = 0;
 	return (void *)(pBlock+1);
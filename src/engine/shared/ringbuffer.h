@@ -3,6 +3,8 @@
 #ifndef ENGINE_SHARED_RINGBUFFER_H
 #define ENGINE_SHARED_RINGBUFFER_H
 
+#include <base/tl/threading.h>
+
 typedef struct RINGBUFFER RINGBUFFER;
 
 class CRingBufferBase
@@ -64,4 +66,60 @@ public:
 	T *Last() { return (T*)CRingBufferBase::Last(); }
 };
 
+/*
+	Queue of fixed size items between exactly one producer and one consumer thread.
+	The producer fills Back(), adds it with Push() and makes the pushed items visible
+	with Publish(). The consumer reads Front() and frees the items with Pop().
+	TSIZE has to be a power of two.
+*/
+template<typename T, int TSIZE>
+class TSpscQueue
+{
+	T *m_pItems;
+	volatile unsigned m_Read;
+	volatile unsigned m_Published;
+	unsigned m_Write;
+
+public:
+	TSpscQueue() : m_pItems(0), m_Read(0), m_Published(0), m_Write(0) {}
+	~TSpscQueue() { Free(); }
+
+	void Init()
+	{
+		Free();
+		m_pItems = (T *)mem_alloc(sizeof(T)*TSIZE, 1);
+		m_Read = 0;
+		m_Published = 0;
+		m_Write = 0;
+	}
+	void Free()
+	{
+		mem_free(m_pItems);
+		m_pItems = 0;
+	}
+
+	// producer
+	T *Back() { return m_Write-m_Read < (unsigned)TSIZE ? &m_pItems[m_Write%TSIZE] : 0; }
+	void Push() { m_Write++; }
+	void Publish()
+	{
+		sync_barrier();
+		m_Published = m_Write;
+	}
+
+	// consumer
+	int Size()
+	{
+		int Size = m_Published-m_Read;
+		sync_barrier();
+		return Size;
+	}
+	T *Front(int Index = 0) { return &m_pItems[(m_Read+Index)%TSIZE]; }
+	void Pop(int Num = 1)
+	{
+		sync_barrier();
+		m_Read += Num;
+	}
+};
+
 #endif
@@ -1,9 +1,12 @@
 /* (c) Magnus Auvinen. See licence.txt in the root of the distribution for more information. */
 /* If you are missing that file, acquire a complete release at teeworlds.com.                */
+#include <base/math.h>
 #include <base/tl/base.h>
 #include <base/tl/algorithm.h>
 #include "snapshot.h"
 #include "compression.h"
+#include "ringbuffer.h"
+#include "snapshot_simd.h"
 #include "uuid_manager.h"
 
 // CSnapshot
@@ -20,14 +23,70 @@ int CSnapshot::GetItemSize(int Index) const
 	return (Offsets()[Index+1] - Offsets()[Index]) - sizeof(CSnapshotItem);
 }
 
-int CSnapshot::GetItemIndex(int Type, int ID) const
+static CUuid GetItemUuid(const CSnapshotItem *pTypeItem)
+{
+	CUuid Uuid;
+	for(int i = 0; i < (int)sizeof(CUuid) / 4; i++)
+	{
+		Uuid.m_aData[i * 4 + 0] = pTypeItem->Data()[i] >> 24;
+		Uuid.m_aData[i * 4 + 1] = pTypeItem->Data()[i] >> 16;
+		Uuid.m_aData[i * 4 + 2] = pTypeItem->Data()[i] >> 8;
+		Uuid.m_aData[i * 4 + 3] = pTypeItem->Data()[i];
+	}
+	return Uuid;
+}
+
+void CSnapshot::FillTypeCache(CSnapshotTypeCache *pCache) const
+{
+	pCache->m_Valid = true;
+	pCache->m_Complete = true;
+	pCache->m_NumTypes = 0;
+
+	// the uuids of the extended types are NETOBJTYPE_EX items, which sort first
+	for(int i = 0; i < m_NumItems && SortedKeys()[i] < ((1<<16)|0); i++)
+	{
+		if(GetItemSize(i) < (int)sizeof(CUuid))
+			continue;
+		int Slot = MAX_TYPE - (SortedKeys()[i]&0xffff);
+		if(Slot < 0 || Slot >= CSnapshotTypeCache::MAX_EXTENDED_TYPES)
+		{
+			pCache->m_Complete = false;
+			continue;
+		}
+
+		while(pCache->m_NumTypes <= Slot)
+			pCache->m_aTypes[pCache->m_NumTypes++] = CSnapshotTypeCache::TYPE_NONE;
+
+		pCache->m_aTypes[Slot] = g_UuidManager.LookupUuid(GetItemUuid(GetItem(i)));
+	}
+}
+
+int CSnapshot::GetItemIndex(int Type, int ID, CSnapshotTypeCache *pCache) const
 {
 	int InternalType = -1;
 	if(Type < OFFSET_UUID)
 	{
 		InternalType = Type;
 	}
-	else
+	else if(pCache)
+	{
+		if(!pCache->m_Valid)
+			FillTypeCache(pCache);
+		// like the search below, the lowest internal type wins
+		for(int i = pCache->m_NumTypes-1; i >= 0; i--)
+		{
+			if(pCache->m_aTypes[i] == Type)
+			{
+				InternalType = MAX_TYPE - i;
+				break;
+			}
+		}
+		if(InternalType == -1 && pCache->m_Complete)
+			return -1;
+	}
+
+	// extended types that don't fit into the cache are looked up every time
+	if(InternalType == -1 && Type >= OFFSET_UUID)
 	{
 		CUuid Uuid = g_UuidManager.GetUuid(Type);
 		int aUuid[sizeof(CUuid) / 4];
@@ -67,7 +126,7 @@ int CSnapshot::GetItemIndex(int Type, int ID) const
 	return Index;
 }
 
-int CSnapshot::GetItemType(int Index) const
+int CSnapshot::GetItemType(int Index, CSnapshotTypeCache *pCache) const
 {
 	int InternalType = GetItem(Index)->Type();
 	if(InternalType < OFFSET_UUID_TYPE)
@@ -75,23 +134,23 @@ int CSnapshot::GetItemType(int Index) const
 		return InternalType;
 	}
 
-	int TypeItemIndex = GetItemIndex(0, InternalType); // NETOBJTYPE_EX
-	if(TypeItemIndex == -1 || GetItemSize(TypeItemIndex) < (int)sizeof(CUuid))
+	int Slot = MAX_TYPE - InternalType;
+	if(pCache && Slot < CSnapshotTypeCache::MAX_EXTENDED_TYPES)
 	{
-		return InternalType;
+		if(!pCache->m_Valid)
+			FillTypeCache(pCache);
+		if(Slot >= pCache->m_NumTypes || pCache->m_aTypes[Slot] == CSnapshotTypeCache::TYPE_NONE)
+			return InternalType;
+		return pCache->m_aTypes[Slot];
 	}
 
-	const CSnapshotItem *pTypeItem = GetItem(TypeItemIndex);
-	CUuid Uuid;
-	for(int i = 0; i < (int)sizeof(CUuid) / 4; i++)
+	int TypeItemIndex = GetItemIndex(0, InternalType); // NETOBJTYPE_EX
+	if(TypeItemIndex == -1 || GetItemSize(TypeItemIndex) < (int)sizeof(CUuid))
 	{
-		Uuid.m_aData[i * 4 + 0] = pTypeItem->Data()[i] >> 24;
-		Uuid.m_aData[i * 4 + 1] = pTypeItem->Data()[i] >> 16;
-		Uuid.m_aData[i * 4 + 2] = pTypeItem->Data()[i] >> 8;
-		Uuid.m_aData[i * 4 + 3] = pTypeItem->Data()[i];
+		return InternalType;
 	}
 
-	return g_UuidManager.LookupUuid(Uuid);
+	return g_UuidManager.LookupUuid(GetItemUuid(GetItem(TypeItemIndex)));
 }
 
 void CSnapshot::InvalidateItem(int Index)
@@ -117,19 +176,53 @@ int CSnapshot::Serialize(char *pDstData)
 
 int CSnapshot::Crc() const
 {
-	int Crc = 0;
+	const CSnapshotSimd *pSimd = SnapshotSimd();
+	if(!m_NumItems)
+		return 0;
 
-	for(int i = 0; i < m_NumItems; i++)
+	// the items are stored back to back, so when all of them are int aligned
+	// the whole data can be summed at once and the item keys subtracted again
+	unsigned Keys = 0;
+	bool Aligned = (m_DataSize%4) == 0;
+	for(int i = 0; i < m_NumItems && Aligned; i++)
 	{
-		const CSnapshotItem *pItem = GetItem(i);
-		int Size = GetItemSize(i);
-
-		for(int b = 0; b < Size/4; b++)
-			Crc += pItem->Data()[b];
+		Aligned = (Offsets()[i]%4) == 0;
+		Keys += (unsigned)GetItem(i)->Key();
 	}
+	if(Aligned)
+	{
+		const int *pData = (const int *)(DataStart() + Offsets()[0]);
+		return (int)((unsigned)pSimd->m_pfnSum(pData, (m_DataSize - Offsets()[0])/4) - Keys);
+	}
+
+	int Crc = 0;
+	for(int i = 0; i < m_NumItems; i++)
+		Crc += pSimd->m_pfnSum(GetItem(i)->Data(), GetItemSize(i)/4);
 	return Crc;
 }
 
+int64 CSnapshot::Hash() const
+{
+	// hash over the whole snapshot including keys and offsets,
+	// two independent lanes to keep the multiplications pipelined
+	const unsigned *pData = (const unsigned *)this;
+	int Num = Size()/4;
+	unsigned long long aHash[2] = { 0xcbf29ce484222325ULL, 0x84222325cbf29ce4ULL };
+	int i = 0;
+	for(; i+1 < Num; i += 2)
+	{
+		aHash[0] = (aHash[0]^pData[i])*0x9e3779b97f4a7c15ULL;
+		aHash[1] = (aHash[1]^pData[i+1])*0x9e3779b97f4a7c15ULL;
+		aHash[0] ^= aHash[0]>>32;
+		aHash[1] ^= aHash[1]>>32;
+	}
+	if(i < Num)
+		aHash[0] = (aHash[0]^pData[i])*0x9e3779b97f4a7c15ULL;
+
+	unsigned long long Hash = (aHash[0]^(aHash[1]*0xff51afd7ed558ccdULL)^Num)*0xc4ceb9fe1a85ec53ULL;
+	return (int64)(Hash^(Hash>>29));
+}
+
 void CSnapshot::DebugDump() const
 {
 	dbg_msg("snapshot", "data_size=%d num_items=%d", m_DataSize, m_NumItems);
@@ -146,84 +239,73 @@ void CSnapshot::DebugDump() const
 
 // CSnapshotDelta
 
-struct CItemList
+// open addressing hash from item key to item index
+class CItemIndex
 {
-	int m_Num;
-	int m_aKeys[64];
-	int m_aIndex[64];
-};
+	struct CSlot
+	{
+		int m_Key;
+		int m_Index; // -1 = empty
+	};
 
-enum
-{
-	HASHLIST_SIZE = 256,
-};
+	CSlot *m_pSlots;
+	int m_Capacity;
+	int m_Shift;
 
-static void GenerateHash(CItemList *pHashlist, const CSnapshot *pSnapshot)
-{
-	for(int i = 0; i < HASHLIST_SIZE; i++)
-		pHashlist[i].m_Num = 0;
+	unsigned Slot(int Key) const { return ((unsigned)Key*2654435761u)>>m_Shift; }
 
-	for(int i = 0; i < pSnapshot->NumItems(); i++)
+public:
+	CItemIndex() : m_pSlots(0), m_Capacity(0), m_Shift(32) {}
+	~CItemIndex() { mem_free(m_pSlots); }
+
+	void Build(const CSnapshot *pSnapshot)
 	{
-		int Key = pSnapshot->GetItem(i)->Key();
-		int HashID = ((Key>>12)&0xf0) | (Key&0xf);
-		if(pHashlist[HashID].m_Num != 64)
+		// keep the load factor at or below one half
+		const int NumItems = pSnapshot->NumItems();
+		int Bits = 4;
+		while((1<<Bits) < NumItems*2)
+			Bits++;
+		const int Size = 1<<Bits;
+		if(Size > m_Capacity)
 		{
-			pHashlist[HashID].m_aIndex[pHashlist[HashID].m_Num] = i;
-			pHashlist[HashID].m_aKeys[pHashlist[HashID].m_Num] = Key;
-			pHashlist[HashID].m_Num++;
+			mem_free(m_pSlots);
+			m_pSlots = (CSlot *)mem_alloc(sizeof(CSlot)*Size, 1);
+			m_Capacity = Size;
 		}
-	}
-}
+		m_Shift = 32-Bits;
+		for(int i = 0; i < Size; i++)
+			m_pSlots[i].m_Index = -1;
 
-static int GetItemIndexHashed(int Key, const CItemList *pHashlist)
-{
-		int HashID = ((Key>>12)&0xf0) | (Key&0xf);
-		for(int i = 0; i < pHashlist[HashID].m_Num; i++)
+		const unsigned Mask = Size-1;
+		for(int i = 0; i < NumItems; i++)
 		{
-			if(pHashlist[HashID].m_aKeys[i] == Key)
-				return pHashlist[HashID].m_aIndex[i];
+			int Key = pSnapshot->GetItem(i)->Key();
+			unsigned s = Slot(Key);
+			while(m_pSlots[s].m_Index != -1)
+				s = (s+1)&Mask;
+			m_pSlots[s].m_Key = Key;
+			m_pSlots[s].m_Index = i;
+		}
 	}
 
-	return -1;
-}
-
-static int DiffItem(const int *pPast, const int *pCurrent, int *pOut, int Size)
-{
-	int Needed = 0;
-	while(Size)
+	int Find(int Key) const
 	{
-		*pOut = *pCurrent-*pPast;
-		Needed |= *pOut;
-		pOut++;
-		pPast++;
-		pCurrent++;
-		Size--;
+		const unsigned Mask = (1u<<(32-m_Shift))-1;
+		for(unsigned s = Slot(Key); m_pSlots[s].m_Index != -1; s = (s+1)&Mask)
+		{
+			if(m_pSlots[s].m_Key == Key)
+				return m_pSlots[s].m_Index;
+		}
+		return -1;
 	}
+};
 
-	return Needed;
-}
+// reused between calls, one per thread as deltas get created in parallel
+static thread_local CItemIndex gs_ItemIndex;
 
 void CSnapshotDelta::UndiffItem(const int *pPast, const int *pDiff, int *pOut, int Size)
 {
-	while(Size)
-	{
-		*pOut = *pPast+*pDiff;
-
-		if(*pDiff == 0)
-			m_aSnapshotDataRate[m_SnapshotCurrent] += 1;
-		else
-		{
-			unsigned char aBuf[16];
-			unsigned char *pEnd = CVariableInt::Pack(aBuf, *pDiff);
-			m_aSnapshotDataRate[m_SnapshotCurrent] += (int)(pEnd - (unsigned char*)aBuf) * 8;
-		}
-
-		pOut++;
-		pPast++;
-		pDiff++;
-		Size--;
-	}
+	m_aSnapshotDataRate[m_SnapshotCurrent] += SnapshotSimd()->m_pfnUndiffItem(pPast, pDiff, pOut, Size);
 }
 
 CSnapshotDelta::CSnapshotDelta()
@@ -257,19 +339,20 @@ int CSnapshotDelta::CreateDelta(const CSnapshot *pFrom, CSnapshot *pTo, void *pD
 	const CSnapshotItem *pCurItem;
 	const CSnapshotItem *pPastItem;
 	int SizeCount = 0;
+	const CSnapshotSimd *pSimd = SnapshotSimd();
 
 	pDelta->m_NumDeletedItems = 0;
 	pDelta->m_NumUpdateItems = 0;
 	pDelta->m_NumTempItems = 0;
 
-	CItemList Hashlist[HASHLIST_SIZE];
-	GenerateHash(Hashlist, pTo);
+	CItemIndex *pIndex = &gs_ItemIndex;
+	pIndex->Build(pTo);
 
 	// pack deleted stuff
 	for(i = 0; i < pFrom->NumItems(); i++)
 	{
 		pFromItem = pFrom->GetItem(i);
-		if(GetItemIndexHashed(pFromItem->Key(), Hashlist) == -1)
+		if(pIndex->Find(pFromItem->Key()) == -1)
 		{
 			// deleted
 			pDelta->m_NumDeletedItems++;
@@ -278,7 +361,7 @@ int CSnapshotDelta::CreateDelta(const CSnapshot *pFrom, CSnapshot *pTo, void *pD
 		}
 	}
 
-	GenerateHash(Hashlist, pFrom);
+	pIndex->Build(pFrom);
 	int aPastIndecies[1024];
 
 	// fetch previous indices
@@ -287,7 +370,7 @@ int CSnapshotDelta::CreateDelta(const CSnapshot *pFrom, CSnapshot *pTo, void *pD
 	for(i = 0; i < NumItems; i++)
 	{
 		pCurItem = pTo->GetItem(i); // O(1) .. O(n)
-		aPastIndecies[i] = GetItemIndexHashed(pCurItem->Key(), Hashlist); // O(n) .. O(n^n)
+		aPastIndecies[i] = pIndex->Find(pCurItem->Key()); // O(1)
 	}
 
 	for(i = 0; i < NumItems; i++)
@@ -308,7 +391,7 @@ int CSnapshotDelta::CreateDelta(const CSnapshot *pFrom, CSnapshot *pTo, void *pD
 			if(!IncludeSize)
 				pItemDataDst = pData+2;
 
-			if(DiffItem(pPastItem->Data(), (int*)pCurItem->Data(), pItemDataDst, ItemSize/4))
+			if(pSimd->m_pfnDiffItem(pPastItem->Data(), (int*)pCurItem->Data(), pItemDataDst, ItemSize/4))
 			{
 
 				*pData++ = pCurItem->Type();
@@ -471,10 +554,119 @@ int CSnapshotDelta::UnpackDelta(const CSnapshot *pFrom, CSnapshot *pTo, const vo
 
 // CSnapshotStorage
 
-void CSnapshotStorage::Init()
+class CSnapshotStorage::CPool : public CRingBufferBase
+{
+	char *m_pMemory;
+	int m_Size;
+
+public:
+	CPool(int Size)
+	{
+		m_pMemory = (char *)mem_alloc(Size, 1);
+		m_Size = Size;
+		CRingBufferBase::Init(m_pMemory, Size, 0);
+	}
+	~CPool() { mem_free(m_pMemory); }
+
+	int Size() const { return m_Size; }
+	bool Owns(const void *pData) const { return (const char *)pData >= m_pMemory && (const char *)pData < m_pMemory+m_Size; }
+
+	void *Allocate(int Size) { return CRingBufferBase::Allocate(Size); }
+	int PopFirst() { return CRingBufferBase::PopFirst(); }
+	void *First() { return CRingBufferBase::First(); }
+};
+
+CSnapshotStorage::CSnapshotStorage()
 {
 	m_pFirst = 0;
 	m_pLast = 0;
+	m_pPool = 0;
+	m_pOldPool = 0;
+	Init();
+}
+
+CSnapshotStorage::~CSnapshotStorage()
+{
+	PurgeAll();
+	delete m_pPool;
+	delete m_pOldPool;
+}
+
+void CSnapshotStorage::Init()
+{
+	PurgeAll();
+	delete m_pPool;
+	delete m_pOldPool;
+	m_pPool = 0;
+	m_pOldPool = 0;
+
+	m_UsedSize = 0;
+	m_PeakUsedSize = 0;
+	m_NumHeapAllocs = 0;
+}
+
+int CSnapshotStorage::PoolSize() const
+{
+	return (m_pPool ? m_pPool->Size() : 0) + (m_pOldPool ? m_pOldPool->Size() : 0);
+}
+
+CSnapshotStorage::CHolder *CSnapshotStorage::Allocate(int Size)
+{
+	CHolder *pHolder = m_pPool ? (CHolder *)m_pPool->Allocate(Size) : 0;
+	if(!pHolder && !m_pOldPool)
+	{
+		// start a bigger pool, the current one is kept until its snapshots are purged
+		int NewSize = m_pPool ? m_pPool->Size()*2 : MIN_POOL_SIZE;
+		while(NewSize < Size*4)
+			NewSize *= 2;
+		if(NewSize <= MAX_POOL_SIZE)
+		{
+			if(m_pPool && m_pPool->First())
+				m_pOldPool = m_pPool;
+			else
+				delete m_pPool;
+			m_pPool = new CPool(NewSize);
+			pHolder = (CHolder *)m_pPool->Allocate(Size);
+		}
+	}
+	if(!pHolder)
+	{
+		pHolder = (CHolder *)mem_alloc(Size, 1);
+		m_NumHeapAllocs++;
+	}
+
+	m_UsedSize += Size;
+	m_PeakUsedSize = max(m_PeakUsedSize, m_UsedSize);
+	return pHolder;
+}
+
+void CSnapshotStorage::Free(CHolder *pHolder)
+{
+	int Size = sizeof(CHolder) + (pHolder->m_pAltSnap ? pHolder->m_SnapSize*2 : pHolder->m_SnapSize);
+	m_UsedSize -= Size;
+
+	CHolder **ppIndex = &m_apTickIndex[pHolder->m_Tick&(TICK_INDEX_SIZE-1)];
+	if(*ppIndex == pHolder)
+		*ppIndex = 0;
+
+	// snapshots are always freed from the front, so they are the oldest item in their pool
+	if(m_pPool && m_pPool->Owns(pHolder))
+	{
+		dbg_assert(m_pPool->First() == pHolder, "snapshot pool out of order");
+		m_pPool->PopFirst();
+	}
+	else if(m_pOldPool && m_pOldPool->Owns(pHolder))
+	{
+		dbg_assert(m_pOldPool->First() == pHolder, "snapshot pool out of order");
+		m_pOldPool->PopFirst();
+		if(!m_pOldPool->First())
+		{
+			delete m_pOldPool;
+			m_pOldPool = 0;
+		}
+	}
+	else
+		mem_free(pHolder);
 }
 
 void CSnapshotStorage::PurgeAll()
@@ -485,13 +677,14 @@ void CSnapshotStorage::PurgeAll()
 	while(pHolder)
 	{
 		pNext = pHolder->m_pNext;
-		mem_free(pHolder);
+		Free(pHolder);
 		pHolder = pNext;
 	}
 
 	// no more snapshots in storage
 	m_pFirst = 0;
 	m_pLast = 0;
+	mem_zero(m_apTickIndex, sizeof(m_apTickIndex));
 }
 
 void CSnapshotStorage::PurgeUntil(int Tick)
@@ -504,7 +697,7 @@ void CSnapshotStorage::PurgeUntil(int Tick)
 		pNext = pHolder->m_pNext;
 		if(pHolder->m_Tick >= Tick)
 			return; // no more to remove
-		mem_free(pHolder);
+		Free(pHolder);
 
 		// did we come to the end of the list?
 		if (!pNext)
@@ -529,7 +722,7 @@ void CSnapshotStorage::Add(int Tick, int64 Tagtime, int DataSize, void *pData, i
 	if(CreateAlt)
 		TotalSize += DataSize;
 
-	CHolder *pHolder = (CHolder *)mem_alloc(TotalSize, 1);
+	CHolder *pHolder = Allocate(TotalSize);
 
 	// set data
 	pHolder->m_Tick = Tick;
@@ -545,7 +738,7 @@ void CSnapshotStorage::Add(int Tick, int64 Tagtime, int DataSize, void *pData, i
 	}
 	else
 		pHolder->m_pAltSnap = 0;
-
+	pHolder->m_AltTypeCache.Reset();
 
 	// link
 	pHolder->m_pNext = 0;
@@ -555,26 +748,36 @@ void CSnapshotStorage::Add(int Tick, int64 Tagtime, int DataSize, void *pData, i
 	else
 		m_pFirst = pHolder;
 	m_pLast = pHolder;
+
+	// the index keeps the oldest holder of a tick, like the list search does
+	CHolder **ppIndex = &m_apTickIndex[Tick&(TICK_INDEX_SIZE-1)];
+	if(!*ppIndex || (*ppIndex)->m_Tick != Tick)
+		*ppIndex = pHolder;
 }
 
 int CSnapshotStorage::Get(int Tick, int64 *pTagtime, CSnapshot **ppData, CSnapshot **ppAltData)
 {
-	CHolder *pHolder = m_pFirst;
+	CHolder *pHolder = m_apTickIndex[Tick&(TICK_INDEX_SIZE-1)];
 
-	while(pHolder)
+	// fall back to searching the list when the tick was overwritten in the index
+	if(!pHolder || pHolder->m_Tick != Tick)
 	{
-		if(pHolder->m_Tick == Tick)
+		for(pHolder = m_pFirst; pHolder; pHolder = pHolder->m_pNext)
 		{
-			if(pTagtime)
-				*pTagtime = pHolder->m_Tagtime;
-			if(ppData)
-				*ppData = pHolder->m_pSnap;
-			if(ppAltData)
-				*ppAltData = pHolder->m_pAltSnap;
-			return pHolder->m_SnapSize;
+			if(pHolder->m_Tick == Tick)
+				break;
 		}
+	}
 
-		pHolder = pHolder->m_pNext;
+	if(pHolder)
+	{
+		if(pTagtime)
+			*pTagtime = pHolder->m_Tagtime;
+		if(ppData)
+			*ppData = pHolder->m_pSnap;
+		if(ppAltData)
+			*ppAltData = pHolder->m_pAltSnap;
+		return pHolder->m_SnapSize;
 	}
 
 	return -1;
@@ -616,6 +819,18 @@ void CSnapshotBuilder::Init(const CSnapshot *pSnapshot)
 	mem_copy(m_aData, pSnapshot->DataStart(), m_DataSize);
 }
 
+void CSnapshotBuilder::Init(const CSnapshotBuilder *pBase)
+{
+	// start with the items of the base, new items are added on top
+	m_DataSize = pBase->m_DataSize;
+	m_NumItems = pBase->m_NumItems;
+	mem_copy(m_aOffsets, pBase->m_aOffsets, sizeof(int)*m_NumItems);
+	mem_copy(m_aData, pBase->m_aData, m_DataSize);
+
+	m_NumExtendedItemTypes = pBase->m_NumExtendedItemTypes;
+	mem_copy(m_aExtendedItemTypes, pBase->m_aExtendedItemTypes, sizeof(int)*m_NumExtendedItemTypes);
+}
+
 bool CSnapshotBuilder::UnserializeSnap(const char *pSrcData, int SrcSize)
 {
 	m_DataSize = 0;
@@ -24,6 +24,30 @@ public:
 };
 
 
+// CSnapshotTypeCache
+
+// maps the extended item types of one snapshot to the registered ones.
+// it is filled by the first lookup and must be reset when the snapshot changes.
+class CSnapshotTypeCache
+{
+	friend class CSnapshot;
+
+	enum
+	{
+		MAX_EXTENDED_TYPES=64,
+		TYPE_NONE=0,
+	};
+
+	bool m_Valid;
+	bool m_Complete; // false if some extended types didn't fit
+	int m_NumTypes;
+	int m_aTypes[MAX_EXTENDED_TYPES]; // by CSnapshot::MAX_TYPE - internal type
+
+public:
+	void Reset() { m_Valid = false; }
+};
+
+
 class CSnapshot
 {
 	friend class CSnapshotBuilder;
@@ -34,6 +58,8 @@ class CSnapshot
 	int *Offsets() const { return (int *)(SortedKeys()+m_NumItems); }
 	char *DataStart() const { return (char*)(Offsets()+m_NumItems); }
 
+	void FillTypeCache(CSnapshotTypeCache *pCache) const;
+
 public:
 	enum
 	{
@@ -44,17 +70,19 @@ public:
 	};
 
 	void Clear() { m_DataSize = 0; m_NumItems = 0; }
+	int Size() const { return sizeof(CSnapshot) + sizeof(int)*2*m_NumItems + m_DataSize; }
 	int NumItems() const { return m_NumItems; }
 	const CSnapshotItem *GetItem(int Index) const;
 	int GetItemSize(int Index) const;
-	int GetItemIndex(int Type, int ID) const;
-	int GetItemType(int Index) const;
+	int GetItemIndex(int Type, int ID, CSnapshotTypeCache *pCache = 0) const;
+	int GetItemType(int Index, CSnapshotTypeCache *pCache = 0) const;
 
 	void InvalidateItem(int Index);
 
 	int Serialize(char *pDstData);
 
 	int Crc() const;
+	int64 Hash() const;
 	void DebugDump() const;
 };
 
@@ -114,17 +142,51 @@ public:
 		int m_SnapSize;
 		CSnapshot *m_pSnap;
 		CSnapshot *m_pAltSnap;
+
+		CSnapshotTypeCache m_AltTypeCache;
 	};
 
 
 	CHolder *m_pFirst;
 	CHolder *m_pLast;
 
+	CSnapshotStorage();
+	~CSnapshotStorage();
+
 	void Init();
 	void PurgeAll();
 	void PurgeUntil(int Tick);
 	void Add(int Tick, int64 Tagtime, int DataSize, void *pData, int CreateAlt);
 	int Get(int Tick, int64 *pTagtime, CSnapshot **ppData, CSnapshot **ppAltData);
+
+	// memory statistics
+	int UsedSize() const { return m_UsedSize; }
+	int PeakUsedSize() const { return m_PeakUsedSize; }
+	int PoolSize() const;
+	int NumHeapAllocs() const { return m_NumHeapAllocs; }
+
+private:
+	enum
+	{
+		TICK_INDEX_SIZE=256,
+		MIN_POOL_SIZE=64*1024,
+		MAX_POOL_SIZE=16*1024*1024,
+	};
+
+	// holders are allocated from a ring buffer as they are freed in the order they were added.
+	// when it is full a bigger one is started and the old one is dropped once it is empty.
+	class CPool;
+	CPool *m_pPool;
+	CPool *m_pOldPool;
+
+	CHolder *m_apTickIndex[TICK_INDEX_SIZE];
+
+	int m_UsedSize;
+	int m_PeakUsedSize;
+	int m_NumHeapAllocs;
+
+	CHolder *Allocate(int Size);
+	void Free(CHolder *pHolder);
 };
 
 class CSnapshotBuilder
@@ -152,6 +214,7 @@ public:
 
 	void Init();
 	void Init(const CSnapshot *pSnapshot);
+	void Init(const CSnapshotBuilder *pBase);
 	bool UnserializeSnap(const char *pSrcData, int SrcSize);
 
 	void *NewItem(int Type, int ID, int Size);
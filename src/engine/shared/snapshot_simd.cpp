@@ -0,0 +1,753 @@
+/* (c) Magnus Auvinen. See licence.txt in the root of the distribution for more information. */
+/* If you are missing that file, acquire a complete release at teeworlds.com.                */
+#include <base/system.h>
+
+#include "compression.h"
+#include "snapshot_simd.h"
+
+#if defined(CONF_ARCH_IA32) || defined(CONF_ARCH_AMD64)
+	#define SNAPSHOTSIMD_X86 1
+	#include <immintrin.h>
+	#if defined(_MSC_VER)
+		#include <intrin.h>
+		#define TARGET_SSE2
+		#define TARGET_AVX2
+	#else
+		#define TARGET_SSE2 __attribute__((target("sse2")))
+		#define TARGET_AVX2 __attribute__((target("avx2")))
+	#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	#define SNAPSHOTSIMD_ARM_NEON 1
+	#include <arm_neon.h>
+#endif
+
+// scalar reference
+static int DiffItemScalar(const int *pPast, const int *pCurrent, int *pOut, int Size)
+{
+	int Needed = 0;
+	while(Size)
+	{
+		*pOut = *pCurrent-*pPast;
+		Needed |= *pOut;
+		pOut++;
+		pPast++;
+		pCurrent++;
+		Size--;
+	}
+
+	return Needed;
+}
+
+static int UndiffItemScalar(const int *pPast, const int *pDiff, int *pOut, int Size)
+{
+	int Rate = 0;
+	while(Size)
+	{
+		*pOut = *pPast+*pDiff;
+
+		if(*pDiff == 0)
+			Rate += 1;
+		else
+		{
+			unsigned char aBuf[16];
+			unsigned char *pEnd = CVariableInt::Pack(aBuf, *pDiff);
+			Rate += (int)(pEnd - (unsigned char*)aBuf) * 8;
+		}
+
+		pOut++;
+		pPast++;
+		pDiff++;
+		Size--;
+	}
+	return Rate;
+}
+
+static int SumScalar(const int *pData, int Size)
+{
+	int Sum = 0;
+	for(int i = 0; i < Size; i++)
+		Sum += pData[i];
+	return Sum;
+}
+
+// the vector versions handle the remainder with these
+static inline int DiffTail(const int *pPast, const int *pCurrent, int *pOut, int Size)
+{
+	int Needed = 0;
+	for(int i = 0; i < Size; i++)
+	{
+		pOut[i] = (int)((unsigned)pCurrent[i]-(unsigned)pPast[i]);
+		Needed |= pOut[i];
+	}
+	return Needed;
+}
+
+static inline int UndiffTail(const int *pPast, const int *pDiff, int *pOut, int Size)
+{
+	int Rate = 0;
+	for(int i = 0; i < Size; i++)
+	{
+		pOut[i] = (int)((unsigned)pPast[i]+(unsigned)pDiff[i]);
+		if(pDiff[i] == 0)
+			Rate += 1;
+		else
+		{
+			// packed size: 6 bits in the first byte, 7 in each following one
+			int Value = pDiff[i]^(pDiff[i]>>31);
+			Rate += 8 * (1 + (Value >= (1<<6)) + (Value >= (1<<13)) + (Value >= (1<<20)) + (Value >= (1<<27)));
+		}
+	}
+	return Rate;
+}
+
+static inline unsigned SumTail(const int *pData, int Size)
+{
+	unsigned Sum = 0;
+	for(int i = 0; i < Size; i++)
+		Sum += (unsigned)pData[i];
+	return Sum;
+}
+
+// packs a block of values the vector versions can't handle, 0 if the output is too small
+static inline unsigned char *VarIntPackBlock(const int *pSrc, int Num, unsigned char *pDst, const unsigned char *pDstEnd)
+{
+	for(int i = 0; i < Num; i++)
+	{
+		if(pDstEnd - pDst < 6)
+			return 0;
+		pDst = CVariableInt::Pack(pDst, pSrc[i]);
+	}
+	return pDst;
+}
+
+static inline long VarIntCompressTail(const int *pSrc, int Num, unsigned char *pDst, const unsigned char *pDstEnd, const void *pDstStart)
+{
+	long Size = CVariableInt::CompressScalar(pSrc, Num*4, pDst, (int)(pDstEnd-pDst));
+	if(Size < 0)
+		return -1;
+	return (long)(pDst-(const unsigned char *)pDstStart) + Size;
+}
+
+static inline long VarIntDecompressTail(const unsigned char *pSrc, const unsigned char *pEnd, int *pDst, const int *pDstEnd, const void *pDstStart)
+{
+	long Size = CVariableInt::DecompressScalar(pSrc, (int)(pEnd-pSrc), pDst, (int)(pDstEnd-pDst)*4);
+	if(Size < 0)
+		return -1;
+	return (long)((unsigned char *)pDst-(const unsigned char *)pDstStart) + Size;
+}
+
+#if defined(SNAPSHOTSIMD_X86)
+TARGET_SSE2 static inline int HorizontalOrSse2(__m128i Value)
+{
+	Value = _mm_or_si128(Value, _mm_shuffle_epi32(Value, _MM_SHUFFLE(1, 0, 3, 2)));
+	Value = _mm_or_si128(Value, _mm_shuffle_epi32(Value, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(Value);
+}
+
+TARGET_SSE2 static inline unsigned HorizontalAddSse2(__m128i Value)
+{
+	Value = _mm_add_epi32(Value, _mm_shuffle_epi32(Value, _MM_SHUFFLE(1, 0, 3, 2)));
+	Value = _mm_add_epi32(Value, _mm_shuffle_epi32(Value, _MM_SHUFFLE(2, 3, 0, 1)));
+	return (unsigned)_mm_cvtsi128_si32(Value);
+}
+
+TARGET_SSE2 static int DiffItemSse2(const int *pPast, const int *pCurrent, int *pOut, int Size)
+{
+	__m128i Needed = _mm_setzero_si128();
+	int i = 0;
+	for(; i+4 <= Size; i += 4)
+	{
+		__m128i Diff = _mm_sub_epi32(_mm_loadu_si128((const __m128i *)(pCurrent+i)), _mm_loadu_si128((const __m128i *)(pPast+i)));
+		_mm_storeu_si128((__m128i *)(pOut+i), Diff);
+		Needed = _mm_or_si128(Needed, Diff);
+	}
+	return HorizontalOrSse2(Needed) | DiffTail(pPast+i, pCurrent+i, pOut+i, Size-i);
+}
+
+TARGET_SSE2 static int UndiffItemSse2(const int *pPast, const int *pDiff, int *pOut, int Size)
+{
+	const __m128i Zero = _mm_setzero_si128();
+	const __m128i One = _mm_set1_epi32(1);
+	const __m128i Limit1 = _mm_set1_epi32((1<<6)-1);
+	const __m128i Limit2 = _mm_set1_epi32((1<<13)-1);
+	const __m128i Limit3 = _mm_set1_epi32((1<<20)-1);
+	const __m128i Limit4 = _mm_set1_epi32((1<<27)-1);
+	__m128i Rate = _mm_setzero_si128();
+	int i = 0;
+	for(; i+4 <= Size; i += 4)
+	{
+		__m128i Diff = _mm_loadu_si128((const __m128i *)(pDiff+i));
+		_mm_storeu_si128((__m128i *)(pOut+i), _mm_add_epi32(_mm_loadu_si128((const __m128i *)(pPast+i)), Diff));
+
+		// comparisons yield -1, so subtracting them counts the extra bytes
+		__m128i Value = _mm_xor_si128(Diff, _mm_srai_epi32(Diff, 31));
+		__m128i Bytes = _mm_sub_epi32(One, _mm_cmpgt_epi32(Value, Limit1));
+		Bytes = _mm_sub_epi32(Bytes, _mm_cmpgt_epi32(Value, Limit2));
+		Bytes = _mm_sub_epi32(Bytes, _mm_cmpgt_epi32(Value, Limit3));
+		Bytes = _mm_sub_epi32(Bytes, _mm_cmpgt_epi32(Value, Limit4));
+		__m128i IsZero = _mm_cmpeq_epi32(Diff, Zero);
+		Rate = _mm_add_epi32(Rate, _mm_or_si128(_mm_and_si128(IsZero, One), _mm_andnot_si128(IsZero, _mm_slli_epi32(Bytes, 3))));
+	}
+	return (int)HorizontalAddSse2(Rate) + UndiffTail(pPast+i, pDiff+i, pOut+i, Size-i);
+}
+
+TARGET_SSE2 static int SumSse2(const int *pData, int Size)
+{
+	__m128i Sum0 = _mm_setzero_si128();
+	__m128i Sum1 = _mm_setzero_si128();
+	int i = 0;
+	for(; i+8 <= Size; i += 8)
+	{
+		Sum0 = _mm_add_epi32(Sum0, _mm_loadu_si128((const __m128i *)(pData+i)));
+		Sum1 = _mm_add_epi32(Sum1, _mm_loadu_si128((const __m128i *)(pData+i+4)));
+	}
+	return (int)(HorizontalAddSse2(_mm_add_epi32(Sum0, Sum1)) + SumTail(pData+i, Size-i));
+}
+
+TARGET_AVX2 static int DiffItemAvx2(const int *pPast, const int *pCurrent, int *pOut, int Size)
+{
+	__m256i Needed = _mm256_setzero_si256();
+	int i = 0;
+	for(; i+8 <= Size; i += 8)
+	{
+		__m256i Diff = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i *)(pCurrent+i)), _mm256_loadu_si256((const __m256i *)(pPast+i)));
+		_mm256_storeu_si256((__m256i *)(pOut+i), Diff);
+		Needed = _mm256_or_si256(Needed, Diff);
+	}
+	__m128i Needed128 = _mm_or_si128(_mm256_castsi256_si128(Needed), _mm256_extracti128_si256(Needed, 1));
+	Needed128 = _mm_or_si128(Needed128, _mm_shuffle_epi32(Needed128, _MM_SHUFFLE(1, 0, 3, 2)));
+	Needed128 = _mm_or_si128(Needed128, _mm_shuffle_epi32(Needed128, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(Needed128) | DiffTail(pPast+i, pCurrent+i, pOut+i, Size-i);
+}
+
+TARGET_AVX2 static int UndiffItemAvx2(const int *pPast, const int *pDiff, int *pOut, int Size)
+{
+	const __m256i Zero = _mm256_setzero_si256();
+	const __m256i One = _mm256_set1_epi32(1);
+	const __m256i Limit1 = _mm256_set1_epi32((1<<6)-1);
+	const __m256i Limit2 = _mm256_set1_epi32((1<<13)-1);
+	const __m256i Limit3 = _mm256_set1_epi32((1<<20)-1);
+	const __m256i Limit4 = _mm256_set1_epi32((1<<27)-1);
+	__m256i Rate = _mm256_setzero_si256();
+	int i = 0;
+	for(; i+8 <= Size; i += 8)
+	{
+		__m256i Diff = _mm256_loadu_si256((const __m256i *)(pDiff+i));
+		_mm256_storeu_si256((__m256i *)(pOut+i), _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(pPast+i)), Diff));
+
+		__m256i Value = _mm256_xor_si256(Diff, _mm256_srai_epi32(Diff, 31));
+		__m256i Bytes = _mm256_sub_epi32(One, _mm256_cmpgt_epi32(Value, Limit1));
+		Bytes = _mm256_sub_epi32(Bytes, _mm256_cmpgt_epi32(Value, Limit2));
+		Bytes = _mm256_sub_epi32(Bytes, _mm256_cmpgt_epi32(Value, Limit3));
+		Bytes = _mm256_sub_epi32(Bytes, _mm256_cmpgt_epi32(Value, Limit4));
+		__m256i IsZero = _mm256_cmpeq_epi32(Diff, Zero);
+		Rate = _mm256_add_epi32(Rate, _mm256_blendv_epi8(_mm256_slli_epi32(Bytes, 3), One, IsZero));
+	}
+	__m128i Rate128 = _mm_add_epi32(_mm256_castsi256_si128(Rate), _mm256_extracti128_si256(Rate, 1));
+	Rate128 = _mm_add_epi32(Rate128, _mm_shuffle_epi32(Rate128, _MM_SHUFFLE(1, 0, 3, 2)));
+	Rate128 = _mm_add_epi32(Rate128, _mm_shuffle_epi32(Rate128, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(Rate128) + UndiffTail(pPast+i, pDiff+i, pOut+i, Size-i);
+}
+
+TARGET_AVX2 static int SumAvx2(const int *pData, int Size)
+{
+	__m256i Sum0 = _mm256_setzero_si256();
+	__m256i Sum1 = _mm256_setzero_si256();
+	int i = 0;
+	for(; i+16 <= Size; i += 16)
+	{
+		Sum0 = _mm256_add_epi32(Sum0, _mm256_loadu_si256((const __m256i *)(pData+i)));
+		Sum1 = _mm256_add_epi32(Sum1, _mm256_loadu_si256((const __m256i *)(pData+i+8)));
+	}
+	Sum0 = _mm256_add_epi32(Sum0, Sum1);
+	__m128i Sum128 = _mm_add_epi32(_mm256_castsi256_si128(Sum0), _mm256_extracti128_si256(Sum0, 1));
+	Sum128 = _mm_add_epi32(Sum128, _mm_shuffle_epi32(Sum128, _MM_SHUFFLE(1, 0, 3, 2)));
+	Sum128 = _mm_add_epi32(Sum128, _mm_shuffle_epi32(Sum128, _MM_SHUFFLE(2, 3, 0, 1)));
+	return (int)((unsigned)_mm_cvtsi128_si32(Sum128) + SumTail(pData+i, Size-i));
+}
+
+// 16 values that are packed into one byte each
+TARGET_SSE2 static inline void VarIntUnpackBytesSse2(__m128i Bytes, int *pDst)
+{
+	const __m128i Zero = _mm_setzero_si128();
+	const __m128i Mask = _mm_set1_epi16(0x3f);
+	__m128i Low = _mm_unpacklo_epi8(Bytes, Zero);
+	__m128i High = _mm_unpackhi_epi8(Bytes, Zero);
+	// move the sign bit to the top to get the mask for the inversion
+	Low = _mm_xor_si128(_mm_and_si128(Low, Mask), _mm_srai_epi16(_mm_slli_epi16(Low, 9), 15));
+	High = _mm_xor_si128(_mm_and_si128(High, Mask), _mm_srai_epi16(_mm_slli_epi16(High, 9), 15));
+	__m128i LowSign = _mm_srai_epi16(Low, 15);
+	__m128i HighSign = _mm_srai_epi16(High, 15);
+	_mm_storeu_si128((__m128i *)pDst, _mm_unpacklo_epi16(Low, LowSign));
+	_mm_storeu_si128((__m128i *)(pDst+4), _mm_unpackhi_epi16(Low, LowSign));
+	_mm_storeu_si128((__m128i *)(pDst+8), _mm_unpacklo_epi16(High, HighSign));
+	_mm_storeu_si128((__m128i *)(pDst+12), _mm_unpackhi_epi16(High, HighSign));
+}
+
+TARGET_SSE2 static long VarIntCompressSse2(const void *pSrc_, int SrcSize, void *pDst_, int DstSize)
+{
+	const int *pSrc = (const int *)pSrc_;
+	int Num = SrcSize/4;
+	unsigned char *pDst = (unsigned char *)pDst_;
+	const unsigned char *pDstEnd = pDst + DstSize;
+	const __m128i Limit1 = _mm_set1_epi32((1<<6)-1);
+	const __m128i Limit2 = _mm_set1_epi32((1<<13)-1);
+	const __m128i Mask = _mm_set1_epi32(0x3f);
+	const __m128i SignBit = _mm_set1_epi32(0x40);
+	const __m128i ExtendBit = _mm_set1_epi32(0x80);
+	const __m128i HighMask = _mm_set1_epi32(0x7f00);
+
+	// blocks of 8 values that are packed into one or two bytes each,
+	// the scalar version needs 6 free bytes for every value
+	while(Num >= 8 && pDstEnd - pDst >= 16+6)
+	{
+		__m128i A = _mm_loadu_si128((const __m128i *)pSrc);
+		__m128i B = _mm_loadu_si128((const __m128i *)(pSrc+4));
+		__m128i SignA = _mm_srai_epi32(A, 31);
+		__m128i SignB = _mm_srai_epi32(B, 31);
+		A = _mm_xor_si128(A, SignA);
+		B = _mm_xor_si128(B, SignB);
+		if(_mm_movemask_epi8(_mm_or_si128(_mm_cmpgt_epi32(A, Limit2), _mm_cmpgt_epi32(B, Limit2))))
+		{
+			if(!(pDst = VarIntPackBlock(pSrc, 8, pDst, pDstEnd)))
+				return -1;
+			pSrc += 8;
+			Num -= 8;
+			continue;
+		}
+
+		// first byte: extend, sign and 6 bits, second byte: the next 7 bits
+		__m128i TwoA = _mm_cmpgt_epi32(A, Limit1);
+		__m128i TwoB = _mm_cmpgt_epi32(B, Limit1);
+		A = _mm_or_si128(_mm_or_si128(_mm_and_si128(A, Mask), _mm_and_si128(SignA, SignBit)),
+			_mm_or_si128(_mm_and_si128(TwoA, ExtendBit), _mm_and_si128(_mm_slli_epi32(A, 2), HighMask)));
+		B = _mm_or_si128(_mm_or_si128(_mm_and_si128(B, Mask), _mm_and_si128(SignB, SignBit)),
+			_mm_or_si128(_mm_and_si128(TwoB, ExtendBit), _mm_and_si128(_mm_slli_epi32(B, 2), HighMask)));
+		int TwoMask = _mm_movemask_ps(_mm_castsi128_ps(TwoA)) | (_mm_movemask_ps(_mm_castsi128_ps(TwoB))<<4);
+
+		// without byte shuffles, always write both bytes and advance by the used ones
+		unsigned short aWords[8];
+		_mm_storeu_si128((__m128i *)aWords, _mm_packs_epi32(A, B));
+		for(int k = 0; k < 8; k++)
+		{
+			pDst[0] = (unsigned char)aWords[k];
+			pDst[1] = (unsigned char)(aWords[k]>>8);
+			pDst += 1 + ((TwoMask>>k)&1);
+		}
+		pSrc += 8;
+		Num -= 8;
+	}
+	return VarIntCompressTail(pSrc, Num, pDst, pDstEnd, pDst_);
+}
+
+TARGET_SSE2 static long VarIntDecompressSse2(const void *pSrc_, int SrcSize, void *pDst_, int DstSize)
+{
+	const unsigned char *pSrc = (const unsigned char *)pSrc_;
+	const unsigned char *pEnd = pSrc + SrcSize;
+	int *pDst = (int *)pDst_;
+	const int *pDstEnd = pDst + DstSize/4;
+
+	while(pEnd - pSrc >= 16 && pDstEnd - pDst >= 16)
+	{
+		__m128i Bytes = _mm_loadu_si128((const __m128i *)pSrc);
+		if(_mm_movemask_epi8(Bytes) == 0)
+		{
+			// no extend bits
+			VarIntUnpackBytesSse2(Bytes, pDst);
+			pSrc += 16;
+			pDst += 16;
+		}
+		else
+		{
+			const unsigned char *pBlockEnd = pSrc + 16;
+			while(pSrc < pBlockEnd)
+				pSrc = CVariableInt::Unpack(pSrc, pDst++);
+		}
+	}
+	return VarIntDecompressTail(pSrc, pEnd, pDst, pDstEnd, pDst_);
+}
+
+// byte shuffles for blocks of 8 values that are packed into one or two bytes each
+struct CVarIntShuffle
+{
+	unsigned char m_aShuffle[16];
+	int m_NumValues;
+	int m_NumBytes;
+};
+
+class CVarIntShuffles
+{
+public:
+	// indexed by the two byte values, from 16 bit words to bytes
+	CVarIntShuffle m_aPack[256];
+	// indexed by the extend bits of 8 bytes, from bytes to 16 bit words
+	CVarIntShuffle m_aUnpack[256];
+
+	CVarIntShuffles()
+	{
+		for(int Mask = 0; Mask < 256; Mask++)
+		{
+			CVarIntShuffle *pPack = &m_aPack[Mask];
+			for(int i = 0; i < 16; i++)
+				pPack->m_aShuffle[i] = 0x80; // zero
+			pPack->m_NumValues = 8;
+			pPack->m_NumBytes = 0;
+			for(int i = 0; i < 8; i++)
+			{
+				pPack->m_aShuffle[pPack->m_NumBytes++] = i*2;
+				if(Mask&(1<<i))
+					pPack->m_aShuffle[pPack->m_NumBytes++] = i*2+1;
+			}
+
+			// stops at the first value that is longer than two bytes or not complete
+			CVarIntShuffle *pUnpack = &m_aUnpack[Mask];
+			for(int i = 0; i < 16; i++)
+				pUnpack->m_aShuffle[i] = 0x80; // zero
+			pUnpack->m_NumValues = 0;
+			pUnpack->m_NumBytes = 0;
+			while(pUnpack->m_NumBytes < 8)
+			{
+				int Pos = pUnpack->m_NumBytes;
+				pUnpack->m_aShuffle[pUnpack->m_NumValues*2] = Pos;
+				if(!(Mask&(1<<Pos)))
+					pUnpack->m_NumBytes++;
+				else if(Pos+1 < 8 && !(Mask&(1<<(Pos+1))))
+				{
+					pUnpack->m_aShuffle[pUnpack->m_NumValues*2+1] = Pos+1;
+					pUnpack->m_NumBytes += 2;
+				}
+				else
+				{
+					pUnpack->m_aShuffle[pUnpack->m_NumValues*2] = 0x80;
+					break;
+				}
+				pUnpack->m_NumValues++;
+			}
+		}
+	}
+};
+
+static const CVarIntShuffles *VarIntShuffles()
+{
+	static const CVarIntShuffles s_Shuffles;
+	return &s_Shuffles;
+}
+
+TARGET_AVX2 static long VarIntCompressAvx2(const void *pSrc_, int SrcSize, void *pDst_, int DstSize)
+{
+	const int *pSrc = (const int *)pSrc_;
+	int Num = SrcSize/4;
+	unsigned char *pDst = (unsigned char *)pDst_;
+	const unsigned char *pDstEnd = pDst + DstSize;
+	const CVarIntShuffles *pShuffles = VarIntShuffles();
+	const __m128i Limit1 = _mm_set1_epi32((1<<6)-1);
+	const __m128i Limit2 = _mm_set1_epi32((1<<13)-1);
+	const __m128i Mask = _mm_set1_epi32(0x3f);
+	const __m128i SignBit = _mm_set1_epi32(0x40);
+	const __m128i ExtendBit = _mm_set1_epi32(0x80);
+	const __m128i HighMask = _mm_set1_epi32(0x7f00);
+
+	while(Num >= 8 && pDstEnd - pDst >= 16+6)
+	{
+		__m128i A = _mm_loadu_si128((const __m128i *)pSrc);
+		__m128i B = _mm_loadu_si128((const __m128i *)(pSrc+4));
+		__m128i SignA = _mm_srai_epi32(A, 31);
+		__m128i SignB = _mm_srai_epi32(B, 31);
+		A = _mm_xor_si128(A, SignA);
+		B = _mm_xor_si128(B, SignB);
+		__m128i Big = _mm_or_si128(_mm_cmpgt_epi32(A, Limit2), _mm_cmpgt_epi32(B, Limit2));
+		if(!_mm_testz_si128(Big, Big))
+		{
+			if(!(pDst = VarIntPackBlock(pSrc, 8, pDst, pDstEnd)))
+				return -1;
+			pSrc += 8;
+			Num -= 8;
+			continue;
+		}
+
+		// first byte: extend, sign and 6 bits, second byte: the next 7 bits
+		__m128i TwoA = _mm_cmpgt_epi32(A, Limit1);
+		__m128i TwoB = _mm_cmpgt_epi32(B, Limit1);
+		A = _mm_or_si128(_mm_or_si128(_mm_and_si128(A, Mask), _mm_and_si128(SignA, SignBit)),
+			_mm_or_si128(_mm_and_si128(TwoA, ExtendBit), _mm_and_si128(_mm_slli_epi32(A, 2), HighMask)));
+		B = _mm_or_si128(_mm_or_si128(_mm_and_si128(B, Mask), _mm_and_si128(SignB, SignBit)),
+			_mm_or_si128(_mm_and_si128(TwoB, ExtendBit), _mm_and_si128(_mm_slli_epi32(B, 2), HighMask)));
+		int TwoMask = _mm_movemask_ps(_mm_castsi128_ps(TwoA)) | (_mm_movemask_ps(_mm_castsi128_ps(TwoB))<<4);
+		const CVarIntShuffle *pShuffle = &pShuffles->m_aPack[TwoMask];
+		__m128i Words = _mm_packs_epi32(A, B);
+		_mm_storeu_si128((__m128i *)pDst, _mm_shuffle_epi8(Words, _mm_loadu_si128((const __m128i *)pShuffle->m_aShuffle)));
+		pDst += pShuffle->m_NumBytes;
+		pSrc += 8;
+		Num -= 8;
+	}
+	return VarIntCompressTail(pSrc, Num, pDst, pDstEnd, pDst_);
+}
+
+TARGET_AVX2 static long VarIntDecompressAvx2(const void *pSrc_, int SrcSize, void *pDst_, int DstSize)
+{
+	const unsigned char *pSrc = (const unsigned char *)pSrc_;
+	const unsigned char *pEnd = pSrc + SrcSize;
+	int *pDst = (int *)pDst_;
+	const int *pDstEnd = pDst + DstSize/4;
+	const CVarIntShuffles *pShuffles = VarIntShuffles();
+	const __m128i Mask = _mm_set1_epi16(0x3f);
+	const __m128i HighMask = _mm_set1_epi16(0x7f<<6);
+
+	while(pEnd - pSrc >= 16 && pDstEnd - pDst >= 16)
+	{
+		__m128i Bytes = _mm_loadu_si128((const __m128i *)pSrc);
+		int ExtendMask = _mm_movemask_epi8(Bytes);
+		if(ExtendMask == 0)
+		{
+			VarIntUnpackBytesSse2(Bytes, pDst);
+			pSrc += 16;
+			pDst += 16;
+			continue;
+		}
+
+		const CVarIntShuffle *pShuffle = &pShuffles->m_aUnpack[ExtendMask&0xff];
+		if(pShuffle->m_NumValues == 0)
+		{
+			pSrc = CVariableInt::Unpack(pSrc, pDst++);
+			continue;
+		}
+
+		__m128i Words = _mm_shuffle_epi8(Bytes, _mm_loadu_si128((const __m128i *)pShuffle->m_aShuffle));
+		__m128i Values = _mm_or_si128(_mm_and_si128(Words, Mask), _mm_and_si128(_mm_srli_epi16(Words, 2), HighMask));
+		Values = _mm_xor_si128(Values, _mm_srai_epi16(_mm_slli_epi16(Words, 9), 15));
+		_mm_storeu_si128((__m128i *)pDst, _mm_cvtepi16_epi32(Values));
+		_mm_storeu_si128((__m128i *)(pDst+4), _mm_cvtepi16_epi32(_mm_srli_si128(Values, 8)));
+		pSrc += pShuffle->m_NumBytes;
+		pDst += pShuffle->m_NumValues;
+	}
+	return VarIntDecompressTail(pSrc, pEnd, pDst, pDstEnd, pDst_);
+}
+
+static void CpuFeatures(bool *pSse2, bool *pAvx2)
+{
+#if defined(_MSC_VER)
+	int aInfo[4];
+	__cpuid(aInfo, 0);
+	int MaxLeaf = aInfo[0];
+	__cpuid(aInfo, 1);
+	*pSse2 = (aInfo[3]&(1<<26)) != 0;
+	// avx2 also needs the os to save the ymm registers
+	bool OsAvx = (aInfo[2]&(1<<27)) && (aInfo[2]&(1<<28)) && (_xgetbv(0)&6) == 6;
+	*pAvx2 = false;
+	if(OsAvx && MaxLeaf >= 7)
+	{
+		__cpuidex(aInfo, 7, 0);
+		*pAvx2 = (aInfo[1]&(1<<5)) != 0;
+	}
+#else
+	__builtin_cpu_init();
+	*pSse2 = __builtin_cpu_supports("sse2");
+	*pAvx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+#if defined(SNAPSHOTSIMD_ARM_NEON)
+static inline unsigned HorizontalAddNeon(uint32x4_t Value)
+{
+	uint32x2_t Half = vadd_u32(vget_low_u32(Value), vget_high_u32(Value));
+	return vget_lane_u32(vpadd_u32(Half, Half), 0);
+}
+
+static int DiffItemNeon(const int *pPast, const int *pCurrent, int *pOut, int Size)
+{
+	int32x4_t Needed = vdupq_n_s32(0);
+	int i = 0;
+	for(; i+4 <= Size; i += 4)
+	{
+		int32x4_t Diff = vsubq_s32(vld1q_s32(pCurrent+i), vld1q_s32(pPast+i));
+		vst1q_s32(pOut+i, Diff);
+		Needed = vorrq_s32(Needed, Diff);
+	}
+	int32x2_t Half = vorr_s32(vget_low_s32(Needed), vget_high_s32(Needed));
+	int Result = vget_lane_s32(Half, 0) | vget_lane_s32(Half, 1);
+	return Result | DiffTail(pPast+i, pCurrent+i, pOut+i, Size-i);
+}
+
+static int UndiffItemNeon(const int *pPast, const int *pDiff, int *pOut, int Size)
+{
+	const uint32x4_t One = vdupq_n_u32(1);
+	uint32x4_t Rate = vdupq_n_u32(0);
+	int i = 0;
+	for(; i+4 <= Size; i += 4)
+	{
+		int32x4_t Diff = vld1q_s32(pDiff+i);
+		vst1q_s32(pOut+i, vaddq_s32(vld1q_s32(pPast+i), Diff));
+
+		// comparisons yield all bits set, so subtracting them counts the extra bytes
+		int32x4_t Value = veorq_s32(Diff, vshrq_n_s32(Diff, 31));
+		uint32x4_t Bytes = vsubq_u32(One, vcgtq_s32(Value, vdupq_n_s32((1<<6)-1)));
+		Bytes = vsubq_u32(Bytes, vcgtq_s32(Value, vdupq_n_s32((1<<13)-1)));
+		Bytes = vsubq_u32(Bytes, vcgtq_s32(Value, vdupq_n_s32((1<<20)-1)));
+		Bytes = vsubq_u32(Bytes, vcgtq_s32(Value, vdupq_n_s32((1<<27)-1)));
+		uint32x4_t IsZero = vceqq_s32(Diff, vdupq_n_s32(0));
+		Rate = vaddq_u32(Rate, vbslq_u32(IsZero, One, vshlq_n_u32(Bytes, 3)));
+	}
+	return (int)HorizontalAddNeon(Rate) + UndiffTail(pPast+i, pDiff+i, pOut+i, Size-i);
+}
+
+static int SumNeon(const int *pData, int Size)
+{
+	uint32x4_t Sum0 = vdupq_n_u32(0);
+	uint32x4_t Sum1 = vdupq_n_u32(0);
+	int i = 0;
+	for(; i+8 <= Size; i += 8)
+	{
+		Sum0 = vaddq_u32(Sum0, vreinterpretq_u32_s32(vld1q_s32(pData+i)));
+		Sum1 = vaddq_u32(Sum1, vreinterpretq_u32_s32(vld1q_s32(pData+i+4)));
+	}
+	return (int)(HorizontalAddNeon(vaddq_u32(Sum0, Sum1)) + SumTail(pData+i, Size-i));
+}
+
+// blocks of 16 values that are packed into one byte each
+static long VarIntCompressNeon(const void *pSrc_, int SrcSize, void *pDst_, int DstSize)
+{
+	const int *pSrc = (const int *)pSrc_;
+	int Num = SrcSize/4;
+	unsigned char *pDst = (unsigned char *)pDst_;
+	const unsigned char *pDstEnd = pDst + DstSize;
+
+	while(Num >= 16 && pDstEnd - pDst >= 16+6)
+	{
+		int16x4_t aBytes[4];
+		uint32x4_t Big = vdupq_n_u32(0);
+		for(int k = 0; k < 4; k++)
+		{
+			int32x4_t Value = vld1q_s32(pSrc+k*4);
+			int32x4_t Sign = vshrq_n_s32(Value, 31);
+			Value = veorq_s32(Value, Sign);
+			Big = vorrq_u32(Big, vcgtq_s32(Value, vdupq_n_s32((1<<6)-1)));
+			aBytes[k] = vmovn_s32(vorrq_s32(vandq_s32(Value, vdupq_n_s32(0x3f)), vandq_s32(Sign, vdupq_n_s32(0x40))));
+		}
+
+		uint32x2_t BigHalf = vorr_u32(vget_low_u32(Big), vget_high_u32(Big));
+		if((vget_lane_u32(BigHalf, 0)|vget_lane_u32(BigHalf, 1)) == 0)
+		{
+			int8x8_t Low = vmovn_s16(vcombine_s16(aBytes[0], aBytes[1]));
+			int8x8_t High = vmovn_s16(vcombine_s16(aBytes[2], aBytes[3]));
+			vst1q_u8(pDst, vreinterpretq_u8_s8(vcombine_s8(Low, High)));
+			pDst += 16;
+		}
+		else if(!(pDst = VarIntPackBlock(pSrc, 16, pDst, pDstEnd)))
+			return -1;
+		pSrc += 16;
+		Num -= 16;
+	}
+	return VarIntCompressTail(pSrc, Num, pDst, pDstEnd, pDst_);
+}
+
+static long VarIntDecompressNeon(const void *pSrc_, int SrcSize, void *pDst_, int DstSize)
+{
+	const unsigned char *pSrc = (const unsigned char *)pSrc_;
+	const unsigned char *pEnd = pSrc + SrcSize;
+	int *pDst = (int *)pDst_;
+	const int *pDstEnd = pDst + DstSize/4;
+
+	while(pEnd - pSrc >= 16 && pDstEnd - pDst >= 16)
+	{
+		uint8x16_t Bytes = vld1q_u8(pSrc);
+		uint64x2_t Extend = vreinterpretq_u64_u8(vandq_u8(Bytes, vdupq_n_u8(0x80)));
+		if((vgetq_lane_u64(Extend, 0)|vgetq_lane_u64(Extend, 1)) == 0)
+		{
+			// no extend bits, move the sign bit to the top to get the mask for the inversion
+			int16x8_t Low = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(Bytes)));
+			int16x8_t High = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(Bytes)));
+			Low = veorq_s16(vandq_s16(Low, vdupq_n_s16(0x3f)), vshrq_n_s16(vshlq_n_s16(Low, 9), 15));
+			High = veorq_s16(vandq_s16(High, vdupq_n_s16(0x3f)), vshrq_n_s16(vshlq_n_s16(High, 9), 15));
+			vst1q_s32(pDst, vmovl_s16(vget_low_s16(Low)));
+			vst1q_s32(pDst+4, vmovl_s16(vget_high_s16(Low)));
+			vst1q_s32(pDst+8, vmovl_s16(vget_low_s16(High)));
+			vst1q_s32(pDst+12, vmovl_s16(vget_high_s16(High)));
+			pSrc += 16;
+			pDst += 16;
+		}
+		else
+		{
+			const unsigned char *pBlockEnd = pSrc + 16;
+			while(pSrc < pBlockEnd)
+				pSrc = CVariableInt::Unpack(pSrc, pDst++);
+		}
+	}
+	return VarIntDecompressTail(pSrc, pEnd, pDst, pDstEnd, pDst_);
+}
+#endif
+
+static const CSnapshotSimd s_aSnapshotSimd[NUM_SNAPSHOTSIMD] = {
+	{"scalar", DiffItemScalar, UndiffItemScalar, SumScalar, CVariableInt::CompressScalar, CVariableInt::DecompressScalar},
+#if defined(SNAPSHOTSIMD_X86)
+	{"sse2", DiffItemSse2, UndiffItemSse2, SumSse2, VarIntCompressSse2, VarIntDecompressSse2},
+	{"avx2", DiffItemAvx2, UndiffItemAvx2, SumAvx2, VarIntCompressAvx2, VarIntDecompressAvx2},
+#else
+	{"sse2", 0, 0, 0, 0, 0},
+	{"avx2", 0, 0, 0, 0, 0},
+#endif
+#if defined(SNAPSHOTSIMD_ARM_NEON)
+	{"neon", DiffItemNeon, UndiffItemNeon, SumNeon, VarIntCompressNeon, VarIntDecompressNeon},
+#else
+	{"neon", 0, 0, 0, 0, 0},
+#endif
+};
+
+class CSnapshotSimdSupport
+{
+public:
+	bool m_aSupported[NUM_SNAPSHOTSIMD];
+	const CSnapshotSimd *m_pBest;
+
+	CSnapshotSimdSupport()
+	{
+		mem_zero(m_aSupported, sizeof(m_aSupported));
+		m_aSupported[SNAPSHOTSIMD_SCALAR] = true;
+#if defined(SNAPSHOTSIMD_X86)
+		CpuFeatures(&m_aSupported[SNAPSHOTSIMD_SSE2], &m_aSupported[SNAPSHOTSIMD_AVX2]);
+#endif
+#if defined(SNAPSHOTSIMD_ARM_NEON)
+		m_aSupported[SNAPSHOTSIMD_NEON] = true;
+#endif
+		m_pBest = &s_aSnapshotSimd[SNAPSHOTSIMD_SCALAR];
+		for(int i = 0; i < NUM_SNAPSHOTSIMD; i++)
+			if(m_aSupported[i])
+				m_pBest = &s_aSnapshotSimd[i];
+	}
+};
+
+static const CSnapshotSimdSupport *Support()
+{
+	static const CSnapshotSimdSupport s_Support;
+	return &s_Support;
+}
+
+static const CSnapshotSimd *gs_pSelectedSnapshotSimd = 0;
+
+const CSnapshotSimd *SnapshotSimd(int Type)
+{
+	if(Type < 0 || Type >= NUM_SNAPSHOTSIMD || !Support()->m_aSupported[Type])
+		return 0;
+	return &s_aSnapshotSimd[Type];
+}
+
+const CSnapshotSimd *SnapshotSimd()
+{
+	if(gs_pSelectedSnapshotSimd)
+		return gs_pSelectedSnapshotSimd;
+	return Support()->m_pBest;
+}
+
+bool SnapshotSimdSelect(int Type)
+{
+	if(Type == -1)
+	{
+		gs_pSelectedSnapshotSimd = 0;
+		return true;
+	}
+	const CSnapshotSimd *pSimd = SnapshotSimd(Type);
+	if(!pSimd)
+		return false;
+	gs_pSelectedSnapshotSimd = pSimd;
+	return true;
+}
@@ -0,0 +1,46 @@
+/* (c) Magnus Auvinen. See licence.txt in the root of the distribution for more information. */
+/* If you are missing that file, acquire a complete release at teeworlds.com.                */
+#ifndef ENGINE_SHARED_SNAPSHOT_SIMD_H
+#define ENGINE_SHARED_SNAPSHOT_SIMD_H
+
+// vectorized inner loops of the snapshot code, the scalar versions are the reference
+
+enum
+{
+	SNAPSHOTSIMD_SCALAR=0,
+	SNAPSHOTSIMD_SSE2,
+	SNAPSHOTSIMD_AVX2,
+	SNAPSHOTSIMD_NEON,
+	NUM_SNAPSHOTSIMD
+};
+
+class CSnapshotSimd
+{
+public:
+	const char *m_pName;
+
+	// writes pCurrent-pPast to pOut, returns the bitwise or of all differences (0 = unchanged)
+	int (*m_pfnDiffItem)(const int *pPast, const int *pCurrent, int *pOut, int Size);
+
+	// writes pPast+pDiff to pOut, returns the data rate of the diff in bits
+	// (1 for a zero, otherwise 8 times the packed size of the value)
+	int (*m_pfnUndiffItem)(const int *pPast, const int *pDiff, int *pOut, int Size);
+
+	// sum of all values, wrapping on overflow
+	int (*m_pfnSum)(const int *pData, int Size);
+
+	// CVariableInt::Compress and Decompress, the output is identical to the scalar versions
+	long (*m_pfnVarIntCompress)(const void *pSrc, int SrcSize, void *pDst, int DstSize);
+	long (*m_pfnVarIntDecompress)(const void *pSrc, int SrcSize, void *pDst, int DstSize);
+};
+
+// returns the implementation of the given type or 0 if the cpu doesn't support it
+const CSnapshotSimd *SnapshotSimd(int Type);
+
+// returns the implementation that is currently used
+const CSnapshotSimd *SnapshotSimd();
+
+// overrides the automatically chosen implementation, -1 restores it
+bool SnapshotSimdSelect(int Type);
+
+#endif
@@ -29,6 +29,7 @@ public:
 	virtual void Tick();
 	virtual void TickDefered();
 	virtual void TickPaused();
+	virtual void SnapShared();
 	virtual void Snap(int SnappingClient);
 	virtual void PostSnap();
 
@@ -126,6 +127,9 @@ private:
 	CCharacterCore m_SendCore; // core that we should send
 	CCharacterCore m_ReckoningCore; // the dead reckoning core
 
+	// what every client gets, only the owner and its spectators see health, armor and ammo
+	CNetObj_Character m_SnapItem;
+
 };
 
 #endif
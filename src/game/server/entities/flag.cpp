@@ -22,7 +22,7 @@ void CFlag::Reset()
 {
 	m_pCarrier = 0;
 	m_AtStand = true;
-	m_Pos = m_StandPos;
+	SetPos(m_StandPos);
 	m_Vel = vec2(0, 0);
 	m_GrabTick = 0;
 }
@@ -47,7 +47,7 @@ void CFlag::TickDefered()
 	if(m_pCarrier)
 	{
 		// update flag position
-		m_Pos = m_pCarrier->GetPos();
+		SetPos(m_pCarrier->GetPos());
 	}
 	else
 	{
@@ -69,7 +69,9 @@ void CFlag::TickDefered()
 			else
 			{
 				m_Vel.y += GameWorld()->m_Core.m_Tuning[Config()->m_ClDummy].m_Gravity;
-				GameServer()->Collision()->MoveBox(&m_Pos, &m_Vel, vec2(ms_PhysSize, ms_PhysSize), 0.5f);
+				vec2 Pos = m_Pos;
+				GameServer()->Collision()->MoveBox(&Pos, &m_Vel, vec2(ms_PhysSize, ms_PhysSize), 0.5f);
+				SetPos(Pos);
 			}
 		}
 	}
@@ -82,16 +84,19 @@ void CFlag::TickPaused()
 		m_GrabTick++;
 }
 
+void CFlag::SnapShared()
+{
+	m_SnapItem.m_X = round_to_int(m_Pos.x);
+	m_SnapItem.m_Y = round_to_int(m_Pos.y);
+	m_SnapItem.m_Team = m_Team;
+}
+
 void CFlag::Snap(int SnappingClient)
 {
 	if(NetworkClipped(SnappingClient))
 		return;
 
 	CNetObj_Flag *pFlag = (CNetObj_Flag *)Server()->SnapNewItem(NETOBJTYPE_FLAG, m_Team, sizeof(CNetObj_Flag));
-	if(!pFlag)
-		return;
-
-	pFlag->m_X = round_to_int(m_Pos.x);
-	pFlag->m_Y = round_to_int(m_Pos.y);
-	pFlag->m_Team = m_Team;
+	if(pFlag)
+		*pFlag = m_SnapItem;
 }
@@ -19,6 +19,8 @@ private:
 	int m_GrabTick;
 	int m_DropTick;
 
+	CNetObj_Flag m_SnapItem;
+
 public:
 	/* Constants */
 	static int const ms_PhysSize = 14;
@@ -36,6 +38,7 @@ public:
 	/* CEntity functions */
 	virtual void Reset();
 	virtual void TickPaused();
+	virtual void SnapShared();
 	virtual void Snap(int SnappingClient);
 	virtual void TickDefered();
 
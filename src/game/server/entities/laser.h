@@ -13,6 +13,7 @@ public:
 	virtual void Reset();
 	virtual void Tick();
 	virtual void TickPaused();
+	virtual void SnapShared();
 	virtual void Snap(int SnappingClient);
 
 protected:
@@ -26,6 +27,8 @@ private:
 	int m_Bounces;
 	int m_EvalTick;
 	int m_Owner;
+
+	CNetObj_Laser m_SnapItem;
 };
 
 #endif
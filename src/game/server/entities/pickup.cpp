@@ -134,16 +134,19 @@ void CPickup::TickPaused()
 		++m_SpawnTick;
 }
 
+void CPickup::SnapShared()
+{
+	m_SnapItem.m_X = round_to_int(m_Pos.x);
+	m_SnapItem.m_Y = round_to_int(m_Pos.y);
+	m_SnapItem.m_Type = m_Type;
+}
+
 void CPickup::Snap(int SnappingClient)
 {
 	if(m_SpawnTick != -1 || NetworkClipped(SnappingClient))
 		return;
 
 	CNetObj_Pickup *pP = static_cast<CNetObj_Pickup *>(Server()->SnapNewItem(NETOBJTYPE_PICKUP, GetID(), sizeof(CNetObj_Pickup)));
-	if(!pP)
-		return;
-
-	pP->m_X = round_to_int(m_Pos.x);
-	pP->m_Y = round_to_int(m_Pos.y);
-	pP->m_Type = m_Type;
+	if(pP)
+		*pP = m_SnapItem;
 }
@@ -15,11 +15,14 @@ public:
 	virtual void Reset();
 	virtual void Tick();
 	virtual void TickPaused();
+	virtual void SnapShared();
 	virtual void Snap(int SnappingClient);
 
 private:
 	int m_Type;
 	int m_SpawnTick;
+
+	CNetObj_Pickup m_SnapItem;
 };
 
 #endif
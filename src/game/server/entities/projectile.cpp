@@ -21,6 +21,7 @@ CProjectile::CProjectile(CGameWorld *pGameWorld, int Type, int Owner, vec2 Pos,
 	m_SoundImpact = SoundImpact;
 	m_Weapon = Weapon;
 	m_StartTick = Server()->Tick();
+	m_StartPos = m_Pos;
 	m_Explosive = Explosive;
 
 	GameWorld()->InsertEntity(this);
@@ -62,7 +63,7 @@ vec2 CProjectile::GetPos(float Time)
 			break;
 	}
 
-	return CalcPos(m_Pos, m_Direction, Curvature, Speed, Time);
+	return CalcPos(m_StartPos, m_Direction, Curvature, Speed, Time);
 }
 
 
@@ -72,6 +73,7 @@ void CProjectile::Tick()
 	float Ct = (Server()->Tick()-m_StartTick)/(float)Server()->TickSpeed();
 	vec2 PrevPos = GetPos(Pt);
 	vec2 CurPos = GetPos(Ct);
+	SetPos(CurPos);
 	int Collide = GameServer()->Collision()->IntersectLine(PrevPos, CurPos, &CurPos, 0);
 	CCharacter *OwnerChar = GameServer()->GetPlayerChar(m_Owner);
 	CCharacter *TargetChr = GameWorld()->IntersectCharacter(PrevPos, CurPos, 6.0f, CurPos, OwnerChar);
@@ -100,22 +102,27 @@ void CProjectile::TickPaused()
 
 void CProjectile::FillInfo(CNetObj_Projectile *pProj)
 {
-	pProj->m_X = round_to_int(m_Pos.x);
-	pProj->m_Y = round_to_int(m_Pos.y);
+	pProj->m_X = round_to_int(m_StartPos.x);
+	pProj->m_Y = round_to_int(m_StartPos.y);
 	pProj->m_VelX = round_to_int(m_Direction.x*100.0f);
 	pProj->m_VelY = round_to_int(m_Direction.y*100.0f);
 	pProj->m_StartTick = m_StartTick;
 	pProj->m_Type = m_Type;
 }
 
-void CProjectile::Snap(int SnappingClient)
+void CProjectile::SnapShared()
 {
 	float Ct = (Server()->Tick()-m_StartTick)/(float)Server()->TickSpeed();
+	m_SnapPos = GetPos(Ct);
+	FillInfo(&m_SnapItem);
+}
 
-	if(NetworkClipped(SnappingClient, GetPos(Ct)))
+void CProjectile::Snap(int SnappingClient)
+{
+	if(NetworkClipped(SnappingClient, m_SnapPos))
 		return;
 
 	CNetObj_Projectile *pProj = static_cast<CNetObj_Projectile *>(Server()->SnapNewItem(NETOBJTYPE_PROJECTILE, GetID(), sizeof(CNetObj_Projectile)));
 	if(pProj)
-		FillInfo(pProj);
+		*pProj = m_SnapItem;
 }
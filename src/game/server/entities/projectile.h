@@ -24,9 +24,14 @@ public:
 	virtual void Reset();
 	virtual void Tick();
 	virtual void TickPaused();
+	virtual void SnapShared();
 	virtual void Snap(int SnappingClient);
 
 private:
+	vec2 m_SnapPos;
+	CNetObj_Projectile m_SnapItem;
+
+	vec2 m_StartPos;
 	vec2 m_Direction;
 	int m_LifeSpan;
 	int m_Owner;
@@ -12,6 +12,11 @@ CEntity::CEntity(CGameWorld *pGameWorld, int ObjType, vec2 Pos, int ProximityRad
 	m_pPrevTypeEntity = 0;
 	m_pNextTypeEntity = 0;
 
+	m_pPrevCellEntity = 0;
+	m_pNextCellEntity = 0;
+	m_GridCell = -1;
+	m_InsertOrder = 0;
+
 	m_ID = Server()->SnapNewID();
 	m_ObjType = ObjType;
 
@@ -40,7 +45,7 @@ int CEntity::NetworkClipped(int SnappingClient, vec2 CheckPos)
 	float dx = GameServer()->m_apPlayers[SnappingClient]->m_ViewPos.x-CheckPos.x;
 	float dy = GameServer()->m_apPlayers[SnappingClient]->m_ViewPos.y-CheckPos.y;
 
-	if(absolute(dx) > 1000.0f || absolute(dy) > 800.0f)
+	if(absolute(dx) > CGameWorld::SNAP_RANGE_X || absolute(dy) > CGameWorld::SNAP_RANGE_Y)
 		return 1;
 
 	if(distance(GameServer()->m_apPlayers[SnappingClient]->m_ViewPos, CheckPos) > 1100.0f)
@@ -26,6 +26,11 @@ private:
 	CEntity *m_pPrevTypeEntity;
 	CEntity *m_pNextTypeEntity;
 
+	CEntity *m_pPrevCellEntity;
+	CEntity *m_pNextCellEntity;
+	int m_GridCell;
+	int64 m_InsertOrder;
+
 	int m_ID;
 	int m_ObjType;
 
@@ -50,6 +55,9 @@ protected:
 	/* Getters */
 	int GetID() const					{ return m_ID; }
 
+	/* Setters */
+	void SetPos(vec2 Pos)				{ m_Pos = Pos; m_pGameWorld->UpdateEntityCell(this); }
+
 public:
 	/* Constructor */
 	CEntity(CGameWorld *pGameWorld, int Objtype, vec2 Pos, int ProximityRadius=0);
@@ -107,6 +115,14 @@ public:
 	*/
 	virtual void TickPaused() {}
 
+	/*
+		Function: SnapShared
+			Called once before the clients are snapped to prepare the
+			items of the entity that are the same for every client.
+			Snap then only has to clip and copy them.
+	*/
+	virtual void SnapShared() {}
+
 	/*
 		Function: Snap
 			Called when a new snapshot is being generated for a specific
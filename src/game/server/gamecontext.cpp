@@ -1566,6 +1566,7 @@ void CGameContext::OnInit()
 
 	m_Layers.Init(Kernel());
 	m_Collision.Init(Config(), &m_Layers);
+	m_World.InitGrid(m_Collision.GetWidth(), m_Collision.GetHeight());
 
 	// select gametype
 	if(str_comp_nocase(Config()->m_SvGametype, "mod") == 0)
@@ -1636,6 +1637,12 @@ void CGameContext::OnShutdown()
 	Clear();
 }
 
+void CGameContext::OnSnapShared()
+{
+	m_World.SnapShared();
+	m_pController->SnapShared();
+}
+
 void CGameContext::OnSnap(int ClientID)
 {
 	// add tuning to demo
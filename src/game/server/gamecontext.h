@@ -25,6 +25,10 @@
 			All players (CPlayer::tick)
 
 
+	Snap shared (once per tick, items that are the same for every client)
+		Game Context (CGameContext::snap_shared)
+			Game Controller (GAMECONTROLLER::snap_shared)
+
 	Snap
 		Game Context (CGameContext::snap)
 			Game World (GAMEWORLD::snap)
@@ -175,6 +179,7 @@ public:
 
 	virtual void OnTick();
 	virtual void OnPreSnap();
+	virtual void OnSnapShared();
 	virtual void OnSnap(int ClientID);
 	virtual void OnPostSnap();
 
@@ -671,6 +671,23 @@ void IGameController::SwapTeamscore()
 
 // general
 void IGameController::Snap(int SnappingClient)
+{
+	// demo recording
+	if(SnappingClient == -1)
+	{
+		CNetObj_De_GameInfo *pGameInfo = static_cast<CNetObj_De_GameInfo *>(Server()->SnapNewItem(NETOBJTYPE_DE_GAMEINFO, 0, sizeof(CNetObj_De_GameInfo)));
+		if(!pGameInfo)
+			return;
+
+		pGameInfo->m_GameFlags = m_GameFlags;
+		pGameInfo->m_ScoreLimit = m_GameInfo.m_ScoreLimit;
+		pGameInfo->m_TimeLimit = m_GameInfo.m_TimeLimit;
+		pGameInfo->m_MatchNum = m_GameInfo.m_MatchNum;
+		pGameInfo->m_MatchCurrent = m_GameInfo.m_MatchCurrent;
+	}
+}
+
+void IGameController::SnapShared()
 {
 	CNetObj_GameData *pGameData = static_cast<CNetObj_GameData *>(Server()->SnapNewItem(NETOBJTYPE_GAMEDATA, 0, sizeof(CNetObj_GameData)));
 	if(!pGameData)
@@ -721,20 +738,6 @@ void IGameController::Snap(int SnappingClient)
 		pGameDataTeam->m_TeamscoreRed = m_aTeamscore[TEAM_RED];
 		pGameDataTeam->m_TeamscoreBlue = m_aTeamscore[TEAM_BLUE];
 	}
-
-	// demo recording
-	if(SnappingClient == -1)
-	{
-		CNetObj_De_GameInfo *pGameInfo = static_cast<CNetObj_De_GameInfo *>(Server()->SnapNewItem(NETOBJTYPE_DE_GAMEINFO, 0, sizeof(CNetObj_De_GameInfo)));
-		if(!pGameInfo)
-			return;
-
-		pGameInfo->m_GameFlags = m_GameFlags;
-		pGameInfo->m_ScoreLimit = m_GameInfo.m_ScoreLimit;
-		pGameInfo->m_TimeLimit = m_GameInfo.m_TimeLimit;
-		pGameInfo->m_MatchNum = m_GameInfo.m_MatchNum;
-		pGameInfo->m_MatchCurrent = m_GameInfo.m_MatchCurrent;
-	}
 }
 
 void IGameController::Tick()
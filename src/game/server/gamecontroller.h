@@ -197,6 +197,7 @@ public:
 
 	// general
 	virtual void Snap(int SnappingClient);
+	virtual void SnapShared();
 	virtual void Tick();
 
 	// info
@@ -115,9 +115,9 @@ bool CGameControllerCTF::DoWincheckMatch()
 }
 
 // general
-void CGameControllerCTF::Snap(int SnappingClient)
+void CGameControllerCTF::SnapShared()
 {
-	IGameController::Snap(SnappingClient);
+	IGameController::SnapShared();
 
 	CNetObj_GameDataFlag *pGameDataFlag = static_cast<CNetObj_GameDataFlag *>(Server()->SnapNewItem(NETOBJTYPE_GAMEDATAFLAG, 0, sizeof(CNetObj_GameDataFlag)));
 	if(!pGameDataFlag)
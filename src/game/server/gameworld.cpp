@@ -1,11 +1,14 @@
 /* (c) Magnus Auvinen. See licence.txt in the root of the distribution for more information. */
 /* If you are missing that file, acquire a complete release at teeworlds.com.                */
 
+#include <engine/shared/config.h>
+
 #include "entities/character.h"
 #include "entity.h"
 #include "gamecontext.h"
 #include "gamecontroller.h"
 #include "gameworld.h"
+#include "player.h"
 
 
 //////////////////////////////////////////////////
@@ -20,7 +23,15 @@ CGameWorld::CGameWorld()
 	m_Paused = false;
 	m_ResetRequested = false;
 	for(int i = 0; i < NUM_ENTTYPES; i++)
+	{
 		m_apFirstEntityTypes[i] = 0;
+		m_aMaxProximityRadius[i] = 0.0f;
+	}
+
+	m_apGridCells = 0;
+	m_GridWidth = 0;
+	m_GridHeight = 0;
+	m_NextInsertOrder = 0;
 }
 
 CGameWorld::~CGameWorld()
@@ -29,6 +40,8 @@ CGameWorld::~CGameWorld()
 	for(int i = 0; i < NUM_ENTTYPES; i++)
 		while(m_apFirstEntityTypes[i])
 			delete m_apFirstEntityTypes[i];
+
+	delete[] m_apGridCells;
 }
 
 void CGameWorld::SetGameServer(CGameContext *pGameServer)
@@ -43,23 +56,135 @@ CEntity *CGameWorld::FindFirst(int Type)
 	return Type < 0 || Type >= NUM_ENTTYPES ? 0 : m_apFirstEntityTypes[Type];
 }
 
+void CGameWorld::InitGrid(int Width, int Height)
+{
+	delete[] m_apGridCells;
+
+	m_GridWidth = max((Width*32+GRID_CELL_SIZE-1)/GRID_CELL_SIZE, 1);
+	m_GridHeight = max((Height*32+GRID_CELL_SIZE-1)/GRID_CELL_SIZE, 1);
+	int NumCells = NUM_ENTTYPES*m_GridWidth*m_GridHeight;
+	m_apGridCells = new CEntity*[NumCells];
+	mem_zero(m_apGridCells, NumCells*sizeof(CEntity *));
+
+	// sort in the entities that already exist
+	for(int i = 0; i < NUM_ENTTYPES; i++)
+		for(CEntity *pEnt = m_apFirstEntityTypes[i]; pEnt; pEnt = pEnt->m_pNextTypeEntity)
+		{
+			pEnt->m_GridCell = -1;
+			GridInsert(pEnt);
+		}
+}
+
+int CGameWorld::GridCoord(float Value, int Size) const
+{
+	// positions outside of the map go to the border cells
+	return (int)clamp(Value/GRID_CELL_SIZE, 0.0f, (float)(Size-1));
+}
+
+int CGameWorld::GridCell(vec2 Pos, int Type) const
+{
+	return (Type*m_GridHeight+GridCoord(Pos.y, m_GridHeight))*m_GridWidth+GridCoord(Pos.x, m_GridWidth);
+}
+
+void CGameWorld::GridInsert(CEntity *pEnt)
+{
+	if(!m_apGridCells)
+		return;
+
+	int Cell = GridCell(pEnt->m_Pos, pEnt->m_ObjType);
+	if(m_apGridCells[Cell])
+		m_apGridCells[Cell]->m_pPrevCellEntity = pEnt;
+	pEnt->m_pNextCellEntity = m_apGridCells[Cell];
+	pEnt->m_pPrevCellEntity = 0;
+	pEnt->m_GridCell = Cell;
+	m_apGridCells[Cell] = pEnt;
+}
+
+void CGameWorld::GridRemove(CEntity *pEnt)
+{
+	if(pEnt->m_GridCell < 0)
+		return;
+
+	if(pEnt->m_pPrevCellEntity)
+		pEnt->m_pPrevCellEntity->m_pNextCellEntity = pEnt->m_pNextCellEntity;
+	else
+		m_apGridCells[pEnt->m_GridCell] = pEnt->m_pNextCellEntity;
+	if(pEnt->m_pNextCellEntity)
+		pEnt->m_pNextCellEntity->m_pPrevCellEntity = pEnt->m_pPrevCellEntity;
+
+	pEnt->m_pNextCellEntity = 0;
+	pEnt->m_pPrevCellEntity = 0;
+	pEnt->m_GridCell = -1;
+}
+
+void CGameWorld::UpdateEntityCell(CEntity *pEnt)
+{
+	// not in the world (yet)
+	if(pEnt->m_GridCell < 0 || GridCell(pEnt->m_Pos, pEnt->m_ObjType) == pEnt->m_GridCell)
+		return;
+
+	GridRemove(pEnt);
+	GridInsert(pEnt);
+}
+
+bool CGameWorld::QueryRange(vec2 Min, vec2 Max, float Border, int *pX0, int *pY0, int *pX1, int *pY1)
+{
+	if(!m_apGridCells || !Config()->m_SvWorldGrid)
+	{
+		*pX0 = *pY0 = *pX1 = *pY1 = 0;
+		return false;
+	}
+
+	*pX0 = GridCoord(Min.x-Border, m_GridWidth);
+	*pY0 = GridCoord(Min.y-Border, m_GridHeight);
+	*pX1 = GridCoord(Max.x+Border, m_GridWidth);
+	*pY1 = GridCoord(Max.y+Border, m_GridHeight);
+	return true;
+}
+
+CEntity *CGameWorld::QueryFirst(int Type, int x, int y, bool Grid) const
+{
+	return Grid ? m_apGridCells[(Type*m_GridHeight+y)*m_GridWidth+x] : m_apFirstEntityTypes[Type];
+}
+
+CEntity *CGameWorld::QueryNext(CEntity *pEnt, bool Grid)
+{
+	return Grid ? pEnt->m_pNextCellEntity : pEnt->m_pNextTypeEntity;
+}
+
 int CGameWorld::FindEntities(vec2 Pos, float Radius, CEntity **ppEnts, int Max, int Type)
 {
 	if(Type < 0 || Type >= NUM_ENTTYPES)
 		return 0;
 
+	int x0, y0, x1, y1;
+	bool Grid = QueryRange(Pos-vec2(Radius, Radius), Pos+vec2(Radius, Radius), m_aMaxProximityRadius[Type], &x0, &y0, &x1, &y1);
+
 	int Num = 0;
-	for(CEntity *pEnt = m_apFirstEntityTypes[Type];	pEnt; pEnt = pEnt->m_pNextTypeEntity)
-	{
-		if(distance(pEnt->m_Pos, Pos) < Radius+pEnt->m_ProximityRadius)
-		{
-			if(ppEnts)
-				ppEnts[Num] = pEnt;
-			Num++;
-			if(Num == Max)
-				break;
-		}
-	}
+	for(int y = y0; y <= y1; y++)
+		for(int x = x0; x <= x1; x++)
+			for(CEntity *pEnt = QueryFirst(Type, x, y, Grid); pEnt; pEnt = QueryNext(pEnt, Grid))
+			{
+				if(distance(pEnt->m_Pos, Pos) >= Radius+pEnt->m_ProximityRadius)
+					continue;
+
+				if(!ppEnts)
+				{
+					Num = min(Num+1, Max);
+					continue;
+				}
+
+				// keep the first entities in list order, like walking the list would
+				int i = Num < Max ? Num++ : Max;
+				while(i > 0 && ppEnts[i-1]->m_InsertOrder < pEnt->m_InsertOrder)
+				{
+					if(i < Max)
+						ppEnts[i] = ppEnts[i-1];
+					i--;
+				}
+				if(i < Max)
+					ppEnts[i] = pEnt;
+			}
 
 	return Num;
 }
@@ -77,6 +202,10 @@ void CGameWorld::InsertEntity(CEntity *pEnt)
 	pEnt->m_pNextTypeEntity = m_apFirstEntityTypes[pEnt->m_ObjType];
 	pEnt->m_pPrevTypeEntity = 0x0;
 	m_apFirstEntityTypes[pEnt->m_ObjType] = pEnt;
+
+	pEnt->m_InsertOrder = m_NextInsertOrder++;
+	m_aMaxProximityRadius[pEnt->m_ObjType] = max(m_aMaxProximityRadius[pEnt->m_ObjType], pEnt->m_ProximityRadius);
+	GridInsert(pEnt);
 }
 
 void CGameWorld::DestroyEntity(CEntity *pEnt)
@@ -104,18 +233,40 @@ void CGameWorld::RemoveEntity(CEntity *pEnt)
 
 	pEnt->m_pNextTypeEntity = 0;
 	pEnt->m_pPrevTypeEntity = 0;
+
+	GridRemove(pEnt);
 }
 
 //
 void CGameWorld::Snap(int SnappingClient)
 {
+	// snapping must not modify the world, several clients can be snapped at the same time
+	vec2 ViewPos = SnappingClient == -1 ? vec2(0, 0) : GameServer()->m_apPlayers[SnappingClient]->m_ViewPos;
+	vec2 Range(SNAP_RANGE_X, SNAP_RANGE_Y);
+
 	for(int i = 0; i < NUM_ENTTYPES; i++)
-		for(CEntity *pEnt = m_apFirstEntityTypes[i]; pEnt; )
-		{
-			m_pNextTraverseEntity = pEnt->m_pNextTypeEntity;
-			pEnt->Snap(SnappingClient);
-			pEnt = m_pNextTraverseEntity;
-		}
+	{
+		// only visit the entities around the view of the client. flags are always needed
+		// and lasers can be seen from both ends, so these are always visited
+		int x0, y0, x1, y1;
+		bool Grid = false;
+		if(SnappingClient != -1 && i != ENTTYPE_FLAG && i != ENTTYPE_LASER)
+			Grid = QueryRange(ViewPos-Range, ViewPos+Range, 0.0f, &x0, &y0, &x1, &y1);
+		else
+			x0 = y0 = x1 = y1 = 0;
+
+		for(int y = y0; y <= y1; y++)
+			for(int x = x0; x <= x1; x++)
+				for(CEntity *pEnt = QueryFirst(i, x, y, Grid); pEnt; pEnt = QueryNext(pEnt, Grid))
+					pEnt->Snap(SnappingClient);
+	}
+}
+
+void CGameWorld::SnapShared()
+{
+	for(int i = 0; i < NUM_ENTTYPES; i++)
+		for(CEntity *pEnt = m_apFirstEntityTypes[i]; pEnt; pEnt = pEnt->m_pNextTypeEntity)
+			pEnt->SnapShared();
 }
 
 void CGameWorld::PostSnap()
@@ -210,25 +361,32 @@ CCharacter *CGameWorld::IntersectCharacter(vec2 Pos0, vec2 Pos1, float Radius, v
 	float ClosestLen = distance(Pos0, Pos1) * 100.0f;
 	CCharacter *pClosest = 0;
 
-	CCharacter *p = (CCharacter *)FindFirst(ENTTYPE_CHARACTER);
-	for(; p; p = (CCharacter *)p->TypeNext())
- 	{
-		if(p == pNotThis)
-			continue;
+	int x0, y0, x1, y1;
+	vec2 Min(min(Pos0.x, Pos1.x)-Radius, min(Pos0.y, Pos1.y)-Radius);
+	vec2 Max(max(Pos0.x, Pos1.x)+Radius, max(Pos0.y, Pos1.y)+Radius);
+	bool Grid = QueryRange(Min, Max, m_aMaxProximityRadius[ENTTYPE_CHARACTER], &x0, &y0, &x1, &y1);
 
-		vec2 IntersectPos = closest_point_on_line(Pos0, Pos1, p->m_Pos);
-		float Len = distance(p->m_Pos, IntersectPos);
-		if(Len < p->m_ProximityRadius+Radius)
-		{
-			Len = distance(Pos0, IntersectPos);
-			if(Len < ClosestLen)
+	for(int y = y0; y <= y1; y++)
+		for(int x = x0; x <= x1; x++)
+			for(CCharacter *p = (CCharacter *)QueryFirst(ENTTYPE_CHARACTER, x, y, Grid); p; p = (CCharacter *)QueryNext(p, Grid))
 			{
-				NewPos = IntersectPos;
-				ClosestLen = Len;
-				pClosest = p;
+				if(p == pNotThis)
+					continue;
+
+				vec2 IntersectPos = closest_point_on_line(Pos0, Pos1, p->m_Pos);
+				float Len = distance(p->m_Pos, IntersectPos);
+				if(Len < p->m_ProximityRadius+Radius)
+				{
+					// on a tie the entity that comes first in the list wins
+					Len = distance(Pos0, IntersectPos);
+					if(Len < ClosestLen || (Len == ClosestLen && pClosest && p->m_InsertOrder > pClosest->m_InsertOrder))
+					{
+						NewPos = IntersectPos;
+						ClosestLen = Len;
+						pClosest = p;
+					}
+				}
 			}
-		}
-	}
 
 	return pClosest;
 }
@@ -236,26 +394,33 @@ CCharacter *CGameWorld::IntersectCharacter(vec2 Pos0, vec2 Pos1, float Radius, v
 
 CEntity *CGameWorld::ClosestEntity(vec2 Pos, float Radius, int Type, CEntity *pNotThis)
 {
+	if(Type < 0 || Type >= NUM_ENTTYPES)
+		return 0;
+
 	// Find other players
 	float ClosestRange = Radius*2;
 	CEntity *pClosest = 0;
 
-	CEntity *p = FindFirst(Type);
-	for(; p; p = p->TypeNext())
- 	{
-		if(p == pNotThis)
-			continue;
+	int x0, y0, x1, y1;
+	bool Grid = QueryRange(Pos-vec2(Radius, Radius), Pos+vec2(Radius, Radius), m_aMaxProximityRadius[Type], &x0, &y0, &x1, &y1);
 
-		float Len = distance(Pos, p->m_Pos);
-		if(Len < p->m_ProximityRadius+Radius)
-		{
-			if(Len < ClosestRange)
+	for(int y = y0; y <= y1; y++)
+		for(int x = x0; x <= x1; x++)
+			for(CEntity *p = QueryFirst(Type, x, y, Grid); p; p = QueryNext(p, Grid))
 			{
-				ClosestRange = Len;
-				pClosest = p;
+				if(p == pNotThis)
+					continue;
+
+				float Len = distance(Pos, p->m_Pos);
+				if(Len < p->m_ProximityRadius+Radius)
+				{
+					if(Len < ClosestRange || (Len == ClosestRange && pClosest && p->m_InsertOrder > pClosest->m_InsertOrder))
+					{
+						ClosestRange = Len;
+						pClosest = p;
+					}
+				}
 			}
-		}
-	}
 
 	return pClosest;
 }
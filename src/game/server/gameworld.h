@@ -26,13 +26,44 @@ public:
 		NUM_ENTTYPES
 	};
 
+	enum
+	{
+		// entities further away from the view position of a client aren't snapped
+		SNAP_RANGE_X=1000,
+		SNAP_RANGE_Y=800,
+	};
+
 private:
+	enum
+	{
+		GRID_CELL_SIZE=128,
+	};
+
 	void Reset();
 	void RemoveEntities();
 
 	CEntity *m_pNextTraverseEntity;
 	CEntity *m_apFirstEntityTypes[NUM_ENTTYPES];
 
+	// the entities of every type are also sorted into a uniform grid over the map,
+	// so the position queries only have to look at the cells around the position
+	CEntity **m_apGridCells;
+	int m_GridWidth;
+	int m_GridHeight;
+	float m_aMaxProximityRadius[NUM_ENTTYPES];
+	int64 m_NextInsertOrder;
+
+	int GridCoord(float Value, int Size) const;
+	int GridCell(vec2 Pos, int Type) const;
+	void GridInsert(CEntity *pEnt);
+	void GridRemove(CEntity *pEnt);
+
+	// the queries walk the grid cells overlapping the range, or a single
+	// pseudo cell with all entities of the type when the grid is not used
+	bool QueryRange(vec2 Min, vec2 Max, float Border, int *pX0, int *pY0, int *pX1, int *pY1);
+	CEntity *QueryFirst(int Type, int x, int y, bool Grid) const;
+	static CEntity *QueryNext(CEntity *pEnt, bool Grid);
+
 	class CGameContext *m_pGameServer;
 	class CConfig *m_pConfig;
 	class IServer *m_pServer;
@@ -53,6 +84,26 @@ public:
 
 	CEntity *FindFirst(int Type);
 
+	/*
+		Function: InitGrid
+			Sets up the entity grid for a map of the given size.
+
+		Arguments:
+			Width - Width of the map in tiles.
+			Height - Height of the map in tiles.
+	*/
+	void InitGrid(int Width, int Height);
+
+	/*
+		Function: UpdateEntityCell
+			Moves an entity to the grid cell of its current position.
+			Called by the entity whenever its position changes.
+
+		Arguments:
+			pEnt - Entity that moved.
+	*/
+	void UpdateEntityCell(CEntity *pEnt);
+
 	/*
 		Function: find_entities
 			Finds entities close to a position and returns them in a list.
@@ -138,6 +189,13 @@ public:
 			is being created.
 	*/
 	void Snap(int SnappingClient);
+
+	/*
+		Function: SnapShared
+			Calls SnapShared on all the entities in the world, once
+			before the snapshots of the clients are created.
+	*/
+	void SnapShared();
 	
 	void PostSnap();
 
@@ -88,6 +88,70 @@ TEST(Ex, SnapshotObject)
 	EXPECT_EQ(pSnap->GetItemIndex(NETOBJTYPE_MYOWNEVENT, 1), IndexEvent);
 }
 
+TEST(Ex, SnapshotBase)
+{
+	CSnapshotBuilder Base;
+	Base.Init();
+	CNetObj_MyOwnObject *pObj = (CNetObj_MyOwnObject *)Base.NewItem(NETOBJTYPE_MYOWNOBJECT, 0, sizeof(*pObj));
+	ASSERT_NE(pObj, nullptr);
+	pObj->m_Test = 1234567890;
+
+	CSnapshotBuilder Builder;
+	Builder.Init(&Base);
+	CNetObj_MyOwnEvent *pEvent = (CNetObj_MyOwnEvent *)Builder.NewItem(NETOBJTYPE_MYOWNEVENT, 1, sizeof(*pEvent));
+	ASSERT_NE(pEvent, nullptr);
+	pEvent->m_Test = 1357924680;
+
+	unsigned char aData[CSnapshot::MAX_SIZE];
+	Builder.Finish(aData);
+	CSnapshot *pSnap = (CSnapshot *)aData;
+
+	int IndexObj = pSnap->GetItemIndex(NETOBJTYPE_MYOWNOBJECT, 0);
+	int IndexEvent = pSnap->GetItemIndex(NETOBJTYPE_MYOWNEVENT, 1);
+	ASSERT_NE(IndexObj, -1);
+	ASSERT_NE(IndexEvent, -1);
+	EXPECT_EQ(pSnap->GetItemType(IndexObj), NETOBJTYPE_MYOWNOBJECT);
+	EXPECT_EQ(pSnap->GetItemType(IndexEvent), NETOBJTYPE_MYOWNEVENT);
+	EXPECT_EQ(((const CNetObj_MyOwnObject *)pSnap->GetItem(IndexObj)->Data())->m_Test, 1234567890);
+	EXPECT_EQ(((const CNetObj_MyOwnEvent *)pSnap->GetItem(IndexEvent)->Data())->m_Test, 1357924680);
+
+	// the base itself stays untouched
+	Base.Finish(aData);
+	EXPECT_NE(pSnap->GetItemIndex(NETOBJTYPE_MYOWNOBJECT, 0), -1);
+	EXPECT_EQ(pSnap->GetItemIndex(NETOBJTYPE_MYOWNEVENT, 1), -1);
+}
+
+TEST(Ex, SnapshotTypeCache)
+{
+	CSnapshotBuilder Builder;
+	Builder.Init();
+	ASSERT_NE(Builder.NewItem(NETOBJTYPE_MYOWNOBJECT, 0, sizeof(CNetObj_MyOwnObject)), nullptr);
+	ASSERT_NE(Builder.NewItem(NETOBJTYPE_MYOWNOBJECT, 3, sizeof(CNetObj_MyOwnObject)), nullptr);
+
+	unsigned char aData[CSnapshot::MAX_SIZE];
+	Builder.Finish(aData);
+	CSnapshot *pSnap = (CSnapshot *)aData;
+
+	CSnapshotTypeCache Cache;
+	Cache.Reset();
+	for(int i = 0; i < pSnap->NumItems(); i++)
+		EXPECT_EQ(pSnap->GetItemType(i, &Cache), pSnap->GetItemType(i));
+	EXPECT_EQ(pSnap->GetItemIndex(NETOBJTYPE_MYOWNOBJECT, 0, &Cache), pSnap->GetItemIndex(NETOBJTYPE_MYOWNOBJECT, 0));
+	EXPECT_EQ(pSnap->GetItemIndex(NETOBJTYPE_MYOWNOBJECT, 3, &Cache), pSnap->GetItemIndex(NETOBJTYPE_MYOWNOBJECT, 3));
+	EXPECT_EQ(pSnap->GetItemIndex(NETOBJTYPE_MYOWNOBJECT, 1, &Cache), -1);
+	EXPECT_EQ(pSnap->GetItemIndex(NETOBJTYPE_MYOWNEVENT, 1, &Cache), -1);
+
+	// a different snapshot needs a fresh cache
+	Builder.Init();
+	ASSERT_NE(Builder.NewItem(NETOBJTYPE_MYOWNEVENT, 1, sizeof(CNetObj_MyOwnEvent)), nullptr);
+	Builder.Finish(aData);
+	Cache.Reset();
+	int IndexEvent = pSnap->GetItemIndex(NETOBJTYPE_MYOWNEVENT, 1, &Cache);
+	ASSERT_NE(IndexEvent, -1);
+	EXPECT_EQ(pSnap->GetItemType(IndexEvent, &Cache), NETOBJTYPE_MYOWNEVENT);
+	EXPECT_EQ(pSnap->GetItemIndex(NETOBJTYPE_MYOWNOBJECT, 0, &Cache), -1);
+}
+
 static void GetWhatIsAnswer(int Uuid, CMsgPacker *pPacker)
 {
 	CMsgPacker Packer(NETMSG_WHATIS, true);
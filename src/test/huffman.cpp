@@ -0,0 +1,147 @@
+#include <gtest/gtest.h>
+
+#include <base/system.h>
+#include <engine/shared/huffman.h>
+
+static CHuffman s_Huffman;
+
+static void ExpectCompressed(const void *pData, int Size, const unsigned char *pExpected, int ExpectedSize)
+{
+	unsigned char aCompressed[256];
+	unsigned char aDecompressed[256];
+	s_Huffman.Init();
+	ASSERT_EQ(s_Huffman.Compress(pData, Size, aCompressed, sizeof(aCompressed)), ExpectedSize);
+	EXPECT_EQ(mem_comp(aCompressed, pExpected, ExpectedSize), 0);
+	ASSERT_EQ(s_Huffman.Decompress(aCompressed, ExpectedSize, aDecompressed, sizeof(aDecompressed)), Size);
+	EXPECT_EQ(mem_comp(aDecompressed, pData, Size), 0);
+}
+
+TEST(Huffman, Format)
+{
+	// output of the bit by bit implementation
+	static const unsigned char s_aEmpty[] = {0x8a, 0x1b};
+	ExpectCompressed("", 0, s_aEmpty, sizeof(s_aEmpty));
+
+	static const unsigned char s_aZero[] = {0x15, 0x37, 0x00};
+	unsigned char Zero = 0;
+	ExpectCompressed(&Zero, 1, s_aZero, sizeof(s_aZero));
+
+	static const unsigned char s_aText[] = {
+		0x50, 0xc2, 0x09, 0x9c, 0xa0, 0xb8, 0xb5, 0x45, 0x70, 0x72, 0x25, 0x38,
+		0x91, 0x4e, 0x59, 0xbb, 0x56, 0x5b, 0x4a, 0xe7, 0xe9, 0x3c, 0x1d, 0x71,
+		0x94, 0x6b, 0x57, 0xdc, 0x00};
+	const char *pText = "teeworlds huffman";
+	ExpectCompressed(pText, str_length(pText), s_aText, sizeof(s_aText));
+
+	static const unsigned char s_aSnap[] = {
+		0xa9, 0x5a, 0x79, 0x97, 0xaf, 0x7a, 0xc9, 0x52, 0xf3, 0xd3, 0x39, 0xeb,
+		0x6d, 0xd1, 0xf3, 0x78, 0xdb, 0xb5, 0x76, 0x79, 0x0d, 0xa8, 0xfa, 0xa9,
+		0xe2, 0x97, 0x5a, 0xad, 0xff, 0x57, 0xdc, 0x00};
+	unsigned char aSnap[64];
+	unsigned State = 1;
+	for(int i = 0; i < 64; i++)
+	{
+		State = State*1103515245+12345;
+		unsigned Value = State>>8;
+		aSnap[i] = (Value%4) ? 0 : (Value>>4)&0xff;
+	}
+	ExpectCompressed(aSnap, sizeof(aSnap), s_aSnap, sizeof(s_aSnap));
+}
+
+TEST(Huffman, RoundTrip)
+{
+	s_Huffman.Init();
+	unsigned char aData[1400];
+	unsigned char aCompressed[2048];
+	unsigned char aDecompressed[1400];
+	unsigned State = 7;
+	for(int Size = 0; Size <= (int)sizeof(aData); Size += 37)
+	{
+		for(int i = 0; i < Size; i++)
+		{
+			State = State*1103515245+12345;
+			aData[i] = (State>>8)%3 ? (State>>16)%4 : (State>>16)&0xff;
+		}
+		int CompressedSize = s_Huffman.Compress(aData, Size, aCompressed, sizeof(aCompressed));
+		ASSERT_GT(CompressedSize, 0);
+		ASSERT_EQ(s_Huffman.Decompress(aCompressed, CompressedSize, aDecompressed, sizeof(aDecompressed)), Size);
+		EXPECT_EQ(mem_comp(aDecompressed, aData, Size), 0);
+
+		// too small buffers fail
+		EXPECT_EQ(s_Huffman.Compress(aData, Size, aCompressed, CompressedSize-1), -1);
+		if(Size > 0)
+		{
+			EXPECT_EQ(s_Huffman.Decompress(aCompressed, CompressedSize, aDecompressed, Size-1), -1);
+		}
+	}
+}
+
+TEST(Huffman, Garbage)
+{
+	s_Huffman.Init();
+	unsigned char aData[128];
+	unsigned char aDecompressed[256];
+	unsigned State = 3;
+	for(int Try = 0; Try < 1000; Try++)
+	{
+		int Size = Try%sizeof(aData);
+		for(int i = 0; i < Size; i++)
+		{
+			State = State*1103515245+12345;
+			aData[i] = State>>16;
+		}
+		EXPECT_LE(s_Huffman.Decompress(aData, Size, aDecompressed, sizeof(aDecompressed)), (int)sizeof(aDecompressed));
+	}
+}
+
+TEST(Huffman, Trained)
+{
+	unsigned char aData[1400];
+	unsigned aCounts[256] = {0};
+	unsigned State = 5;
+	for(int i = 0; i < (int)sizeof(aData); i++)
+	{
+		State = State*1103515245+12345;
+		aData[i] = (State>>8)%5 ? 0x40+(State>>16)%8 : (State>>16)&0xff;
+		aCounts[aData[i]]++;
+	}
+
+	unsigned aFrequencies[256];
+	CHuffman::NormalizeFrequencies(aCounts, aFrequencies);
+	ASSERT_TRUE(CHuffman::ValidFrequencies(aFrequencies));
+
+	static CHuffman s_Trained;
+	s_Huffman.Init();
+	s_Trained.Init(aFrequencies);
+	EXPECT_LT(s_Trained.EstimateSize(aCounts), s_Huffman.EstimateSize(aCounts));
+
+	unsigned char aCompressed[2048];
+	unsigned char aDecompressed[1400];
+	int DefaultSize = s_Huffman.Compress(aData, sizeof(aData), aCompressed, sizeof(aCompressed));
+	int TrainedSize = s_Trained.Compress(aData, sizeof(aData), aCompressed, sizeof(aCompressed));
+	ASSERT_GT(TrainedSize, 0);
+	EXPECT_LT(TrainedSize, DefaultSize);
+	ASSERT_EQ(s_Trained.Decompress(aCompressed, TrainedSize, aDecompressed, sizeof(aDecompressed)), (int)sizeof(aData));
+	EXPECT_EQ(mem_comp(aDecompressed, aData, sizeof(aData)), 0);
+
+	// a single dominant byte still leaves all codes decodable
+	for(int i = 0; i < 256; i++)
+	{
+		aCounts[i] = 0;
+		aData[i] = i;
+	}
+	aCounts[0] = 0xffffffff;
+	CHuffman::NormalizeFrequencies(aCounts, aFrequencies);
+	ASSERT_TRUE(CHuffman::ValidFrequencies(aFrequencies));
+	s_Trained.Init(aFrequencies);
+	TrainedSize = s_Trained.Compress(aData, 256, aCompressed, sizeof(aCompressed));
+	ASSERT_GT(TrainedSize, 0);
+	ASSERT_EQ(s_Trained.Decompress(aCompressed, TrainedSize, aDecompressed, sizeof(aDecompressed)), 256);
+	EXPECT_EQ(mem_comp(aDecompressed, aData, 256), 0);
+
+	// tables from peers are checked
+	aFrequencies[7] = 0;
+	EXPECT_FALSE(CHuffman::ValidFrequencies(aFrequencies));
+	aFrequencies[7] = CHuffman::HUFFMAN_MAX_TOTAL;
+	EXPECT_FALSE(CHuffman::ValidFrequencies(aFrequencies));
+}
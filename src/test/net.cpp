@@ -0,0 +1,497 @@
+#include <gtest/gtest.h>
+
+#include <base/system.h>
+
+#include <engine/shared/config.h>
+#include <engine/shared/huffman.h>
+#include <engine/shared/network.h>
+
+static NETSOCKET CreateLocalSocket(NETADDR *pAddr)
+{
+	net_addr_from_str(pAddr, "127.0.0.1");
+
+	// find a free port
+	NETSOCKET Socket;
+	net_invalidate_socket(&Socket);
+	for(int Port = 23400; Port < 23500 && Socket.ipv4sock < 0; Port++)
+	{
+		pAddr->port = Port;
+		Socket = net_udp_create(*pAddr, 0);
+	}
+	return Socket;
+}
+
+TEST(Net, UdpSendBatch)
+{
+	net_init();
+	NETADDR RecvAddr;
+	NETADDR SendAddr;
+	NETSOCKET RecvSocket = CreateLocalSocket(&RecvAddr);
+	NETSOCKET SendSocket = CreateLocalSocket(&SendAddr);
+	ASSERT_GE(RecvSocket.ipv4sock, 0);
+	ASSERT_GE(SendSocket.ipv4sock, 0);
+
+	enum
+	{
+		NUM_PACKETS=100,
+	};
+	int aData[NUM_PACKETS];
+	NETUDPPACKET aPackets[NUM_PACKETS];
+	for(int i = 0; i < NUM_PACKETS; i++)
+	{
+		aData[i] = i;
+		aPackets[i].addr = RecvAddr;
+		aPackets[i].data = &aData[i];
+		aPackets[i].size = sizeof(aData[i]);
+	}
+	int Calls = net_udp_send_batch(SendSocket, aPackets, NUM_PACKETS);
+	EXPECT_GT(Calls, 0);
+	EXPECT_LE(Calls, NUM_PACKETS);
+
+	// the packets arrive in order
+	for(int i = 0; i < NUM_PACKETS; i++)
+	{
+		net_socket_read_wait(RecvSocket, 100);
+		NETADDR From;
+		int Data = -1;
+		ASSERT_EQ(net_udp_recv(RecvSocket, &From, &Data, sizeof(Data)), (int)sizeof(Data));
+		EXPECT_EQ(Data, i);
+		EXPECT_EQ(From.port, SendAddr.port);
+	}
+
+	net_udp_close(RecvSocket);
+	net_udp_close(SendSocket);
+}
+
+TEST(Net, UdpRecvBatch)
+{
+	net_init();
+	NETADDR RecvAddr;
+	NETADDR SendAddr;
+	NETSOCKET RecvSocket = CreateLocalSocket(&RecvAddr);
+	NETSOCKET SendSocket = CreateLocalSocket(&SendAddr);
+	ASSERT_GE(RecvSocket.ipv4sock, 0);
+	ASSERT_GE(SendSocket.ipv4sock, 0);
+
+	enum
+	{
+		NUM_PACKETS=20,
+	};
+	int aData[NUM_PACKETS];
+	NETUDPPACKET aPackets[NUM_PACKETS];
+
+	// nothing to receive yet
+	for(int i = 0; i < NUM_PACKETS; i++)
+	{
+		aPackets[i].data = &aData[i];
+		aPackets[i].size = sizeof(aData[i]);
+	}
+	EXPECT_EQ(net_udp_recv_batch(RecvSocket, aPackets, NUM_PACKETS), 0);
+
+	for(int i = 0; i < NUM_PACKETS; i++)
+		net_udp_send(SendSocket, &RecvAddr, &i, sizeof(i));
+
+	// the packets arrive in order, possibly spread over several batches
+	int Received = 0;
+	for(int Try = 0; Try < 100 && Received < NUM_PACKETS; Try++)
+	{
+		net_socket_read_wait(RecvSocket, 100);
+		for(int i = Received; i < NUM_PACKETS; i++)
+		{
+			aPackets[i].data = &aData[i];
+			aPackets[i].size = sizeof(aData[i]);
+		}
+		int Num = net_udp_recv_batch(RecvSocket, aPackets+Received, NUM_PACKETS-Received);
+		ASSERT_GE(Num, 0);
+		Received += Num;
+	}
+	ASSERT_EQ(Received, (int)NUM_PACKETS);
+	for(int i = 0; i < NUM_PACKETS; i++)
+	{
+		EXPECT_EQ(aPackets[i].size, (int)sizeof(aData[i]));
+		EXPECT_EQ(aData[i], i);
+		EXPECT_EQ(aPackets[i].addr.port, SendAddr.port);
+	}
+
+	net_udp_close(RecvSocket);
+	net_udp_close(SendSocket);
+}
+
+struct CNetServerSlots
+{
+	int m_aConnected[NET_MAX_CLIENTS];
+	int m_NumConnected;
+	int m_NumDropped;
+
+	CNetServerSlots() : m_NumConnected(0), m_NumDropped(0) {}
+
+	static int NewClient(int ClientID, void *pUser)
+	{
+		CNetServerSlots *pThis = (CNetServerSlots *)pUser;
+		pThis->m_aConnected[pThis->m_NumConnected++] = ClientID;
+		return 0;
+	}
+
+	static int DelClient(int ClientID, const char *pReason, void *pUser)
+	{
+		CNetServerSlots *pThis = (CNetServerSlots *)pUser;
+		pThis->m_NumDropped++;
+		return 0;
+	}
+};
+
+static void PumpNetwork(CNetServer *pServer, CNetClient *pClients, int NumClients)
+{
+	for(int Try = 0; Try < 50; Try++)
+	{
+		CNetChunk Chunk;
+		pServer->Update();
+		while(pServer->Recv(&Chunk))
+			;
+		for(int i = 0; i < NumClients; i++)
+		{
+			pClients[i].Update();
+			while(pClients[i].Recv(&Chunk))
+				;
+		}
+		thread_sleep(2);
+	}
+}
+
+TEST(Net, ServerSlots)
+{
+	ASSERT_EQ(secure_random_init(), 0);
+	static CConfig s_Config;
+	mem_zero(&s_Config, sizeof(s_Config));
+
+	NETADDR ServerAddr;
+	net_addr_from_str(&ServerAddr, "127.0.0.1");
+	static CNetServer s_Server;
+	CNetServerSlots Slots;
+	Slots.m_NumConnected = 0;
+	bool Opened = false;
+	for(int Port = 23500; Port < 23600 && !Opened; Port++)
+	{
+		ServerAddr.port = Port;
+		Opened = s_Server.Open(ServerAddr, &s_Config, 0, 0, 0, 4, 2, CNetServerSlots::NewClient, CNetServerSlots::DelClient, &Slots);
+	}
+	ASSERT_TRUE(Opened);
+
+	// only two clients with the same ip get a slot
+	enum
+	{
+		NUM_CLIENTS=3,
+	};
+	static CNetClient s_aClients[NUM_CLIENTS];
+	NETADDR BindAddr;
+	net_addr_from_str(&BindAddr, "127.0.0.1");
+	for(int i = 0; i < NUM_CLIENTS; i++)
+	{
+		ASSERT_TRUE(s_aClients[i].Open(BindAddr, &s_Config, 0, 0, NETCREATE_FLAG_RANDOMPORT));
+		s_aClients[i].Connect(&ServerAddr);
+		PumpNetwork(&s_Server, s_aClients, i+1);
+	}
+	ASSERT_EQ(Slots.m_NumConnected, 2);
+	EXPECT_EQ(Slots.m_aConnected[0], 0);
+	EXPECT_EQ(Slots.m_aConnected[1], 1);
+	EXPECT_EQ(s_aClients[0].State(), (int)NETSTATE_ONLINE);
+	EXPECT_EQ(s_aClients[1].State(), (int)NETSTATE_ONLINE);
+	EXPECT_NE(s_aClients[2].State(), (int)NETSTATE_ONLINE);
+
+	// the lowest free slot is reused
+	s_Server.Drop(0, "test");
+	s_aClients[2].Close();
+	ASSERT_TRUE(s_aClients[2].Open(BindAddr, &s_Config, 0, 0, NETCREATE_FLAG_RANDOMPORT));
+	s_aClients[2].Connect(&ServerAddr);
+	PumpNetwork(&s_Server, s_aClients, NUM_CLIENTS);
+	ASSERT_EQ(Slots.m_NumConnected, 3);
+	EXPECT_EQ(Slots.m_aConnected[2], 0);
+	EXPECT_EQ(s_aClients[2].State(), (int)NETSTATE_ONLINE);
+	EXPECT_EQ(net_addr_comp(s_Server.ClientAddr(0), s_Server.ClientAddr(1), false), 0);
+
+	for(int i = 0; i < NUM_CLIENTS; i++)
+		s_aClients[i].Close();
+	s_Server.Close();
+}
+
+TEST(Net, ServerSlotOutOfBuffer)
+{
+	ASSERT_EQ(secure_random_init(), 0);
+	static CConfig s_Config;
+	mem_zero(&s_Config, sizeof(s_Config));
+
+	NETADDR ServerAddr;
+	net_addr_from_str(&ServerAddr, "127.0.0.1");
+	static CNetServer s_Server;
+	CNetServerSlots Slots;
+	bool Opened = false;
+	for(int Port = 23700; Port < 23800 && !Opened; Port++)
+	{
+		ServerAddr.port = Port;
+		Opened = s_Server.Open(ServerAddr, &s_Config, 0, 0, 0, 1, 1, CNetServerSlots::NewClient, CNetServerSlots::DelClient, &Slots);
+	}
+	ASSERT_TRUE(Opened);
+
+	static CNetClient s_Client;
+	NETADDR BindAddr;
+	net_addr_from_str(&BindAddr, "127.0.0.1");
+	ASSERT_TRUE(s_Client.Open(BindAddr, &s_Config, 0, 0, NETCREATE_FLAG_RANDOMPORT));
+	s_Client.Connect(&ServerAddr);
+	PumpNetwork(&s_Server, &s_Client, 1);
+	ASSERT_EQ(Slots.m_NumConnected, 1);
+	ASSERT_EQ(s_Client.State(), (int)NETSTATE_ONLINE);
+
+	// vital chunks the client never acks fill the resend buffer until the connection closes itself,
+	// that frees the only slot and the ip count
+	static char s_aData[1000] = {0};
+	CNetChunk Chunk;
+	Chunk.m_ClientID = 0;
+	Chunk.m_Flags = NETSENDFLAG_VITAL;
+	Chunk.m_pData = s_aData;
+	Chunk.m_DataSize = sizeof(s_aData);
+	for(int i = 0; i < NET_CONN_BUFFERSIZE/(int)sizeof(s_aData)*2 && !Slots.m_NumDropped; i++)
+		s_Server.Send(&Chunk);
+	EXPECT_EQ(Slots.m_NumDropped, 1);
+	s_Server.Update();
+	EXPECT_EQ(Slots.m_NumDropped, 1);
+
+	// the same address gets a new connection
+	PumpNetwork(&s_Server, &s_Client, 1);
+	EXPECT_NE(s_Client.State(), (int)NETSTATE_ONLINE);
+	s_Client.Connect(&ServerAddr);
+	PumpNetwork(&s_Server, &s_Client, 1);
+	ASSERT_EQ(Slots.m_NumConnected, 2);
+	EXPECT_EQ(Slots.m_aConnected[1], 0);
+	EXPECT_EQ(s_Client.State(), (int)NETSTATE_ONLINE);
+
+	s_Client.Close();
+	s_Server.Close();
+}
+
+struct CNetServerThread : CNetServerSlots
+{
+	static int Connless(const CNetChunk *pChunk, unsigned char *pReply, int MaxReplySize, void *pUser)
+	{
+		if(pChunk->m_DataSize != 4 || mem_comp(pChunk->m_pData, "ping", 4) != 0)
+			return 0;
+		mem_copy(pReply, "pong", 4);
+		return 4;
+	}
+};
+
+TEST(Net, ServerThread)
+{
+	ASSERT_EQ(secure_random_init(), 0);
+	static CConfig s_Config;
+	mem_zero(&s_Config, sizeof(s_Config));
+
+	NETADDR ServerAddr;
+	net_addr_from_str(&ServerAddr, "127.0.0.1");
+	static CNetServer s_Server;
+	CNetServerThread Slots;
+	Slots.m_NumConnected = 0;
+	bool Opened = false;
+	for(int Port = 23600; Port < 23700 && !Opened; Port++)
+	{
+		ServerAddr.port = Port;
+		Opened = s_Server.Open(ServerAddr, &s_Config, 0, 0, 0, 4, 4, CNetServerThread::NewClient, CNetServerThread::DelClient, &Slots);
+	}
+	ASSERT_TRUE(Opened);
+	NETWAIT RecvWait = net_wait_create();
+	ASSERT_TRUE(RecvWait);
+	ASSERT_TRUE(s_Server.StartThread(CNetServerThread::Connless, RecvWait));
+	EXPECT_TRUE(s_Server.HasThread());
+
+	static CNetClient s_Client;
+	NETADDR BindAddr;
+	net_addr_from_str(&BindAddr, "127.0.0.1");
+	ASSERT_TRUE(s_Client.Open(BindAddr, &s_Config, 0, 0, NETCREATE_FLAG_RANDOMPORT));
+
+	// the network thread answers connless packets itself
+	CNetChunk Chunk;
+	Chunk.m_ClientID = -1;
+	Chunk.m_Address = ServerAddr;
+	Chunk.m_Flags = NETSENDFLAG_CONNLESS;
+	Chunk.m_pData = "ping";
+	Chunk.m_DataSize = 4;
+	s_Client.Send(&Chunk);
+	bool Pong = false;
+	for(int Try = 0; Try < 100 && !Pong; Try++)
+	{
+		s_Server.Update();
+		while(s_Server.Recv(&Chunk))
+			;
+		s_Client.Update();
+		while(s_Client.Recv(&Chunk))
+			Pong |= Chunk.m_DataSize == 4 && mem_comp(Chunk.m_pData, "pong", 4) == 0;
+		thread_sleep(2);
+	}
+	EXPECT_TRUE(Pong);
+
+	// connections are still handled by the caller
+	s_Client.Connect(&ServerAddr);
+	PumpNetwork(&s_Server, &s_Client, 1);
+	ASSERT_EQ(Slots.m_NumConnected, 1);
+	EXPECT_EQ(s_Client.State(), (int)NETSTATE_ONLINE);
+
+	// the game thread is woken up when the packet is queued
+	while(net_wait_until(RecvWait, time_get()+time_freq()/1000) == 1)
+		;
+	Chunk.m_ClientID = 0;
+	Chunk.m_Flags = NETSENDFLAG_VITAL;
+	Chunk.m_pData = "data";
+	Chunk.m_DataSize = 4;
+	s_Client.Send(&Chunk);
+	s_Client.Flush();
+	EXPECT_EQ(net_wait_until(RecvWait, time_get()+time_freq()), 1);
+	bool Received = false;
+	for(int Try = 0; Try < 100 && !Received; Try++)
+	{
+		s_Server.Update();
+		while(s_Server.Recv(&Chunk))
+			Received |= Chunk.m_ClientID == 0 && Chunk.m_DataSize == 4 && mem_comp(Chunk.m_pData, "data", 4) == 0;
+		s_Client.Update();
+		thread_sleep(2);
+	}
+	EXPECT_TRUE(Received);
+
+	s_Client.Close();
+	s_Server.Close();
+	EXPECT_FALSE(s_Server.HasThread());
+	net_wait_destroy(RecvWait);
+}
+
+static bool ReceiveData(CNetServer *pServer, CNetClient *pClient, const char *pData)
+{
+	int Size = str_length(pData);
+	for(int Try = 0; Try < 100; Try++)
+	{
+		CNetChunk Chunk;
+		pServer->Update();
+		while(pServer->Recv(&Chunk))
+			;
+		pClient->Update();
+		while(pClient->Recv(&Chunk))
+		{
+			if(Chunk.m_DataSize == Size && mem_comp(Chunk.m_pData, pData, Size) == 0)
+				return true;
+		}
+		thread_sleep(2);
+	}
+	return false;
+}
+
+TEST(Net, HuffmanTable)
+{
+	ASSERT_EQ(secure_random_init(), 0);
+	static CConfig s_Config;
+	mem_zero(&s_Config, sizeof(s_Config));
+
+	NETADDR ServerAddr;
+	net_addr_from_str(&ServerAddr, "127.0.0.1");
+	static CNetServer s_Server;
+	CNetServerSlots Slots;
+	Slots.m_NumConnected = 0;
+	bool Opened = false;
+	for(int Port = 23700; Port < 23800 && !Opened; Port++)
+	{
+		ServerAddr.port = Port;
+		Opened = s_Server.Open(ServerAddr, &s_Config, 0, 0, 0, 4, 4, CNetServerSlots::NewClient, CNetServerSlots::DelClient, &Slots);
+	}
+	ASSERT_TRUE(Opened);
+
+	static CNetClient s_Client;
+	NETADDR BindAddr;
+	net_addr_from_str(&BindAddr, "127.0.0.1");
+	ASSERT_TRUE(s_Client.Open(BindAddr, &s_Config, 0, 0, NETCREATE_FLAG_RANDOMPORT));
+	s_Client.Connect(&ServerAddr);
+	PumpNetwork(&s_Server, &s_Client, 1);
+	ASSERT_EQ(Slots.m_NumConnected, 1);
+
+	// a table that favours the letters of the messages
+	unsigned aCounts[256] = {0};
+	for(int i = 'a'; i <= 'z'; i++)
+		aCounts[i] = 1000;
+	unsigned aFrequencies[256];
+	CHuffman::NormalizeFrequencies(aCounts, aFrequencies);
+
+	// long enough to be sent compressed
+	char aTrained[256];
+	char aFallback[256];
+	char aDropped[256];
+	for(int i = 0; i < (int)sizeof(aTrained)-1; i++)
+	{
+		aTrained[i] = 'a'+i%26;
+		aFallback[i] = 'z'-i%26;
+		aDropped[i] = 'a'+i%13;
+	}
+	aTrained[sizeof(aTrained)-1] = 0;
+	aFallback[sizeof(aFallback)-1] = 0;
+	aDropped[sizeof(aDropped)-1] = 0;
+
+	CNetChunk Chunk;
+	Chunk.m_ClientID = 0;
+	Chunk.m_Flags = NETSENDFLAG_VITAL|NETSENDFLAG_FLUSH;
+	Chunk.m_DataSize = sizeof(aTrained)-1;
+
+	// the client decodes packets of the tables it installed
+	s_Server.SetHuffmanTable(1, aFrequencies);
+	s_Client.SetHuffmanTable(1, aFrequencies);
+	s_Server.SetClientHuffmanTable(0, 1);
+	Chunk.m_pData = aTrained;
+	s_Server.Send(&Chunk);
+	EXPECT_TRUE(ReceiveData(&s_Server, &s_Client, aTrained));
+
+	// a new table in the same slot falls back to the default one until the client has it
+	s_Server.SetHuffmanTable(3, aFrequencies);
+	Chunk.m_pData = aFallback;
+	s_Server.Send(&Chunk);
+	EXPECT_TRUE(ReceiveData(&s_Server, &s_Client, aFallback));
+
+	// packets of unknown tables are dropped
+	s_Server.SetHuffmanTable(2, aFrequencies);
+	s_Server.SetClientHuffmanTable(0, 2);
+	Chunk.m_pData = aDropped;
+	s_Server.Send(&Chunk);
+	EXPECT_FALSE(ReceiveData(&s_Server, &s_Client, aDropped));
+
+	s_Client.Close();
+	s_Server.Close();
+}
+
+TEST(Net, RateLimit)
+{
+	static CNetRateLimit s_RateLimit;
+	NETADDR Addr1, Addr2, Addr3;
+	net_addr_from_str(&Addr1, "10.0.0.1:8303");
+	net_addr_from_str(&Addr2, "10.0.0.2:8303");
+	net_addr_from_str(&Addr3, "[2001:db8::1]:8303");
+	int64 Now = time_get();
+
+	// the burst goes through, everything after it is dropped
+	for(int i = 0; i < 10; i++)
+		EXPECT_TRUE(s_RateLimit.Allow(&Addr1, 5, 10, Now));
+	EXPECT_FALSE(s_RateLimit.Allow(&Addr1, 5, 10, Now));
+
+	// other sources are independent, addresses of the same /64 are limited together
+	EXPECT_TRUE(s_RateLimit.Allow(&Addr2, 5, 10, Now));
+	for(int i = 0; i < 10; i++)
+		EXPECT_TRUE(s_RateLimit.Allow(&Addr3, 5, 10, Now));
+	net_addr_from_str(&Addr3, "[2001:db8::2]:1234");
+	EXPECT_FALSE(s_RateLimit.Allow(&Addr3, 5, 10, Now));
+
+	// the bucket drains at the rate
+	Now += time_freq()/5;
+	EXPECT_TRUE(s_RateLimit.Allow(&Addr1, 5, 10, Now));
+	EXPECT_FALSE(s_RateLimit.Allow(&Addr1, 5, 10, Now));
+	Now += time_freq()*2;
+	for(int i = 0; i < 10; i++)
+		EXPECT_TRUE(s_RateLimit.Allow(&Addr1, 5, 10, Now));
+	EXPECT_FALSE(s_RateLimit.Allow(&Addr1, 5, 10, Now));
+
+	// a rate of 0 disables the limit
+	EXPECT_TRUE(s_RateLimit.Allow(&Addr1, 0, 10, Now));
+
+	s_RateLimit.Reset();
+	EXPECT_TRUE(s_RateLimit.Allow(&Addr1, 5, 10, Now));
+}
@@ -0,0 +1,161 @@
+#include <gtest/gtest.h>
+
+#include <base/math.h>
+#include <base/system.h>
+
+#include <engine/console.h>
+#include <engine/shared/config.h>
+#include <engine/shared/netban.h>
+
+class NetBan : public ::testing::Test
+{
+protected:
+	IConsole *m_pConsole;
+	CNetBan m_Ban;
+
+	NetBan()
+	{
+		m_pConsole = CreateConsole(CFGFLAG_SERVER);
+		m_Ban.Init(m_pConsole, 0);
+	}
+
+	~NetBan()
+	{
+		delete m_pConsole;
+	}
+
+	static NETADDR Addr(const char *pStr)
+	{
+		NETADDR Addr;
+		EXPECT_EQ(net_addr_from_str(&Addr, pStr), 0);
+		return Addr;
+	}
+
+	static CNetRange Range(const char *pLB, const char *pUB)
+	{
+		CNetRange Range;
+		Range.m_LB = Addr(pLB);
+		Range.m_UB = Addr(pUB);
+		return Range;
+	}
+
+	bool IsBanned(const char *pAddr, char *pReason = 0, unsigned ReasonSize = 0)
+	{
+		NETADDR Address = Addr(pAddr);
+		char aBuf[256];
+		bool Banned = m_Ban.IsBanned(&Address, aBuf, sizeof(aBuf), 0);
+		if(Banned && pReason)
+			str_copy(pReason, aBuf, ReasonSize);
+		return Banned;
+	}
+};
+
+TEST_F(NetBan, Range)
+{
+	CNetRange Banned = Range("10.0.0.5", "10.0.1.200");
+	EXPECT_EQ(m_Ban.BanRange(&Banned, 0, "range"), 0);
+
+	EXPECT_FALSE(IsBanned("10.0.0.4"));
+	EXPECT_TRUE(IsBanned("10.0.0.5"));
+	EXPECT_TRUE(IsBanned("10.0.0.255"));
+	EXPECT_TRUE(IsBanned("10.0.1.0"));
+	EXPECT_TRUE(IsBanned("10.0.1.200"));
+	EXPECT_FALSE(IsBanned("10.0.1.201"));
+	EXPECT_FALSE(IsBanned("11.0.0.5"));
+	EXPECT_FALSE(IsBanned("[::a00:5]"));
+
+	EXPECT_EQ(m_Ban.UnbanByRange(&Banned), 0);
+	EXPECT_FALSE(IsBanned("10.0.0.5"));
+	EXPECT_FALSE(IsBanned("10.0.1.0"));
+}
+
+TEST_F(NetBan, MostSpecific)
+{
+	CNetRange Outer = Range("10.0.0.0", "10.255.255.255");
+	CNetRange Inner = Range("10.1.2.0", "10.1.2.255");
+	EXPECT_EQ(m_Ban.BanRange(&Outer, 0, "outer"), 0);
+	EXPECT_EQ(m_Ban.BanRange(&Inner, 0, "inner"), 0);
+
+	char aReason[256];
+	EXPECT_TRUE(IsBanned("10.1.2.3", aReason, sizeof(aReason)));
+	EXPECT_STREQ(aReason, "You have been banned for life (inner)");
+	EXPECT_TRUE(IsBanned("10.2.0.0", aReason, sizeof(aReason)));
+	EXPECT_STREQ(aReason, "You have been banned for life (outer)");
+
+	EXPECT_EQ(m_Ban.UnbanByRange(&Inner), 0);
+	EXPECT_TRUE(IsBanned("10.1.2.3", aReason, sizeof(aReason)));
+	EXPECT_STREQ(aReason, "You have been banned for life (outer)");
+
+	m_Ban.UnbanAll();
+	EXPECT_FALSE(IsBanned("10.1.2.3"));
+}
+
+TEST_F(NetBan, Ipv6)
+{
+	CNetRange Banned = Range("[2001:db8::1]", "[2001:db8::1:0]");
+	EXPECT_EQ(m_Ban.BanRange(&Banned, 0, "range"), 0);
+
+	EXPECT_FALSE(IsBanned("[2001:db8::]"));
+	EXPECT_TRUE(IsBanned("[2001:db8::1]"));
+	EXPECT_TRUE(IsBanned("[2001:db8::ffff]"));
+	EXPECT_TRUE(IsBanned("[2001:db8::1:0]"));
+	EXPECT_FALSE(IsBanned("[2001:db8::1:1]"));
+	EXPECT_FALSE(IsBanned("32.1.13.184"));
+}
+
+TEST_F(NetBan, Random)
+{
+	// overlapping ranges in a few subnets, checked against a plain scan
+	enum
+	{
+		NUM_RANGES=2000,
+		NUM_LOOKUPS=20000,
+	};
+	static CNetRange s_aRanges[NUM_RANGES];
+	static bool s_aActive[NUM_RANGES];
+	unsigned Seed = 1;
+	for(int i = 0; i < NUM_RANGES; i++)
+	{
+		Seed = Seed*1103515245+12345;
+		unsigned Start = 0x0a000000|((Seed>>8)&0x3ffff);
+		Seed = Seed*1103515245+12345;
+		unsigned End = Start+1+((Seed>>8)%(i%10 == 0 ? 4096 : 64));
+		for(int b = 0; b < 4; b++)
+		{
+			s_aRanges[i].m_LB.ip[b] = (Start>>(24-b*8))&0xff;
+			s_aRanges[i].m_UB.ip[b] = (End>>(24-b*8))&0xff;
+		}
+		s_aRanges[i].m_LB.type = s_aRanges[i].m_UB.type = NETTYPE_IPV4;
+		s_aRanges[i].m_LB.port = s_aRanges[i].m_UB.port = 0;
+		s_aActive[i] = m_Ban.BanRange(&s_aRanges[i], 0, "random") == 0;
+	}
+
+	for(int Pass = 0; Pass < 2; Pass++)
+	{
+		for(int n = 0; n < NUM_LOOKUPS; n++)
+		{
+			Seed = Seed*1103515245+12345;
+			unsigned Value = 0x0a000000|((Seed>>8)&0x3ffff);
+			NETADDR Address = {0};
+			Address.type = NETTYPE_IPV4;
+			for(int b = 0; b < 4; b++)
+				Address.ip[b] = (Value>>(24-b*8))&0xff;
+
+			bool Expected = false;
+			for(int i = 0; i < NUM_RANGES && !Expected; i++)
+				Expected = s_aActive[i] && mem_comp(s_aRanges[i].m_LB.ip, Address.ip, 4) <= 0 && mem_comp(s_aRanges[i].m_UB.ip, Address.ip, 4) >= 0;
+			char aBuf[256];
+			ASSERT_EQ(m_Ban.IsBanned(&Address, aBuf, sizeof(aBuf), 0), Expected);
+		}
+
+		// remove every other range and check again
+		for(int i = 0; i < NUM_RANGES; i += 2)
+		{
+			if(s_aActive[i])
+			{
+				EXPECT_EQ(m_Ban.UnbanByRange(&s_aRanges[i]), 0);
+				s_aActive[i] = false;
+			}
+		}
+	}
+}
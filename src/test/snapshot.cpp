@@ -0,0 +1,457 @@
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+
+#include <base/math.h>
+#include <base/system.h>
+#include <engine/shared/compression.h>
+#include <engine/shared/snapshot.h>
+#include <engine/shared/snapshot_simd.h>
+#include <generated/protocol.h>
+
+class CRandom
+{
+	unsigned m_State;
+public:
+	CRandom(unsigned Seed) : m_State(Seed) {}
+	unsigned Next()
+	{
+		m_State = m_State*1103515245+12345;
+		return m_State>>8;
+	}
+	// mostly small values like real snapshot deltas, sometimes big ones
+	int NextValue()
+	{
+		unsigned Kind = Next()%8;
+		unsigned Value = Next()<<8 | (Next()&0xff);
+		switch(Kind)
+		{
+		case 0: return 0;
+		case 1: return (int)(Value%64) - 32;
+		case 2: return (int)(Value%16384) - 8192;
+		case 3: return (int)(Value%(1<<21)) - (1<<20);
+		case 4: return (int)(Value%(1<<28)) - (1<<27);
+		case 5: return Next()%2 ? 0x7fffffff : (int)0x80000000;
+		default: return (int)Value;
+		}
+	}
+};
+
+// builds a snapshot of a full server: characters, player infos, projectiles and pickups
+static int BuildGameSnapshot(void *pData, int Tick, int NumPlayers)
+{
+	CSnapshotBuilder *pBuilder = new CSnapshotBuilder();
+	pBuilder->Init();
+
+	CNetObj_GameData *pGameData = (CNetObj_GameData *)pBuilder->NewItem(NETOBJTYPE_GAMEDATA, 0, sizeof(CNetObj_GameData));
+	mem_zero(pGameData, sizeof(*pGameData));
+	pGameData->m_GameStartTick = 100;
+
+	for(int i = 0; i < NumPlayers; i++)
+	{
+		CNetObj_PlayerInfo *pInfo = (CNetObj_PlayerInfo *)pBuilder->NewItem(NETOBJTYPE_PLAYERINFO, i, sizeof(CNetObj_PlayerInfo));
+		pInfo->m_PlayerFlags = 0;
+		pInfo->m_Score = i+Tick/500;
+		pInfo->m_Latency = 20+i%7;
+
+		CNetObj_Character *pChr = (CNetObj_Character *)pBuilder->NewItem(NETOBJTYPE_CHARACTER, i, sizeof(CNetObj_Character));
+		pChr->m_Tick = Tick;
+		pChr->m_X = 1000+i*64+Tick*(i%5);
+		pChr->m_Y = 800+i*16-Tick*(i%3);
+		pChr->m_VelX = (i%5)*256;
+		pChr->m_VelY = (Tick%3)*128;
+		pChr->m_Angle = (Tick*7+i)%256;
+		pChr->m_Direction = i%3-1;
+		pChr->m_Jumped = Tick%2;
+		pChr->m_HookedPlayer = -1;
+		pChr->m_HookState = i%4 ? 0 : 3;
+		pChr->m_HookTick = Tick-i;
+		pChr->m_HookX = pChr->m_X+100;
+		pChr->m_HookY = pChr->m_Y-50;
+		pChr->m_HookDx = 0;
+		pChr->m_HookDy = 0;
+		pChr->m_Health = 10;
+		pChr->m_Armor = i%10;
+		pChr->m_AmmoCount = 10;
+		pChr->m_Weapon = i%5;
+		pChr->m_Emote = 0;
+		pChr->m_AttackTick = Tick-(i%20);
+		pChr->m_TriggeredEvents = 0;
+	}
+
+	for(int i = 0; i < NumPlayers; i++)
+	{
+		CNetObj_Projectile *pProj = (CNetObj_Projectile *)pBuilder->NewItem(NETOBJTYPE_PROJECTILE, 128+(i+Tick/10)%256, sizeof(CNetObj_Projectile));
+		pProj->m_X = i*100;
+		pProj->m_Y = i*50;
+		pProj->m_VelX = 500;
+		pProj->m_VelY = -200;
+		pProj->m_Type = WEAPON_GRENADE;
+		pProj->m_StartTick = Tick-i%10;
+	}
+
+	for(int i = 0; i < 32; i++)
+	{
+		CNetObj_Pickup *pPickup = (CNetObj_Pickup *)pBuilder->NewItem(NETOBJTYPE_PICKUP, 64+i, sizeof(CNetObj_Pickup));
+		pPickup->m_X = i*320;
+		pPickup->m_Y = 640;
+		pPickup->m_Type = i%3;
+	}
+
+	int Size = pBuilder->Finish(pData);
+	delete pBuilder;
+	return Size;
+}
+
+static int ReferenceCrc(const CSnapshot *pSnap)
+{
+	unsigned Crc = 0;
+	for(int i = 0; i < pSnap->NumItems(); i++)
+		for(int b = 0; b < pSnap->GetItemSize(i)/4; b++)
+			Crc += (unsigned)pSnap->GetItem(i)->Data()[b];
+	return (int)Crc;
+}
+
+TEST(SnapshotSimd, DiffUndiffIdentical)
+{
+	const CSnapshotSimd *pScalar = SnapshotSimd(SNAPSHOTSIMD_SCALAR);
+	ASSERT_TRUE(pScalar);
+
+	CRandom Random(1234);
+	int aPast[80], aCurrent[80];
+	int aExpected[80], aGot[80];
+	for(int Type = 1; Type < NUM_SNAPSHOTSIMD; Type++)
+	{
+		const CSnapshotSimd *pSimd = SnapshotSimd(Type);
+		if(!pSimd)
+			continue;
+		for(int Run = 0; Run < 500; Run++)
+		{
+			int Size = Run%80;
+			for(int i = 0; i < Size; i++)
+			{
+				aPast[i] = Random.NextValue();
+				aCurrent[i] = Random.Next()%4 ? aPast[i] : Random.NextValue();
+			}
+
+			mem_zero(aExpected, sizeof(aExpected));
+			mem_zero(aGot, sizeof(aGot));
+			EXPECT_EQ(pSimd->m_pfnDiffItem(aPast, aCurrent, aGot, Size), pScalar->m_pfnDiffItem(aPast, aCurrent, aExpected, Size)) << pSimd->m_pName;
+			EXPECT_EQ(mem_comp(aGot, aExpected, sizeof(aGot)), 0) << pSimd->m_pName;
+
+			mem_zero(aExpected, sizeof(aExpected));
+			mem_zero(aGot, sizeof(aGot));
+			EXPECT_EQ(pSimd->m_pfnUndiffItem(aPast, aCurrent, aGot, Size), pScalar->m_pfnUndiffItem(aPast, aCurrent, aExpected, Size)) << pSimd->m_pName;
+			EXPECT_EQ(mem_comp(aGot, aExpected, sizeof(aGot)), 0) << pSimd->m_pName;
+
+			EXPECT_EQ(pSimd->m_pfnSum(aCurrent, Size), pScalar->m_pfnSum(aCurrent, Size)) << pSimd->m_pName;
+		}
+	}
+}
+
+TEST(SnapshotSimd, VarIntIdentical)
+{
+	const CSnapshotSimd *pScalar = SnapshotSimd(SNAPSHOTSIMD_SCALAR);
+	ASSERT_TRUE(pScalar);
+
+	CRandom Random(5678);
+	int aValues[200], aExpected[200], aGot[200];
+	unsigned char aPacked[1200], aExpectedPacked[1200], aGotPacked[1200];
+	for(int Type = 1; Type < NUM_SNAPSHOTSIMD; Type++)
+	{
+		const CSnapshotSimd *pSimd = SnapshotSimd(Type);
+		if(!pSimd)
+			continue;
+		for(int Run = 0; Run < 2000; Run++)
+		{
+			// runs of small values with some bigger ones in between
+			int Num = Random.Next()%200;
+			int Kind = Random.Next()%4;
+			for(int i = 0; i < Num; i++)
+			{
+				switch(Random.Next()%8 < (unsigned)Kind*2 ? 3 : Kind)
+				{
+				case 0: aValues[i] = (int)(Random.Next()%128) - 64; break;
+				case 1: aValues[i] = (int)(Random.Next()%16384) - 8192; break;
+				case 2: aValues[i] = Random.Next()%2 ? 0 : (int)(Random.Next()%4096); break;
+				default: aValues[i] = Random.NextValue();
+				}
+			}
+
+			// too small output buffers fail the same way
+			int DstSize = Run%4 ? (int)sizeof(aPacked) : (int)(Random.Next()%(Num*6+1));
+			long Size = pScalar->m_pfnVarIntCompress(aValues, Num*4, aExpectedPacked, DstSize);
+			ASSERT_EQ(pSimd->m_pfnVarIntCompress(aValues, Num*4, aGotPacked, DstSize), Size) << pSimd->m_pName;
+			if(Size < 0)
+				continue;
+			EXPECT_EQ(mem_comp(aGotPacked, aExpectedPacked, Size), 0) << pSimd->m_pName;
+
+			DstSize = Run%4 ? (int)sizeof(aGot) : (int)(Random.Next()%(Num*4+8));
+			mem_zero(aExpected, sizeof(aExpected));
+			mem_zero(aGot, sizeof(aGot));
+			long UnpackedSize = pScalar->m_pfnVarIntDecompress(aExpectedPacked, Size, aExpected, DstSize);
+			ASSERT_EQ(pSimd->m_pfnVarIntDecompress(aExpectedPacked, Size, aGot, DstSize), UnpackedSize) << pSimd->m_pName;
+			if(UnpackedSize >= 0)
+			{
+				EXPECT_EQ(mem_comp(aGot, aExpected, UnpackedSize), 0) << pSimd->m_pName;
+			}
+			if(DstSize == (int)sizeof(aGot))
+			{
+				ASSERT_EQ(UnpackedSize, Num*4);
+				EXPECT_EQ(mem_comp(aGot, aValues, UnpackedSize), 0) << pSimd->m_pName;
+			}
+
+			// arbitrary data, the last value may be incomplete
+			int GarbageSize = Random.Next()%200;
+			for(int i = 0; i < (int)sizeof(aPacked); i++)
+				aPacked[i] = Random.Next()%3 ? Random.Next()&0x7f : Random.Next();
+			UnpackedSize = pScalar->m_pfnVarIntDecompress(aPacked, GarbageSize, aExpected, sizeof(aExpected));
+			ASSERT_EQ(pSimd->m_pfnVarIntDecompress(aPacked, GarbageSize, aGot, sizeof(aGot)), UnpackedSize) << pSimd->m_pName;
+			EXPECT_EQ(mem_comp(aGot, aExpected, UnpackedSize), 0) << pSimd->m_pName;
+		}
+	}
+}
+
+TEST(SnapshotSimd, CrcIdentical)
+{
+	CRandom Random(4321);
+	static char s_aData[CSnapshot::MAX_SIZE];
+	CSnapshotBuilder *pBuilder = new CSnapshotBuilder();
+	for(int Run = 0; Run < 20; Run++)
+	{
+		pBuilder->Init();
+		int NumItems = Random.Next()%300;
+		for(int i = 0; i < NumItems; i++)
+		{
+			int Size = (Random.Next()%40)*4;
+			int *pItem = (int *)pBuilder->NewItem(1+Random.Next()%30, i, Size);
+			for(int b = 0; b < Size/4; b++)
+				pItem[b] = Random.NextValue();
+		}
+		pBuilder->Finish(s_aData);
+		const CSnapshot *pSnap = (const CSnapshot *)s_aData;
+
+		for(int Type = 0; Type < NUM_SNAPSHOTSIMD; Type++)
+		{
+			if(!SnapshotSimdSelect(Type))
+				continue;
+			EXPECT_EQ(pSnap->Crc(), ReferenceCrc(pSnap)) << SnapshotSimd()->m_pName;
+		}
+		SnapshotSimdSelect(-1);
+	}
+	delete pBuilder;
+}
+
+TEST(SnapshotSimd, Benchmark)
+{
+	static char s_aFrom[CSnapshot::MAX_SIZE];
+	static char s_aTo[CSnapshot::MAX_SIZE];
+	static char s_aDelta[CSnapshot::MAX_SIZE];
+	static char s_aUnpacked[CSnapshot::MAX_SIZE];
+	const CSnapshot *pFrom = (const CSnapshot *)s_aFrom;
+	CSnapshot *pTo = (CSnapshot *)s_aTo;
+	CSnapshotDelta *pDelta = new CSnapshotDelta();
+
+	BuildGameSnapshot(s_aFrom, 1000, 64);
+	BuildGameSnapshot(s_aTo, 1002, 64);
+
+	const int Iterations = 200;
+	for(int Type = 0; Type < NUM_SNAPSHOTSIMD; Type++)
+	{
+		if(!SnapshotSimdSelect(Type))
+			continue;
+
+		int DeltaSize = 0;
+		unsigned Crc = 0;
+		int64 Start = time_get();
+		for(int i = 0; i < Iterations; i++)
+			DeltaSize = pDelta->CreateDelta(pFrom, pTo, s_aDelta);
+		int64 DeltaTime = time_get()-Start;
+
+		Start = time_get();
+		for(int i = 0; i < Iterations; i++)
+			pDelta->UnpackDelta(pFrom, (CSnapshot *)s_aUnpacked, s_aDelta, DeltaSize);
+		int64 UnpackTime = time_get()-Start;
+
+		Start = time_get();
+		for(int i = 0; i < Iterations; i++)
+			Crc += (unsigned)pTo->Crc();
+		int64 CrcTime = time_get()-Start;
+
+		static unsigned char s_aPacked[CSnapshot::MAX_SIZE];
+		int PackedSize = 0;
+		Start = time_get();
+		for(int i = 0; i < Iterations; i++)
+			PackedSize = CVariableInt::Compress(s_aDelta, DeltaSize, s_aPacked, sizeof(s_aPacked));
+		int64 PackTime = time_get()-Start;
+
+		Start = time_get();
+		for(int i = 0; i < Iterations; i++)
+			EXPECT_EQ(CVariableInt::Decompress(s_aPacked, PackedSize, s_aUnpacked, sizeof(s_aUnpacked)), DeltaSize);
+		int64 VarIntUnpackTime = time_get()-Start;
+		EXPECT_EQ(mem_comp(s_aUnpacked, s_aDelta, DeltaSize), 0);
+		pDelta->UnpackDelta(pFrom, (CSnapshot *)s_aUnpacked, s_aDelta, DeltaSize);
+
+		EXPECT_EQ(((const CSnapshot *)s_aUnpacked)->Crc(), pTo->Crc());
+		EXPECT_EQ(Crc, (unsigned)pTo->Crc()*Iterations);
+
+		printf("[ BENCH    ] %s: items=%d delta=%lldns unpack=%lldns crc=%lldns varint_pack=%lldns varint_unpack=%lldns\n", SnapshotSimd()->m_pName, pTo->NumItems(),
+			DeltaTime*1000000000/time_freq()/Iterations, UnpackTime*1000000000/time_freq()/Iterations, CrcTime*1000000000/time_freq()/Iterations,
+			PackTime*1000000000/time_freq()/Iterations, VarIntUnpackTime*1000000000/time_freq()/Iterations);
+	}
+	SnapshotSimdSelect(-1);
+	delete pDelta;
+}
+
+static int BuildCollidingSnapshot(void *pData, int NumItems, int Value)
+{
+	// same type and the same lower key bits, the items all end up in one bucket of a key bit hash
+	CSnapshotBuilder *pBuilder = new CSnapshotBuilder();
+	pBuilder->Init();
+	for(int i = 0; i < NumItems; i++)
+	{
+		int *pItem = (int *)pBuilder->NewItem(NETOBJTYPE_PROJECTILE, i*16, sizeof(CNetObj_Projectile));
+		for(int b = 0; b < (int)(sizeof(CNetObj_Projectile)/4); b++)
+			pItem[b] = Value+i;
+	}
+	int Size = pBuilder->Finish(pData);
+	delete pBuilder;
+	return Size;
+}
+
+TEST(SnapshotDelta, ManyCollidingKeys)
+{
+	static char s_aFrom[CSnapshot::MAX_SIZE];
+	static char s_aTo[CSnapshot::MAX_SIZE];
+	static char s_aDelta[CSnapshot::MAX_SIZE];
+	static char s_aUnpacked[CSnapshot::MAX_SIZE];
+	CSnapshotDelta *pDelta = new CSnapshotDelta();
+
+	BuildCollidingSnapshot(s_aFrom, 300, 1);
+	BuildCollidingSnapshot(s_aTo, 300, 1);
+	EXPECT_EQ(pDelta->CreateDelta((CSnapshot *)s_aFrom, (CSnapshot *)s_aTo, s_aDelta), 0);
+
+	BuildCollidingSnapshot(s_aTo, 280, 2);
+	int DeltaSize = pDelta->CreateDelta((CSnapshot *)s_aFrom, (CSnapshot *)s_aTo, s_aDelta);
+	const CSnapshotDelta::CData *pData = (const CSnapshotDelta::CData *)s_aDelta;
+	EXPECT_EQ(pData->m_NumDeletedItems, 20);
+	EXPECT_EQ(pData->m_NumUpdateItems, 280);
+
+	int UnpackedSize = pDelta->UnpackDelta((CSnapshot *)s_aFrom, (CSnapshot *)s_aUnpacked, s_aDelta, DeltaSize);
+	ASSERT_GT(UnpackedSize, 0);
+	EXPECT_EQ(((CSnapshot *)s_aUnpacked)->NumItems(), 280);
+	EXPECT_EQ(((CSnapshot *)s_aUnpacked)->Crc(), ((CSnapshot *)s_aTo)->Crc());
+	delete pDelta;
+}
+
+TEST(SnapshotDelta, BenchmarkMaxItems)
+{
+	static char s_aFrom[CSnapshot::MAX_SIZE];
+	static char s_aTo[CSnapshot::MAX_SIZE];
+	static char s_aDelta[CSnapshot::MAX_SIZE];
+	static char s_aUnpacked[CSnapshot::MAX_SIZE];
+	CSnapshotDelta *pDelta = new CSnapshotDelta();
+
+	// the builder fits MAX_ITEMS-1 items, keep some space for the item data
+	CSnapshotBuilder *pBuilder = new CSnapshotBuilder();
+	for(int Snap = 0; Snap < 2; Snap++)
+	{
+		pBuilder->Init();
+		for(int i = 0; i < 1023; i++)
+		{
+			int *pItem = (int *)pBuilder->NewItem(NETOBJTYPE_PROJECTILE+i%4, (i*37+Snap*i%3)&0xffff, sizeof(CNetObj_Projectile));
+			for(int b = 0; b < (int)(sizeof(CNetObj_Projectile)/4); b++)
+				pItem[b] = i*b+Snap*(i%5);
+		}
+		pBuilder->Finish(Snap ? s_aTo : s_aFrom);
+	}
+	delete pBuilder;
+
+	const CSnapshot *pFrom = (const CSnapshot *)s_aFrom;
+	const CSnapshot *pTo = (const CSnapshot *)s_aTo;
+	ASSERT_EQ(pTo->NumItems(), 1023);
+
+	const int Iterations = 100;
+	int DeltaSize = 0;
+	int64 Start = time_get();
+	for(int i = 0; i < Iterations; i++)
+		DeltaSize = pDelta->CreateDelta(pFrom, (CSnapshot *)pTo, s_aDelta);
+	int64 DeltaTime = time_get()-Start;
+
+	Start = time_get();
+	for(int i = 0; i < Iterations; i++)
+		pDelta->UnpackDelta(pFrom, (CSnapshot *)s_aUnpacked, s_aDelta, DeltaSize);
+	int64 UnpackTime = time_get()-Start;
+
+	EXPECT_EQ(((const CSnapshot *)s_aUnpacked)->NumItems(), pTo->NumItems());
+	EXPECT_EQ(((const CSnapshot *)s_aUnpacked)->Crc(), pTo->Crc());
+
+	printf("[ BENCH    ] items=%d delta=%lldns unpack=%lldns\n", pTo->NumItems(),
+		DeltaTime*1000000000/time_freq()/Iterations, UnpackTime*1000000000/time_freq()/Iterations);
+	delete pDelta;
+}
+
+TEST(SnapshotStorage, Pool)
+{
+	static char s_aData[CSnapshot::MAX_SIZE];
+	CRandom Random(42);
+	CSnapshotStorage Storage;
+	Storage.Init();
+
+	const int History = 150;
+	int aSizes[2000];
+	for(int Tick = 0; Tick < 2000; Tick++)
+	{
+		// snapshots grow over time to force the pool to grow
+		int Size = 4*(16+Random.Next()%(64+Tick*2));
+		aSizes[Tick] = Size;
+		for(int i = 0; i < Size/4; i++)
+			((int *)s_aData)[i] = Tick*7919+i;
+
+		Storage.PurgeUntil(Tick-History);
+		Storage.Add(Tick, Tick, Size, s_aData, Tick%2);
+
+		// the list stays in order
+		int Num = 0;
+		for(CSnapshotStorage::CHolder *pHolder = Storage.m_pFirst; pHolder; pHolder = pHolder->m_pNext, Num++)
+		{
+			EXPECT_EQ(pHolder->m_Tick, max(Tick-History, 0)+Num);
+			EXPECT_EQ(pHolder->m_pPrev ? pHolder->m_pPrev->m_pNext : Storage.m_pFirst, pHolder);
+		}
+		EXPECT_EQ(Storage.m_pLast->m_Tick, Tick);
+
+		int GetTick = Tick-(int)(Random.Next()%(History+10));
+		CSnapshot *pSnap = 0;
+		CSnapshot *pAltSnap = 0;
+		int64 Tagtime = 0;
+		int GotSize = Storage.Get(GetTick, &Tagtime, &pSnap, &pAltSnap);
+		if(GetTick < 0 || GetTick < Tick-History)
+		{
+			EXPECT_EQ(GotSize, -1);
+			continue;
+		}
+		ASSERT_EQ(GotSize, aSizes[GetTick]);
+		EXPECT_EQ(Tagtime, GetTick);
+		EXPECT_EQ(((int *)pSnap)[GotSize/4-1], GetTick*7919+GotSize/4-1);
+		EXPECT_EQ(pAltSnap != 0, GetTick%2 == 1);
+		if(pAltSnap)
+		{
+			EXPECT_EQ(mem_comp(pSnap, pAltSnap, GotSize), 0);
+		}
+	}
+
+	// once the pool has grown to fit the history it doesn't fall back to the heap anymore
+	int HeapAllocs = Storage.NumHeapAllocs();
+	for(int Tick = 2000; Tick < 2500; Tick++)
+	{
+		Storage.PurgeUntil(Tick-History);
+		Storage.Add(Tick, Tick, 1024, s_aData, 0);
+	}
+	EXPECT_EQ(Storage.NumHeapAllocs(), HeapAllocs);
+	EXPECT_GT(Storage.PeakUsedSize(), 0);
+	EXPECT_LE(Storage.UsedSize(), Storage.PeakUsedSize());
+
+	Storage.PurgeAll();
+	EXPECT_EQ(Storage.UsedSize(), 0);
+	EXPECT_EQ(Storage.m_pFirst, (CSnapshotStorage::CHolder *)0);
+}